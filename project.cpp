@@ -11,599 +11,14421 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
-#define HASH_TABLE_SIZE 127
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#define PARCEL_HAVE_INOTIFY 1   // other systems poll the followed manifest
+#include <errno.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#define PARCEL_HAVE_EPOLL 1   // the query server and its load generator are built on epoll
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARCEL_HAVE_SSE2 1
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define PARCEL_HAVE_AVX2 1   // compiled in for x64, used only when cpuSupportsAvx2 says so
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PARCEL_AVX2_FUNCTION
+#else
+#define PARCEL_AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+#endif
+
+// Runtime statistics are compiled in unless PARCEL_NO_STATS is defined, which removes every
+// counter and timer from the hot paths; the structural statistics are gathered on demand either way
+#ifndef PARCEL_NO_STATS
+#define PARCEL_STATS 1
+#endif
+
+#ifndef _MSC_VER
+// the bounds checked CRT functions used below are Microsoft extensions, map them for other compilers;
+// scanf_s takes a buffer size after every %s buffer, which plain scanf must not get, so calls with
+// a buffer go through scanfString and the others straight to scanf
+static inline int scanfString(const char* format, char* buffer, unsigned int size)
+{
+	(void)size;   // the width in the format already bounds the read
+	return scanf(format, buffer);
+}
+#define SCANF_S_SELECT(first, second, third, name, ...) name
+#define scanf_s(...) SCANF_S_SELECT(__VA_ARGS__, scanfString, scanf, scanf)(__VA_ARGS__)
+#define _countof(array) (sizeof(array) / sizeof((array)[0]))
+static inline int fopen_s(FILE** file, const char* filename, const char* mode)
+{
+	*file = fopen(filename, mode);
+	return *file == NULL;
+}
+static inline int strcpy_s(char* destination, size_t size, const char* source)
+{
+	snprintf(destination, size, "%s", source);
+	return 0;
+}
+#endif
+
+#define COUNTRY_TABLE_INITIAL_SLOTS 128   // open addressing slots, always a power of two
+#define COUNTRY_TABLE_MAX_LOAD 70   // grow the country table past 70% occupancy
+#define ARENA_CHUNK_SHIFT 16   // each arena slab holds 2^16 parcel nodes
+#define ARENA_CHUNK_SIZE (1u << ARENA_CHUNK_SHIFT)
+#define ARENA_CHUNK_MASK (ARENA_CHUNK_SIZE - 1)
+#define ARENA_MAX_CHUNKS 4096   // upper bound of 2^28 parcel nodes in the arena
+#define NULL_PARCEL 0u   // arena slot 0 is reserved so that index 0 acts as the NULL link
+#define MAX_COUNTRIES 65535   // country ids are stored in 16 bits
+#define AVL_MAX_HEIGHT 64   // an AVL tree of 2^32 nodes is at most ~46 levels high
+#define RANGE_PAGE_SIZE 256   // parcels fetched per call when a range query is displayed page by page
+#define MAX_COUNTRY_NAME_LENGTH 63   // longer destination names are rejected as malformed rows
+#define COUNTRY_LIST_EMPTY 0xFFFFu   // marks an unused slot of a country list perfect hash
+#define COUNTRY_LIST_BUCKET_SIZE 4   // average names per perfect hash bucket
+#define PARSE_MIN_CHUNK_BYTES (1 << 20)   // files are split across threads in chunks of at least 1 MB
+#define PARSE_MAX_THREADS 64
+#define INGEST_BENCH_MAX_FILES 32   // the ingest benchmark splits the data file into 1, 2, 4 ... up to this many files
+#define MAX_REPORTED_ROW_ERRORS 20   // malformed rows reported with their line number, per chunk
+#define LIVE_MAX_READERS 64   // reader threads the live index can track at once
+#define LIVE_BATCH_SIZE 256   // parcels a live writer submits at a time
+#define LIVE_BENCH_MILLISECONDS 2000   // length of each phase of the live ingest benchmark
+#define LIVE_BENCH_SAMPLES (1 << 20)   // latency samples kept per reader thread
+#define MIXED_BENCH_OPERATIONS 4000000   // operations timed by the mixed workload benchmark
+#define VALUATION_BENCH_TOP 100   // parcels asked for by each query of the valuation benchmark
+#define VALUATION_BENCH_QUERIES 10000   // index queries timed per kind
+#define VALUATION_BENCH_SCANS 5   // full scans timed per kind
+#define VALUATION_BENCH_UPDATES 200000   // parcels inserted and removed again with and without the index
+#define SKETCH_K 200   // items on the top level of a quantile sketch, ranks come out within about 1.7% of the parcels
+#define SKETCH_MAX_LEVELS 32   // an item of the top level stands for 2^31 values, more than a store can hold
+#define SKETCH_MIN_WIDTH 8   // smallest capacity of a level, so the low levels are not compacted on every value
+#define SKETCH_CAPACITY (3 * SKETCH_K + SKETCH_MIN_WIDTH * SKETCH_MAX_LEVELS)   // the level capacities never add up to more
+#define SKETCH_HISTOGRAM_BUCKETS 10   // equal width buckets of the displayed histograms
+#define QUANTILE_BENCH_QUERIES 2000   // sketch queries timed per kind
+#define BOX_LEAF_SIZE 16   // parcels of a k-d tree node which is scanned instead of split
+#define BOX_BENCH_QUERIES 2000   // weight and valuation box queries timed by the benchmark
+#define GENERATOR_MIN_WEIGHT 100   // generated weights span the range of couriers.txt, in grams
+#define GENERATOR_MAX_WEIGHT 50000
+#define GENERATOR_MIN_CENTS 1000   // generated valuations span $10.00 to $2000.00
+#define GENERATOR_MAX_CENTS 200000
+#define GENERATOR_DUPLICATE_WEIGHTS 32   // distinct weights of a file generated with many duplicates
+#define SUITE_LOAD_RUNS 3   // times the benchmark suite loads the data file
+#define SUITE_MILLISECONDS 1000   // time spent on each operation of the benchmark suite
+#define SUITE_OPERATIONS 1000000   // most calls timed per operation of the benchmark suite
+#define SUITE_TOP 100   // parcels asked for by the top-k and valuation range calls of the suite
+#define STATS_MAX_THREADS 128   // threads with their own statistics slot, any more share one
+#define STATS_BUCKETS 40   // latency histogram buckets, bucket b counts calls of [2^b, 2^(b+1)) ns
+#define FOLLOW_READ_BYTES (4 << 20)   // appended bytes a follower reads and inserts as one batch
+#define FOLLOW_POLL_MILLISECONDS 250   // how often a followed manifest is checked without a change notice
+#define COLUMN_BLOCK_SIZE 128   // parcels per block of a compressed column, the unit which is decoded at a time
+#define HEAP_BLOCK_OVERHEAD 16   // typical per-allocation bookkeeping of the C runtime heap
+#define OUTPUT_BUFFER_SIZE (1 << 20)   // batch results are written to the stream in blocks of 1 MB
+#define BATCH_SPLIT_PARCELS 8192   // listings longer than this are cut into slices for the thread pool
+#define BATCH_MAX_THREADS 256
+#define SERVER_INPUT_BYTES 4096   // received bytes a server connection buffers, a longer request line closes it
+#define SERVER_MAX_EVENTS 256   // epoll events handled per wakeup
+#define SERVER_BACKLOG 1024   // connections waiting to be accepted
+#define LOAD_SECONDS 5   // length of a load generator run
+#define LOAD_CONNECTIONS 256   // concurrent connections of the load generator by default
+#define LOAD_REQUESTS 1024   // distinct requests the load generator cycles through
+#define ROLLUP_MIN_COUNTRIES 64   // fewest countries worth a thread of the rollup report
+#define SNAPSHOT_MAGIC "PRCLSNAP"
+#define SNAPSHOT_VERSION 5   // bump whenever the snapshot layout or the Parcel node changes
+#define SNAPSHOT_BYTE_ORDER 0x01020304u   // reads back differently on a machine of the other byte order
+#define SNAPSHOT_ALIGNMENT 4096   // parcel nodes start on a page boundary so slabs can be mapped in place
+#define SNAPSHOT_CHECKSUM_SEED 0xcbf29ce484222325ULL
+
+typedef unsigned int ParcelIndex;   // 32-bit index of a parcel node inside the arena
+typedef long long Cents;   // money in hundredths of a dollar, so sums of valuations are exact
+typedef int ParcelCents;   // the valuation of one parcel in cents, as a node stores it in the 4 bytes the float took
+#define PARCEL_MAX_VALUATION ((Cents)INT_MAX)   // highest valuation a single parcel can hold, $21,474,836.47
+
+// Structure defination for the aggregates of a group of parcels, kept per subtree in every node
+typedef struct ParcelAggregate
+{
+	long long weightSum;   // total weight in grams
+	Cents valuationSum;   // total valuation
+	ParcelCents minValuation;   // valuation of the cheapest parcel, cached so merging never touches other nodes
+	ParcelCents maxValuation;   // valuation of the most expensive parcel
+	unsigned int count;   // number of parcels
+	ParcelIndex cheapest;   // first parcel in weight order with the lowest valuation
+	ParcelIndex mostExpensive;   // first parcel in weight order with the highest valuation
+} ParcelAggregate;
 
 // Structure defination for parcel, representing each parcel in the system
 typedef struct Parcel
 {
-	char* destination;   // dynamically allocated string for the destination country
+	ParcelCents valuation;   // valuation of the parcel
 	int weight;   // weight of the parcel in grams
-	float valuation;   // valuation of the parcel in dollars
-	struct Parcel* left;   // pointer to the left child in BST
-	struct Parcel* right;   // pointer to the right child in BST
+	ParcelIndex left;   // arena index of the left child in BST
+	ParcelIndex right;   // arena index of the right child in BST
+	unsigned int generation;   // live writer batch which created the node, 0 for loaded nodes
+	unsigned short countryId;   // interned id of the destination country
+	unsigned char height;   // height of the AVL subtree rooted at this node, 1 for a leaf
+	ParcelAggregate subtree;   // aggregates of this node and all of its descendants
 } Parcel;
 
+static_assert(sizeof(Parcel) <= 64, "a parcel node must stay within one cache line");
+
+// Structure defination for the original pointer based parcel node, only used to size the footprint report
+typedef struct LegacyParcel
+{
+	char* destination;
+	int weight;
+	float valuation;
+	struct LegacyParcel* left;
+	struct LegacyParcel* right;
+} LegacyParcel;
+
+// Structure defination for the slab arena, which owns the nodes of every parcel
+typedef struct ParcelArena
+{
+	Parcel* chunks[ARENA_MAX_CHUNKS];   // fixed size slabs, never moved once allocated
+	unsigned int chunkCount;   // number of slabs allocated so far
+	unsigned int mappedChunks;   // leading slabs which live in the snapshot mapping and are not freed
+	ParcelIndex nextIndex;   // next unused slot in the arena
+	ParcelIndex freeList;   // released nodes waiting for reuse, linked through their left index
+	unsigned int freeCount;   // number of nodes on the free list
+} ParcelArena;
+
+// Structure defination for one slot of the open addressing country table
+typedef struct CountrySlot
+{
+	unsigned long hashValue;   // full hash of the country name, kept to skip strcmp and to rehash on growth
+	int countryId;   // id of the country in the slot, -1 when the slot is empty
+} CountrySlot;
+
+// Structure defination for the catalog of interned destination countries, each with its own BST
+typedef struct CountryCatalog
+{
+	char** names;   // interned country names indexed by country id
+	unsigned int* parcelCounts;   // number of parcels stored per country id
+	ParcelIndex* roots;   // arena index of the BST root per country id
+	CountrySlot* slots;   // open addressing hash table keyed on the full country name
+	unsigned int slotCount;   // number of slots, a power of two
+	unsigned int count;   // number of interned countries
+	unsigned int capacity;   // allocated length of the per country arrays
+	size_t nameBytes;   // bytes used by the interned names
+} CountryCatalog;
+
+// Structure defination for the list of accepted countries with its perfect hash
+typedef struct CountryList
+{
+	const char* const* names;   // accepted names, the position of a name is its dense id
+	const unsigned char* lengths;   // length of each name
+	unsigned int count;   // number of accepted names
+	const unsigned int* displacements;   // displacement per bucket of the perfect hash
+	unsigned int bucketMask;   // number of buckets minus one
+	const unsigned short* slots;   // dense id per slot, COUNTRY_LIST_EMPTY when unused
+	unsigned int slotMask;   // number of slots minus one
+	unsigned long long checksum;   // checksum of the names in order, recorded in snapshots
+	int owned;   // 1 when the arrays were allocated by loadCountryList
+} CountryList;
+
+// Structure defination for a view of a whole file mapped into memory
+typedef struct MappedFile
+{
+	const char* data;   // first byte of the file, NULL for an empty file
+	size_t size;   // size of the file in bytes
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int descriptor;
+#endif
+} MappedFile;
+
+// Structure defination for one block of a compressed weight column
+typedef struct ColumnBlock
+{
+	int firstWeight;   // weight of the first parcel of the block
+	unsigned int deltaOffset;   // byte offset of the varint deltas of the other parcels of the block
+} ColumnBlock;
+
+// Structure defination for the read optimized copy of one country's parcels, as weight sorted columns
+typedef struct CountryColumns
+{
+	int* weights;   // weights in ascending order
+	ParcelCents* valuations;   // valuation of the parcel at the same position, as the node stores it
+	unsigned int count;   // number of parcels in the columns, compared with the BST to detect stale columns
+	ColumnBlock* blocks;   // compressed form instead of the arrays above, one block per COLUMN_BLOCK_SIZE parcels
+	unsigned char* weightDeltas;   // LEB128 varint difference of every weight to the one before it in its block
+	unsigned long long* packedValuations;   // valuation minus valuationBase in valuationBits bits per parcel
+	Cents valuationBase;   // the lowest valuation, the frame of reference of the packed valuations
+	unsigned int valuationBits;   // bits per packed valuation, 0 when all valuations are equal
+	size_t deltaBytes;   // length of weightDeltas
+} CountryColumns;
+
+// Structure defination for the totals and extremes of a slice of a compressed country segment
+typedef struct ColumnSummary
+{
+	long long weightSum;   // total weight in grams
+	Cents valuationSum;   // total valuation
+	int cheapestWeight;   // weight of the first parcel with the lowest valuation
+	Cents minValuation;
+	int mostExpensiveWeight;   // weight of the first parcel with the highest valuation
+	Cents maxValuation;
+} ColumnSummary;
+
+typedef unsigned int ValuationSlot;   // index of an entry of the valuation index, slot 0 acts as the NULL link
+
+// Structure defination for one entry of the valuation index, a copy of a parcel's fields kept in valuation order
+typedef struct ValuationEntry
+{
+	Cents valuation;   // valuation of the parcel, compared first
+	int weight;   // weight of the parcel in grams, compared last
+	ValuationSlot left;   // slot of the left child
+	ValuationSlot right;   // slot of the right child
+	unsigned int count;   // number of entries in the subtree, for ranks
+	unsigned short countryId;   // interned id of the destination country, compared second
+	unsigned char height;   // height of the AVL subtree rooted at this entry, 0 while the slot is free
+} ValuationEntry;
+
+// Structure defination for the secondary index ordering every parcel by valuation, overall and per country
+typedef struct ValuationIndex
+{
+	ValuationEntry* entries;   // one entry per parcel in the global tree and one in its country's tree
+	unsigned int entryCount;   // slots handed out so far, slot 0 included
+	unsigned int capacity;   // allocated length of entries
+	ValuationSlot freeList;   // released slots, linked through their left slot
+	ValuationSlot globalRoot;   // tree over the parcels of every country
+	ValuationSlot* countryRoots;   // tree over the parcels of one country, by country id
+	unsigned int countryCapacity;   // allocated length of countryRoots
+	int built;   // 1 once the index exists and inserts and removals keep it current
+} ValuationIndex;
+
+// Structure defination for a KLL quantile sketch of one stream of values, of a fixed size however long the stream is
+typedef struct QuantileSketch
+{
+	long long items[SKETCH_CAPACITY];   // kept values level after level, the top level first; an item of level h stands for 2^h values
+	unsigned short levelSizes[SKETCH_MAX_LEVELS];   // items held by each level, level 0 is the last one in items
+	unsigned short levelCapacities[SKETCH_MAX_LEVELS];   // items each level holds before it is compacted
+	unsigned int levelCount;   // levels in use, at least one
+	unsigned int itemCount;   // items held by all levels
+	unsigned int capacity;   // items the levels hold before the lowest full one is compacted
+	unsigned long long count;   // values added to the sketch
+	long long minimum;   // exact smallest value
+	long long maximum;   // exact largest value
+	unsigned long long random;   // state of the coin which picks the surviving half of a compaction
+} QuantileSketch;
+
+// Structure defination for one kept value of a sketch and the number of values it stands for
+typedef struct SketchItem
+{
+	long long value;
+	unsigned long long weight;
+} SketchItem;
+
+// Structure defination for the weight and valuation sketches of one country
+typedef struct CountrySketches
+{
+	QuantileSketch weights;   // weights in grams
+	QuantileSketch valuations;   // valuations in cents
+	int stale;   // 1 after a removal, which a sketch cannot take back, until it is rebuilt from the tree
+} CountrySketches;
+
+// Structure defination for the quantile sketches of every country
+typedef struct QuantileIndex
+{
+	CountrySketches* countries;   // sketches indexed by country id, built on first use
+	unsigned int capacity;   // allocated length of countries
+	int built;   // 1 once the sketches exist and inserts keep them current
+} QuantileIndex;
+
+// Structure defination for one parcel of the two dimensional index
+typedef struct BoxPoint
+{
+	Cents valuation;
+	int weight;
+} BoxPoint;
+
+// Structure defination for the bounding box and totals of the parcels below a k-d tree node
+typedef struct BoxNode
+{
+	int minWeight;
+	int maxWeight;
+	Cents minValuation;
+	Cents maxValuation;
+	long long weightSum;   // total weight in grams
+	Cents valuationSum;   // total valuation
+	unsigned int count;   // number of parcels
+} BoxNode;
+
+// Structure defination for the k-d tree of one country over weight and valuation
+typedef struct CountryBoxes
+{
+	BoxPoint* points;   // the parcels, reordered so every node covers a consecutive run of them
+	BoxNode* nodes;   // node 1 is the root, the children of node i are 2i and 2i+1
+	unsigned int count;   // number of parcels, compared with the BST to detect a stale tree
+	unsigned int nodeCount;   // allocated length of nodes
+} CountryBoxes;
+
+// Structure defination for the two dimensional indexes of every country
+typedef struct BoxIndex
+{
+	CountryBoxes* countries;   // k-d trees indexed by country id, built on first use
+	unsigned int capacity;   // allocated length of countries
+} BoxIndex;
+
+// Structure defination for the rows of one country while the store is loaded lazily
+typedef struct LazyCountry
+{
+	unsigned long long* offsets;   // file offset of every row of the country, in file order
+	size_t count;   // number of rows
+	size_t capacity;   // allocated length of offsets
+	size_t bytes;   // arena bytes of the BST while it is built
+	unsigned long long lastUsed;   // tick of the last query which needed the BST, for LRU eviction
+	int built;   // 1 while the BST of the country is in the arena
+	int pinned;   // 1 once a parcel was removed or re-weighed, the rows no longer describe the BST
+} LazyCountry;
+
+// Structure defination for lazy loading, where the BST of a country is built on its first query
+typedef struct LazyIndex
+{
+	int active;   // 1 when the store is loaded lazily
+	const char* filename;   // the data file, for warnings about its rows
+	MappedFile file;   // the data file, mapped while the store is lazy
+	LazyCountry* countries;   // indexed by country id
+	unsigned int capacity;   // allocated length of countries
+	size_t budget;   // bytes the built BSTs may take between menu operations, 0 for no limit
+	size_t used;   // bytes the built BSTs take
+	unsigned long long clock;   // ticks on every use of a BST, orders the countries for eviction
+	unsigned int builds;   // BSTs built so far
+	unsigned int evictions;   // BSTs evicted so far
+} LazyIndex;
+
+// Structure defination for the bounds of a weight and valuation box query, all inclusive
+typedef struct BoxRange
+{
+	int minWeight;
+	int maxWeight;
+	Cents minValuation;
+	Cents maxValuation;
+} BoxRange;
+
+// Structure defination for the totals of the parcels inside a box
+typedef struct BoxTotals
+{
+	unsigned int count;   // number of parcels
+	long long weightSum;   // total weight in grams
+	Cents valuationSum;   // total valuation
+} BoxTotals;
+
+// Structure defination for the parcel store, holding the arena and the country catalog
+typedef struct ParcelStore
+{
+	ParcelArena arena;
+	CountryCatalog catalog;
+	int columnar;   // 1 when queries read the columnar segments instead of walking the trees
+	int compressed;   // 1 when the columnar segments are kept delta and bit packed, decoded while scanning
+	CountryColumns* columns;   // columnar segments indexed by country id, built on first use
+	unsigned int columnCapacity;   // allocated length of columns
+	MappedFile snapshot;   // snapshot backing the mapped slabs, data is NULL when loaded from text
+	ValuationIndex valuations;   // parcels in valuation order, built on the first valuation query
+	QuantileIndex quantiles;   // weight and valuation distributions, built on the first quantile query
+	BoxIndex boxes;   // weight and valuation k-d trees, built on the first box query
+	LazyIndex lazy;   // row offsets per country when the BSTs are built on their first query
+} ParcelStore;
+
+// Structure defination for the header at the start of a snapshot file
+typedef struct SnapshotHeader
+{
+	char magic[8];   // SNAPSHOT_MAGIC without the terminator
+	unsigned int version;   // SNAPSHOT_VERSION of the writer
+	unsigned int byteOrder;   // SNAPSHOT_BYTE_ORDER as seen by the writer
+	unsigned int parcelSize;   // sizeof(Parcel) of the writer, the nodes are stored as they sit in memory
+	unsigned int countryCount;   // number of entries in the country directory
+	unsigned int parcelCount;   // number of arena slots stored, slot 0 included
+	ParcelIndex freeList;   // first node of the arena free list
+	unsigned int freeCount;   // number of nodes on the free list
+	unsigned int countryListHash;   // low bits of the checksum of the country list the rows were filtered with
+	unsigned long long sourceSize;   // size of the text file the index was built from
+	unsigned long long sourceModified;   // modification time of that text file
+	unsigned long long directoryOffset;   // file offset of the country directory
+	unsigned long long directoryBytes;   // size of the directory entries and the names after them
+	unsigned long long parcelOffset;   // file offset of arena slot 0, aligned to SNAPSHOT_ALIGNMENT
+	unsigned long long directoryChecksum;   // checksum of the directory and names
+	unsigned long long parcelChecksum;   // checksum of all stored parcel nodes
+	unsigned long long headerChecksum;   // checksum of this header with this field set to 0
+} SnapshotHeader;
+
+// Structure defination for one country of the snapshot directory
+typedef struct SnapshotCountry
+{
+	ParcelIndex root;   // arena index of the root of the country's BST
+	unsigned int parcelCount;   // number of parcels of the country
+	unsigned int nameOffset;   // offset of the name from the start of the directory
+	unsigned int nameLength;   // number of characters in the name, not NUL terminated
+} SnapshotCountry;
+
+// Structure defination for one version of the live index published to readers
+typedef struct IndexVersion
+{
+	CountryCatalog catalog;   // private copy of the country tables, with the roots of this version
+	unsigned int generation;   // writer batch which published the version
+	size_t parcelCount;   // number of parcels reachable from the roots
+} IndexVersion;
+
+// Structure defination for the nodes replaced by one writer batch, waiting until no reader can reach them
+typedef struct RetiredNodes
+{
+	unsigned long long epoch;   // reusable once every active reader entered at this epoch or later
+	ParcelIndex* nodes;   // the replaced nodes
+	size_t count;
+	IndexVersion* version;   // the version replaced by the same batch
+	struct RetiredNodes* next;
+} RetiredNodes;
+
+// Structure defination for the slot of one reader thread, one cache line each
+typedef struct LiveReader
+{
+	std::atomic<unsigned long long> epoch;   // epoch the reader entered in, 0 while it is not reading
+	std::atomic<int> inUse;   // 1 while a thread owns the slot
+	char padding[64 - sizeof(std::atomic<unsigned long long>) - sizeof(std::atomic<int>)];
+} LiveReader;
+
+// Structure defination for a parcel store accepting inserts while it is queried
+typedef struct LiveIndex
+{
+	ParcelStore* store;   // owned by the writers, readers only follow arena links from a version
+	std::atomic<IndexVersion*> current;   // the version new readers get
+	std::atomic<unsigned long long> epoch;   // advanced by every published batch
+	LiveReader readers[LIVE_MAX_READERS];
+	std::mutex writer;   // serializes the writers, never taken by readers
+	unsigned int generation;   // batch in progress, nodes of this generation are private to it
+	RetiredNodes* retired;   // batches of replaced nodes, newest first
+	ParcelIndex* retiring;   // nodes replaced by the batch in progress
+	size_t retiringCount;
+	size_t retiringCapacity;
+	unsigned long long copiedNodes;   // nodes copied to keep published versions intact
+	unsigned long long reclaimedNodes;   // replaced nodes handed back to the arena
+} LiveIndex;
+
+// Structure defination for one parcel submitted to the live index
+typedef struct LiveParcel
+{
+	const char* country;   // destination country
+	int weight;   // weight of the parcel in grams
+	Cents valuation;   // valuation of the parcel
+} LiveParcel;
+
+// Structure defination for one thread of the live ingest benchmark
+typedef struct LiveBenchWorker
+{
+	LiveIndex* live;
+	int id;   // number of the thread, seeds its random numbers
+	std::atomic<int>* stop;   // set when the phase is over
+	const char** countries;   // country names a writer picks from
+	unsigned int countryCount;
+	unsigned long long operations;   // queries run or parcels inserted
+	unsigned long long violations;   // inconsistent results seen by a reader
+	unsigned int* latencies;   // ring of query latencies in nanoseconds, readers only
+} LiveBenchWorker;
+
+// Structure defination for a thread inserting the rows appended to a manifest into a live index
+typedef struct ManifestFollower
+{
+	LiveIndex* live;   // the index the new rows go into
+	const char* filename;   // the followed manifest
+	const CountryList* validCountries;   // rows of other countries are skipped
+	unsigned long long offset;   // bytes of the file consumed so far
+	int skipPartial;   // 1 while the rest of a line loaded before its newline arrived is still to be skipped
+	char* buffer;   // FOLLOW_READ_BYTES of the file read from the offset
+	LiveParcel* parcels;   // rows of one read, their names point into the buffer
+	size_t parcelCapacity;
+	int watch;   // inotify descriptor, -1 when the file is polled
+	std::atomic<int> stop;   // set to make the thread return
+	std::thread thread;
+	unsigned long long ingestedRows;   // rows inserted since the follower started
+	unsigned long long malformedRows;   // appended rows which could not be parsed
+	unsigned long long filteredRows;   // appended rows of countries which are not listed
+} ManifestFollower;
+
+// Structure defination for an iterative in-order walk over one BST
+typedef struct ParcelIterator
+{
+	const ParcelArena* arena;   // the arena which owns the nodes
+	ParcelIndex stack[AVL_MAX_HEIGHT];   // ancestors whose right subtree is still to be visited
+	int top;   // number of entries on the stack
+	ParcelIndex current;   // next subtree to descend into
+} ParcelIterator;
+
+// Structure defination for a range of weights, each bound either inclusive or exclusive
+typedef struct WeightRange
+{
+	int minWeight;   // lower bound of the range in grams
+	int maxWeight;   // upper bound of the range in grams
+	int minInclusive;   // 1 if parcels of exactly minWeight match, 0 if they do not
+	int maxInclusive;   // 1 if parcels of exactly maxWeight match, 0 if they do not
+} WeightRange;
+
+// Structure defination for a parcel waiting in a bulk load partition
+typedef struct BulkRow
+{
+	int weight;   // weight of the parcel in grams
+	Cents valuation;   // valuation of the parcel
+} BulkRow;
+
+// Structure defination for one parsed manifest row, the country name still points into the file
+typedef struct ParsedRow
+{
+	const char* country;   // first character of the country name, not NUL terminated
+	unsigned int countryLength;   // number of characters in the country name
+	int weight;   // weight of the parcel in grams
+	Cents valuation;   // valuation of the parcel
+} ParsedRow;
+
+// Structure defination for a malformed row, reported with its line number
+typedef struct RowError
+{
+	size_t line;   // line number inside the chunk until the chunks are stitched together, then in the file
+	const char* reason;   // what was wrong with the row
+} RowError;
+
+// Structure defination for the slice of a file parsed by one thread
+typedef struct ParseChunk
+{
+	const char* begin;   // first byte of the chunk, always the start of a line
+	const char* end;   // one past the last byte of the chunk, always after a newline or at the end of file
+	ParsedRow* rows;   // rows parsed from the chunk, in file order
+	size_t rowCount;
+	size_t rowCapacity;
+	size_t lineCount;   // number of lines in the chunk
+	RowError errors[MAX_REPORTED_ROW_ERRORS];   // first malformed rows of the chunk
+	size_t errorCount;   // number of all malformed rows of the chunk
+} ParseChunk;
+
+// Structure defination for a whole manifest parsed in parallel chunks
+typedef struct ParsedManifest
+{
+	ParseChunk* chunks;   // chunks in file order
+	int chunkCount;
+	size_t rowCount;   // rows parsed in all chunks
+	size_t errorCount;   // malformed rows in all chunks
+} ParsedManifest;
+
+// Structure defination for the data files given on the command line, with the patterns expanded
+typedef struct FileList
+{
+	char** names;   // file names in load order
+	size_t count;
+	size_t capacity;   // allocated length of names
+} FileList;
+
+// Structure defination for one data file of a sharded ingest, loaded into sorted runs by its own thread
+typedef struct ShardRuns
+{
+	const char* filename;
+	BulkRow* rows;   // rows of the listed countries, country after country in list order, each run sorted by weight
+	size_t* offsets;   // by list id, where the run of the country starts in rows, one more entry for the end
+	size_t* firstRows;   // by list id, the position of the country's first row in the file, SIZE_MAX if it has none
+	size_t filtered;   // rows skipped because their country is not listed
+	size_t bytes;   // size of the file
+	int failed;   // 1 if the file could not be opened
+} ShardRuns;
+
+// Structure defination for the work shared by the threads of a sharded ingest
+typedef struct ShardedIngest
+{
+	ParcelStore* store;
+	const CountryList* validCountries;
+	ShardRuns* shards;   // one per file, in file order
+	size_t shardCount;
+	int parseThreads;   // threads each file is parsed with
+	int* routes;   // by list id, the interned country id, -1 if no file has the country
+	ParcelIndex* bases;   // by list id, the first of the arena slots of the merged country, NULL_PARCEL to skip it
+	std::atomic<size_t> nextShard;   // next file to be loaded
+	std::atomic<unsigned int> nextCountry;   // next list id to be merged
+} ShardedIngest;
+
+// Operations of a batch query, numbered like the menu options they stand for
+typedef enum QueryType
+{
+	QUERY_LIST = 1,
+	QUERY_WEIGHT = 2,
+	QUERY_TOTALS = 3,
+	QUERY_VALUATION_EXTREMES = 4,
+	QUERY_WEIGHT_EXTREMES = 5,
+	QUERY_RANGE = 9,
+	QUERY_TOP_K = 12,
+	QUERY_VALUATION_RANGE = 13,
+	QUERY_QUANTILES = 15,
+	QUERY_BOX = 16,
+	QUERY_TYPE_COUNT
+} QueryType;
+
+// Names of the batch query operations, indexed by QueryType
+static const char* const batchQueryNames[QUERY_TYPE_COUNT] = { "", "list", "weight", "totals", "cheapest", "lightest", "", "", "", "range",
+	"", "", "top-k", "valuation-range", "", "quantiles", "box" };
+
+// Output formats of the batch mode
+typedef enum OutputFormat
+{
+	OUTPUT_HUMAN,   // the text the interactive menu prints
+	OUTPUT_JSON,   // one JSON object per line
+	OUTPUT_CSV   // one CSV record per line after a header
+} OutputFormat;
+
+// Structure defination for one parsed line of a batch file
+typedef struct BatchQuery
+{
+	QueryType type;   // the operation to run
+	char country[MAX_COUNTRY_NAME_LENGTH + 1];   // the country the query is about
+	int weight;   // the weight to compare with, or the smallest weight of a range
+	int maxWeight;   // the largest weight of a range
+	int higher;   // 1 for parcels heavier than weight or the most valuable ones, 0 for lighter or least valuable ones
+	unsigned int count;   // the number of parcels of a top-k query
+	Cents minValuation;   // the lowest valuation of a box or a valuation range
+	Cents maxValuation;   // the highest valuation of a box or a valuation range
+} BatchQuery;
+
+// Structure defination for a growable output buffer in front of a stream
+typedef struct OutputBuffer
+{
+	char* data;   // buffered bytes not written to the stream yet
+	size_t used;   // number of buffered bytes
+	size_t capacity;   // allocated size of data
+	FILE* file;   // stream the buffer is flushed to, NULL to keep everything in memory
+} OutputBuffer;
+
+// Structure defination for one line of a batch file
+typedef struct BatchItem
+{
+	BatchQuery query;   // the parsed query
+	size_t line;   // line number in the batch file
+	const char* error;   // why the line is malformed, NULL for a valid query
+} BatchItem;
+
+// Kinds of batch task, a whole query or a slice of a long listing
+typedef enum BatchTaskKind
+{
+	TASK_WHOLE,   // runs the whole query
+	TASK_FIRST_SLICE,   // first slice of a split listing, also writes its heading
+	TASK_SLICE   // any later slice of a split listing
+} BatchTaskKind;
+
+// Structure defination for one unit of work of the batch thread pool
+typedef struct BatchTask
+{
+	unsigned int item;   // the batch item the task belongs to
+	ParcelIndex root;   // root of the country's BST, for slices
+	unsigned int first;   // first position in weight order of a slice
+	unsigned int end;   // position past the last parcel of a slice
+	BatchTaskKind kind;
+} BatchTask;
+
+// Structure defination for the totals of one batch run
+typedef struct BatchOutcome
+{
+	size_t queries;   // number of non-blank lines
+	size_t malformed;   // number of malformed lines
+	size_t tasks;   // number of tasks the queries were cut into
+	size_t bytes;   // number of output bytes
+	unsigned long long checksum;   // checksum of the output, to compare runs
+} BatchOutcome;
+
+// Structure defination for a batch being run by the thread pool
+typedef struct BatchExecutor
+{
+	const ParcelStore* store;   // the index the queries read
+	const BatchItem* items;   // the parsed batch
+	const BatchTask* tasks;   // the tasks in submission order
+	OutputFormat format;
+	const CountryList* validCountries;
+	int workerCount;   // number of pool threads
+	std::atomic<unsigned long long> ranges[BATCH_MAX_THREADS];   // per worker, task numbers [begin, end) as begin << 32 | end
+	OutputBuffer* results;   // output of every task, written in task order
+	unsigned char* done;   // 1 when the task's output is complete, guarded by lock
+	std::mutex lock;
+	std::condition_variable progress;   // signalled whenever a task is done
+} BatchExecutor;
+
+// Structure defination for the rollup of one country in the all-countries report
+typedef struct RollupRow
+{
+	const char* country;   // interned name of the country
+	unsigned int count;   // number of parcels, 0 for a country whose parcels were all removed
+	long long weightSum;   // total weight in grams
+	Cents valuationSum;   // total valuation
+	const Parcel* cheapest;   // first parcel in weight order with the lowest valuation
+	const Parcel* mostExpensive;   // first parcel in weight order with the highest valuation
+	const Parcel* lightest;
+	const Parcel* heaviest;   // first parcel holding the largest weight
+} RollupRow;
+
+#ifdef PARCEL_HAVE_EPOLL
+// Structure defination for one client connection of the query server
+typedef struct ServerConnection
+{
+	int descriptor;
+	unsigned int events;   // epoll events the descriptor is watched for
+	char input[SERVER_INPUT_BYTES];   // received bytes not taken as requests yet
+	size_t inputUsed;
+	OutputBuffer output;   // framed responses not sent yet
+	size_t sent;   // bytes of output already sent
+	size_t requests;   // requests taken so far, numbering the records of machine readable output
+	BatchQuery query;   // the request being answered
+	const char* error;   // why the request line did not parse, NULL for a query
+	OutputBuffer result;   // the answer, written by the worker
+	int busy;   // 1 while the request is queued or running, the worker owns query and result then
+	int closed;   // 1 once the peer hung up, the connection is freed when no request is running
+	struct ServerConnection* next;   // link in the queue of the workers or in the list of answered requests
+	struct ServerConnection* previousLive;   // links in the list of connections not freed yet
+	struct ServerConnection* nextLive;
+} ServerConnection;
+
+// Structure defination for the query server, its event loop and its workers
+typedef struct QueryServer
+{
+	const ParcelStore* store;   // the index the requests read
+	const CountryList* validCountries;
+	OutputFormat format;   // the format of the answers
+	int listener;   // listening socket
+	int epoll;   // epoll instance of the event loop
+	int wakeup;   // eventfd the workers signal answered requests on
+	int workerCount;
+	std::thread workers[BATCH_MAX_THREADS];
+	std::mutex lock;
+	std::condition_variable pending;   // signalled when a request is queued or the server stops
+	ServerConnection* queued;   // requests waiting for a worker, oldest first, guarded by lock
+	ServerConnection* queuedTail;
+	ServerConnection* answered;   // requests waiting for the event loop, guarded by lock
+	ServerConnection* live;   // every connection not freed yet, for the shutdown
+	int stopping;   // set to make the workers return, guarded by lock
+	unsigned long long served;   // requests answered
+	unsigned long long accepted;   // connections accepted
+} QueryServer;
+
+// Structure defination for one connection of the load generator
+typedef struct LoadConnection
+{
+	int descriptor;
+	const char* request;   // the request line being sent
+	size_t requestLength;
+	size_t requestSent;   // bytes of the request sent so far
+	size_t remaining;   // payload bytes of the answer still to come, SIZE_MAX while its byte count is read
+	size_t length;   // the byte count being read
+	std::chrono::steady_clock::time_point started;   // when the request was sent
+} LoadConnection;
+#endif
+
+// Structure defination for the depth and balance statistics of one BST
+typedef struct TreeStats
+{
+	unsigned int nodes;   // number of parcels in the tree
+	int height;   // number of levels on the longest root to leaf path
+	int minLeafDepth;   // number of levels on the shortest root to leaf path
+	unsigned long long depthSum;   // sum of the depth of every node, for the average depth
+	int maxImbalance;   // largest height difference between the two subtrees of any node
+} TreeStats;
+
+// Orders of the weights in a generated parcel file
+typedef enum WeightOrder
+{
+	WEIGHT_ORDER_RANDOM,   // every weight drawn independently
+	WEIGHT_ORDER_SORTED,   // weights rise from the first row to the last
+	WEIGHT_ORDER_REVERSE,   // weights fall from the first row to the last
+	WEIGHT_ORDER_DUPLICATES,   // weights drawn from GENERATOR_DUPLICATE_WEIGHTS values
+	WEIGHT_ORDER_COUNT
+} WeightOrder;
+
+// Names of the weight orders on the command line, indexed by WeightOrder
+static const char* const weightOrderNames[WEIGHT_ORDER_COUNT] = { "random", "sorted", "reverse", "duplicates" };
+
+// Structure defination for the settings of a generated parcel file
+typedef struct GeneratorOptions
+{
+	unsigned long long rows;   // number of rows to write
+	unsigned long long seed;   // the same seed and settings always give the same file
+	double skew;   // Zipf exponent of the country distribution, 0 for uniform
+	WeightOrder order;
+} GeneratorOptions;
+
+// Structure defination for the timings of one operation of the benchmark suite
+typedef struct SuiteResult
+{
+	const char* name;   // the operation, named like the batch queries where there is one
+	const char* unit;   // what the throughput counts, rows or calls
+	unsigned long long calls;   // number of timed calls
+	unsigned long long items;   // rows or calls handled by the timed calls
+	double seconds;   // total time of the timed calls
+	unsigned long long p50;   // median time of one call in nanoseconds
+	unsigned long long p99;
+	size_t peakResident;   // peak resident memory of the process in bytes after the operation
+} SuiteResult;
+
+// Structure defination for the occupancy of the country hash table
+typedef struct CountryTableStats
+{
+	unsigned int collisions;   // countries displaced from their home slot
+	unsigned int maxProbe;   // slots inspected by the longest successful lookup
+	unsigned long long probeSum;   // slots inspected by a lookup of every country
+} CountryTableStats;
+
+// Counters of the runtime statistics
+typedef enum StatCounter
+{
+	STAT_ROWS_PARSED,   // valid rows parsed from data files
+	STAT_ROWS_REJECTED,   // malformed rows skipped while parsing
+	STAT_ROWS_FILTERED,   // rows skipped because their country is not listed
+	STAT_BYTES_PARSED,   // bytes of data files parsed
+	STAT_COUNTRY_LOOKUPS,   // lookups in the country hash table
+	STAT_COUNTRY_PROBES,   // slots inspected by those lookups
+	STAT_NODES_VISITED,   // tree nodes visited by searches, descents and updates
+	STAT_PARCELS_RETURNED,   // parcels handed out by listings and range queries
+	STAT_PARCELS_INSERTED,
+	STAT_PARCELS_REMOVED,
+	STAT_PARCELS_UPDATED,
+	STAT_ROTATIONS,   // AVL rotations of the parcel trees
+	STAT_COUNTER_COUNT
+} StatCounter;
+
+// Names of the counters in reports, indexed by StatCounter
+static const char* const statCounterNames[STAT_COUNTER_COUNT] = { "rows_parsed", "rows_rejected", "rows_filtered", "bytes_parsed", "country_lookups",
+	"country_probes", "nodes_visited", "parcels_returned", "parcels_inserted", "parcels_removed", "parcels_updated", "rotations" };
+
+// Operations timed by the runtime statistics
+typedef enum StatOperation
+{
+	STAT_OP_LOAD,   // loadData
+	STAT_OP_SNAPSHOT,   // loadSnapshot
+	STAT_OP_LIST,   // menu option 1 and list queries
+	STAT_OP_WEIGHT,   // menu option 2 and weight queries
+	STAT_OP_TOTALS,   // menu option 3 and totals queries
+	STAT_OP_CHEAPEST,   // menu option 4 and cheapest queries
+	STAT_OP_LIGHTEST,   // menu option 5 and lightest queries
+	STAT_OP_RANGE,   // menu option 9 and range queries
+	STAT_OP_INSERT,   // insertIntoBst
+	STAT_OP_REMOVE,   // removeParcel
+	STAT_OP_UPDATE,   // updateParcel
+	STAT_OP_TOP_K,   // queryValuationExtremes
+	STAT_OP_VALUATION_RANGE,   // queryValuationRange
+	STAT_OP_QUANTILES,   // displayQuantiles
+	STAT_OP_BOX,   // menu option 16 and box queries
+	STAT_OP_ROLLUP,   // menu option 17 and --rollup
+	STAT_OP_MATERIALIZE,   // materializeCountry
+	STAT_OPERATION_COUNT
+} StatOperation;
+
+// Names of the timed operations in reports, like the batch queries where there is one
+static const char* const statOperationNames[STAT_OPERATION_COUNT] = { "load", "snapshot", "list", "weight", "totals", "cheapest",
+	"lightest", "range", "insert", "remove", "update", "top-k", "valuation-range", "quantiles", "box", "rollup", "materialize" };
+
+// Timed operation of each batch query, indexed by QueryType
+static const StatOperation batchQueryOperations[QUERY_TYPE_COUNT] = { STAT_OP_LIST, STAT_OP_LIST, STAT_OP_WEIGHT, STAT_OP_TOTALS,
+	STAT_OP_CHEAPEST, STAT_OP_LIGHTEST, STAT_OP_RANGE, STAT_OP_RANGE, STAT_OP_RANGE, STAT_OP_RANGE, STAT_OP_BOX, STAT_OP_BOX,
+	STAT_OP_TOP_K, STAT_OP_VALUATION_RANGE, STAT_OP_BOX, STAT_OP_QUANTILES, STAT_OP_BOX };
+
+//
+// FUNCTION: centsToDollars
+// DESCRIPTION:
+//		This function converts cents to dollars for printing. Below 2^53 cents the double is the
+//		closest one to the exact amount, so %.2f prints the stored cents digit for digit.
+// PARAMETERS:
+//		Cents cents: the amount in cents.
+// RETURNS:
+//		double: the amount in dollars.
+//
+static inline double centsToDollars(Cents cents)
+{
+	return (double)cents / 100.0;
+}
+
+#ifdef PARCEL_STATS
+// Structure defination for the statistics of one thread. Only the owning thread writes a slot,
+// with plain loads and stores, so counting costs no locked instruction; readers sum every slot.
+// A slot keeps its counts when its thread ends and the next thread carries on from them.
+typedef struct alignas(64) StatSlot
+{
+	std::atomic<int> owned;   // 1 while a thread counts into the slot
+	std::atomic<unsigned long long> counters[STAT_COUNTER_COUNT];
+	std::atomic<unsigned long long> calls[STAT_OPERATION_COUNT];
+	std::atomic<unsigned long long> nanoseconds[STAT_OPERATION_COUNT];
+	std::atomic<unsigned long long> buckets[STAT_OPERATION_COUNT][STATS_BUCKETS];
+} StatSlot;
+
+static StatSlot statSlots[STATS_MAX_THREADS + 1];   // the last slot is shared by threads which found no free one
+
+// Structure defination for the slot a thread counts into, handed back when the thread ends
+typedef struct StatThread
+{
+	StatSlot* slot;
+	~StatThread()
+	{
+		if (slot != NULL && slot != &statSlots[STATS_MAX_THREADS])
+		{
+			slot->owned.store(0, std::memory_order_release);
+		}
+	}
+} StatThread;
+
+static thread_local StatThread statThread;
+
+//
+// FUNCTION: statSlot
+// DESCRIPTION:
+//		This function returns the statistics slot of the calling thread, claiming a free one on
+//		the thread's first count.
+// PARAMETERS:
+//		void: this function does not take any parameters.
+// RETURNS:
+//		StatSlot*: the slot of the thread.
+//
+static StatSlot* statSlot()
+{
+	if (statThread.slot == NULL)
+	{
+		statThread.slot = &statSlots[STATS_MAX_THREADS];
+		for (int i = 0; i < STATS_MAX_THREADS; i++)
+		{
+			int expected = 0;
+			if (statSlots[i].owned.load(std::memory_order_relaxed) == 0 && statSlots[i].owned.compare_exchange_strong(expected, 1, std::memory_order_acquire))
+			{
+				statThread.slot = &statSlots[i];
+				break;
+			}
+		}
+	}
+	return statThread.slot;
+}
+
+//
+// FUNCTION: addToStatistic
+// DESCRIPTION:
+//		This function adds to one word of the calling thread's statistics slot. The owner is the
+//		only writer, so a relaxed load and store suffice; the shared slot needs a real increment.
+// PARAMETERS:
+//		StatSlot* slot: the slot of the calling thread.
+//		std::atomic<unsigned long long>* word: the word to be added to.
+//		unsigned long long amount: the amount to be added.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static inline void addToStatistic(StatSlot* slot, std::atomic<unsigned long long>* word, unsigned long long amount)
+{
+	if (slot == &statSlots[STATS_MAX_THREADS])
+	{
+		word->fetch_add(amount, std::memory_order_relaxed);
+	}
+	else
+	{
+		word->store(word->load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+}
+
+//
+// FUNCTION: countStatistic
+// DESCRIPTION:
+//		This function adds to a counter of the runtime statistics, use STAT_ADD instead so the
+//		call compiles out with the statistics.
+// PARAMETERS:
+//		StatCounter counter: the counter to be added to.
+//		unsigned long long amount: the amount to be added.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static inline void countStatistic(StatCounter counter, unsigned long long amount)
+{
+	StatSlot* slot = statSlot();
+	addToStatistic(slot, &slot->counters[counter], amount);
+}
+
+// Structure defination for a timer which adds the time of its scope to an operation's histogram
+typedef struct StatTimer
+{
+	StatOperation operation;
+	std::chrono::steady_clock::time_point start;
+
+	explicit StatTimer(StatOperation timed) : operation(timed), start(std::chrono::steady_clock::now())
+	{
+	}
+
+	~StatTimer()
+	{
+		unsigned long long elapsed = (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		StatSlot* slot = statSlot();
+		int bucket = 0;
+		while (bucket < STATS_BUCKETS - 1 && (elapsed >> (bucket + 1)) != 0)
+		{
+			bucket++;   // the highest set bit picks the bucket
+		}
+		addToStatistic(slot, &slot->calls[operation], 1);
+		addToStatistic(slot, &slot->nanoseconds[operation], elapsed);
+		addToStatistic(slot, &slot->buckets[operation][bucket], 1);
+	}
+} StatTimer;
+
+#define STAT_ADD(counter, amount) countStatistic(counter, amount)
+#define STAT_TIME(operation) StatTimer statTimer(operation)
+#else
+#define STAT_ADD(counter, amount) ((void)sizeof(amount))   // keeps the amount "used" without evaluating it
+#define STAT_TIME(operation) ((void)0)
+#endif
+
+//
+// FUNCTION: hashBytes
+// DESCRIPTION:
+//		This function is generating the djb2 hash value of a country name which is
+//		given by its length instead of a NUL terminator, such as a name inside a mapped file.
+// PARAMETERS:
+//		const char* str: the first character of the name.
+//		size_t length: the number of characters in the name.
+// RETURNS:
+//		unsigned long: the full 32-bit hash value.
+//
+unsigned long hashBytes(const char* str, size_t length)
+{
+	unsigned long hash = 5381;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = ((hash << 5) + hash) + (unsigned char)str[i];
+	}
+	return hash & 0xFFFFFFFFUL;   // same value on 32-bit and 64-bit longs
+}
+
 //
 // FUNCTION: hash
 // DESCRIPTION: 
 //		This function is generating hash value from a string like 
-//		country name with the help of algorithm.
+//		country name with the help of djb2 algorithm.
 //PARAMETERS: 
-//		char* str: the string like country name for which the hash value 
+//		const char* str: the string like country name for which the hash value 
 //		is getting generated.
 // RETURNS: 
-//		unsigned long: the hash value which is limited to the range of
-//		hash table size.
+//		unsigned long: the full 32-bit hash value, the country table maps it
+//		to a slot itself.
 //	
-unsigned long hash(char* str)
+unsigned long hash(const char* str)
 {
-	unsigned long hash = 5381;
-	int c;
-	while ((c = *str++))
-	{
-		hash = ((hash << 5) + hash) + c;
-	}
-	return hash % HASH_TABLE_SIZE;   // returns the hash value within the range of the hash table size
+	return hashBytes(str, strlen(str));
 }
 
 //
-// FUNCTION:
-//		createParcel
-// DESCRIPTION: 
-//		This function cretaes a new Parcel structure with provided country,
-//		weight and valuation.
+// FUNCTION: initParcelStore
+// DESCRIPTION:
+//		This function initializes an empty parcel store with no slabs and no countries.
 // PARAMETERS:
-//		char* country: the destination country for the parcel.
-//		int weight: the weight of the Parcel in grams.
-//		float valuation: the valuation of the parcel in dollars.
+//		ParcelStore* store: the parcel store to be initialized.
 // RETURNS:
-//		Parcel*: which is a pointer to the newly created Parcel structure
-//		or exits on memory allocation failure.
+//		void: this function does not return a value.
+//
+void initParcelStore(ParcelStore* store)
+{
+	memset(store, 0, sizeof(*store));   // no slabs and no countries yet, the country table is allocated on first use
+}
+
+//
+// FUNCTION: getParcel
+// DESCRIPTION:
+//		This function converts a 32-bit arena index into the address of the parcel node.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the node.
+//		ParcelIndex index: the arena index of the node.
+// RETURNS:
+//		Parcel*: pointer to the parcel node inside its slab.
+//
+static inline Parcel* getParcel(const ParcelArena* arena, ParcelIndex index)
+{
+	return &arena->chunks[index >> ARENA_CHUNK_SHIFT][index & ARENA_CHUNK_MASK];
+}
+
+//
+// FUNCTION: arenaAllocate
+// DESCRIPTION:
+//		This function hands out the next free parcel slot of the arena, allocating a
+//		new slab when the current one is full.
+// PARAMETERS:
+//		ParcelArena* arena: the arena to allocate from.
+// RETURNS:
+//		ParcelIndex: the arena index of the new slot or exits on memory allocation failure.
 //
-Parcel* createParcel(char* country, int weight, float valuation)
+ParcelIndex arenaAllocate(ParcelArena* arena)
 {
-	Parcel* newParcel = (Parcel*)malloc(sizeof(Parcel)); // allocate memory for new parcel
-	if (newParcel == NULL)
+	if (arena->freeList != NULL_PARCEL)
 	{
-		fprintf(stderr, "Error: Memory allocation failed for newParcel.\n");
-		exit(1);   // Exit the program if memory allocation got failed
+		ParcelIndex index = arena->freeList;   // reuse a released node before growing the arena
+		arena->freeList = getParcel(arena, index)->left;
+		arena->freeCount--;
+		return index;
 	}
 
-	newParcel->destination = (char*)malloc(strlen(country) + 1); // allocate memory for the country name
-	if (newParcel->destination == NULL)
+	if (arena->nextIndex == 0 && arena->chunkCount == 0)
 	{
-		fprintf(stderr, "Error: Memory allocation failed for destination.\n");
-		free(newParcel);   // Free the already allocated memory for newParcel
-		exit(1);   // Exit program if memory allocation got failed
+		arena->nextIndex = 1;   // skip slot 0 which is reserved for NULL_PARCEL
 	}
 
-	strcpy_s(newParcel->destination, strlen(country) + 1, country); // copy the country name to the destination
+	if ((arena->nextIndex >> ARENA_CHUNK_SHIFT) >= arena->chunkCount)
+	{
+		if (arena->chunkCount == ARENA_MAX_CHUNKS)
+		{
+			fprintf(stderr, "Error: Parcel arena is full.\n");
+			exit(1);
+		}
+
+		Parcel* chunk = (Parcel*)malloc(sizeof(Parcel) * ARENA_CHUNK_SIZE);   // allocate a whole slab at once
+		if (chunk == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for arena slab.\n");
+			exit(1);   // Exit the program if memory allocation got failed
+		}
+		arena->chunks[arena->chunkCount++] = chunk;
+	}
+
+	return arena->nextIndex++;
+}
+
+//
+// FUNCTION: arenaRelease
+// DESCRIPTION:
+//		This function puts a node which no tree can reach any more on the free list of the
+//		arena, so arenaAllocate hands it out again.
+// PARAMETERS:
+//		ParcelArena* arena: the arena which owns the node.
+//		ParcelIndex index: the arena index of the node.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void arenaRelease(ParcelArena* arena, ParcelIndex index)
+{
+	getParcel(arena, index)->height = 0;   // no node in a tree has height 0, this marks it as free
+	getParcel(arena, index)->left = arena->freeList;
+	arena->freeList = index;
+	arena->freeCount++;
+}
+
+//
+// FUNCTION: arenaAllocateRange
+// DESCRIPTION:
+//		This function hands out a run of consecutive arena slots, so a whole tree can be laid
+//		out in sequential memory.
+// PARAMETERS:
+//		ParcelArena* arena: the arena to allocate from.
+//		unsigned int count: the number of slots, at least 1.
+// RETURNS:
+//		ParcelIndex: the arena index of the first slot or exits on memory allocation failure.
+//
+ParcelIndex arenaAllocateRange(ParcelArena* arena, unsigned int count)
+{
+	ParcelIndex first = arenaAllocate(arena);   // also reserves slot 0 on first use
+	unsigned long long last = (unsigned long long)first + count - 1;
+
+	if (last >= (unsigned long long)ARENA_MAX_CHUNKS * ARENA_CHUNK_SIZE)
+	{
+		fprintf(stderr, "Error: Parcel arena is full.\n");
+		exit(1);
+	}
+	while ((last >> ARENA_CHUNK_SHIFT) >= arena->chunkCount)
+	{
+		Parcel* chunk = (Parcel*)malloc(sizeof(Parcel) * ARENA_CHUNK_SIZE);
+		if (chunk == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for arena slab.\n");
+			exit(1);
+		}
+		arena->chunks[arena->chunkCount++] = chunk;
+	}
+	arena->nextIndex = (ParcelIndex)(last + 1);
+	return first;
+}
+
+//
+// FUNCTION: slotForHash
+// DESCRIPTION:
+//		This function maps a country hash to its home slot with a Fibonacci multiply,
+//		which spreads djb2 values evenly over a power of two table.
+// PARAMETERS:
+//		unsigned long hashValue: the full hash of the country name.
+//		unsigned int slotCount: the number of slots, a power of two.
+// RETURNS:
+//		unsigned int: the home slot of the hash value.
+//
+static inline unsigned int slotForHash(unsigned long hashValue, unsigned int slotCount)
+{
+	return (unsigned int)(((unsigned long long)hashValue * 2654435769ULL) >> 16) & (slotCount - 1);
+}
+
+//
+// FUNCTION: findCountryIdBytes
+// DESCRIPTION:
+//		This function looks up the interned id of a country name given by its length by
+//		linear probing the open addressing country table.
+// PARAMETERS:
+//		const CountryCatalog* catalog: the catalog of interned countries.
+//		const char* country: the first character of the name to look up.
+//		size_t length: the number of characters in the name.
+// RETURNS:
+//		int: the country id, or -1 if the country was never interned.
+//
+int findCountryIdBytes(const CountryCatalog* catalog, const char* country, size_t length)
+{
+	if (catalog->slotCount == 0)
+	{
+		return -1;   // nothing was interned yet
+	}
+
+	unsigned long hashValue = hashBytes(country, length);
+	unsigned int mask = catalog->slotCount - 1;
+	unsigned int probes = 1;
+	STAT_ADD(STAT_COUNTRY_LOOKUPS, 1);
+	for (unsigned int slot = slotForHash(hashValue, catalog->slotCount); ; slot = (slot + 1) & mask, probes++)
+	{
+		const CountrySlot* entry = &catalog->slots[slot];
+		if (entry->countryId == -1)
+		{
+			STAT_ADD(STAT_COUNTRY_PROBES, probes);
+			return -1;   // an empty slot ends the probe sequence
+		}
+
+		const char* name = catalog->names[entry->countryId];
+		if (entry->hashValue == hashValue && strncmp(name, country, length) == 0 && name[length] == '\0')
+		{
+			STAT_ADD(STAT_COUNTRY_PROBES, probes);
+			return entry->countryId;
+		}
+	}
+}
+
+//
+// FUNCTION: findCountryId
+// DESCRIPTION:
+//		This function looks up the interned id of a country name.
+// PARAMETERS:
+//		const CountryCatalog* catalog: the catalog of interned countries.
+//		const char* country: the name of the country to look up.
+// RETURNS:
+//		int: the country id, or -1 if the country was never interned.
+//
+int findCountryId(const CountryCatalog* catalog, const char* country)
+{
+	return findCountryIdBytes(catalog, country, strlen(country));
+}
+
+//
+// FUNCTION: placeCountrySlot
+// DESCRIPTION:
+//		This function stores a country id in the first free slot of its probe sequence.
+// PARAMETERS:
+//		CountrySlot* slots: the slots of the country table.
+//		unsigned int slotCount: the number of slots, a power of two.
+//		unsigned long hashValue: the full hash of the country name.
+//		int countryId: the id of the country to be stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void placeCountrySlot(CountrySlot* slots, unsigned int slotCount, unsigned long hashValue, int countryId)
+{
+	unsigned int slot = slotForHash(hashValue, slotCount);
+	while (slots[slot].countryId != -1)
+	{
+		slot = (slot + 1) & (slotCount - 1);   // linear probing
+	}
+	slots[slot].hashValue = hashValue;
+	slots[slot].countryId = countryId;
+}
+
+//
+// FUNCTION: growCountryTable
+// DESCRIPTION:
+//		This function doubles the country table and re-places every country with its stored hash.
+// PARAMETERS:
+//		CountryCatalog* catalog: the catalog whose table is to grow.
+// RETURNS:
+//		void: this function does not return a value, it exits on memory allocation failure.
+//
+static void growCountryTable(CountryCatalog* catalog)
+{
+	unsigned int slotCount = catalog->slotCount ? catalog->slotCount * 2 : COUNTRY_TABLE_INITIAL_SLOTS;
+	CountrySlot* slots = (CountrySlot*)malloc(slotCount * sizeof(CountrySlot));
+	if (slots == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for country table.\n");
+		exit(1);
+	}
+
+	for (unsigned int i = 0; i < slotCount; i++)
+	{
+		slots[i].countryId = -1;   // mark every slot empty
+	}
+	for (unsigned int i = 0; i < catalog->slotCount; i++)
+	{
+		if (catalog->slots[i].countryId != -1)
+		{
+			placeCountrySlot(slots, slotCount, catalog->slots[i].hashValue, catalog->slots[i].countryId);
+		}
+	}
+
+	free(catalog->slots);
+	catalog->slots = slots;
+	catalog->slotCount = slotCount;
+}
+
+//
+// FUNCTION: internCountryBytes
+// DESCRIPTION:
+//		This function returns the id of a country name given by its length, adding a single
+//		shared copy of the name and an empty BST to the catalog the first time it is seen.
+// PARAMETERS:
+//		CountryCatalog* catalog: the catalog of interned countries.
+//		const char* country: the first character of the name to intern.
+//		size_t length: the number of characters in the name.
+// RETURNS:
+//		unsigned short: the country id or exits on memory allocation failure.
+//
+unsigned short internCountryBytes(CountryCatalog* catalog, const char* country, size_t length)
+{
+	int id = findCountryIdBytes(catalog, country, length);
+	if (id != -1)
+	{
+		return (unsigned short)id;
+	}
+
+	if (catalog->count == MAX_COUNTRIES)
+	{
+		fprintf(stderr, "Error: Too many distinct countries.\n");
+		exit(1);
+	}
+
+	if (catalog->count == catalog->capacity)
+	{
+		unsigned int capacity = catalog->capacity ? catalog->capacity * 2 : 64;   // grow the per country arrays geometrically
+		char** names = (char**)realloc(catalog->names, capacity * sizeof(char*));
+		unsigned int* parcelCounts = (unsigned int*)realloc(catalog->parcelCounts, capacity * sizeof(unsigned int));
+		ParcelIndex* roots = (ParcelIndex*)realloc(catalog->roots, capacity * sizeof(ParcelIndex));
+		if (names) catalog->names = names;
+		if (parcelCounts) catalog->parcelCounts = parcelCounts;
+		if (roots) catalog->roots = roots;
+		if (names == NULL || parcelCounts == NULL || roots == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for country catalog.\n");
+			exit(1);
+		}
+		catalog->capacity = capacity;
+	}
+
+	if ((unsigned long long)(catalog->count + 1) * 100 > (unsigned long long)catalog->slotCount * COUNTRY_TABLE_MAX_LOAD)
+	{
+		growCountryTable(catalog);   // keep probe sequences short as the country set grows
+	}
+
+	char* name = (char*)malloc(length + 1);   // the only copy of this name in the whole store
+	if (name == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for country name.\n");
+		exit(1);
+	}
+	memcpy(name, country, length);
+	name[length] = '\0';
+
+	id = (int)catalog->count++;
+	catalog->names[id] = name;
+	catalog->parcelCounts[id] = 0;
+	catalog->roots[id] = NULL_PARCEL;   // every country gets its own empty BST
+	catalog->nameBytes += length + 1;
+	placeCountrySlot(catalog->slots, catalog->slotCount, hashBytes(country, length), id);
+	return (unsigned short)id;
+}
+
+//
+// FUNCTION: internCountry
+// DESCRIPTION:
+//		This function returns the id of a country name, adding it to the catalog the first time it is seen.
+// PARAMETERS:
+//		CountryCatalog* catalog: the catalog of interned countries.
+//		const char* country: the name of the country to intern.
+// RETURNS:
+//		unsigned short: the country id or exits on memory allocation failure.
+//
+unsigned short internCountry(CountryCatalog* catalog, const char* country)
+{
+	return internCountryBytes(catalog, country, strlen(country));
+}
+
+//
+// FUNCTION: freeCountryCatalog
+// DESCRIPTION:
+//		This function frees the interned country names and the tables of the catalog,
+//		leaving an empty catalog behind.
+// PARAMETERS:
+//		CountryCatalog* catalog: the catalog to be freed.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void freeCountryCatalog(CountryCatalog* catalog)
+{
+	for (unsigned int i = 0; i < catalog->count; i++)
+	{
+		free(catalog->names[i]);   // free the interned country names
+	}
+	free(catalog->names);
+	free(catalog->parcelCounts);
+	free(catalog->roots);
+	free(catalog->slots);
+	memset(catalog, 0, sizeof(*catalog));
+}
+
+//
+// FUNCTION: hashCountryName
+// DESCRIPTION:
+//		This function is the FNV-1a hash of a country name followed by a final mix, so the high
+//		bits which pick the perfect hash bucket depend on every byte. It is constexpr so the
+//		table of the built-in countries is generated by the compiler.
+// PARAMETERS:
+//		const char* name: the first character of the name.
+//		size_t length: the number of characters in the name.
+// RETURNS:
+//		unsigned long long: the 64-bit hash value.
+//
+constexpr unsigned long long hashCountryName(const char* name, size_t length)
+{
+	unsigned long long hashValue = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++)
+	{
+		hashValue = (hashValue ^ (unsigned char)name[i]) * 1099511628211ULL;
+	}
+	hashValue ^= hashValue >> 33;
+	hashValue *= 0xff51afd7ed558ccdULL;
+	return hashValue ^ (hashValue >> 33);
+}
+
+//
+// FUNCTION: countryNameLength
+// DESCRIPTION:
+//		This function is strlen for constant expressions.
+// PARAMETERS:
+//		const char* name: a NUL terminated name.
+// RETURNS:
+//		unsigned int: the number of characters before the terminator.
+//
+constexpr unsigned int countryNameLength(const char* name)
+{
+	unsigned int length = 0;
+	while (name[length] != '\0')
+	{
+		length++;
+	}
+	return length;
+}
+
+//
+// FUNCTION: nextPowerOfTwo
+// DESCRIPTION:
+//		This function rounds a count up to a power of two.
+// PARAMETERS:
+//		unsigned int value: the count.
+// RETURNS:
+//		unsigned int: the smallest power of two which is at least the count.
+//
+constexpr unsigned int nextPowerOfTwo(unsigned int value)
+{
+	unsigned int power = 1;
+	while (power < value)
+	{
+		power <<= 1;
+	}
+	return power;
+}
+
+//
+// FUNCTION: perfectHashBucket
+// DESCRIPTION:
+//		This function picks the bucket of a hashed name, from the top bits of the hash.
+// PARAMETERS:
+//		unsigned long long hashValue: the hash of the name.
+//		unsigned int bucketMask: the number of buckets minus one.
+// RETURNS:
+//		unsigned int: the bucket of the name.
+//
+constexpr unsigned int perfectHashBucket(unsigned long long hashValue, unsigned int bucketMask)
+{
+	return (unsigned int)(hashValue >> 44) & bucketMask;
+}
+
+//
+// FUNCTION: perfectHashSlot
+// DESCRIPTION:
+//		This function gives the slot of a hashed name for its bucket's displacement. The step
+//		is odd, so as the displacement grows every slot of the power of two table is tried.
+// PARAMETERS:
+//		unsigned long long hashValue: the hash of the name.
+//		unsigned int displacement: the displacement of the name's bucket.
+//		unsigned int slotMask: the number of slots minus one.
+// RETURNS:
+//		unsigned int: the slot of the name.
+//
+constexpr unsigned int perfectHashSlot(unsigned long long hashValue, unsigned int displacement, unsigned int slotMask)
+{
+	return (unsigned int)((hashValue + displacement * ((hashValue >> 20) | 1)) & slotMask);
+}
+
+//
+// FUNCTION: buildPerfectHash
+// DESCRIPTION:
+//		This function builds a hash-and-displace perfect hash over a list of names. The names
+//		are grouped into buckets by hash, then the buckets are placed largest first: each gets
+//		the smallest displacement which puts all of its names into slots no other name holds.
+//		A lookup is then one hash, one bucket read and one slot read. It is constexpr so the
+//		compiler builds the table of the built-in countries, and runs as is for a config file.
+// PARAMETERS:
+//		const char* const* names: the names, the position of a name is its dense id.
+//		unsigned int count: the number of names, less than COUNTRY_LIST_EMPTY.
+//		unsigned long long* hashes: scratch space for count hashes.
+//		unsigned int* members: scratch space for count names grouped by bucket.
+//		unsigned int* offsets: scratch space for bucketCount + 1 bucket offsets.
+//		unsigned int* displacements: bucketCount displacements, filled in.
+//		unsigned int bucketCount: the number of buckets, a power of two.
+//		unsigned short* slots: slotCount slots, filled with the dense id hashed to each.
+//		unsigned int slotCount: the number of slots, a power of two above count.
+// RETURNS:
+//		int: returns 1 if every name got its own slot, 0 if a name is listed twice.
+//
+constexpr int buildPerfectHash(const char* const* names, unsigned int count, unsigned long long* hashes, unsigned int* members, unsigned int* offsets,
+	unsigned int* displacements, unsigned int bucketCount, unsigned short* slots, unsigned int slotCount)
+{
+	unsigned int largest = 0;
+
+	// group the names by bucket with a counting sort, the displacements serve as the fill cursors
+	for (unsigned int bucket = 0; bucket <= bucketCount; bucket++)
+	{
+		offsets[bucket] = 0;
+	}
+	for (unsigned int i = 0; i < count; i++)
+	{
+		hashes[i] = hashCountryName(names[i], countryNameLength(names[i]));
+		offsets[perfectHashBucket(hashes[i], bucketCount - 1) + 1]++;
+	}
+	for (unsigned int bucket = 0; bucket < bucketCount; bucket++)
+	{
+		largest = offsets[bucket + 1] > largest ? offsets[bucket + 1] : largest;
+		offsets[bucket + 1] += offsets[bucket];
+		displacements[bucket] = offsets[bucket];
+	}
+	for (unsigned int i = 0; i < count; i++)
+	{
+		members[displacements[perfectHashBucket(hashes[i], bucketCount - 1)]++] = i;
+	}
+	for (unsigned int bucket = 0; bucket < bucketCount; bucket++)
+	{
+		displacements[bucket] = 0;
+	}
+	for (unsigned int slot = 0; slot < slotCount; slot++)
+	{
+		slots[slot] = COUNTRY_LIST_EMPTY;
+	}
+
+	// the big buckets go first, while most slots are still free
+	for (unsigned int size = largest; size > 0; size--)
+	{
+		for (unsigned int bucket = 0; bucket < bucketCount; bucket++)
+		{
+			if (offsets[bucket + 1] - offsets[bucket] != size)
+			{
+				continue;
+			}
+
+			unsigned int displacement = 0;
+			for (; displacement < slotCount; displacement++)
+			{
+				unsigned int placed = offsets[bucket];
+				while (placed < offsets[bucket + 1])
+				{
+					unsigned int slot = perfectHashSlot(hashes[members[placed]], displacement, slotCount - 1);
+					if (slots[slot] != COUNTRY_LIST_EMPTY)
+					{
+						break;
+					}
+					slots[slot] = (unsigned short)members[placed++];
+				}
+				if (placed == offsets[bucket + 1])
+				{
+					break;   // every name of the bucket found a free slot
+				}
+				while (placed > offsets[bucket])
+				{
+					placed--;
+					slots[perfectHashSlot(hashes[members[placed]], displacement, slotCount - 1)] = COUNTRY_LIST_EMPTY;   // undo the partial placement
+				}
+			}
+			if (displacement == slotCount)
+			{
+				return 0;   // only names with the same hash, so the same name, can never be separated
+			}
+			displacements[bucket] = displacement;
+		}
+	}
+	return 1;
+}
+
+// The countries accepted unless a --countries file replaces them, their position is their dense id
+static constexpr const char* builtinCountries[] =
+{
+	"Azerbaijan", "Italy", "Ukraine", "Germany", "Australia", "Vanuatu", "Bulgaria", "Mongolia", "Armenia",
+	"Yemen", "Bahamas", "Trinidad & Tobago", "Spain", "Russian Federation", "Djobouti", "Ethiopia",
+	"Eswatini", "Slovakia", "Aruba", "Nepal", "India", "Gambia", "Israel", "Kosovo", "Burkina", "Barbados",
+	"Algeria", "Afghanistan", "Albania", "San Marino", "Costa Rica", "Marshall Islands", "Iceland",
+	"Kuwait", "Japan", "Canada", "Oman", "Liberia", "Vietnam", "Taiwan", "Bhutan", "Indonesia",
+	"Antigua & Deps", "Colombia", "France", "Brazil", "Congo", "Guatemala", "Guinea-Bissau", "Austria",
+	"Slovenia", "Comoros", "Serbia", "China", "Belarus", "Dominica", "Madagascar", "Chile", "Denmark",
+	"Tajikistan", "Angola", "Nicaragua", "Georgia", "Argentina", "Bangladesh", "Moldova"
+};
+static constexpr unsigned int builtinCountryCount = sizeof(builtinCountries) / sizeof(builtinCountries[0]);
+static constexpr unsigned int builtinBucketCount = nextPowerOfTwo(builtinCountryCount / COUNTRY_LIST_BUCKET_SIZE + 1);
+static constexpr unsigned int builtinSlotCount = nextPowerOfTwo(builtinCountryCount * 2);
+
+// Structure defination for the perfect hash of the built-in countries, generated at compile time
+typedef struct BuiltinCountryHash
+{
+	unsigned int displacements[builtinBucketCount];
+	unsigned short slots[builtinSlotCount];
+	unsigned char lengths[builtinCountryCount];
+	int built;   // 1 if buildPerfectHash succeeded
+} BuiltinCountryHash;
+
+//
+// FUNCTION: makeBuiltinCountryHash
+// DESCRIPTION:
+//		This function builds the perfect hash of the built-in countries, evaluated by the compiler.
+// PARAMETERS:
+//		void: this function does not take any parameters.
+// RETURNS:
+//		BuiltinCountryHash: the finished table.
+//
+constexpr BuiltinCountryHash makeBuiltinCountryHash()
+{
+	BuiltinCountryHash table = {};
+	unsigned long long hashes[builtinCountryCount] = {};
+	unsigned int members[builtinCountryCount] = {};
+	unsigned int offsets[builtinBucketCount + 1] = {};
+
+	table.built = buildPerfectHash(builtinCountries, builtinCountryCount, hashes, members, offsets, table.displacements, builtinBucketCount, table.slots, builtinSlotCount);
+	for (unsigned int i = 0; i < builtinCountryCount; i++)
+	{
+		table.lengths[i] = (unsigned char)countryNameLength(builtinCountries[i]);
+	}
+	return table;
+}
+
+static constexpr BuiltinCountryHash builtinCountryHash = makeBuiltinCountryHash();
+static_assert(builtinCountryHash.built, "two built-in countries share a name");
+
+//
+// FUNCTION: countryListChecksum
+// DESCRIPTION:
+//		This function folds the names of a country list in order into a checksum, which
+//		snapshots record so an index built under another list is not reused.
+// PARAMETERS:
+//		const CountryList* list: the list, its names already filled in.
+// RETURNS:
+//		unsigned long long: the checksum.
+//
+unsigned long long countryListChecksum(const CountryList* list)
+{
+	unsigned long long checksum = SNAPSHOT_CHECKSUM_SEED;
+	for (unsigned int i = 0; i < list->count; i++)
+	{
+		checksum = (checksum ^ hashCountryName(list->names[i], list->lengths[i])) * 1099511628211ULL;
+	}
+	return checksum;
+}
+
+//
+// FUNCTION: initBuiltinCountryList
+// DESCRIPTION:
+//		This function sets up the list of the built-in countries over their compile time table.
+// PARAMETERS:
+//		CountryList* list: the list to be set up.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void initBuiltinCountryList(CountryList* list)
+{
+	memset(list, 0, sizeof(*list));
+	list->names = builtinCountries;
+	list->lengths = builtinCountryHash.lengths;
+	list->count = builtinCountryCount;
+	list->displacements = builtinCountryHash.displacements;
+	list->bucketMask = builtinBucketCount - 1;
+	list->slots = builtinCountryHash.slots;
+	list->slotMask = builtinSlotCount - 1;
+	list->checksum = countryListChecksum(list);
+}
+
+//
+// FUNCTION: findListedCountry
+// DESCRIPTION:
+//		This function looks a name up in a country list with its perfect hash: one hash, one
+//		bucket and one slot, then a single comparison confirms the name.
+// PARAMETERS:
+//		const CountryList* list: the list of accepted countries.
+//		const char* name: the first character of the name, not necessarily NUL terminated.
+//		size_t length: the number of characters in the name.
+// RETURNS:
+//		int: the dense id of the country in the list, -1 if it is not listed.
+//
+int findListedCountry(const CountryList* list, const char* name, size_t length)
+{
+	if (list->count == 0)
+	{
+		return -1;
+	}
+
+	unsigned long long hashValue = hashCountryName(name, length);
+	unsigned int displacement = list->displacements[perfectHashBucket(hashValue, list->bucketMask)];
+	unsigned int id = list->slots[perfectHashSlot(hashValue, displacement, list->slotMask)];
+	if (id != COUNTRY_LIST_EMPTY && list->lengths[id] == length && memcmp(list->names[id], name, length) == 0)
+	{
+		return (int)id;
+	}
+	return -1;
+}
+
+//
+// FUNCTION: freeCountryList
+// DESCRIPTION:
+//		This function frees a country list loaded from a config file, the built-in list owns
+//		nothing and is left alone.
+// PARAMETERS:
+//		CountryList* list: the list to be freed.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void freeCountryList(CountryList* list)
+{
+	if (list->owned)
+	{
+		for (unsigned int i = 0; i < list->count; i++)
+		{
+			free((char*)list->names[i]);
+		}
+		free((char**)list->names);
+		free((unsigned char*)list->lengths);
+		free((unsigned int*)list->displacements);
+		free((unsigned short*)list->slots);
+	}
+	memset(list, 0, sizeof(*list));
+}
+
+//
+// FUNCTION: findCountryRoot
+// DESCRIPTION:
+//		This function returns the BST holding the parcels of exactly one country.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		const char* country: the name of the country.
+// RETURNS:
+//		ParcelIndex: the arena index of the root of the country's BST, NULL_PARCEL if it has no parcels.
+//
+ParcelIndex findCountryRoot(const ParcelStore* store, const char* country)
+{
+	int id = findCountryId(&store->catalog, country);
+	return id == -1 ? NULL_PARCEL : store->catalog.roots[id];
+}
+
+//
+// FUNCTION: initParcelNode
+// DESCRIPTION:
+//		This function fills an arena slot with a parcel which is not linked into any BST yet.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the arena and the country catalog.
+//		ParcelIndex index: the arena index of the slot.
+//		unsigned short countryId: the interned id of the destination country.
+//		int weight: the weight of the Parcel in grams.
+//		Cents valuation: the valuation of the parcel.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void initParcelNode(ParcelStore* store, ParcelIndex index, unsigned short countryId, int weight, Cents valuation)
+{
+	Parcel* newParcel = getParcel(&store->arena, index);
+
 	newParcel->weight = weight; // set the weight of the parcel
-	newParcel->valuation = valuation; // set the valuation of parcel
-	newParcel->left = newParcel->right = NULL; // initialize left and right child childeren to NULL
-	return newParcel;
+	newParcel->valuation = (ParcelCents)valuation; // set the valuation of parcel, the parsers keep it within PARCEL_MAX_VALUATION
+	newParcel->left = newParcel->right = NULL_PARCEL; // initialize left and right child childeren to NULL
+	newParcel->countryId = countryId;
+	newParcel->height = 1;   // a new node is always inserted as a leaf
+	newParcel->generation = 0;
+	newParcel->subtree.count = 1;
+	newParcel->subtree.weightSum = weight;
+	newParcel->subtree.valuationSum = valuation;
+	newParcel->subtree.cheapest = newParcel->subtree.mostExpensive = index;
+	newParcel->subtree.minValuation = newParcel->subtree.maxValuation = newParcel->valuation;
+	store->catalog.parcelCounts[countryId]++;
+}
+
+//
+// FUNCTION: createParcelForCountry
+// DESCRIPTION:
+//		This function creates a new Parcel node in the arena for an already interned country.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the arena and the country catalog.
+//		unsigned short countryId: the interned id of the destination country.
+//		int weight: the weight of the Parcel in grams.
+//		Cents valuation: the valuation of the parcel.
+// RETURNS:
+//		ParcelIndex: the arena index of the newly created Parcel node
+//		or exits on memory allocation failure.
+//
+ParcelIndex createParcelForCountry(ParcelStore* store, unsigned short countryId, int weight, Cents valuation)
+{
+	ParcelIndex index = arenaAllocate(&store->arena);   // take the next slot of the arena
+	initParcelNode(store, index, countryId, weight, valuation);
+	return index;
+}
+
+//
+// FUNCTION: nodeHeight
+// DESCRIPTION:
+//		This function returns the height of the subtree at the given arena index.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the node.
+//		ParcelIndex index: the arena index of the subtree root.
+// RETURNS:
+//		int: the height of the subtree, 0 for an empty subtree.
+//
+static inline int nodeHeight(const ParcelArena* arena, ParcelIndex index)
+{
+	return index == NULL_PARCEL ? 0 : getParcel(arena, index)->height;
+}
+
+//
+// FUNCTION: mergeAggregate
+// DESCRIPTION:
+//		This function folds the aggregates of a group of parcels which comes later in weight order
+//		into the aggregates of an earlier group. Ties on valuation keep the earlier parcel, so the
+//		extremes match a left to right scan.
+// PARAMETERS:
+//		ParcelAggregate* first: the aggregates of the earlier group, updated in place.
+//		const ParcelAggregate* second: the aggregates of the later group.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void mergeAggregate(ParcelAggregate* first, const ParcelAggregate* second)
+{
+	if (second->count == 0)
+	{
+		return;
+	}
+	if (first->count == 0)
+	{
+		*first = *second;
+		return;
+	}
+
+	first->count += second->count;
+	first->weightSum += second->weightSum;
+	first->valuationSum += second->valuationSum;
+	if (second->minValuation < first->minValuation)
+	{
+		first->cheapest = second->cheapest;
+		first->minValuation = second->minValuation;
+	}
+	if (second->maxValuation > first->maxValuation)
+	{
+		first->mostExpensive = second->mostExpensive;
+		first->maxValuation = second->maxValuation;
+	}
+}
+
+//
+// FUNCTION: nodeAggregate
+// DESCRIPTION:
+//		This function builds the aggregates of a single parcel, ignoring its subtrees.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the parcel.
+//		ParcelIndex index: the arena index of the parcel.
+//		ParcelAggregate* aggregate: the variable where the aggregates will get stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void nodeAggregate(const ParcelArena* arena, ParcelIndex index, ParcelAggregate* aggregate)
+{
+	const Parcel* parcel = getParcel(arena, index);
+	aggregate->count = 1;
+	aggregate->weightSum = parcel->weight;
+	aggregate->valuationSum = parcel->valuation;
+	aggregate->cheapest = aggregate->mostExpensive = index;
+	aggregate->minValuation = aggregate->maxValuation = parcel->valuation;
+}
+
+//
+// FUNCTION: addToAggregate
+// DESCRIPTION:
+//		This function adds one newly inserted parcel to the aggregates of an ancestor whose shape
+//		did not change, without reading the children of the ancestor. On equal valuations the new
+//		parcel only wins if it comes first in weight order.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the nodes.
+//		ParcelAggregate* aggregate: the aggregates of the ancestor, updated in place.
+//		ParcelIndex index: the arena index of the new parcel.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void addToAggregate(const ParcelArena* arena, ParcelAggregate* aggregate, ParcelIndex index)
+{
+	const Parcel* parcel = getParcel(arena, index);
+
+	aggregate->count++;
+	aggregate->weightSum += parcel->weight;
+	aggregate->valuationSum += parcel->valuation;
+	if (parcel->valuation < aggregate->minValuation ||
+		(parcel->valuation == aggregate->minValuation && parcel->weight < getParcel(arena, aggregate->cheapest)->weight))
+	{
+		aggregate->cheapest = index;
+		aggregate->minValuation = parcel->valuation;
+	}
+	if (parcel->valuation > aggregate->maxValuation ||
+		(parcel->valuation == aggregate->maxValuation && parcel->weight < getParcel(arena, aggregate->mostExpensive)->weight))
+	{
+		aggregate->mostExpensive = index;
+		aggregate->maxValuation = parcel->valuation;
+	}
+}
+
+//
+// FUNCTION: updateNode
+// DESCRIPTION:
+//		This function recomputes the height and the subtree aggregates of a node from its children.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the node.
+//		ParcelIndex index: the arena index of the node to be recomputed.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void updateNode(const ParcelArena* arena, ParcelIndex index)
+{
+	Parcel* node = getParcel(arena, index);
+	int leftHeight = nodeHeight(arena, node->left);
+	int rightHeight = nodeHeight(arena, node->right);
+	ParcelAggregate self;
+
+	node->height = (unsigned char)((leftHeight > rightHeight ? leftHeight : rightHeight) + 1);
+
+	memset(&node->subtree, 0, sizeof(node->subtree));
+	if (node->left != NULL_PARCEL)
+	{
+		node->subtree = getParcel(arena, node->left)->subtree;   // left subtree comes first in weight order
+	}
+	nodeAggregate(arena, index, &self);
+	mergeAggregate(&node->subtree, &self);
+	if (node->right != NULL_PARCEL)
+	{
+		mergeAggregate(&node->subtree, &getParcel(arena, node->right)->subtree);
+	}
+}
+
+//
+// FUNCTION: rotateLeft
+// DESCRIPTION:
+//		This function rotates the subtree at the given link to the left, making the
+//		right child the new subtree root.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the nodes.
+//		ParcelIndex* link: pointer to the link which holds the subtree root.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void rotateLeft(const ParcelArena* arena, ParcelIndex* link)
+{
+	ParcelIndex oldRoot = *link;
+	Parcel* node = getParcel(arena, oldRoot);
+	ParcelIndex newRoot = node->right;
+	Parcel* pivot = getParcel(arena, newRoot);
+
+	node->right = pivot->left;   // the inner subtree of the pivot moves across
+	pivot->left = oldRoot;
+	STAT_ADD(STAT_ROTATIONS, 1);
+	updateNode(arena, oldRoot);   // the old root is now the lower node
+	updateNode(arena, newRoot);
+	*link = newRoot;
+}
+
+//
+// FUNCTION: rotateRight
+// DESCRIPTION:
+//		This function rotates the subtree at the given link to the right, making the
+//		left child the new subtree root.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the nodes.
+//		ParcelIndex* link: pointer to the link which holds the subtree root.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void rotateRight(const ParcelArena* arena, ParcelIndex* link)
+{
+	ParcelIndex oldRoot = *link;
+	Parcel* node = getParcel(arena, oldRoot);
+	ParcelIndex newRoot = node->left;
+	Parcel* pivot = getParcel(arena, newRoot);
+
+	node->left = pivot->right;   // the inner subtree of the pivot moves across
+	pivot->right = oldRoot;
+	STAT_ADD(STAT_ROTATIONS, 1);
+	updateNode(arena, oldRoot);   // the old root is now the lower node
+	updateNode(arena, newRoot);
+	*link = newRoot;
+}
+
+//
+// FUNCTION: rebalance
+// DESCRIPTION:
+//		This function restores the AVL property at the given link with a single or
+//		double rotation and refreshes the height and aggregates of the subtree root.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the nodes.
+//		ParcelIndex* link: pointer to the link which holds the subtree root.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void rebalance(const ParcelArena* arena, ParcelIndex* link)
+{
+	Parcel* node = getParcel(arena, *link);
+	int balance = nodeHeight(arena, node->left) - nodeHeight(arena, node->right);
+
+	if (balance > 1)
+	{
+		Parcel* left = getParcel(arena, node->left);
+		if (nodeHeight(arena, left->left) < nodeHeight(arena, left->right))
+		{
+			rotateLeft(arena, &node->left);   // left-right case needs a double rotation
+		}
+		rotateRight(arena, link);
+	}
+	else if (balance < -1)
+	{
+		Parcel* right = getParcel(arena, node->right);
+		if (nodeHeight(arena, right->right) < nodeHeight(arena, right->left))
+		{
+			rotateRight(arena, &node->right);   // right-left case needs a double rotation
+		}
+		rotateLeft(arena, link);
+	}
+	else
+	{
+		updateNode(arena, *link);
+	}
+}
+
+//
+// FUNCTION: compareValuationKey
+// DESCRIPTION:
+//		This function orders a parcel against an entry of the valuation index by valuation, then
+//		country id, then weight. Parcels equal on all three cannot be told apart, so any entry
+//		with an equal key stands for any of them.
+// PARAMETERS:
+//		const ValuationEntry* entry: the entry to compare with.
+//		Cents valuation: the valuation of the parcel.
+//		unsigned short countryId: the country id of the parcel.
+//		int weight: the weight of the parcel.
+// RETURNS:
+//		int: negative if the parcel comes before the entry, positive if after, 0 if equal.
+//
+static inline int compareValuationKey(const ValuationEntry* entry, Cents valuation, unsigned short countryId, int weight)
+{
+	if (valuation != entry->valuation)
+	{
+		return valuation < entry->valuation ? -1 : 1;
+	}
+	if (countryId != entry->countryId)
+	{
+		return countryId < entry->countryId ? -1 : 1;
+	}
+	return weight < entry->weight ? -1 : weight > entry->weight;
+}
+
+//
+// FUNCTION: valuationHeight
+// DESCRIPTION:
+//		This function returns the height of the valuation subtree at the given slot.
+// PARAMETERS:
+//		const ValuationEntry* entries: the entries of the valuation index.
+//		ValuationSlot slot: the slot of the subtree root.
+// RETURNS:
+//		int: the height of the subtree, 0 for the NULL slot.
+//
+static inline int valuationHeight(const ValuationEntry* entries, ValuationSlot slot)
+{
+	return slot == 0 ? 0 : entries[slot].height;
+}
+
+//
+// FUNCTION: updateValuationEntry
+// DESCRIPTION:
+//		This function recomputes the height and subtree count of an entry from its children.
+// PARAMETERS:
+//		ValuationEntry* entries: the entries of the valuation index.
+//		ValuationSlot slot: the slot of the entry to be recomputed.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void updateValuationEntry(ValuationEntry* entries, ValuationSlot slot)
+{
+	ValuationEntry* entry = &entries[slot];
+	int leftHeight = valuationHeight(entries, entry->left);
+	int rightHeight = valuationHeight(entries, entry->right);
+
+	entry->height = (unsigned char)((leftHeight > rightHeight ? leftHeight : rightHeight) + 1);
+	entry->count = 1 + (entry->left != 0 ? entries[entry->left].count : 0) + (entry->right != 0 ? entries[entry->right].count : 0);
+}
+
+//
+// FUNCTION: rotateValuation
+// DESCRIPTION:
+//		This function rotates the valuation subtree at the given link, making the left child
+//		(rotating right) or the right child (rotating left) the new subtree root.
+// PARAMETERS:
+//		ValuationEntry* entries: the entries of the valuation index.
+//		ValuationSlot* link: pointer to the link which holds the subtree root.
+//		int toLeft: 1 to rotate left, 0 to rotate right.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void rotateValuation(ValuationEntry* entries, ValuationSlot* link, int toLeft)
+{
+	ValuationSlot oldRoot = *link;
+	ValuationEntry* entry = &entries[oldRoot];
+	ValuationSlot newRoot = toLeft ? entry->right : entry->left;
+	ValuationEntry* pivot = &entries[newRoot];
+
+	if (toLeft)
+	{
+		entry->right = pivot->left;   // the inner subtree of the pivot moves across
+		pivot->left = oldRoot;
+	}
+	else
+	{
+		entry->left = pivot->right;
+		pivot->right = oldRoot;
+	}
+	updateValuationEntry(entries, oldRoot);   // the old root is now the lower entry
+	updateValuationEntry(entries, newRoot);
+	*link = newRoot;
+}
+
+//
+// FUNCTION: rebalanceValuation
+// DESCRIPTION:
+//		This function restores the AVL property at a link of a valuation tree with a single or
+//		double rotation, the same way rebalance does for the parcel trees.
+// PARAMETERS:
+//		ValuationEntry* entries: the entries of the valuation index.
+//		ValuationSlot* link: pointer to the link which holds the subtree root.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void rebalanceValuation(ValuationEntry* entries, ValuationSlot* link)
+{
+	ValuationEntry* entry = &entries[*link];
+	int balance = valuationHeight(entries, entry->left) - valuationHeight(entries, entry->right);
+
+	if (balance > 1)
+	{
+		const ValuationEntry* left = &entries[entry->left];
+		if (valuationHeight(entries, left->left) < valuationHeight(entries, left->right))
+		{
+			rotateValuation(entries, &entry->left, 1);   // left-right case needs a double rotation
+		}
+		rotateValuation(entries, link, 0);
+	}
+	else if (balance < -1)
+	{
+		const ValuationEntry* right = &entries[entry->right];
+		if (valuationHeight(entries, right->right) < valuationHeight(entries, right->left))
+		{
+			rotateValuation(entries, &entry->right, 0);   // right-left case needs a double rotation
+		}
+		rotateValuation(entries, link, 1);
+	}
+	else
+	{
+		updateValuationEntry(entries, *link);
+	}
+}
+
+//
+// FUNCTION: allocateValuationEntry
+// DESCRIPTION:
+//		This function hands out a slot of the valuation index, reusing released slots first.
+//		The entries may move when the array grows, so no slot address may be held across a call.
+// PARAMETERS:
+//		ValuationIndex* index: the valuation index.
+// RETURNS:
+//		ValuationSlot: the new slot or exits on memory allocation failure.
+//
+static ValuationSlot allocateValuationEntry(ValuationIndex* index)
+{
+	if (index->freeList != 0)
+	{
+		ValuationSlot slot = index->freeList;
+		index->freeList = index->entries[slot].left;
+		return slot;
+	}
+	if (index->entryCount == index->capacity)
+	{
+		unsigned int capacity = index->capacity > 0 ? index->capacity * 2 : 4096;
+		ValuationEntry* entries = (ValuationEntry*)realloc(index->entries, capacity * sizeof(ValuationEntry));
+		if (entries == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for valuation index.\n");
+			exit(1);
+		}
+		index->entries = entries;
+		index->capacity = capacity;
+	}
+	return index->entryCount++;
+}
+
+//
+// FUNCTION: insertValuationEntry
+// DESCRIPTION:
+//		This function inserts an entry into a valuation tree and rebalances the path back up.
+// PARAMETERS:
+//		ValuationEntry* entries: the entries of the valuation index.
+//		ValuationSlot* root: pointer to the root slot of the tree.
+//		ValuationSlot slot: the slot of the new entry, its key already filled in.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void insertValuationEntry(ValuationEntry* entries, ValuationSlot* root, ValuationSlot slot)
+{
+	ValuationSlot* path[AVL_MAX_HEIGHT];
+	int depth = 0;
+	ValuationEntry* entry = &entries[slot];
+	ValuationSlot* link = root;
+
+	entry->left = entry->right = 0;
+	entry->height = 1;
+	entry->count = 1;
+	while (*link != 0)
+	{
+		ValuationEntry* node = &entries[*link];
+		node->count++;   // the entry always goes in below, so every node passed gains one
+		path[depth++] = link;
+		link = compareValuationKey(node, entry->valuation, entry->countryId, entry->weight) < 0 ? &node->left : &node->right;
+	}
+	*link = slot;
+
+	int settled = 0;   // set once a subtree kept its height, nothing above it changes shape
+	while (depth > 0 && !settled)
+	{
+		link = path[--depth];
+		int oldHeight = entries[*link].height;
+		rebalanceValuation(entries, link);
+		settled = entries[*link].height == oldHeight;
+	}
+}
+
+//
+// FUNCTION: removeValuationEntry
+// DESCRIPTION:
+//		This function removes an entry with the given key from a valuation tree, replacing an
+//		entry with two children by its in-order successor, and rebalances the path back up.
+// PARAMETERS:
+//		ValuationEntry* entries: the entries of the valuation index.
+//		ValuationSlot* root: pointer to the root slot of the tree.
+//		Cents valuation: the valuation of the parcel.
+//		unsigned short countryId: the country id of the parcel.
+//		int weight: the weight of the parcel.
+// RETURNS:
+//		ValuationSlot: the slot which left the tree, 0 if no entry has the key.
+//
+static ValuationSlot removeValuationEntry(ValuationEntry* entries, ValuationSlot* root, Cents valuation, unsigned short countryId, int weight)
+{
+	ValuationSlot* path[AVL_MAX_HEIGHT];
+	int heights[AVL_MAX_HEIGHT];   // height of the subtree at each link before the removal
+	int depth = 0;
+	ValuationSlot* link = root;
+	int order;
+
+	while (*link != 0 && (order = compareValuationKey(&entries[*link], valuation, countryId, weight)) != 0)
+	{
+		heights[depth] = entries[*link].height;
+		path[depth++] = link;
+		link = order < 0 ? &entries[*link].left : &entries[*link].right;
+	}
+	if (*link == 0)
+	{
+		return 0;
+	}
+
+	ValuationSlot removed = *link;
+	ValuationEntry* entry = &entries[removed];
+	int entryDepth = depth;   // links below this one changed shape, they are always rebalanced
+	if (entry->left == 0 || entry->right == 0)
+	{
+		*link = entry->left != 0 ? entry->left : entry->right;
+	}
+	else
+	{
+		heights[depth] = entry->height;
+		path[depth++] = link;
+		ValuationSlot* successorLink = &entry->right;
+		while (entries[*successorLink].left != 0)
+		{
+			heights[depth] = entries[*successorLink].height;
+			path[depth++] = successorLink;
+			successorLink = &entries[*successorLink].left;
+		}
+
+		ValuationSlot successor = *successorLink;
+		ValuationEntry* moved = &entries[successor];
+		*successorLink = moved->right;
+		moved->left = entry->left;
+		moved->right = entry->right;
+		*link = successor;
+		if (depth > entryDepth + 1)
+		{
+			path[entryDepth + 1] = &moved->right;   // the removed entry's right link now belongs to the successor
+		}
+	}
+	for (int i = 0; i < entryDepth; i++)
+	{
+		entries[*path[i]].count--;   // every ancestor loses one entry, whether or not it is rebalanced
+	}
+
+	int settled = 0;   // set once a subtree above the removed entry kept its height
+	while (depth > 0 && !(settled && depth <= entryDepth))
+	{
+		link = path[--depth];
+		rebalanceValuation(entries, link);
+		settled = entries[*link].height == heights[depth];
+	}
+	return removed;
+}
+
+//
+// FUNCTION: freeValuationIndex
+// DESCRIPTION:
+//		This function frees the valuation index, which is built again on the next valuation query.
+// PARAMETERS:
+//		ValuationIndex* index: the valuation index.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void freeValuationIndex(ValuationIndex* index)
+{
+	free(index->entries);
+	free(index->countryRoots);
+	memset(index, 0, sizeof(*index));
+}
+
+//
+// FUNCTION: addToValuationIndex
+// DESCRIPTION:
+//		This function adds a new parcel to the global and the country tree of the valuation
+//		index, if the index was built. Called for every parcel inserted into a BST.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the index.
+//		const Parcel* parcel: the new parcel.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void addToValuationIndex(ParcelStore* store, const Parcel* parcel)
+{
+	ValuationIndex* index = &store->valuations;
+
+	if (!index->built)
+	{
+		return;
+	}
+	if (parcel->countryId >= index->countryCapacity)
+	{
+		unsigned int capacity = store->catalog.capacity;
+		ValuationSlot* roots = (ValuationSlot*)realloc(index->countryRoots, capacity * sizeof(ValuationSlot));
+		if (roots == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for valuation index.\n");
+			exit(1);
+		}
+		memset(roots + index->countryCapacity, 0, (capacity - index->countryCapacity) * sizeof(ValuationSlot));
+		index->countryRoots = roots;
+		index->countryCapacity = capacity;
+	}
+
+	ValuationSlot slots[2];
+	slots[0] = allocateValuationEntry(index);
+	slots[1] = allocateValuationEntry(index);   // both before any address into the entries is taken
+	for (int i = 0; i < 2; i++)
+	{
+		index->entries[slots[i]].valuation = parcel->valuation;
+		index->entries[slots[i]].weight = parcel->weight;
+		index->entries[slots[i]].countryId = parcel->countryId;
+	}
+	insertValuationEntry(index->entries, &index->globalRoot, slots[0]);
+	insertValuationEntry(index->entries, &index->countryRoots[parcel->countryId], slots[1]);
+}
+
+//
+// FUNCTION: removeFromValuationIndex
+// DESCRIPTION:
+//		This function takes a parcel out of both trees of the valuation index, if the index was
+//		built. It must be called while the parcel still holds the fields it was indexed with.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the index.
+//		const Parcel* parcel: the parcel leaving its BST.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void removeFromValuationIndex(ParcelStore* store, const Parcel* parcel)
+{
+	ValuationIndex* index = &store->valuations;
+	ValuationSlot slots[2];
+
+	if (!index->built)
+	{
+		return;
+	}
+	slots[0] = removeValuationEntry(index->entries, &index->globalRoot, parcel->valuation, parcel->countryId, parcel->weight);
+	slots[1] = parcel->countryId < index->countryCapacity
+		? removeValuationEntry(index->entries, &index->countryRoots[parcel->countryId], parcel->valuation, parcel->countryId, parcel->weight) : 0;
+	for (int i = 0; i < 2; i++)
+	{
+		if (slots[i] != 0)
+		{
+			index->entries[slots[i]].height = 0;
+			index->entries[slots[i]].left = index->freeList;
+			index->freeList = slots[i];
+		}
+	}
+}
+
+//
+// FUNCTION: refreshSketchCapacity
+// DESCRIPTION:
+//		This function works out how many items the levels of a sketch hold before one is
+//		compacted, after the sketch got a new top level. The top level holds SKETCH_K items and
+//		every level below two thirds of the one above, but at least SKETCH_MIN_WIDTH, so the
+//		capacities add up to less than 3k plus SKETCH_MIN_WIDTH per level.
+// PARAMETERS:
+//		QuantileSketch* sketch: the sketch whose levels changed.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void refreshSketchCapacity(QuantileSketch* sketch)
+{
+	unsigned int levelCapacity = SKETCH_K;
+
+	sketch->capacity = 0;
+	for (unsigned int level = sketch->levelCount; level-- > 0;)
+	{
+		sketch->levelCapacities[level] = (unsigned short)(levelCapacity > SKETCH_MIN_WIDTH ? levelCapacity : SKETCH_MIN_WIDTH);
+		sketch->capacity += sketch->levelCapacities[level];
+		levelCapacity = (levelCapacity * 2 + 2) / 3;   // two thirds, rounded up
+	}
+}
+
+//
+// FUNCTION: initQuantileSketch
+// DESCRIPTION:
+//		This function empties a quantile sketch.
+// PARAMETERS:
+//		QuantileSketch* sketch: the sketch to be initialized.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void initQuantileSketch(QuantileSketch* sketch)
+{
+	sketch->levelCount = 1;
+	sketch->levelSizes[0] = 0;
+	sketch->itemCount = 0;
+	sketch->count = 0;
+	sketch->minimum = LLONG_MAX;
+	sketch->maximum = LLONG_MIN;
+	sketch->random = 0x9e3779b97f4a7c15ULL;   // fixed, so the same stream always gives the same answers
+	refreshSketchCapacity(sketch);
+}
+
+//
+// FUNCTION: compareSketchValues
+// DESCRIPTION:
+//		This function compares two kept values of a sketch for qsort.
+// PARAMETERS:
+//		const void* first: the first value.
+//		const void* second: the second value.
+// RETURNS:
+//		int: negative, zero or positive like strcmp.
+//
+static int compareSketchValues(const void* first, const void* second)
+{
+	long long a = *(const long long*)first;
+	long long b = *(const long long*)second;
+	return (a > b) - (a < b);
+}
+
+//
+// FUNCTION: compactSketchLevel
+// DESCRIPTION:
+//		This function compacts one level of a sketch: one value of every adjacent pair of the
+//		sorted level moves up a level with twice the weight and the other is dropped, the coin
+//		deciding which, and the largest value stays behind when the count is odd. Only level 0
+//		needs sorting, the levels above are kept sorted. The level above sits right in front of
+//		this one in items, so the survivors are merged into it from the back, spilling into the
+//		space of this level, and only the levels below move.
+// PARAMETERS:
+//		QuantileSketch* sketch: the sketch.
+//		unsigned int level: the level to be compacted, below SKETCH_MAX_LEVELS - 1.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void compactSketchLevel(QuantileSketch* sketch, unsigned int level)
+{
+	unsigned int offset = 0;
+	for (unsigned int above = level + 1; above < sketch->levelCount; above++)
+	{
+		offset += sketch->levelSizes[above];
+	}
+	if (level + 1 == sketch->levelCount)
+	{
+		sketch->levelSizes[sketch->levelCount++] = 0;   // a new empty top level, nothing moves
+		refreshSketchCapacity(sketch);
+	}
+
+	long long* items = sketch->items + offset;
+	unsigned int size = sketch->levelSizes[level];
+	unsigned int pairs = size / 2;
+	unsigned int rest = sketch->itemCount - offset - size;   // items of the levels below
+
+	sketch->random ^= sketch->random << 13;   // xorshift64
+	sketch->random ^= sketch->random >> 7;
+	sketch->random ^= sketch->random << 17;
+	unsigned int coin = (unsigned int)(sketch->random >> 63);
+
+	if (level == 0 && size > 32)
+	{
+		qsort(items, size, sizeof(long long), compareSketchValues);
+	}
+	for (unsigned int i = 1; level == 0 && size <= 32 && i < size; i++)   // insertion sort for the small low level
+	{
+		long long value = items[i];
+		unsigned int slot = i;
+		while (slot > 0 && items[slot - 1] > value)
+		{
+			items[slot] = items[slot - 1];
+			slot--;
+		}
+		items[slot] = value;
+	}
+	long long survivors[SKETCH_CAPACITY / 2];
+	long long leftover = items[size - 1];
+	for (unsigned int i = 0; i < pairs; i++)
+	{
+		survivors[i] = items[2 * i + coin];
+	}
+
+	// merge the survivors into the sorted level above, from the back into the space of this level
+	long long* upper = items - sketch->levelSizes[level + 1];
+	long long* from = items - 1;
+	long long* to = items + pairs - 1;
+	for (unsigned int survivor = pairs; survivor > 0;)
+	{
+		*to-- = from >= upper && *from > survivors[survivor - 1] ? *from-- : survivors[--survivor];
+	}
+	if (size % 2 != 0)
+	{
+		items[pairs] = leftover;
+	}
+	memmove(items + pairs + size % 2, items + size, rest * sizeof(long long));
+	sketch->levelSizes[level + 1] = (unsigned short)(sketch->levelSizes[level + 1] + pairs);
+	sketch->levelSizes[level] = (unsigned short)(size % 2);
+	sketch->itemCount -= pairs;
+}
+
+//
+// FUNCTION: compressQuantileSketch
+// DESCRIPTION:
+//		This function compacts the lowest full levels of a sketch until its items fit its capacity again.
+// PARAMETERS:
+//		QuantileSketch* sketch: the sketch.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void compressQuantileSketch(QuantileSketch* sketch)
+{
+	while (sketch->itemCount >= sketch->capacity)
+	{
+		unsigned int level = 0;
+		while (level < sketch->levelCount && sketch->levelSizes[level] < sketch->levelCapacities[level])
+		{
+			level++;
+		}
+		if (level >= sketch->levelCount || level + 1 >= SKETCH_MAX_LEVELS)
+		{
+			return;   // no level is full, or the top one cannot grow
+		}
+		compactSketchLevel(sketch, level);
+	}
+}
+
+//
+// FUNCTION: addToSketchLevel
+// DESCRIPTION:
+//		This function adds a value to one level of a sketch, where it stands for 2^level values.
+//		Merging sketches adds their items this way; the count and extremes are up to the caller.
+// PARAMETERS:
+//		QuantileSketch* sketch: the sketch.
+//		long long value: the value to be added.
+//		unsigned int level: the level of the value, below SKETCH_MAX_LEVELS.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void addToSketchLevel(QuantileSketch* sketch, long long value, unsigned int level)
+{
+	while (sketch->levelCount <= level)
+	{
+		sketch->levelSizes[sketch->levelCount++] = 0;
+		refreshSketchCapacity(sketch);
+	}
+
+	unsigned int first = 0;
+	for (unsigned int above = level + 1; above < sketch->levelCount; above++)
+	{
+		first += sketch->levelSizes[above];
+	}
+	unsigned int end = first + sketch->levelSizes[level];
+	while (level > 0 && end > first && sketch->items[end - 1] > value)
+	{
+		end--;   // the levels above 0 stay sorted
+	}
+	memmove(sketch->items + end + 1, sketch->items + end, (sketch->itemCount - end) * sizeof(long long));
+	sketch->items[end] = value;
+	sketch->levelSizes[level]++;
+	sketch->itemCount++;
+	compressQuantileSketch(sketch);
+}
+
+//
+// FUNCTION: addToQuantileSketch
+// DESCRIPTION:
+//		This function adds one value of the stream to a sketch in amortized O(1).
+// PARAMETERS:
+//		QuantileSketch* sketch: the sketch.
+//		long long value: the value to be added.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static inline void addToQuantileSketch(QuantileSketch* sketch, long long value)
+{
+	sketch->count++;
+	sketch->minimum = value < sketch->minimum ? value : sketch->minimum;
+	sketch->maximum = value > sketch->maximum ? value : sketch->maximum;
+	sketch->items[sketch->itemCount++] = value;   // level 0 is the last level, nothing moves
+	sketch->levelSizes[0]++;
+	if (sketch->itemCount >= sketch->capacity)
+	{
+		compressQuantileSketch(sketch);
+	}
+}
+
+//
+// FUNCTION: addToQuantileIndex
+// DESCRIPTION:
+//		This function adds a new parcel to the sketches of its country, if they were built and
+//		are current. Called for every parcel inserted into a BST.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the sketches.
+//		const Parcel* parcel: the new parcel.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void addToQuantileIndex(ParcelStore* store, const Parcel* parcel)
+{
+	QuantileIndex* index = &store->quantiles;
+
+	if (!index->built || parcel->countryId >= index->capacity || index->countries[parcel->countryId].stale)
+	{
+		return;   // getCountrySketches builds them from the tree when they are asked for
+	}
+	addToQuantileSketch(&index->countries[parcel->countryId].weights, parcel->weight);
+	addToQuantileSketch(&index->countries[parcel->countryId].valuations, parcel->valuation);
+}
+
+//
+// FUNCTION: markSketchesStale
+// DESCRIPTION:
+//		This function marks the sketches of a country as stale once one of its parcels is
+//		removed, since a sketch cannot take a value back. They are rebuilt on next use.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the sketches.
+//		unsigned short countryId: the interned id of the country.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void markSketchesStale(ParcelStore* store, unsigned short countryId)
+{
+	if (countryId < store->quantiles.capacity)
+	{
+		store->quantiles.countries[countryId].stale = 1;
+	}
+}
+
+//
+// FUNCTION: freeQuantileIndex
+// DESCRIPTION:
+//		This function frees the sketches of every country.
+// PARAMETERS:
+//		QuantileIndex* index: the quantile sketches.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void freeQuantileIndex(QuantileIndex* index)
+{
+	free(index->countries);
+	memset(index, 0, sizeof(*index));
+}
+
+//
+// FUNCTION: insertIntoBst
+// DRSCRIPTION: 
+//		This function insert a new parcel into the AVL balanced BST based on weight of the parcel.
+//		The descent is iterative and the path is rebalanced on the way back up, so the tree
+//		stays O(log n) deep even when the parcels arrive sorted by weight, and the subtree
+//		aggregates of every ancestor are refreshed.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex* root: pointer to the root index of the BST where the parcel is to be inserted.
+//		ParcelIndex newParcel: the arena index of the parcel that needs to be inserted into the BST.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void insertIntoBst(ParcelStore* store, ParcelIndex* root, ParcelIndex newParcel)
+{
+	STAT_TIME(STAT_OP_INSERT);
+	const ParcelArena* arena = &store->arena;
+	ParcelIndex* path[AVL_MAX_HEIGHT];   // links followed from the root down to the new leaf
+	int depth = 0;
+	int weight = getParcel(arena, newParcel)->weight;
+	ParcelIndex* link = root;
+
+	while (*link != NULL_PARCEL)
+	{
+		Parcel* node = getParcel(arena, *link);
+		path[depth++] = link;
+
+		// go left if weight is less, right if weight is more or equal
+		link = weight < node->weight ? &node->left : &node->right;
+	}
+	*link = newParcel;   // insert new parcel at the empty link
+	STAT_ADD(STAT_NODES_VISITED, depth);
+	STAT_ADD(STAT_PARCELS_INSERTED, 1);
+
+	int settled = 0;   // set once a subtree kept its height, nothing above it needs rebalancing
+	while (depth > 0)
+	{
+		link = path[--depth];
+		if (settled)
+		{
+			addToAggregate(arena, &getParcel(arena, *link)->subtree, newParcel);   // only the aggregates change up here
+			continue;
+		}
+
+		int oldHeight = nodeHeight(arena, *link);
+		rebalance(arena, link);   // refreshes height and aggregates from both children
+		settled = nodeHeight(arena, *link) == oldHeight;
+	}
+	addToValuationIndex(store, getParcel(arena, newParcel));
+	addToQuantileIndex(store, getParcel(arena, newParcel));
+}
+
+//
+// FUNCTION: locateParcel
+// DESCRIPTION:
+//		This function finds the links from the root of a BST down to one parcel of the given
+//		weight: either a given node, or a parcel with the given valuation. Rotations can leave
+//		parcels of equal weight on both sides of each other, so both subtrees are searched only
+//		below nodes of that weight, which keeps the search O(log n) plus the parcels sharing it.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the nodes.
+//		ParcelIndex* root: pointer to the root index of the BST.
+//		int weight: the weight of the parcel.
+//		ParcelIndex target: the node to be found, or NULL_PARCEL to match on the valuation.
+//		Cents valuation: the valuation to match when no target is given.
+//		ParcelIndex** path: AVL_MAX_HEIGHT entries, filled with the links from the root down to the parcel.
+// RETURNS:
+//		int: the number of links on the path, the last one holds the parcel, 0 if it is not in the tree.
+//
+static int locateParcel(const ParcelArena* arena, ParcelIndex* root, int weight, ParcelIndex target, Cents valuation, ParcelIndex** path)
+{
+	unsigned char searchedRight[AVL_MAX_HEIGHT];   // 1 once nothing is left to search below the link at the same depth
+	int depth = 0;
+	ParcelIndex* link = root;
+
+	while (1)
+	{
+		if (*link != NULL_PARCEL)
+		{
+			Parcel* node = getParcel(arena, *link);
+			path[depth] = link;
+			STAT_ADD(STAT_NODES_VISITED, 1);
+			if (node->weight == weight && (target != NULL_PARCEL ? *link == target : node->valuation == valuation))
+			{
+				return depth + 1;
+			}
+
+			// a different weight leaves one side to search, an equal weight tries left and then right
+			searchedRight[depth++] = node->weight != weight;
+			link = weight < node->weight || node->weight == weight ? &node->left : &node->right;
+			continue;
+		}
+
+		// dead end, go back to the deepest node of equal weight whose right side is still unsearched
+		while (depth > 0 && searchedRight[depth - 1])
+		{
+			depth--;
+		}
+		if (depth == 0)
+		{
+			return 0;
+		}
+		searchedRight[depth - 1] = 1;
+		link = &getParcel(arena, *path[depth - 1])->right;
+	}
+}
+
+//
+// FUNCTION: unlinkParcel
+// DESCRIPTION:
+//		This function takes the parcel at the end of a path out of its BST and rebalances every
+//		ancestor, which also recomputes their aggregates. A parcel with two children is replaced
+//		by its in-order successor node rather than by a copy of the successor's fields, so every
+//		other parcel keeps its arena index.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the nodes.
+//		ParcelIndex** path: the links from the root down to the parcel, as filled by locateParcel.
+//		int depth: the number of links on the path.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void unlinkParcel(const ParcelArena* arena, ParcelIndex** path, int depth)
+{
+	ParcelIndex* link = path[depth - 1];
+	Parcel* node = getParcel(arena, *link);
+
+	if (node->left == NULL_PARCEL || node->right == NULL_PARCEL)
+	{
+		*link = node->left != NULL_PARCEL ? node->left : node->right;   // the only child, if any, moves up
+		depth--;
+	}
+	else
+	{
+		int nodeDepth = depth;
+		ParcelIndex* successorLink = &node->right;
+		while (getParcel(arena, *successorLink)->left != NULL_PARCEL)
+		{
+			path[depth++] = successorLink;   // every node passed loses a parcel from its left subtree
+			successorLink = &getParcel(arena, *successorLink)->left;
+		}
+
+		ParcelIndex successor = *successorLink;
+		Parcel* moved = getParcel(arena, successor);
+		*successorLink = moved->right;
+		moved->left = node->left;
+		moved->right = node->right;
+		*link = successor;
+		if (depth > nodeDepth)
+		{
+			path[nodeDepth] = &moved->right;   // the removed node's right link now belongs to the successor
+		}
+	}
+
+	while (depth > 0)
+	{
+		rebalance(arena, path[--depth]);   // an ancestor may have lost its cheapest or most expensive parcel
+	}
+}
+
+//
+// FUNCTION: freeCountryColumns
+// DESCRIPTION:
+//		This function frees the columns of one country in either form, leaving them empty.
+// PARAMETERS:
+//		CountryColumns* columns: the columns to be freed.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void freeCountryColumns(CountryColumns* columns)
+{
+	free(columns->weights);
+	free(columns->valuations);
+	free(columns->blocks);
+	free(columns->weightDeltas);
+	free(columns->packedValuations);
+	memset(columns, 0, sizeof(*columns));
+}
+
+//
+// FUNCTION: dropCountryColumns
+// DESCRIPTION:
+//		This function frees the columnar segments of a country whose parcels changed in place,
+//		which a parcel count comparison cannot notice. They are rebuilt on next use.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the columns.
+//		unsigned short countryId: the interned id of the country.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void dropCountryColumns(ParcelStore* store, unsigned short countryId)
+{
+	if (countryId < store->columnCapacity)
+	{
+		freeCountryColumns(&store->columns[countryId]);
+	}
+}
+
+//
+// FUNCTION: freeCountryBoxes
+// DESCRIPTION:
+//		This function frees the k-d tree of one country.
+// PARAMETERS:
+//		CountryBoxes* boxes: the k-d tree.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void freeCountryBoxes(CountryBoxes* boxes)
+{
+	free(boxes->points);
+	free(boxes->nodes);
+	memset(boxes, 0, sizeof(*boxes));
+}
+
+//
+// FUNCTION: dropCountryBoxes
+// DESCRIPTION:
+//		This function frees the k-d tree of a country whose parcels changed in place, like
+//		dropCountryColumns does for the columns. It is rebuilt on next use.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the k-d trees.
+//		unsigned short countryId: the interned id of the country.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void dropCountryBoxes(ParcelStore* store, unsigned short countryId)
+{
+	if (countryId < store->boxes.capacity)
+	{
+		freeCountryBoxes(&store->boxes.countries[countryId]);
+	}
+}
+
+//
+// FUNCTION: findParcel
+// DESCRIPTION:
+//		This function finds a parcel of a country by its weight and valuation. The arena index
+//		it returns is the parcel's id, which stays the same until the parcel is removed.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: the arena index of the root of the country's BST.
+//		int weight: the weight of the parcel in grams.
+//		Cents valuation: the valuation of the parcel.
+// RETURNS:
+//		ParcelIndex: the id of a matching parcel, or NULL_PARCEL if there is none.
+//
+ParcelIndex findParcel(const ParcelStore* store, ParcelIndex root, int weight, Cents valuation)
+{
+	ParcelIndex* path[AVL_MAX_HEIGHT];
+	int depth = locateParcel(&store->arena, &root, weight, NULL_PARCEL, valuation, path);
+	return depth > 0 ? *path[depth - 1] : NULL_PARCEL;
+}
+
+//
+// FUNCTION: isStoredParcel
+// DESCRIPTION:
+//		This function tells whether an id names a parcel which is in the store, and not a node
+//		on the free list or a slot the arena never handed out.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex id: the id to be checked.
+// RETURNS:
+//		int: returns 1 if the parcel is stored else 0.
+//
+int isStoredParcel(const ParcelStore* store, ParcelIndex id)
+{
+	return id != NULL_PARCEL && id < store->arena.nextIndex && getParcel(&store->arena, id)->height != 0;
+}
+
+//
+// FUNCTION: removeParcel
+// DESCRIPTION:
+//		This function removes a parcel, for example once it got dispatched, in O(log n). The node
+//		goes on the free list of the arena and the next new parcel reuses it.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the parcel.
+//		ParcelIndex id: the id of the parcel, as returned by findParcel.
+// RETURNS:
+//		int: returns 1 if the parcel got removed, 0 if the id names no stored parcel.
+//
+int removeParcel(ParcelStore* store, ParcelIndex id)
+{
+	STAT_TIME(STAT_OP_REMOVE);
+	ParcelIndex* path[AVL_MAX_HEIGHT];
+
+	if (!isStoredParcel(store, id))
+	{
+		return 0;
+	}
+	const Parcel* parcel = getParcel(&store->arena, id);
+	unsigned short countryId = parcel->countryId;
+	int depth = locateParcel(&store->arena, &store->catalog.roots[countryId], parcel->weight, id, 0, path);
+	if (depth == 0)
+	{
+		return 0;
+	}
+
+	unlinkParcel(&store->arena, path, depth);
+	removeFromValuationIndex(store, parcel);
+	markSketchesStale(store, countryId);
+	store->catalog.parcelCounts[countryId]--;
+	arenaRelease(&store->arena, id);
+	dropCountryColumns(store, countryId);
+	dropCountryBoxes(store, countryId);
+	if (store->lazy.active)
+	{
+		store->lazy.countries[countryId].pinned = 1;   // the file no longer describes this BST, it must not be evicted
+	}
+	STAT_ADD(STAT_PARCELS_REMOVED, 1);
+	return 1;
+}
+
+//
+// FUNCTION: updateParcel
+// DESCRIPTION:
+//		This function gives a parcel a new weight and valuation, for example after it got
+//		re-weighed, in O(log n). The node is taken out of its BST and inserted again under the
+//		new weight, so the parcel keeps its id.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the parcel.
+//		ParcelIndex id: the id of the parcel, as returned by findParcel.
+//		int weight: the new weight of the parcel in grams.
+//		Cents valuation: the new valuation of the parcel.
+// RETURNS:
+//		int: returns 1 if the parcel got updated, 0 if the id names no stored parcel.
+//
+int updateParcel(ParcelStore* store, ParcelIndex id, int weight, Cents valuation)
+{
+	STAT_TIME(STAT_OP_UPDATE);
+	ParcelIndex* path[AVL_MAX_HEIGHT];
+
+	if (!isStoredParcel(store, id))
+	{
+		return 0;
+	}
+	const Parcel* parcel = getParcel(&store->arena, id);
+	unsigned short countryId = parcel->countryId;
+	int depth = locateParcel(&store->arena, &store->catalog.roots[countryId], parcel->weight, id, 0, path);
+	if (depth == 0)
+	{
+		return 0;
+	}
+
+	unlinkParcel(&store->arena, path, depth);
+	removeFromValuationIndex(store, parcel);   // insertIntoBst indexes it again under the new fields
+	markSketchesStale(store, countryId);
+	store->catalog.parcelCounts[countryId]--;
+	initParcelNode(store, id, countryId, weight, valuation);   // counts the parcel again
+	insertIntoBst(store, &store->catalog.roots[countryId], id);
+	dropCountryColumns(store, countryId);
+	dropCountryBoxes(store, countryId);
+	if (store->lazy.active)
+	{
+		store->lazy.countries[countryId].pinned = 1;
+	}
+	STAT_ADD(STAT_PARCELS_UPDATED, 1);
+	return 1;
+}
+
+//
+// FUNCTION: initIterator
+// DESCRIPTION:
+//		This function prepares an iterative in-order walk over a BST.
+// PARAMETERS:
+//		ParcelIterator* iterator: the iterator to be initialized.
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: the arena index of the root of the BST to be walked.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void initIterator(ParcelIterator* iterator, const ParcelStore* store, ParcelIndex root)
+{
+	iterator->arena = &store->arena;
+	iterator->top = 0;
+	iterator->current = root;
+}
+
+//
+// FUNCTION: nextParcel
+// DESCRIPTION:
+//		This function returns the next parcel of an in-order walk, using an explicit
+//		stack instead of recursion.
+// PARAMETERS:
+//		ParcelIterator* iterator: the iterator of the walk.
+// RETURNS:
+//		const Parcel*: the next parcel in weight order, or NULL when the walk is finished.
+//
+const Parcel* nextParcel(ParcelIterator* iterator)
+{
+	while (iterator->current != NULL_PARCEL)
+	{
+		iterator->stack[iterator->top++] = iterator->current;   // remember the node, visit its left subtree first
+		iterator->current = getParcel(iterator->arena, iterator->current)->left;
+	}
+
+	if (iterator->top == 0)
+	{
+		return NULL;
+	}
+
+	const Parcel* parcel = getParcel(iterator->arena, iterator->stack[--iterator->top]);
+	iterator->current = parcel->right;   // the right subtree comes after the node itself
+	return parcel;
+}
+
+//
+// FUNCTION: countWeightsBelow
+// DESCRIPTION:
+//		This function counts the parcels lighter than a weight (or not heavier, when inclusive)
+//		in O(log n) using the subtree counts.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: the arena index of the root of the BST.
+//		int weight: the weight to compare with.
+//		int inclusive: 1 to also count parcels of exactly this weight.
+// RETURNS:
+//		unsigned int: the number of parcels before the weight in weight order.
+//
+unsigned int countWeightsBelow(const ParcelStore* store, ParcelIndex root, int weight, int inclusive)
+{
+	unsigned int count = 0;
+	unsigned int visited = 0;
+	while (root != NULL_PARCEL)
+	{
+		const Parcel* parcel = getParcel(&store->arena, root);
+		visited++;
+		if (parcel->weight < weight || (inclusive && parcel->weight == weight))
+		{
+			count += parcel->subtree.count - (parcel->right != NULL_PARCEL ? getParcel(&store->arena, parcel->right)->subtree.count : 0);   // node and its left subtree
+			root = parcel->right;
+		}
+		else
+		{
+			root = parcel->left;
+		}
+	}
+	STAT_ADD(STAT_NODES_VISITED, visited);
+	return count;
+}
+
+//
+// FUNCTION: seekIterator
+// DESCRIPTION:
+//		This function positions an in-order iterator on the parcel with the given rank in
+//		weight order in O(log n), so a walk can start in the middle of the tree.
+// PARAMETERS:
+//		ParcelIterator* iterator: the iterator to be positioned.
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: the arena index of the root of the BST.
+//		unsigned int position: the zero based rank of the first parcel to be returned.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void seekIterator(ParcelIterator* iterator, const ParcelStore* store, ParcelIndex root, unsigned int position)
+{
+	unsigned int visited = 0;
+
+	initIterator(iterator, store, NULL_PARCEL);
+	while (root != NULL_PARCEL)
+	{
+		const Parcel* parcel = getParcel(&store->arena, root);
+		visited++;
+		unsigned int leftCount = parcel->left != NULL_PARCEL ? getParcel(&store->arena, parcel->left)->subtree.count : 0;
+
+		if (position < leftCount)
+		{
+			iterator->stack[iterator->top++] = root;   // visited after the left subtree
+			root = parcel->left;
+		}
+		else if (position == leftCount)
+		{
+			iterator->stack[iterator->top++] = root;   // the next parcel to be returned
+			break;
+		}
+		else
+		{
+			position -= leftCount + 1;   // skip the left subtree and the node
+			root = parcel->right;
+		}
+	}
+	STAT_ADD(STAT_NODES_VISITED, visited);
+}
+
+//
+// FUNCTION: queryWeightRange
+// DESCRIPTION:
+//		This function returns the parcels of a BST whose weight lies inside a range, in weight
+//		order, skipping the first offset matches and returning at most limit of them. Only the
+//		subtrees which can hold matches are visited, so the cost is O(log n + k).
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: the arena index of the root of the BST.
+//		const WeightRange* range: the weight bounds to match.
+//		unsigned int offset: the number of matching parcels to skip.
+//		unsigned int limit: the largest number of parcels to return.
+//		const Parcel** results: the array of at least limit entries where the matches will get stored.
+//		unsigned int* totalMatches: where the number of all matching parcels will get stored, may be NULL.
+// RETURNS:
+//		unsigned int: the number of parcels stored in results.
+//
+unsigned int queryWeightRange(const ParcelStore* store, ParcelIndex root, const WeightRange* range, unsigned int offset, unsigned int limit, const Parcel** results, unsigned int* totalMatches)
+{
+	// ranks of the first match and of the first parcel past the range
+	unsigned int first = countWeightsBelow(store, root, range->minWeight, !range->minInclusive);
+	unsigned int end = countWeightsBelow(store, root, range->maxWeight, range->maxInclusive);
+	unsigned int found = 0;
+
+	if (end < first)
+	{
+		end = first;   // empty range
+	}
+	if (totalMatches != NULL)
+	{
+		*totalMatches = end - first;
+	}
+	if (offset >= end - first)
+	{
+		return 0;
+	}
+
+	ParcelIterator iterator;
+	const Parcel* parcel;
+	unsigned int available = end - first - offset;
+
+	seekIterator(&iterator, store, root, first + offset);
+	while (found < limit && found < available && (parcel = nextParcel(&iterator)) != NULL)
+	{
+		results[found++] = parcel;
+	}
+	STAT_ADD(STAT_PARCELS_RETURNED, found);
+	return found;
+}
+
+//
+// FUNCTION: mapFile
+// DESCRIPTION:
+//		This function maps a whole file into memory, so it can be parsed in place
+//		without copying it through stdio buffers.
+// PARAMETERS:
+//		MappedFile* mapped: the variable where the mapping will get stored.
+//		const char* filename: the name of the file to be mapped.
+//		int copyOnWrite: 1 to allow writes into the mapped pages which stay private to the process,
+//		0 for a read-only mapping which is read front to back.
+// RETURNS:
+//		int: returns 1 if the file got mapped else 0.
+//
+int mapFile(MappedFile* mapped, const char* filename, int copyOnWrite)
+{
+	memset(mapped, 0, sizeof(*mapped));
+#ifdef _WIN32
+	mapped->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		copyOnWrite ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mapped->file == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mapped->file, &size))
+	{
+		CloseHandle(mapped->file);
+		return 0;
+	}
+	mapped->size = (size_t)size.QuadPart;
+	if (mapped->size == 0)
+	{
+		return 1;   // an empty file can not be mapped, there is nothing to parse anyway
+	}
+
+	mapped->mapping = CreateFileMappingA(mapped->file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	if (mapped->mapping == NULL)
+	{
+		CloseHandle(mapped->file);
+		return 0;
+	}
+	mapped->data = (const char*)MapViewOfFile(mapped->mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if (mapped->data == NULL)
+	{
+		CloseHandle(mapped->mapping);
+		CloseHandle(mapped->file);
+		return 0;
+	}
+#else
+	struct stat info;
+	mapped->descriptor = open(filename, O_RDONLY);
+	if (mapped->descriptor < 0)
+	{
+		return 0;
+	}
+	if (fstat(mapped->descriptor, &info) != 0)
+	{
+		close(mapped->descriptor);
+		return 0;
+	}
+	mapped->size = (size_t)info.st_size;
+	if (mapped->size == 0)
+	{
+		return 1;   // an empty file can not be mapped, there is nothing to parse anyway
+	}
+
+	void* data = mmap(NULL, mapped->size, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, mapped->descriptor, 0);
+	if (data == MAP_FAILED)
+	{
+		close(mapped->descriptor);
+		return 0;
+	}
+	madvise(data, mapped->size, copyOnWrite ? MADV_RANDOM : MADV_SEQUENTIAL);   // the parser reads every page once, front to back
+	mapped->data = (const char*)data;
+#endif
+	return 1;
+}
+
+//
+// FUNCTION: unmapFile
+// DESCRIPTION:
+//		This function releases a file mapped by mapFile.
+// PARAMETERS:
+//		MappedFile* mapped: the mapping to be released.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void unmapFile(MappedFile* mapped)
+{
+#ifdef _WIN32
+	if (mapped->data != NULL)
+	{
+		UnmapViewOfFile(mapped->data);
+		CloseHandle(mapped->mapping);
+	}
+	CloseHandle(mapped->file);
+#else
+	if (mapped->data != NULL)
+	{
+		munmap((void*)mapped->data, mapped->size);
+	}
+	close(mapped->descriptor);
+#endif
+	memset(mapped, 0, sizeof(*mapped));
+}
+
+//
+// FUNCTION: findByte
+// DESCRIPTION:
+//		This function finds the next occurrence of a byte, comparing 16 bytes at a time with
+//		SSE2 when it is available.
+// PARAMETERS:
+//		const char* cursor: the first byte to be inspected.
+//		const char* end: one past the last byte to be inspected.
+//		char wanted: the byte to find.
+// RETURNS:
+//		const char*: the address of the byte, or end if it does not occur.
+//
+const char* findByte(const char* cursor, const char* end, char wanted)
+{
+#ifdef PARCEL_HAVE_SSE2
+	const __m128i pattern = _mm_set1_epi8(wanted);
+	while (end - cursor >= 16)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)cursor);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern));   // one bit per matching byte
+		if (mask != 0)
+		{
+			int offset = 0;
+			while ((mask & 1) == 0)
+			{
+				mask >>= 1;
+				offset++;
+			}
+			return cursor + offset;
+		}
+		cursor += 16;
+	}
+#endif
+	while (cursor < end && *cursor != wanted)
+	{
+		cursor++;   // tail shorter than one vector, or no SSE2
+	}
+	return cursor;
+}
+
+//
+// FUNCTION: skipBlanks
+// DESCRIPTION:
+//		This function skips spaces and tabs.
+// PARAMETERS:
+//		const char* cursor: the first byte to be inspected.
+//		const char* end: one past the last byte to be inspected.
+// RETURNS:
+//		const char*: the first byte which is not a blank, or end.
+//
+static inline const char* skipBlanks(const char* cursor, const char* end)
+{
+	while (cursor < end && (*cursor == ' ' || *cursor == '\t'))
+	{
+		cursor++;
+	}
+	return cursor;
+}
+
+//
+// FUNCTION: loadCountryList
+// DESCRIPTION:
+//		This function reads the accepted countries from a config file, one name per line. Blank
+//		lines and lines starting with # are skipped, and blanks around a name are ignored. The
+//		perfect hash is built the same way as the compiler builds the built-in one.
+// PARAMETERS:
+//		CountryList* list: the list to be filled in, released with freeCountryList.
+//		const char* filename: the name of the config file.
+// RETURNS:
+//		int: returns 1 if the list was loaded else 0, after printing why.
+//
+int loadCountryList(CountryList* list, const char* filename)
+{
+	MappedFile file;
+	char** names = NULL;
+	unsigned char* lengths = NULL;
+	unsigned int count = 0;
+	unsigned int capacity = 0;
+
+	memset(list, 0, sizeof(*list));
+	if (!mapFile(&file, filename, 0))
+	{
+		fprintf(stderr, "Error: Unable to open country list %s\n", filename);
+		return 0;
+	}
+
+	const char* end = file.data + file.size;
+	for (const char* cursor = file.data; cursor < end; )
+	{
+		const char* lineEnd = findByte(cursor, end, '\n');
+		const char* first = skipBlanks(cursor, lineEnd);
+		const char* last = lineEnd;
+		while (last > first && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+		{
+			last--;
+		}
+		cursor = lineEnd + 1;
+		if (first == last || *first == '#')
+		{
+			continue;
+		}
+		if (last - first > MAX_COUNTRY_NAME_LENGTH || count == COUNTRY_LIST_EMPTY)
+		{
+			fprintf(stderr, "Error: %s: country name too long or too many countries\n", filename);
+			unmapFile(&file);
+			list->names = names;
+			list->lengths = lengths;
+			list->count = count;
+			list->owned = 1;
+			freeCountryList(list);
+			return 0;
+		}
+
+		if (count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			char** grownNames = (char**)realloc(names, capacity * sizeof(char*));
+			unsigned char* grownLengths = (unsigned char*)realloc(lengths, capacity);
+			if (grownNames == NULL || grownLengths == NULL)
+			{
+				fprintf(stderr, "Error: Memory allocation failed for country list.\n");
+				exit(1);
+			}
+			names = grownNames;
+			lengths = grownLengths;
+		}
+		names[count] = (char*)malloc((size_t)(last - first) + 1);
+		if (names[count] == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for country list.\n");
+			exit(1);
+		}
+		memcpy(names[count], first, (size_t)(last - first));
+		names[count][last - first] = '\0';
+		lengths[count++] = (unsigned char)(last - first);
+	}
+	unmapFile(&file);
+
+	unsigned int bucketCount = nextPowerOfTwo(count / COUNTRY_LIST_BUCKET_SIZE + 1);
+	unsigned int slotCount = nextPowerOfTwo(count * 2 + 1);
+	unsigned long long* hashes = (unsigned long long*)malloc((count + 1) * sizeof(unsigned long long));
+	unsigned int* members = (unsigned int*)malloc((count + 1) * sizeof(unsigned int));
+	unsigned int* offsets = (unsigned int*)malloc((bucketCount + 1) * sizeof(unsigned int));
+	unsigned int* displacements = (unsigned int*)malloc(bucketCount * sizeof(unsigned int));
+	unsigned short* slots = (unsigned short*)malloc(slotCount * sizeof(unsigned short));
+	if (hashes == NULL || members == NULL || offsets == NULL || displacements == NULL || slots == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for country list.\n");
+		exit(1);
+	}
+
+	int built = buildPerfectHash(names, count, hashes, members, offsets, displacements, bucketCount, slots, slotCount);
+	free(hashes);
+	free(members);
+	free(offsets);
+
+	list->names = names;
+	list->lengths = lengths;
+	list->count = count;
+	list->displacements = displacements;
+	list->bucketMask = bucketCount - 1;
+	list->slots = slots;
+	list->slotMask = slotCount - 1;
+	list->owned = 1;
+	list->checksum = countryListChecksum(list);
+	if (!built)
+	{
+		fprintf(stderr, "Error: %s lists a country twice.\n", filename);
+		freeCountryList(list);
+		return 0;
+	}
+	if (count == 0)
+	{
+		fprintf(stderr, "Warning: %s lists no countries, every row and query will be rejected.\n", filename);
+	}
+	return 1;
+}
+
+//
+// FUNCTION: parseInteger
+// DESCRIPTION:
+//		This function parses an optionally signed decimal integer without going through the
+//		locale aware C library.
+// PARAMETERS:
+//		const char** cursor: the position to parse from, moved past the digits.
+//		const char* end: one past the last byte which may be read.
+//		int* value: the variable where the integer will get stored.
+// RETURNS:
+//		int: returns 1 if an integer in the range of int got parsed else 0.
+//
+int parseInteger(const char** cursor, const char* end, int* value)
+{
+	const char* p = *cursor;
+	int negative = 0;
+	long long result = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	const char* digits = p;
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		result = result * 10 + (*p - '0');
+		if (result > (long long)INT_MAX + 1)
+		{
+			return 0;   // overflow
+		}
+		p++;
+	}
+	if (p == digits)
+	{
+		return 0;   // no digits at all
+	}
+
+	result = negative ? -result : result;
+	if (result > INT_MAX || result < INT_MIN)
+	{
+		return 0;
+	}
+	*value = (int)result;
+	*cursor = p;
+	return 1;
+}
+
+//
+// FUNCTION: parseCents
+// DESCRIPTION:
+//		This function parses a decimal amount such as 1234.56 into whole cents without going
+//		through floating point, so the stored value is exactly the one written. Digits past the
+//		cents round to the nearest cent, halves away from zero.
+// PARAMETERS:
+//		const char** cursor: the position to parse from, moved past the number.
+//		const char* end: one past the last byte which may be read.
+//		Cents* value: the variable where the amount will get stored.
+// RETURNS:
+//		int: returns 1 if a number got parsed else 0.
+//
+int parseCents(const char** cursor, const char* end, Cents* value)
+{
+	const char* p = *cursor;
+	int negative = 0;
+	long long cents = 0;
+	int digits = 0;
+	int fractionDigits = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		if (digits++ >= 16)
+		{
+			return 0;   // more dollars than the cents can hold
+		}
+		cents = cents * 10 + (*p++ - '0');
+	}
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			if (fractionDigits < 2)
+			{
+				cents = cents * 10 + (*p - '0');
+			}
+			else if (fractionDigits == 2 && *p >= '5')
+			{
+				cents++;   // round on the first digit past the cents
+			}
+			fractionDigits++;
+			p++;
+		}
+	}
+	if (digits + fractionDigits == 0)
+	{
+		return 0;
+	}
+
+	for (int scale = fractionDigits; scale < 2; scale++)
+	{
+		cents *= 10;
+	}
+	*value = negative ? -cents : cents;
+	*cursor = p;
+	return 1;
+}
+
+//
+// FUNCTION: parseRow
+// DESCRIPTION:
+//		This function parses one "Country, weight, valuation" row of a manifest.
+// PARAMETERS:
+//		const char* line: the first byte of the row.
+//		const char* end: one past the last byte of the row, without the newline.
+//		ParsedRow* row: the variable where the row will get stored.
+// RETURNS:
+//		const char*: NULL if the row got parsed, else the reason why it is malformed.
+//
+const char* parseRow(const char* line, const char* end, ParsedRow* row)
+{
+	if (end > line && end[-1] == '\r')
+	{
+		end--;   // tolerate CRLF line endings
+	}
+
+	const char* comma = findByte(line, end, ',');
+	if (comma == end)
+	{
+		return "missing comma after the country name";
+	}
+
+	const char* nameEnd = comma;
+	while (nameEnd > line && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t'))
+	{
+		nameEnd--;   // trailing blanks are not part of the name
+	}
+	if (nameEnd == line)
+	{
+		return "empty country name";
+	}
+	if (nameEnd - line > MAX_COUNTRY_NAME_LENGTH)
+	{
+		return "country name too long";
+	}
+
+	const char* cursor = skipBlanks(comma + 1, end);
+	if (!parseInteger(&cursor, end, &row->weight))
+	{
+		return "weight is not a valid integer";
+	}
+	cursor = skipBlanks(cursor, end);
+	if (cursor == end || *cursor != ',')
+	{
+		return "missing comma after the weight";
+	}
+
+	cursor = skipBlanks(cursor + 1, end);
+	if (!parseCents(&cursor, end, &row->valuation))
+	{
+		return "valuation is not a valid number";
+	}
+	if (row->valuation > PARCEL_MAX_VALUATION || row->valuation < -PARCEL_MAX_VALUATION)
+	{
+		return "valuation out of range";
+	}
+	if (skipBlanks(cursor, end) != end)
+	{
+		return "unexpected characters after the valuation";
+	}
+
+	row->country = line;
+	row->countryLength = (unsigned int)(nameEnd - line);
+	return NULL;
+}
+
+//
+// FUNCTION: parseChunk
+// DESCRIPTION:
+//		This function parses every row of one chunk of a manifest, keeping the well formed rows
+//		in file order and remembering the line number of the first malformed ones.
+// PARAMETERS:
+//		ParseChunk* chunk: the chunk to be parsed, its begin and end must already be set.
+// RETURNS:
+//		void: this function does not return a value, it exits on memory allocation failure.
+//
+void parseChunk(ParseChunk* chunk)
+{
+	const char* cursor = chunk->begin;
+
+	while (cursor < chunk->end)
+	{
+		const char* lineEnd = findByte(cursor, chunk->end, '\n');
+		chunk->lineCount++;
+
+		if (skipBlanks(cursor, lineEnd) != lineEnd && !(lineEnd - cursor == 1 && *cursor == '\r'))   // blank lines are ignored
+		{
+			if (chunk->rowCount == chunk->rowCapacity)
+			{
+				size_t capacity = chunk->rowCapacity ? chunk->rowCapacity * 2 : 4096;
+				ParsedRow* rows = (ParsedRow*)realloc(chunk->rows, capacity * sizeof(ParsedRow));
+				if (rows == NULL)
+				{
+					fprintf(stderr, "Error: Memory allocation failed for parsed rows.\n");
+					exit(1);
+				}
+				chunk->rows = rows;
+				chunk->rowCapacity = capacity;
+			}
+
+			const char* reason = parseRow(cursor, lineEnd, &chunk->rows[chunk->rowCount]);
+			if (reason == NULL)
+			{
+				chunk->rowCount++;
+			}
+			else
+			{
+				if (chunk->errorCount < MAX_REPORTED_ROW_ERRORS)
+				{
+					chunk->errors[chunk->errorCount].line = chunk->lineCount;
+					chunk->errors[chunk->errorCount].reason = reason;
+				}
+				chunk->errorCount++;
+			}
+		}
+
+		cursor = lineEnd + 1;   // step over the newline, or past the end on the last line
+	}
+	STAT_ADD(STAT_ROWS_PARSED, chunk->rowCount);
+	STAT_ADD(STAT_ROWS_REJECTED, chunk->errorCount);
+	STAT_ADD(STAT_BYTES_PARSED, (size_t)(chunk->end - chunk->begin));
+}
+
+//
+// FUNCTION: parseManifest
+// DESCRIPTION:
+//		This function splits a manifest held in memory into chunks which start on line
+//		boundaries and parses the chunks in parallel, one thread per chunk. Line numbers of
+//		malformed rows are made file relative once every chunk is done.
+// PARAMETERS:
+//		const char* data: the first byte of the manifest.
+//		size_t size: the size of the manifest in bytes.
+//		int threadCount: the number of threads to use, 0 to use every core.
+//		ParsedManifest* manifest: the variable where the parsed chunks will get stored.
+// RETURNS:
+//		void: this function does not return a value, it exits on memory allocation failure.
+//
+void parseManifest(const char* data, size_t size, int threadCount, ParsedManifest* manifest)
+{
+	memset(manifest, 0, sizeof(*manifest));
+	if (threadCount <= 0)
+	{
+		threadCount = (int)std::thread::hardware_concurrency();
+	}
+	if ((size_t)threadCount > size / PARSE_MIN_CHUNK_BYTES)
+	{
+		threadCount = (int)(size / PARSE_MIN_CHUNK_BYTES);   // small files are not worth the threads
+	}
+	if (threadCount > PARSE_MAX_THREADS)
+	{
+		threadCount = PARSE_MAX_THREADS;
+	}
+	if (threadCount < 1)
+	{
+		threadCount = 1;
+	}
+
+	manifest->chunks = (ParseChunk*)calloc((size_t)threadCount, sizeof(ParseChunk));
+	if (manifest->chunks == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for parse chunks.\n");
+		exit(1);
+	}
+
+	// cut the data into roughly equal chunks, moving every cut forward to the next line start
+	const char* end = data + size;
+	const char* begin = data;
+	for (int i = 0; i < threadCount && begin < end; i++)
+	{
+		const char* cut = i == threadCount - 1 ? end : data + size / threadCount * (i + 1);
+		if (cut < begin)
+		{
+			cut = begin;
+		}
+		if (cut < end)
+		{
+			cut = findByte(cut, end, '\n');
+			cut = cut < end ? cut + 1 : end;
+		}
+		manifest->chunks[manifest->chunkCount].begin = begin;
+		manifest->chunks[manifest->chunkCount].end = cut;
+		manifest->chunkCount++;
+		begin = cut;
+	}
+
+	std::thread workers[PARSE_MAX_THREADS];
+	for (int i = 1; i < manifest->chunkCount; i++)
+	{
+		workers[i] = std::thread(parseChunk, &manifest->chunks[i]);
+	}
+	if (manifest->chunkCount > 0)
+	{
+		parseChunk(&manifest->chunks[0]);   // the calling thread takes the first chunk
+	}
+	for (int i = 1; i < manifest->chunkCount; i++)
+	{
+		workers[i].join();
+	}
+
+	size_t firstLine = 0;
+	for (int i = 0; i < manifest->chunkCount; i++)
+	{
+		ParseChunk* chunk = &manifest->chunks[i];
+		size_t reported = chunk->errorCount < MAX_REPORTED_ROW_ERRORS ? chunk->errorCount : MAX_REPORTED_ROW_ERRORS;
+		for (size_t e = 0; e < reported; e++)
+		{
+			chunk->errors[e].line += firstLine;   // chunk relative to file relative
+		}
+		firstLine += chunk->lineCount;
+		manifest->rowCount += chunk->rowCount;
+		manifest->errorCount += chunk->errorCount;
+	}
+}
+
+//
+// FUNCTION: reportParseErrors
+// DESCRIPTION:
+//		This function prints the malformed rows of a parsed manifest with their line numbers.
+// PARAMETERS:
+//		const ParsedManifest* manifest: the parsed manifest.
+//		const char* filename: the name of the manifest, used in the messages.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void reportParseErrors(const ParsedManifest* manifest, const char* filename)
+{
+	size_t printed = 0;
+
+	for (int i = 0; i < manifest->chunkCount; i++)
+	{
+		const ParseChunk* chunk = &manifest->chunks[i];
+		for (size_t e = 0; e < chunk->errorCount && e < MAX_REPORTED_ROW_ERRORS; e++)
+		{
+			if (printed++ < MAX_REPORTED_ROW_ERRORS)
+			{
+				fprintf(stderr, "Warning: %s:%zu: skipped malformed row, %s\n", filename, chunk->errors[e].line, chunk->errors[e].reason);
+			}
+		}
+	}
+	if (manifest->errorCount > 0)
+	{
+		fprintf(stderr, "Warning: %s: skipped %zu malformed rows out of %zu\n", filename, manifest->errorCount, manifest->errorCount + manifest->rowCount);
+	}
+}
+
+//
+// FUNCTION: freeManifest
+// DESCRIPTION:
+//		This function releases the rows of a parsed manifest.
+// PARAMETERS:
+//		ParsedManifest* manifest: the parsed manifest to be released.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void freeManifest(ParsedManifest* manifest)
+{
+	for (int i = 0; i < manifest->chunkCount; i++)
+	{
+		free(manifest->chunks[i].rows);
+	}
+	free(manifest->chunks);
+	memset(manifest, 0, sizeof(*manifest));
+}
+
+//
+// FUNCTION: sortBulkRows
+// DESCRIPTION:
+//		This function sorts rows by weight with an LSD radix sort over the four bytes of the
+//		weight. The sort is stable, so parcels of equal weight keep their file order, and byte
+//		positions where every row has the same value are skipped.
+// PARAMETERS:
+//		BulkRow* rows: the rows to be sorted in place.
+//		BulkRow* scratch: a buffer of at least count rows.
+//		size_t count: the number of rows.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void sortBulkRows(BulkRow* rows, BulkRow* scratch, size_t count)
+{
+	size_t histogram[4][256];
+	BulkRow* source = rows;
+	BulkRow* target = scratch;
+
+	memset(histogram, 0, sizeof(histogram));
+	for (size_t i = 0; i < count; i++)
+	{
+		unsigned int key = (unsigned int)rows[i].weight ^ 0x80000000u;   // flip the sign bit so negative weights sort first
+		histogram[0][key & 0xFF]++;
+		histogram[1][(key >> 8) & 0xFF]++;
+		histogram[2][(key >> 16) & 0xFF]++;
+		histogram[3][key >> 24]++;
+	}
+
+	for (int pass = 0; pass < 4; pass++)
+	{
+		int shift = pass * 8;
+		size_t offsets[256];
+		size_t total = 0;
+
+		if (histogram[pass][((unsigned int)rows[0].weight ^ 0x80000000u) >> shift & 0xFF] == count)
+		{
+			continue;   // every row has the same byte here, the pass would not move anything
+		}
+		for (int digit = 0; digit < 256; digit++)
+		{
+			offsets[digit] = total;
+			total += histogram[pass][digit];
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			unsigned int key = (unsigned int)source[i].weight ^ 0x80000000u;
+			target[offsets[(key >> shift) & 0xFF]++] = source[i];
+		}
+
+		BulkRow* swap = source;
+		source = target;
+		target = swap;
+	}
+
+	if (source != rows)
+	{
+		memcpy(rows, source, count * sizeof(BulkRow));   // an odd number of passes left the result in the scratch buffer
+	}
+}
+
+//
+// FUNCTION: buildBalancedSubtree
+// DESCRIPTION:
+//		This function links a run of parcels which already sit in weight order in consecutive
+//		arena slots into a perfectly balanced BST, choosing the middle parcel as the root of
+//		every subtree and filling in heights and aggregates bottom-up. The recursion is only
+//		log2(n) deep.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the nodes.
+//		ParcelIndex base: the arena index of the first parcel of the run.
+//		unsigned int first: the position of the first parcel of the subtree in the run.
+//		unsigned int end: the position one past the last parcel of the subtree in the run.
+// RETURNS:
+//		ParcelIndex: the arena index of the root of the subtree, NULL_PARCEL if it is empty.
+//
+ParcelIndex buildBalancedSubtree(const ParcelArena* arena, ParcelIndex base, unsigned int first, unsigned int end)
+{
+	if (first >= end)
+	{
+		return NULL_PARCEL;
+	}
+
+	unsigned int middle = first + (end - first) / 2;
+	ParcelIndex index = base + middle;
+	Parcel* node = getParcel(arena, index);
+
+	node->left = buildBalancedSubtree(arena, base, first, middle);
+	node->right = buildBalancedSubtree(arena, base, middle + 1, end);
+	updateNode(arena, index);   // both children are complete, so the aggregates can be filled in
+	return index;
+}
+
+//
+// FUNCTION: bulkLoadRows
+// DESCRIPTION:
+//		This function loads a parsed manifest in bulk. The rows are partitioned by country with
+//		a stable counting sort, every partition is radix sorted by weight, and the BST of each
+//		country is built bottom-up in linear time over a run of consecutive arena slots. A country
+//		which already has parcels gets the new rows through the incremental insert instead.
+//		Rows are routed by the perfect hash of the country list, so a country is only interned
+//		once, and rows of countries which are not listed are skipped.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store where the rows will be loaded.
+//		const ParsedManifest* manifest: the parsed rows, in file order.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		size_t: the number of rows skipped because their country is not listed, it exits on
+//		memory allocation failure.
+//
+size_t bulkLoadRows(ParcelStore* store, const ParsedManifest* manifest, const CountryList* validCountries)
+{
+	size_t rowCount = manifest->rowCount;
+	size_t filtered = 0;
+	if (rowCount == 0)
+	{
+		return 0;
+	}
+	freeValuationIndex(&store->valuations);   // bulk built trees bypass it, it is rebuilt on the next valuation query
+
+	unsigned short* countryIds = (unsigned short*)malloc(rowCount * sizeof(unsigned short));
+	BulkRow* rows = (BulkRow*)malloc(rowCount * sizeof(BulkRow));
+	BulkRow* scratch = (BulkRow*)malloc(rowCount * sizeof(BulkRow));
+	int* routes = (int*)malloc(((size_t)validCountries->count + 1) * sizeof(int));
+	if (countryIds == NULL || rows == NULL || scratch == NULL || routes == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for bulk load.\n");
+		exit(1);
+	}
+	for (unsigned int i = 0; i < validCountries->count; i++)
+	{
+		routes[i] = -1;   // interned on the first row of the country
+	}
+
+	// route the country of every row, in file order, unlisted rows get the id MAX_COUNTRIES
+	size_t position = 0;
+	for (int i = 0; i < manifest->chunkCount; i++)
+	{
+		const ParseChunk* chunk = &manifest->chunks[i];
+		for (size_t r = 0; r < chunk->rowCount; r++)
+		{
+			int listId = findListedCountry(validCountries, chunk->rows[r].country, chunk->rows[r].countryLength);
+			if (listId == -1)
+			{
+				countryIds[position++] = MAX_COUNTRIES;
+				filtered++;
+				continue;
+			}
+			if (routes[listId] == -1)
+			{
+				routes[listId] = internCountryBytes(&store->catalog, chunk->rows[r].country, chunk->rows[r].countryLength);
+			}
+			countryIds[position++] = (unsigned short)routes[listId];
+		}
+	}
+	STAT_ADD(STAT_ROWS_FILTERED, filtered);
+
+	// count the rows of every country and turn the counts into partition offsets
+	unsigned int countryCount = store->catalog.count;
+	size_t* offsets = (size_t*)calloc((size_t)countryCount + 1, sizeof(size_t));
+	if (offsets == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for bulk load.\n");
+		exit(1);
+	}
+	for (size_t i = 0; i < rowCount; i++)
+	{
+		if (countryIds[i] != MAX_COUNTRIES)
+		{
+			offsets[countryIds[i] + 1]++;
+		}
+	}
+	for (unsigned int id = 0; id < countryCount; id++)
+	{
+		offsets[id + 1] += offsets[id];
+	}
+
+	// scatter the rows into their partitions, keeping file order inside each partition
+	position = 0;
+	for (int i = 0; i < manifest->chunkCount; i++)
+	{
+		const ParseChunk* chunk = &manifest->chunks[i];
+		for (size_t r = 0; r < chunk->rowCount; r++, position++)
+		{
+			if (countryIds[position] == MAX_COUNTRIES)
+			{
+				continue;
+			}
+			BulkRow* row = &scratch[offsets[countryIds[position]]++];
+			row->weight = chunk->rows[r].weight;
+			row->valuation = chunk->rows[r].valuation;
+		}
+	}
+	memcpy(rows, scratch, (rowCount - filtered) * sizeof(BulkRow));
+
+	// every offset now points at the end of its partition
+	size_t begin = 0;
+	for (unsigned int id = 0; id < countryCount; begin = offsets[id++])
+	{
+		size_t count = offsets[id] - begin;
+		if (count == 0)
+		{
+			continue;
+		}
+
+		sortBulkRows(&rows[begin], scratch, count);
+		if (store->catalog.roots[id] != NULL_PARCEL)
+		{
+			for (size_t r = begin; r < offsets[id]; r++)
+			{
+				ParcelIndex newParcel = createParcelForCountry(store, (unsigned short)id, rows[r].weight, rows[r].valuation);
+				insertIntoBst(store, &store->catalog.roots[id], newParcel);   // the country was loaded before
+			}
+			continue;
+		}
+
+		ParcelIndex base = arenaAllocateRange(&store->arena, (unsigned int)count);
+		for (size_t r = 0; r < count; r++)
+		{
+			initParcelNode(store, base + (ParcelIndex)r, (unsigned short)id, rows[begin + r].weight, rows[begin + r].valuation);
+		}
+		store->catalog.roots[id] = buildBalancedSubtree(&store->arena, base, 0, (unsigned int)count);
+		STAT_ADD(STAT_PARCELS_INSERTED, count);
+	}
+
+	free(offsets);
+	free(scratch);
+	free(rows);
+	free(countryIds);
+	free(routes);
+	return filtered;
+}
+
+// 
+// FUNCTION: loadData
+// DESCRIPTION: 
+//		This function loads data from a file into the hash table. The file is memory mapped and
+//		parsed in parallel chunks, then every country's BST is bulk built from its sorted rows.
+// PARAMETERS: 
+//		ParcelStore* store: the parcel store where the data will be loaded.
+//		const char* filename: the name of the file which is containing data.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		size_t: the number of bytes of the file which got loaded.
+//
+size_t loadData(ParcelStore* store, const char* filename, const CountryList* validCountries)
+{
+	STAT_TIME(STAT_OP_LOAD);
+	MappedFile file;
+	if (!mapFile(&file, filename, 0))   // map the file for reading
+	{
+		fprintf(stderr, "Error: Unable to open file %s\n", filename);   // print error message if file can't be opened
+		exit(1);
+	}
+
+	ParsedManifest manifest;
+	parseManifest(file.data, file.size, 0, &manifest);
+	reportParseErrors(&manifest, filename);
+
+	size_t filtered = bulkLoadRows(store, &manifest, validCountries);   // build the hash table from the parsed rows
+	if (filtered > 0)
+	{
+		fprintf(stderr, "Warning: %s: skipped %zu rows of countries which are not listed\n", filename, filtered);
+	}
+
+	freeManifest(&manifest);
+	size_t loaded = file.size;
+	unmapFile(&file);   // release the file after reading all data
+	return loaded;
+}
+
+//
+// FUNCTION: loadDataLazily
+// DESCRIPTION:
+//		This function loads a data file lazily. The file stays mapped and a single pass only
+//		splits it into the row offsets of every country: it finds the end of each line and the
+//		country name in front of the first comma, and routes the name through the perfect hash
+//		of the country list. Weights and valuations are parsed when a query first needs the BST
+//		of a country, so the menu is up after one scan of the file whatever its size.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store where the data will be loaded.
+//		const char* filename: the name of the file which is containing data.
+//		size_t budget: the bytes the built BSTs may take between menu operations, 0 for no limit.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		size_t: the number of bytes of the file, it exits if the file can not be read.
+//
+size_t loadDataLazily(ParcelStore* store, const char* filename, size_t budget, const CountryList* validCountries)
+{
+	STAT_TIME(STAT_OP_LOAD);
+	LazyIndex* lazy = &store->lazy;
+	if (!mapFile(&lazy->file, filename, 0))
+	{
+		fprintf(stderr, "Error: Unable to open file %s\n", filename);
+		exit(1);
+	}
+	lazy->active = 1;
+	lazy->filename = filename;
+	lazy->budget = budget;
+
+	int* routes = (int*)malloc(((size_t)validCountries->count + 1) * sizeof(int));
+	if (routes == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for lazy load.\n");
+		exit(1);
+	}
+	for (unsigned int i = 0; i < validCountries->count; i++)
+	{
+		routes[i] = -1;   // interned on the first row of the country
+	}
+
+	const char* data = lazy->file.data;
+	const char* end = data + lazy->file.size;
+	size_t filtered = 0;
+	size_t rejected = 0;
+	for (const char* cursor = data; cursor < end; )
+	{
+		const char* lineEnd = findByte(cursor, end, '\n');
+		const char* comma = findByte(cursor, lineEnd, ',');
+		const char* nameEnd = comma;
+		while (nameEnd > cursor && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t'))
+		{
+			nameEnd--;
+		}
+
+		if (comma == lineEnd)
+		{
+			rejected += skipBlanks(cursor, lineEnd) != lineEnd && !(lineEnd - cursor == 1 && *cursor == '\r');   // blank lines are ignored
+		}
+		else
+		{
+			int listId = findListedCountry(validCountries, cursor, (size_t)(nameEnd - cursor));
+			if (listId == -1)
+			{
+				filtered++;
+			}
+			else
+			{
+				if (routes[listId] == -1)
+				{
+					routes[listId] = internCountryBytes(&store->catalog, cursor, (size_t)(nameEnd - cursor));
+					if ((unsigned int)routes[listId] >= lazy->capacity)
+					{
+						unsigned int capacity = store->catalog.capacity;
+						LazyCountry* countries = (LazyCountry*)realloc(lazy->countries, capacity * sizeof(LazyCountry));
+						if (countries == NULL)
+						{
+							fprintf(stderr, "Error: Memory allocation failed for lazy load.\n");
+							exit(1);
+						}
+						memset(countries + lazy->capacity, 0, (capacity - lazy->capacity) * sizeof(LazyCountry));
+						lazy->countries = countries;
+						lazy->capacity = capacity;
+					}
+				}
+
+				LazyCountry* country = &lazy->countries[routes[listId]];
+				if (country->count == country->capacity)
+				{
+					size_t capacity = country->capacity ? country->capacity * 2 : 1024;
+					unsigned long long* offsets = (unsigned long long*)realloc(country->offsets, capacity * sizeof(unsigned long long));
+					if (offsets == NULL)
+					{
+						fprintf(stderr, "Error: Memory allocation failed for lazy load.\n");
+						exit(1);
+					}
+					country->offsets = offsets;
+					country->capacity = capacity;
+				}
+				country->offsets[country->count++] = (unsigned long long)(cursor - data);
+			}
+		}
+		cursor = lineEnd + 1;   // step over the newline, or past the end on the last line
+	}
+	STAT_ADD(STAT_ROWS_FILTERED, filtered);
+	STAT_ADD(STAT_ROWS_REJECTED, rejected);
+
+	if (rejected > 0)
+	{
+		fprintf(stderr, "Warning: %s: skipped %zu rows without a comma\n", filename, rejected);
+	}
+	if (filtered > 0)
+	{
+		fprintf(stderr, "Warning: %s: skipped %zu rows of countries which are not listed\n", filename, filtered);
+	}
+	free(routes);
+	return lazy->file.size;
+}
+
+//
+// FUNCTION: buildBalancedSlots
+// DESCRIPTION:
+//		This function links parcels which sit in weight order in the listed arena slots into a
+//		perfectly balanced BST, like buildBalancedSubtree does for a run of consecutive slots.
+//		It lets a lazily built BST reuse the nodes an evicted one gave back to the arena.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the nodes.
+//		const ParcelIndex* slots: the arena index of every parcel, in weight order.
+//		unsigned int first: the position of the first parcel of the subtree.
+//		unsigned int end: the position one past the last parcel of the subtree.
+// RETURNS:
+//		ParcelIndex: the arena index of the root of the subtree, NULL_PARCEL if it is empty.
+//
+ParcelIndex buildBalancedSlots(const ParcelArena* arena, const ParcelIndex* slots, unsigned int first, unsigned int end)
+{
+	if (first >= end)
+	{
+		return NULL_PARCEL;
+	}
+
+	unsigned int middle = first + (end - first) / 2;
+	Parcel* node = getParcel(arena, slots[middle]);
+
+	node->left = buildBalancedSlots(arena, slots, first, middle);
+	node->right = buildBalancedSlots(arena, slots, middle + 1, end);
+	updateNode(arena, slots[middle]);
+	return slots[middle];
+}
+
+//
+// FUNCTION: materializeCountry
+// DESCRIPTION:
+//		This function builds the BST of a country of a lazily loaded store if it is not built,
+//		and marks it as the most recently used one. The rows are parsed from the mapped file,
+//		radix sorted by weight and bulk built like loadData does, taking nodes from the arena
+//		free list first. Nothing is evicted here, so parcels a query holds stay valid until
+//		trimLazyIndex runs after it.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		int countryId: the interned id of the country.
+// RETURNS:
+//		ParcelIndex: the arena index of the root of the BST, NULL_PARCEL if the country has no parcels.
+//
+ParcelIndex materializeCountry(ParcelStore* store, int countryId)
+{
+	LazyIndex* lazy = &store->lazy;
+	LazyCountry* country = &lazy->countries[countryId];
+
+	country->lastUsed = ++lazy->clock;
+	if (country->built || country->count == 0)
+	{
+		return store->catalog.roots[countryId];
+	}
+
+	STAT_TIME(STAT_OP_MATERIALIZE);
+	BulkRow* rows = (BulkRow*)malloc(country->count * sizeof(BulkRow));
+	BulkRow* scratch = (BulkRow*)malloc(country->count * sizeof(BulkRow));
+	ParcelIndex* slots = (ParcelIndex*)malloc(country->count * sizeof(ParcelIndex));
+	if (rows == NULL || scratch == NULL || slots == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for lazy load.\n");
+		exit(1);
+	}
+
+	const char* end = lazy->file.data + lazy->file.size;
+	size_t kept = 0;
+	for (size_t i = 0; i < country->count; i++)
+	{
+		const char* line = lazy->file.data + country->offsets[i];
+		ParsedRow row;
+		if (parseRow(line, findByte(line, end, '\n'), &row) == NULL)
+		{
+			rows[kept].weight = row.weight;
+			rows[kept].valuation = row.valuation;
+			kept++;
+		}
+	}
+	STAT_ADD(STAT_ROWS_PARSED, kept);
+	STAT_ADD(STAT_ROWS_REJECTED, country->count - kept);
+	if (kept < country->count)
+	{
+		fprintf(stderr, "Warning: %s: skipped %zu malformed rows of %s\n", lazy->filename, country->count - kept, store->catalog.names[countryId]);
+	}
+
+	if (kept > 0)
+	{
+		sortBulkRows(rows, scratch, kept);
+		size_t reused = store->arena.freeCount < kept ? store->arena.freeCount : kept;
+		for (size_t r = 0; r < reused; r++)
+		{
+			slots[r] = arenaAllocate(&store->arena);   // nodes of evicted BSTs
+		}
+		if (kept > reused)
+		{
+			ParcelIndex base = arenaAllocateRange(&store->arena, (unsigned int)(kept - reused));
+			for (size_t r = reused; r < kept; r++)
+			{
+				slots[r] = base + (ParcelIndex)(r - reused);
+			}
+		}
+		for (size_t r = 0; r < kept; r++)
+		{
+			initParcelNode(store, slots[r], (unsigned short)countryId, rows[r].weight, rows[r].valuation);
+		}
+		store->catalog.roots[countryId] = buildBalancedSlots(&store->arena, slots, 0, (unsigned int)kept);
+		STAT_ADD(STAT_PARCELS_INSERTED, kept);
+		freeValuationIndex(&store->valuations);   // bulk built trees bypass it, it is rebuilt on the next valuation query
+		markSketchesStale(store, (unsigned short)countryId);
+	}
+
+	country->built = 1;
+	country->bytes = kept * sizeof(Parcel);
+	lazy->used += country->bytes;
+	lazy->builds++;
+	free(slots);
+	free(scratch);
+	free(rows);
+	return store->catalog.roots[countryId];
+}
+
+//
+// FUNCTION: materializeAllCountries
+// DESCRIPTION:
+//		This function builds the BST of every country of a lazily loaded store, for the
+//		operations which read every country or which share the store between threads.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+// RETURNS:
+//		void: this function does not return a value, it does nothing for a store loaded in full.
+//
+void materializeAllCountries(ParcelStore* store)
+{
+	for (unsigned int id = 0; store->lazy.active && id < store->catalog.count; id++)
+	{
+		materializeCountry(store, (int)id);
+	}
+}
+
+//
+// FUNCTION: loadCountryRoot
+// DESCRIPTION:
+//		This function looks up the BST of a country like findCountryRoot, building it first when
+//		the store is loaded lazily.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		const char* country: the name of the country.
+// RETURNS:
+//		ParcelIndex: the arena index of the root of the BST, NULL_PARCEL if the country has no parcels.
+//
+ParcelIndex loadCountryRoot(ParcelStore* store, const char* country)
+{
+	int id = findCountryId(&store->catalog, country);
+	if (id == -1)
+	{
+		return NULL_PARCEL;
+	}
+	return store->lazy.active ? materializeCountry(store, id) : store->catalog.roots[id];
+}
+
+//
+// FUNCTION: evictCountry
+// DESCRIPTION:
+//		This function drops the BST of a lazily loaded country, giving its nodes back to the arena
+//		and dropping the indexes derived from it. Its row offsets stay, so the next query which
+//		needs it builds it again.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		int countryId: the interned id of the country.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void evictCountry(ParcelStore* store, int countryId)
+{
+	LazyCountry* country = &store->lazy.countries[countryId];
+	ParcelIndex stack[AVL_MAX_HEIGHT + 1];
+	int top = 0;
+
+	if (store->catalog.roots[countryId] != NULL_PARCEL)
+	{
+		stack[top++] = store->catalog.roots[countryId];
+	}
+	while (top > 0)
+	{
+		ParcelIndex index = stack[--top];
+		const Parcel* node = getParcel(&store->arena, index);
+		if (node->right != NULL_PARCEL)
+		{
+			stack[top++] = node->right;
+		}
+		if (node->left != NULL_PARCEL)
+		{
+			stack[top++] = node->left;   // taken next, so the stack never holds more than a path and its right siblings
+		}
+		arenaRelease(&store->arena, index);   // overwrites left, which is already on the stack
+	}
+
+	store->catalog.roots[countryId] = NULL_PARCEL;
+	store->catalog.parcelCounts[countryId] = 0;
+	dropCountryBoxes(store, (unsigned short)countryId);
+	dropCountryColumns(store, (unsigned short)countryId);
+	markSketchesStale(store, (unsigned short)countryId);
+	freeValuationIndex(&store->valuations);
+	store->lazy.used -= country->bytes;
+	country->bytes = 0;
+	country->built = 0;
+	store->lazy.evictions++;
+}
+
+//
+// FUNCTION: trimLazyIndex
+// DESCRIPTION:
+//		This function evicts the least recently used BSTs of a lazily loaded store until the
+//		built ones fit the memory budget again. The BST used last and BSTs with removed or
+//		re-weighed parcels are kept, whatever the budget.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void trimLazyIndex(ParcelStore* store)
+{
+	LazyIndex* lazy = &store->lazy;
+
+	while (lazy->active && lazy->budget > 0 && lazy->used > lazy->budget)
+	{
+		int oldest = -1;
+		for (unsigned int id = 0; id < store->catalog.count; id++)
+		{
+			const LazyCountry* country = &lazy->countries[id];
+			if (country->built && !country->pinned && country->lastUsed < lazy->clock
+				&& (oldest == -1 || country->lastUsed < lazy->countries[oldest].lastUsed))
+			{
+				oldest = (int)id;
+			}
+		}
+		if (oldest == -1)
+		{
+			return;   // everything left is in use or pinned
+		}
+		evictCountry(store, oldest);
+	}
+}
+
+//
+// FUNCTION: freeLazyIndex
+// DESCRIPTION:
+//		This function frees the row offsets of a lazily loaded store and unmaps its data file.
+// PARAMETERS:
+//		LazyIndex* lazy: the lazy index.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void freeLazyIndex(LazyIndex* lazy)
+{
+	for (unsigned int id = 0; id < lazy->capacity; id++)
+	{
+		free(lazy->countries[id].offsets);
+	}
+	free(lazy->countries);
+	if (lazy->active)
+	{
+		unmapFile(&lazy->file);
+	}
+	memset(lazy, 0, sizeof(*lazy));
+}
+
+//
+// FUNCTION: addFileName
+// DESCRIPTION:
+//		This function appends a copy of a file name to a file list.
+// PARAMETERS:
+//		FileList* files: the file list.
+//		const char* name: the file name to be added.
+// RETURNS:
+//		void: this function does not return a value, it exits on memory allocation failure.
+//
+void addFileName(FileList* files, const char* name)
+{
+	if (files->count == files->capacity)
+	{
+		size_t capacity = files->capacity == 0 ? 8 : files->capacity * 2;
+		char** names = (char**)realloc(files->names, capacity * sizeof(char*));
+		if (names == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for file list.\n");
+			exit(1);
+		}
+		files->names = names;
+		files->capacity = capacity;
+	}
+	char* copy = (char*)malloc(strlen(name) + 1);
+	if (copy == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for file list.\n");
+		exit(1);
+	}
+	strcpy(copy, name);
+	files->names[files->count++] = copy;
+}
+
+//
+// FUNCTION: compareFileNames
+// DESCRIPTION:
+//		This function is the comparator of qsort to order the matches of a file pattern by name.
+// PARAMETERS:
+//		const void* a: pointer to the first file name.
+//		const void* b: pointer to the second file name.
+// RETURNS:
+//		int: negative, zero or positive as the first name sorts before, with or after the second.
+//
+int compareFileNames(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+//
+// FUNCTION: expandFilePattern
+// DESCRIPTION:
+//		This function adds the data files named by a command line argument to a file list. An
+//		argument with wildcards is expanded, its matches are added in name order so the load
+//		order does not depend on the directory, any other argument is added as it is.
+// PARAMETERS:
+//		FileList* files: the file list.
+//		const char* pattern: the file name or wildcard pattern.
+// RETURNS:
+//		int: 1 when at least one file was added, 0 when the pattern matches no file.
+//
+int expandFilePattern(FileList* files, const char* pattern)
+{
+	if (strpbrk(pattern, "*?[") == NULL)
+	{
+		addFileName(files, pattern);   // a plain name, a missing file is reported when it is loaded
+		return 1;
+	}
+
+	size_t first = files->count;
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE search = FindFirstFileA(pattern, &found);
+	if (search != INVALID_HANDLE_VALUE)
+	{
+		const char* slash = strrchr(pattern, '\\');
+		const char* forward = strrchr(pattern, '/');
+		size_t directory = slash == NULL && forward == NULL ? 0 : (size_t)((slash > forward ? slash : forward) - pattern) + 1;
+		char path[MAX_PATH];
+		do
+		{
+			if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			{
+				snprintf(path, sizeof(path), "%.*s%s", (int)directory, pattern, found.cFileName);   // the matches carry no directory
+				addFileName(files, path);
+			}
+		} while (FindNextFileA(search, &found));
+		FindClose(search);
+	}
+#else
+	glob_t matches;
+	if (glob(pattern, 0, NULL, &matches) == 0)
+	{
+		for (size_t i = 0; i < matches.gl_pathc; i++)
+		{
+			addFileName(files, matches.gl_pathv[i]);
+		}
+		globfree(&matches);
+	}
+#endif
+	if (files->count == first)
+	{
+		fprintf(stderr, "Error: No data file matches %s\n", pattern);
+		return 0;
+	}
+	qsort(&files->names[first], files->count - first, sizeof(char*), compareFileNames);
+	return 1;
+}
+
+//
+// FUNCTION: freeFileList
+// DESCRIPTION:
+//		This function frees the names of a file list.
+// PARAMETERS:
+//		FileList* files: the file list.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void freeFileList(FileList* files)
+{
+	for (size_t i = 0; i < files->count; i++)
+	{
+		free(files->names[i]);
+	}
+	free(files->names);
+	files->names = NULL;
+	files->count = files->capacity = 0;
+}
+
+//
+// FUNCTION: loadShardRuns
+// DESCRIPTION:
+//		This function loads one data file of a sharded ingest into sorted runs, without touching
+//		the store: the rows are routed by the perfect hash of the country list, partitioned by
+//		country with a stable counting sort and every partition is radix sorted by weight, so each
+//		run keeps the file order of equal weights.
+// PARAMETERS:
+//		ShardRuns* shard: the file to be loaded, its filename set.
+//		const CountryList* validCountries: the list of valid countries.
+//		int parseThreads: the number of threads the file is parsed with.
+// RETURNS:
+//		void: this function does not return a value, it exits on memory allocation failure.
+//
+void loadShardRuns(ShardRuns* shard, const CountryList* validCountries, int parseThreads)
+{
+	MappedFile file;
+	ParsedManifest manifest;
+	unsigned int listCount = validCountries->count;
+
+	shard->offsets = (size_t*)calloc((size_t)listCount + 1, sizeof(size_t));
+	shard->firstRows = (size_t*)malloc(((size_t)listCount + 1) * sizeof(size_t));
+	if (shard->offsets == NULL || shard->firstRows == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for bulk load.\n");
+		exit(1);
+	}
+	for (unsigned int i = 0; i < listCount; i++)
+	{
+		shard->firstRows[i] = SIZE_MAX;
+	}
+	if (!mapFile(&file, shard->filename, 0))
+	{
+		fprintf(stderr, "Error: Unable to open file %s\n", shard->filename);
+		shard->failed = 1;
+		return;
+	}
+	parseManifest(file.data, file.size, parseThreads, &manifest);
+	reportParseErrors(&manifest, shard->filename);
+
+	size_t rowCount = manifest.rowCount;
+	int* listIds = (int*)malloc((rowCount + 1) * sizeof(int));
+	shard->rows = (BulkRow*)malloc((rowCount + 1) * sizeof(BulkRow));
+	BulkRow* scratch = (BulkRow*)malloc((rowCount + 1) * sizeof(BulkRow));
+	if (listIds == NULL || shard->rows == NULL || scratch == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for bulk load.\n");
+		exit(1);
+	}
+
+	// route every row and count the rows of every listed country
+	size_t position = 0;
+	for (int i = 0; i < manifest.chunkCount; i++)
+	{
+		const ParseChunk* chunk = &manifest.chunks[i];
+		for (size_t r = 0; r < chunk->rowCount; r++, position++)
+		{
+			int listId = findListedCountry(validCountries, chunk->rows[r].country, chunk->rows[r].countryLength);
+			listIds[position] = listId;
+			if (listId == -1)
+			{
+				shard->filtered++;
+				continue;
+			}
+			if (shard->firstRows[listId] == SIZE_MAX)
+			{
+				shard->firstRows[listId] = position;
+			}
+			shard->offsets[listId + 1]++;
+		}
+	}
+	for (unsigned int i = 0; i < listCount; i++)
+	{
+		shard->offsets[i + 1] += shard->offsets[i];
+	}
+
+	// scatter the rows into their runs in file order, then sort every run by weight
+	position = 0;
+	for (int i = 0; i < manifest.chunkCount; i++)
+	{
+		const ParseChunk* chunk = &manifest.chunks[i];
+		for (size_t r = 0; r < chunk->rowCount; r++, position++)
+		{
+			if (listIds[position] != -1)
+			{
+				BulkRow* row = &shard->rows[shard->offsets[listIds[position]]++];
+				row->weight = chunk->rows[r].weight;
+				row->valuation = chunk->rows[r].valuation;
+			}
+		}
+	}
+	for (unsigned int i = listCount; i > 0; i--)
+	{
+		shard->offsets[i] = shard->offsets[i - 1];   // every offset pointed at the end of its run, shift them back to the starts
+	}
+	shard->offsets[0] = 0;
+	for (unsigned int i = 0; i < listCount; i++)
+	{
+		sortBulkRows(&shard->rows[shard->offsets[i]], scratch, shard->offsets[i + 1] - shard->offsets[i]);
+	}
+
+	free(scratch);
+	free(listIds);
+	freeManifest(&manifest);
+	shard->bytes = file.size;
+	unmapFile(&file);
+}
+
+//
+// FUNCTION: shardHeadBefore
+// DESCRIPTION:
+//		This function orders the current rows of two runs of one country during the merge: the
+//		lighter row goes first and on equal weights the run of the earlier file, which keeps the
+//		merge stable.
+// PARAMETERS:
+//		const ShardedIngest* ingest: the loaded runs.
+//		const size_t* heads: the position of the current row of every run.
+//		size_t first: the index of the file of one run.
+//		size_t second: the index of the file of the other run.
+// RETURNS:
+//		int: returns 1 if the row of the first run goes before the row of the second else 0.
+//
+static inline int shardHeadBefore(const ShardedIngest* ingest, const size_t* heads, size_t first, size_t second)
+{
+	int firstWeight = ingest->shards[first].rows[heads[first]].weight;
+	int secondWeight = ingest->shards[second].rows[heads[second]].weight;
+	return firstWeight < secondWeight || (firstWeight == secondWeight && first < second);
+}
+
+//
+// FUNCTION: siftShardHead
+// DESCRIPTION:
+//		This function moves a run down the min-heap of the merge until both of its children come
+//		after it, so the heap root is always the run with the next row.
+// PARAMETERS:
+//		const ShardedIngest* ingest: the loaded runs.
+//		const size_t* heads: the position of the current row of every run.
+//		size_t* heap: the file indexes of the runs which still have rows, in heap order.
+//		size_t heapCount: the number of runs in the heap.
+//		size_t position: the heap position of the run to be moved down.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void siftShardHead(const ShardedIngest* ingest, const size_t* heads, size_t* heap, size_t heapCount, size_t position)
+{
+	size_t shard = heap[position];
+	while (2 * position + 1 < heapCount)
+	{
+		size_t child = 2 * position + 1;
+		if (child + 1 < heapCount && shardHeadBefore(ingest, heads, heap[child + 1], heap[child]))
+		{
+			child++;
+		}
+		if (!shardHeadBefore(ingest, heads, heap[child], shard))
+		{
+			break;
+		}
+		heap[position] = heap[child];
+		position = child;
+	}
+	heap[position] = shard;
+}
+
+//
+// FUNCTION: runShardWorker
+// DESCRIPTION:
+//		This function is run by every thread of a sharded ingest: it loads data files into sorted
+//		runs until none is left, then merges the runs of one country after another into the arena.
+//		The merge of the runs is stable, the runs of earlier files go first on equal weights, so
+//		the trees come out exactly as if the files had been loaded as one. A min-heap over the
+//		current row of every run picks the next row in O(log k) for k files.
+// PARAMETERS:
+//		ShardedIngest* ingest: the work shared by the threads.
+//		int mergePhase: 0 to load the files, 1 to merge the runs.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void runShardWorker(ShardedIngest* ingest, int mergePhase)
+{
+	if (!mergePhase)
+	{
+		size_t shard;
+		while ((shard = ingest->nextShard.fetch_add(1)) < ingest->shardCount)
+		{
+			loadShardRuns(&ingest->shards[shard], ingest->validCountries, ingest->parseThreads);
+		}
+		return;
+	}
+
+	ParcelStore* store = ingest->store;
+	size_t* heads = (size_t*)malloc(ingest->shardCount * sizeof(size_t));
+	size_t* heap = (size_t*)malloc(ingest->shardCount * sizeof(size_t));
+	if (heads == NULL || heap == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for bulk load.\n");
+		exit(1);
+	}
+	unsigned int listId;
+	while ((listId = ingest->nextCountry.fetch_add(1)) < ingest->validCountries->count)
+	{
+		ParcelIndex base = ingest->bases[listId];
+		if (base == NULL_PARCEL)
+		{
+			continue;
+		}
+
+		unsigned short countryId = (unsigned short)ingest->routes[listId];
+		ParcelIndex next = base;
+		size_t heapCount = 0;
+		for (size_t s = 0; s < ingest->shardCount; s++)
+		{
+			const ShardRuns* shard = &ingest->shards[s];
+			if (!shard->failed && shard->offsets[listId] < shard->offsets[listId + 1])
+			{
+				heads[s] = shard->offsets[listId];
+				heap[heapCount++] = s;   // only the runs with rows take part in the merge
+			}
+		}
+		for (size_t position = heapCount / 2; position > 0; position--)
+		{
+			siftShardHead(ingest, heads, heap, heapCount, position - 1);
+		}
+		while (heapCount > 0)
+		{
+			size_t from = heap[0];
+			const ShardRuns* shard = &ingest->shards[from];
+			const BulkRow* lightest = &shard->rows[heads[from]];
+			initParcelNode(store, next++, countryId, lightest->weight, lightest->valuation);
+			if (++heads[from] == shard->offsets[listId + 1])
+			{
+				heap[0] = heap[--heapCount];   // the run is used up, the last run of the heap takes its place
+			}
+			siftShardHead(ingest, heads, heap, heapCount, 0);
+		}
+		store->catalog.roots[countryId] = buildBalancedSubtree(&store->arena, base, 0, next - base);
+		STAT_ADD(STAT_PARCELS_INSERTED, next - base);
+	}
+	free(heap);
+	free(heads);
+}
+
+//
+// FUNCTION: loadDataFiles
+// DESCRIPTION:
+//		This function loads several data files at once. Every file is parsed and sorted into
+//		per-country runs on its own thread, then the runs of each country are merged straight
+//		into a consecutive range of arena slots and its BST is built bottom-up, the countries
+//		again spread over the threads. Countries are interned in the order they first appear in
+//		the files, so the store is the same as after loading the files one after the other.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store where the data will be loaded.
+//		const FileList* files: the data files, in load order.
+//		int threadCount: the number of threads to use, 0 to use every core.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		size_t: the number of bytes of all files which got loaded, it exits if a file cannot be opened.
+//
+size_t loadDataFiles(ParcelStore* store, const FileList* files, int threadCount, const CountryList* validCountries)
+{
+	STAT_TIME(STAT_OP_LOAD);
+	ShardedIngest* ingest = new ShardedIngest;
+	unsigned int listCount = validCountries->count;
+	size_t loaded = 0;
+	int failed = 0;
+
+	if (threadCount <= 0)
+	{
+		threadCount = (int)std::thread::hardware_concurrency();
+	}
+	threadCount = threadCount < 1 ? 1 : threadCount > PARSE_MAX_THREADS ? PARSE_MAX_THREADS : threadCount;
+	ingest->store = store;
+	ingest->validCountries = validCountries;
+	ingest->shardCount = files->count;
+	ingest->shards = (ShardRuns*)calloc(files->count + 1, sizeof(ShardRuns));
+	ingest->routes = (int*)malloc(((size_t)listCount + 1) * sizeof(int));
+	ingest->bases = (ParcelIndex*)calloc((size_t)listCount + 1, sizeof(ParcelIndex));
+	if (ingest->shards == NULL || ingest->routes == NULL || ingest->bases == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for bulk load.\n");
+		exit(1);
+	}
+	for (size_t s = 0; s < files->count; s++)
+	{
+		ingest->shards[s].filename = files->names[s];
+	}
+	ingest->parseThreads = files->count >= (size_t)threadCount ? 1 : threadCount / (int)files->count;   // spare cores parse inside the files
+	ingest->nextShard = 0;
+	ingest->nextCountry = 0;
+	freeValuationIndex(&store->valuations);   // bulk built trees bypass it, it is rebuilt on the next valuation query
+
+	std::thread workers[PARSE_MAX_THREADS];
+	int fileThreads = (size_t)threadCount < files->count ? threadCount : (int)files->count;
+	for (int i = 1; i < fileThreads; i++)
+	{
+		workers[i] = std::thread(runShardWorker, ingest, 0);
+	}
+	runShardWorker(ingest, 0);   // the calling thread loads files too
+	for (int i = 1; i < fileThreads; i++)
+	{
+		workers[i].join();
+	}
+
+	// intern the countries in order of first appearance and hand every new one its arena slots
+	for (size_t s = 0; s < files->count; s++)
+	{
+		const ShardRuns* shard = &ingest->shards[s];
+		failed |= shard->failed;
+		loaded += shard->bytes;
+		if (shard->filtered > 0)
+		{
+			fprintf(stderr, "Warning: %s: skipped %zu rows of countries which are not listed\n", shard->filename, shard->filtered);
+		}
+		STAT_ADD(STAT_ROWS_FILTERED, shard->filtered);
+	}
+	if (failed)
+	{
+		exit(1);   // like loadData, a missing file stops the program
+	}
+	for (unsigned int i = 0; i < listCount; i++)
+	{
+		ingest->routes[i] = -1;
+	}
+	for (size_t s = 0; s < files->count; s++)
+	{
+		const ShardRuns* shard = &ingest->shards[s];
+		while (1)
+		{
+			int first = -1;
+			for (unsigned int i = 0; i < listCount; i++)
+			{
+				if (ingest->routes[i] == -1 && shard->firstRows[i] != SIZE_MAX && (first == -1 || shard->firstRows[i] < shard->firstRows[first]))
+				{
+					first = (int)i;
+				}
+			}
+			if (first == -1)
+			{
+				break;
+			}
+			ingest->routes[first] = internCountryBytes(&store->catalog, validCountries->names[first], validCountries->lengths[first]);
+		}
+	}
+	for (unsigned int i = 0; i < listCount; i++)
+	{
+		size_t count = 0;
+		for (size_t s = 0; s < files->count; s++)
+		{
+			count += ingest->shards[s].offsets[i + 1] - ingest->shards[s].offsets[i];
+		}
+		if (count == 0)
+		{
+			continue;
+		}
+		if (store->catalog.roots[ingest->routes[i]] != NULL_PARCEL)
+		{
+			for (size_t s = 0; s < files->count; s++)   // the country was loaded before, its rows go in one by one
+			{
+				const ShardRuns* shard = &ingest->shards[s];
+				for (size_t r = shard->offsets[i]; r < shard->offsets[i + 1]; r++)
+				{
+					ParcelIndex newParcel = createParcelForCountry(store, (unsigned short)ingest->routes[i], shard->rows[r].weight, shard->rows[r].valuation);
+					insertIntoBst(store, &store->catalog.roots[ingest->routes[i]], newParcel);
+				}
+			}
+			continue;
+		}
+		ingest->bases[i] = arenaAllocateRange(&store->arena, (unsigned int)count);
+	}
+
+	int mergeThreads = (unsigned int)threadCount < listCount ? threadCount : (int)listCount;
+	for (int i = 1; i < mergeThreads; i++)
+	{
+		workers[i] = std::thread(runShardWorker, ingest, 1);
+	}
+	runShardWorker(ingest, 1);
+	for (int i = 1; i < mergeThreads; i++)
+	{
+		workers[i].join();
+	}
+
+	for (size_t s = 0; s < files->count; s++)
+	{
+		free(ingest->shards[s].rows);
+		free(ingest->shards[s].offsets);
+		free(ingest->shards[s].firstRows);
+	}
+	free(ingest->shards);
+	free(ingest->routes);
+	free(ingest->bases);
+	delete ingest;
+	return loaded;
+}
+
+//
+// FUNCTION: checksumBytes
+// DESCRIPTION:
+//		This function folds a block of bytes into a 64-bit checksum, eight bytes at a time.
+//		Blocks whose size is a multiple of eight can be chained through the seed.
+// PARAMETERS:
+//		const void* data: the first byte of the block.
+//		size_t size: the number of bytes in the block.
+//		unsigned long long seed: the checksum of the preceding blocks, or SNAPSHOT_CHECKSUM_SEED.
+// RETURNS:
+//		unsigned long long: the checksum including this block.
+//
+unsigned long long checksumBytes(const void* data, size_t size, unsigned long long seed)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	unsigned long long checksum = seed;
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, bytes + i, sizeof(word));
+		checksum = (checksum ^ word) * 0x100000001b3ULL;
+		checksum ^= checksum >> 29;
+	}
+	for (; i < size; i++)
+	{
+		checksum = (checksum ^ bytes[i]) * 0x100000001b3ULL;
+	}
+	return checksum;
+}
+
+//
+// FUNCTION: getSourceStamp
+// DESCRIPTION:
+//		This function reads the size and last modification time of a source file, which are
+//		recorded in the snapshot to tell whether the snapshot is still current.
+// PARAMETERS:
+//		const char* filename: the name of the source file.
+//		unsigned long long* size: the variable where the size of the file will get stored.
+//		unsigned long long* modified: the variable where the modification time will get stored.
+// RETURNS:
+//		int: returns 1 if the file exists else 0.
+//
+int getSourceStamp(const char* filename, unsigned long long* size, unsigned long long* modified)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &info))
+	{
+		return 0;
+	}
+	*size = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	*modified = ((unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat info;
+	if (stat(filename, &info) != 0)
+	{
+		return 0;
+	}
+	*size = (unsigned long long)info.st_size;
+	*modified = (unsigned long long)info.st_mtime * 1000000000ULL;
+#if defined(__linux__) || defined(__APPLE__)
+#ifdef __APPLE__
+	*modified += (unsigned long long)info.st_mtimespec.tv_nsec;
+#else
+	*modified += (unsigned long long)info.st_mtim.tv_nsec;
+#endif
+#endif
+#endif
+	return 1;
+}
+
+// the padding of a node which stageSnapshotParcels zeroes, update both together whenever a field of Parcel changes
+static_assert(offsetof(Parcel, height) + sizeof(unsigned char) == 23 && offsetof(Parcel, subtree) == 24
+	&& offsetof(ParcelAggregate, mostExpensive) + sizeof(ParcelIndex) == 36 && sizeof(ParcelAggregate) == 40
+	&& sizeof(Parcel) == offsetof(Parcel, subtree) + sizeof(ParcelAggregate), "the snapshot staging no longer matches the Parcel layout");
+
+//
+// FUNCTION: stageSnapshotParcels
+// DESCRIPTION:
+//		This function copies a run of arena slots into a buffer and zeroes what is not parcel
+//		data: the unused slot 0 and the padding of every node. The same index then always gives
+//		the same file and the checksums only cover defined bytes.
+// PARAMETERS:
+//		const ParcelArena* arena: the arena which owns the nodes.
+//		ParcelIndex first: the arena index of the first slot, the start of a slab.
+//		unsigned int count: the number of slots, at most one slab.
+//		Parcel* staging: a buffer of at least count nodes.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void stageSnapshotParcels(const ParcelArena* arena, ParcelIndex first, unsigned int count, Parcel* staging)
+{
+	memcpy(staging, getParcel(arena, first), count * sizeof(Parcel));   // a slab is contiguous
+	if (first == 0)
+	{
+		memset(&staging[0], 0, sizeof(Parcel));   // slot 0 is reserved for NULL_PARCEL and never written
+	}
+	for (unsigned int i = 0; i < count; i++)
+	{
+		unsigned char* node = (unsigned char*)&staging[i];
+		memset(node + offsetof(Parcel, height) + sizeof(unsigned char), 0, offsetof(Parcel, subtree) - offsetof(Parcel, height) - sizeof(unsigned char));
+		memset(node + offsetof(Parcel, subtree) + offsetof(ParcelAggregate, mostExpensive) + sizeof(ParcelIndex), 0,
+			sizeof(ParcelAggregate) - offsetof(ParcelAggregate, mostExpensive) - sizeof(ParcelIndex));
+	}
+}
+
+//
+// FUNCTION: writeSnapshot
+// DESCRIPTION:
+//		This function writes the built index to a binary snapshot: a header, the country
+//		directory with the interned names, and the parcel nodes in their arena layout, aggregates
+//		included. Every slab goes through a staging buffer which zeroes slot 0 and the padding, and
+//		is summed as it is written; the header is written again at the end with the checksums. The
+//		file is written under a temporary name and then renamed, so a reader never sees half a
+//		snapshot.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store to be saved.
+//		const char* snapshotPath: the name of the snapshot file.
+//		unsigned long long sourceSize: the size of the text file the index was built from.
+//		unsigned long long sourceModified: the modification time of that text file.
+//		const CountryList* validCountries: the list of valid countries the rows were filtered with.
+// RETURNS:
+//		int: returns 1 if the snapshot got written else 0.
+//
+int writeSnapshot(const ParcelStore* store, const char* snapshotPath, unsigned long long sourceSize, unsigned long long sourceModified,
+	const CountryList* validCountries)
+{
+	const CountryCatalog* catalog = &store->catalog;
+	SnapshotHeader header;
+	size_t directoryBytes = catalog->count * sizeof(SnapshotCountry) + catalog->nameBytes;
+	unsigned char* directory = (unsigned char*)calloc(1, directoryBytes + 1);
+	Parcel* staging = (Parcel*)malloc(ARENA_CHUNK_SIZE * sizeof(Parcel));   // one slab at a time, padding zeroed
+	if (directory == NULL || staging == NULL)
+	{
+		free(directory);
+		free(staging);
+		return 0;
+	}
+
+	// the directory entries come first, followed by the names they point at
+	SnapshotCountry* entries = (SnapshotCountry*)directory;
+	size_t nameOffset = catalog->count * sizeof(SnapshotCountry);
+	for (unsigned int id = 0; id < catalog->count; id++)
+	{
+		size_t length = strlen(catalog->names[id]);
+		entries[id].root = catalog->roots[id];
+		entries[id].parcelCount = catalog->parcelCounts[id];
+		entries[id].nameOffset = (unsigned int)nameOffset;
+		entries[id].nameLength = (unsigned int)length;
+		memcpy(directory + nameOffset, catalog->names[id], length);
+		nameOffset += length;
+	}
+	directoryBytes = nameOffset;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byteOrder = SNAPSHOT_BYTE_ORDER;
+	header.parcelSize = sizeof(Parcel);
+	header.countryCount = catalog->count;
+	header.parcelCount = store->arena.nextIndex;
+	header.freeList = store->arena.freeList;
+	header.freeCount = store->arena.freeCount;
+	header.countryListHash = (unsigned int)validCountries->checksum;
+	header.sourceSize = sourceSize;
+	header.sourceModified = sourceModified;
+	header.directoryOffset = sizeof(SnapshotHeader);
+	header.directoryBytes = directoryBytes;
+	header.parcelOffset = (header.directoryOffset + directoryBytes + SNAPSHOT_ALIGNMENT - 1) & ~(unsigned long long)(SNAPSHOT_ALIGNMENT - 1);
+	header.directoryChecksum = checksumBytes(directory, directoryBytes, SNAPSHOT_CHECKSUM_SEED);
+	header.parcelChecksum = SNAPSHOT_CHECKSUM_SEED;   // accumulated over the staged slabs as they are written
+
+	size_t pathLength = strlen(snapshotPath);
+	char* temporaryPath = (char*)malloc(pathLength + 5);
+	FILE* file = NULL;
+	if (temporaryPath == NULL)
+	{
+		free(directory);
+		free(staging);
+		return 0;
+	}
+	snprintf(temporaryPath, pathLength + 5, "%s.tmp", snapshotPath);
+
+	int written = fopen_s(&file, temporaryPath, "wb") == 0 && file != NULL;
+	if (written)
+	{
+		static const unsigned char padding[SNAPSHOT_ALIGNMENT] = { 0 };
+		written = fwrite(&header, sizeof(header), 1, file) == 1
+			&& fwrite(directory, 1, directoryBytes, file) == directoryBytes
+			&& fwrite(padding, 1, (size_t)(header.parcelOffset - header.directoryOffset - directoryBytes), file) == header.parcelOffset - header.directoryOffset - directoryBytes;
+		for (ParcelIndex first = 0; written && first < store->arena.nextIndex; first += ARENA_CHUNK_SIZE)
+		{
+			unsigned int count = store->arena.nextIndex - first < ARENA_CHUNK_SIZE ? store->arena.nextIndex - first : ARENA_CHUNK_SIZE;
+			stageSnapshotParcels(&store->arena, first, count, staging);
+			header.parcelChecksum = checksumBytes(staging, count * sizeof(Parcel), header.parcelChecksum);
+			written = fwrite(staging, sizeof(Parcel), count, file) == count;   // one write per slab
+		}
+
+		// the header went out with both checksums 0, write it again now that the parcels are summed
+		header.headerChecksum = checksumBytes(&header, sizeof(header), SNAPSHOT_CHECKSUM_SEED);   // computed while the field is still 0
+		written = written && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+		written = fclose(file) == 0 && written;
+	}
+
+	if (written)
+	{
+#ifdef _WIN32
+		written = MoveFileExA(temporaryPath, snapshotPath, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		written = rename(temporaryPath, snapshotPath) == 0;
+#endif
+	}
+	if (!written)
+	{
+		remove(temporaryPath);
+	}
+
+	free(temporaryPath);
+	free(directory);
+	free(staging);
+	return written;
+}
+
+//
+// FUNCTION: loadSnapshot
+// DESCRIPTION:
+//		This function maps a snapshot written by writeSnapshot and serves the arena straight out
+//		of the mapping: every full slab points into the file and only the last, partly filled slab
+//		is copied so it can keep growing. The mapping is copy-on-write, so later changes to a node
+//		never reach the file. Only the small country directory is read up front, the parcel pages
+//		are faulted in as the queries touch them.
+// PARAMETERS:
+//		ParcelStore* store: an empty parcel store to be filled.
+//		const char* snapshotPath: the name of the snapshot file.
+//		const char* sourcePath: the name of the text file the snapshot has to match.
+//		int verifyParcels: 1 to also check the checksum of every parcel node, which reads the whole file.
+//		const CountryList* validCountries: the list of valid countries the snapshot has to be filtered with.
+// RETURNS:
+//		int: returns 1 if the snapshot got loaded, 0 if it is missing, stale or damaged.
+//
+int loadSnapshot(ParcelStore* store, const char* snapshotPath, const char* sourcePath, int verifyParcels, const CountryList* validCountries)
+{
+	unsigned long long sourceSize;
+	unsigned long long sourceModified;
+	MappedFile mapped;
+	SnapshotHeader header;
+
+	if (!getSourceStamp(sourcePath, &sourceSize, &sourceModified) || !mapFile(&mapped, snapshotPath, 1))
+	{
+		return 0;   // no source to compare with, or no snapshot yet
+	}
+	if (mapped.size < sizeof(header))
+	{
+		unmapFile(&mapped);
+		return 0;
+	}
+
+	memcpy(&header, mapped.data, sizeof(header));
+	unsigned long long headerChecksum = header.headerChecksum;
+	header.headerChecksum = 0;
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION
+		|| header.byteOrder != SNAPSHOT_BYTE_ORDER || header.parcelSize != sizeof(Parcel))
+	{
+		unmapFile(&mapped);   // written by another build or an older format
+		return 0;
+	}
+	if (header.sourceSize != sourceSize || header.sourceModified != sourceModified)
+	{
+		unmapFile(&mapped);   // the text file changed since the snapshot was written
+		return 0;
+	}
+	if (header.countryListHash != (unsigned int)validCountries->checksum)
+	{
+		unmapFile(&mapped);   // built with another country list, so it holds other rows
+		return 0;
+	}
+
+	const char* damage = NULL;
+	if (checksumBytes(&header, sizeof(header), SNAPSHOT_CHECKSUM_SEED) != headerChecksum)
+	{
+		damage = "header checksum mismatch";
+	}
+	else if (header.directoryOffset + header.directoryBytes > header.parcelOffset || header.parcelOffset % SNAPSHOT_ALIGNMENT != 0
+		|| header.parcelOffset + (unsigned long long)header.parcelCount * sizeof(Parcel) > mapped.size
+		|| header.countryCount > MAX_COUNTRIES || header.parcelCount > (unsigned long long)ARENA_MAX_CHUNKS * ARENA_CHUNK_SIZE)
+	{
+		damage = "truncated file";
+	}
+	else if (checksumBytes(mapped.data + header.directoryOffset, (size_t)header.directoryBytes, SNAPSHOT_CHECKSUM_SEED) != header.directoryChecksum)
+	{
+		damage = "directory checksum mismatch";
+	}
+	else if (verifyParcels && checksumBytes(mapped.data + header.parcelOffset, (size_t)header.parcelCount * sizeof(Parcel), SNAPSHOT_CHECKSUM_SEED) != header.parcelChecksum)
+	{
+		damage = "parcel checksum mismatch";
+	}
+
+	// rebuild the country catalog from the directory, ids come back in the same order
+	const unsigned char* directory = (const unsigned char*)mapped.data + header.directoryOffset;
+	for (unsigned int id = 0; damage == NULL && id < header.countryCount; id++)
+	{
+		SnapshotCountry entry;
+		memcpy(&entry, directory + id * sizeof(SnapshotCountry), sizeof(entry));
+		if ((unsigned long long)entry.nameOffset + entry.nameLength > header.directoryBytes || entry.root >= header.parcelCount
+			|| entry.nameLength == 0 || entry.nameLength > MAX_COUNTRY_NAME_LENGTH)
+		{
+			damage = "bad country directory";
+			break;
+		}
+		unsigned short countryId = internCountryBytes(&store->catalog, (const char*)directory + entry.nameOffset, entry.nameLength);
+		store->catalog.roots[countryId] = entry.root;
+		store->catalog.parcelCounts[countryId] = entry.parcelCount;
+	}
+
+	if (damage != NULL)
+	{
+		fprintf(stderr, "Warning: %s: %s, rebuilding from %s\n", snapshotPath, damage, sourcePath);
+		freeCountryCatalog(&store->catalog);
+		unmapFile(&mapped);
+		return 0;
+	}
+
+	// full slabs are used in place, the partly filled last slab is copied out so it can grow
+	Parcel* parcels = (Parcel*)(mapped.data + header.parcelOffset);
+	unsigned int fullChunks = header.parcelCount >> ARENA_CHUNK_SHIFT;
+	unsigned int tailCount = header.parcelCount & ARENA_CHUNK_MASK;
+	for (unsigned int i = 0; i < fullChunks; i++)
+	{
+		store->arena.chunks[i] = parcels + (size_t)i * ARENA_CHUNK_SIZE;
+	}
+	store->arena.chunkCount = fullChunks;
+	store->arena.mappedChunks = fullChunks;
+	if (tailCount > 0)
+	{
+		Parcel* chunk = (Parcel*)malloc(sizeof(Parcel) * ARENA_CHUNK_SIZE);
+		if (chunk == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for arena slab.\n");
+			exit(1);
+		}
+		memcpy(chunk, parcels + (size_t)fullChunks * ARENA_CHUNK_SIZE, tailCount * sizeof(Parcel));
+		store->arena.chunks[store->arena.chunkCount++] = chunk;
+	}
+	store->arena.nextIndex = header.parcelCount;
+	store->arena.freeList = header.freeList < header.parcelCount ? header.freeList : NULL_PARCEL;
+	store->arena.freeCount = store->arena.freeList != NULL_PARCEL ? header.freeCount : 0;
+	store->snapshot = mapped;
+	return 1;
+}
+
+//
+// FUNCTION: createIndexVersion
+// DESCRIPTION:
+//		This function copies the country tables of the writer's catalog into a new version for
+//		the readers. The interned names are shared, they are never freed while the index lives.
+// PARAMETERS:
+//		const CountryCatalog* catalog: the writer's catalog.
+//		unsigned int generation: the writer batch publishing the version.
+// RETURNS:
+//		IndexVersion*: the new version.
+//
+IndexVersion* createIndexVersion(const CountryCatalog* catalog, unsigned int generation)
+{
+	IndexVersion* version = (IndexVersion*)calloc(1, sizeof(IndexVersion));
+	unsigned int count = catalog->count > 0 ? catalog->count : 1;
+
+	if (version != NULL)
+	{
+		version->generation = generation;
+		version->catalog = *catalog;
+		version->catalog.capacity = count;
+		version->catalog.names = (char**)malloc(count * sizeof(char*));
+		version->catalog.parcelCounts = (unsigned int*)malloc(count * sizeof(unsigned int));
+		version->catalog.roots = (ParcelIndex*)malloc(count * sizeof(ParcelIndex));
+		version->catalog.slots = catalog->slotCount > 0 ? (CountrySlot*)malloc(catalog->slotCount * sizeof(CountrySlot)) : NULL;
+	}
+	if (version == NULL || version->catalog.names == NULL || version->catalog.parcelCounts == NULL || version->catalog.roots == NULL
+		|| (catalog->slotCount > 0 && version->catalog.slots == NULL))
+	{
+		fprintf(stderr, "Error: Memory allocation failed for index version.\n");
+		exit(1);
+	}
+
+	memcpy(version->catalog.names, catalog->names, catalog->count * sizeof(char*));
+	memcpy(version->catalog.parcelCounts, catalog->parcelCounts, catalog->count * sizeof(unsigned int));
+	memcpy(version->catalog.roots, catalog->roots, catalog->count * sizeof(ParcelIndex));
+	if (catalog->slotCount > 0)
+	{
+		memcpy(version->catalog.slots, catalog->slots, catalog->slotCount * sizeof(CountrySlot));
+	}
+	for (unsigned int id = 0; id < catalog->count; id++)
+	{
+		version->parcelCount += catalog->parcelCounts[id];
+	}
+	return version;
+}
+
+//
+// FUNCTION: freeIndexVersion
+// DESCRIPTION:
+//		This function frees the tables of a version, leaving the shared names alone.
+// PARAMETERS:
+//		IndexVersion* version: the version to be freed.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void freeIndexVersion(IndexVersion* version)
+{
+	if (version != NULL)
+	{
+		free(version->catalog.names);
+		free(version->catalog.parcelCounts);
+		free(version->catalog.roots);
+		free(version->catalog.slots);
+		free(version);
+	}
+}
+
+//
+// FUNCTION: initLiveIndex
+// DESCRIPTION:
+//		This function puts a loaded parcel store behind a live index, which accepts new parcels
+//		while readers query it. The store then belongs to the writers: readers only follow
+//		arena links from the roots of a published version, never the store's own catalog.
+// PARAMETERS:
+//		LiveIndex* live: the live index to be set up.
+//		ParcelStore* store: the loaded parcel store.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void initLiveIndex(LiveIndex* live, ParcelStore* store)
+{
+	live->store = store;
+	live->generation = 1;   // nodes of the loaded index carry generation 0
+	live->retired = NULL;
+	live->retiring = NULL;
+	live->retiringCount = 0;
+	live->retiringCapacity = 0;
+	live->copiedNodes = 0;
+	live->reclaimedNodes = 0;
+	live->epoch.store(1);
+	for (int i = 0; i < LIVE_MAX_READERS; i++)
+	{
+		live->readers[i].epoch.store(0);
+		live->readers[i].inUse.store(0);
+	}
+	live->current.store(createIndexVersion(&store->catalog, 0));
+}
+
+//
+// FUNCTION: registerLiveReader
+// DESCRIPTION:
+//		This function claims a reader slot for the calling thread.
+// PARAMETERS:
+//		LiveIndex* live: the live index.
+// RETURNS:
+//		int: the slot of the reader, or -1 when LIVE_MAX_READERS threads are reading already.
+//
+int registerLiveReader(LiveIndex* live)
+{
+	for (int i = 0; i < LIVE_MAX_READERS; i++)
+	{
+		int expected = 0;
+		if (live->readers[i].inUse.compare_exchange_strong(expected, 1))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+//
+// FUNCTION: unregisterLiveReader
+// DESCRIPTION:
+//		This function gives a reader slot back.
+// PARAMETERS:
+//		LiveIndex* live: the live index.
+//		int reader: the slot of the reader.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void unregisterLiveReader(LiveIndex* live, int reader)
+{
+	live->readers[reader].epoch.store(0);
+	live->readers[reader].inUse.store(0);
+}
+
+//
+// FUNCTION: beginLiveRead
+// DESCRIPTION:
+//		This function pins the current version for a reader. The reader announces the epoch it
+//		entered in before loading the version, so no node the version can reach is reused until
+//		endLiveRead. Readers never block and never wait for writers.
+// PARAMETERS:
+//		LiveIndex* live: the live index.
+//		int reader: the slot of the reader.
+// RETURNS:
+//		const IndexVersion*: the version to be queried, stable until endLiveRead.
+//
+const IndexVersion* beginLiveRead(LiveIndex* live, int reader)
+{
+	live->readers[reader].epoch.store(live->epoch.load());
+	return live->current.load();
+}
+
+//
+// FUNCTION: endLiveRead
+// DESCRIPTION:
+//		This function releases the version pinned by beginLiveRead.
+// PARAMETERS:
+//		LiveIndex* live: the live index.
+//		int reader: the slot of the reader.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void endLiveRead(LiveIndex* live, int reader)
+{
+	live->readers[reader].epoch.store(0, std::memory_order_release);
+}
+
+//
+// FUNCTION: retireLiveNode
+// DESCRIPTION:
+//		This function remembers a published node which the batch in progress replaced by a copy.
+// PARAMETERS:
+//		LiveIndex* live: the live index.
+//		ParcelIndex index: the replaced node.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void retireLiveNode(LiveIndex* live, ParcelIndex index)
+{
+	if (live->retiringCount == live->retiringCapacity)
+	{
+		size_t capacity = live->retiringCapacity > 0 ? live->retiringCapacity * 2 : 1024;
+		ParcelIndex* grown = (ParcelIndex*)realloc(live->retiring, capacity * sizeof(ParcelIndex));
+		if (grown == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for retired nodes.\n");
+			exit(1);
+		}
+		live->retiring = grown;
+		live->retiringCapacity = capacity;
+	}
+	live->retiring[live->retiringCount++] = index;
+}
+
+//
+// FUNCTION: copyInsertPath
+// DESCRIPTION:
+//		This function makes every node on the path an insert of the given weight will follow
+//		private to the batch in progress, copying the nodes a published version can still reach.
+//		Nodes copied earlier in the same batch are reused as they are, so a batch of inserts into
+//		one country copies the shared top of the tree only once. Afterwards insertIntoBst can
+//		rebalance in place, because an AVL insert only rotates nodes on its own path.
+// PARAMETERS:
+//		LiveIndex* live: the live index.
+//		ParcelIndex* root: the writer's root link of the country.
+//		int weight: the weight of the parcel about to be inserted.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void copyInsertPath(LiveIndex* live, ParcelIndex* root, int weight)
+{
+	ParcelArena* arena = &live->store->arena;
+	ParcelIndex path[AVL_MAX_HEIGHT];   // private nodes on the path, top down
+	ParcelIndex replaced[AVL_MAX_HEIGHT];   // published node each of them replaced, NULL_PARCEL if none
+	int depth = 0;
+	ParcelIndex* link = root;
+
+	while (*link != NULL_PARCEL)
+	{
+		Parcel* node = getParcel(arena, *link);
+		replaced[depth] = NULL_PARCEL;
+		if (node->generation != live->generation)
+		{
+			ParcelIndex copy = arenaAllocate(arena);
+			Parcel* fresh = getParcel(arena, copy);
+			*fresh = *node;
+			fresh->generation = live->generation;
+			retireLiveNode(live, *link);
+			replaced[depth] = *link;
+			*link = copy;   // the parent is private already, or link is the writer's root
+			node = fresh;
+			live->copiedNodes++;
+		}
+		path[depth++] = *link;
+		link = weight < node->weight ? &node->left : &node->right;   // same way insertIntoBst goes
+	}
+
+	// the copied aggregates may still name the nodes they replaced as cheapest or most expensive
+	for (int i = 0; i < depth; i++)
+	{
+		ParcelAggregate* aggregate = &getParcel(arena, path[i])->subtree;
+		for (int j = i; j < depth; j++)
+		{
+			if (replaced[j] == NULL_PARCEL)
+			{
+				continue;
+			}
+			if (aggregate->cheapest == replaced[j])
+			{
+				aggregate->cheapest = path[j];
+			}
+			if (aggregate->mostExpensive == replaced[j])
+			{
+				aggregate->mostExpensive = path[j];
+			}
+		}
+	}
+}
+
+//
+// FUNCTION: reclaimLiveNodes
+// DESCRIPTION:
+//		This function hands retired nodes back to the arena once every active reader entered
+//		after they were retired, so no pinned version can reach them any more.
+// PARAMETERS:
+//		LiveIndex* live: the live index, with the writer lock held.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void reclaimLiveNodes(LiveIndex* live)
+{
+	unsigned long long oldestReader = ULLONG_MAX;
+	for (int i = 0; i < LIVE_MAX_READERS; i++)
+	{
+		unsigned long long epoch = live->readers[i].epoch.load();
+		if (epoch != 0 && epoch < oldestReader)
+		{
+			oldestReader = epoch;
+		}
+	}
+
+	RetiredNodes** link = &live->retired;
+	while (*link != NULL)
+	{
+		RetiredNodes* batch = *link;
+		if (batch->epoch > oldestReader)
+		{
+			link = &batch->next;   // a reader may still see the version these nodes belong to
+			continue;
+		}
+
+		for (size_t i = 0; i < batch->count; i++)
+		{
+			arenaRelease(&live->store->arena, batch->nodes[i]);
+		}
+		live->reclaimedNodes += batch->count;
+		freeIndexVersion(batch->version);
+		free(batch->nodes);
+		*link = batch->next;
+		free(batch);
+	}
+}
+
+//
+// FUNCTION: publishLiveVersion
+// DESCRIPTION:
+//		This function publishes the roots of the store as the current version, then retires the
+//		replaced version together with the nodes only it could reach. It ends the batch in
+//		progress, the caller holds the writer mutex.
+// PARAMETERS:
+//		LiveIndex* live: the live index.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void publishLiveVersion(LiveIndex* live)
+{
+	IndexVersion* previous = live->current.exchange(createIndexVersion(&live->store->catalog, live->generation));
+	RetiredNodes* batch = (RetiredNodes*)malloc(sizeof(RetiredNodes));
+	if (batch == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for retired nodes.\n");
+		exit(1);
+	}
+	batch->epoch = live->epoch.fetch_add(1) + 1;
+	batch->nodes = live->retiring;
+	batch->count = live->retiringCount;
+	batch->version = previous;
+	batch->next = live->retired;
+	live->retired = batch;
+	live->retiring = NULL;
+	live->retiringCount = 0;
+	live->retiringCapacity = 0;
+	live->generation++;
+
+	reclaimLiveNodes(live);
+}
+
+//
+// FUNCTION: insertLiveBatch
+// DESCRIPTION:
+//		This function inserts a batch of parcels into the live index while readers keep querying.
+//		The batch is grouped by country, each parcel is inserted along a privately copied path,
+//		and the new roots are published as one version at the end, so readers see either none or
+//		all of the batch. Writers queue on a mutex among themselves, readers never take it.
+// PARAMETERS:
+//		LiveIndex* live: the live index.
+//		const LiveParcel* parcels: the parcels to be inserted.
+//		size_t count: the number of parcels.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void insertLiveBatch(LiveIndex* live, const LiveParcel* parcels, size_t count)
+{
+	std::lock_guard<std::mutex> guard(live->writer);
+	ParcelStore* store = live->store;
+	STAT_ADD(STAT_PARCELS_INSERTED, count);
+	unsigned short* countryIds = (unsigned short*)malloc((count + 1) * sizeof(unsigned short));
+	size_t* order = (size_t*)malloc((count + 1) * sizeof(size_t));
+	if (countryIds == NULL || order == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for live batch.\n");
+		exit(1);
+	}
+
+	// group the batch by country with a stable counting sort, so each tree is visited once
+	for (size_t i = 0; i < count; i++)
+	{
+		countryIds[i] = internCountry(&store->catalog, parcels[i].country);
+	}
+	size_t* offsets = (size_t*)calloc(store->catalog.count + 1, sizeof(size_t));
+	if (offsets == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for live batch.\n");
+		exit(1);
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		offsets[countryIds[i] + 1]++;
+	}
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		offsets[id + 1] += offsets[id];
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		order[offsets[countryIds[i]]++] = i;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const LiveParcel* parcel = &parcels[order[i]];
+		unsigned short countryId = countryIds[order[i]];
+		ParcelIndex newParcel = createParcelForCountry(store, countryId, parcel->weight, parcel->valuation);
+		getParcel(&store->arena, newParcel)->generation = live->generation;
+		copyInsertPath(live, &store->catalog.roots[countryId], parcel->weight);
+		insertIntoBst(store, &store->catalog.roots[countryId], newParcel);
+	}
+
+	publishLiveVersion(live);
+	free(offsets);
+	free(order);
+	free(countryIds);
+}
+
+//
+// FUNCTION: destroyLiveIndex
+// DESCRIPTION:
+//		This function frees the versions and retired node lists of a live index once no reader
+//		is left. The parcel store stays loaded and holds every inserted parcel.
+// PARAMETERS:
+//		LiveIndex* live: the live index.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void destroyLiveIndex(LiveIndex* live)
+{
+	while (live->retired != NULL)
+	{
+		RetiredNodes* batch = live->retired;
+		for (size_t i = 0; i < batch->count; i++)
+		{
+			arenaRelease(&live->store->arena, batch->nodes[i]);
+		}
+		live->retired = batch->next;
+		freeIndexVersion(batch->version);
+		free(batch->nodes);
+		free(batch);
+	}
+	freeIndexVersion(live->current.exchange(NULL));
+	free(live->retiring);
+	live->retiring = NULL;
+}
+
+//
+// FUNCTION: readManifestTail
+// DESCRIPTION:
+//		This function reads what got appended to a followed manifest since the last call and
+//		inserts its complete rows into the live index as one batch. A line without its newline
+//		yet is left in the file for the next call. A file smaller than the offset was truncated
+//		or replaced, and is followed again from its start.
+// PARAMETERS:
+//		ManifestFollower* follower: the state of the follower.
+// RETURNS:
+//		int: returns 1 if some bytes got consumed, 0 once the follower caught up.
+//
+int readManifestTail(ManifestFollower* follower)
+{
+	unsigned long long size;
+	unsigned long long modified;
+	FILE* file;
+
+	if (!getSourceStamp(follower->filename, &size, &modified))
+	{
+		return 0;   // moved away for the moment, wait for it to come back
+	}
+	if (size < follower->offset)
+	{
+		fprintf(stderr, "Warning: %s shrank to %llu bytes, following it again from the start\n", follower->filename, size);
+		follower->offset = 0;
+		follower->skipPartial = 0;
+	}
+	if (size == follower->offset || fopen_s(&file, follower->filename, "rb") != 0)
+	{
+		return 0;
+	}
+
+	size_t wanted = size - follower->offset < FOLLOW_READ_BYTES ? (size_t)(size - follower->offset) : FOLLOW_READ_BYTES;
+#ifdef _WIN32
+	int seeked = _fseeki64(file, (long long)follower->offset, SEEK_SET) == 0;
+#else
+	int seeked = fseeko(file, (off_t)follower->offset, SEEK_SET) == 0;
+#endif
+	size_t length = seeked ? fread(follower->buffer, 1, wanted, file) : 0;
+	fclose(file);
+
+	char* cursor = follower->buffer;
+	char* end = cursor + length;
+	if (follower->skipPartial)
+	{
+		char* lineEnd = (char*)findByte(cursor, end, '\n');
+		if (lineEnd == end)
+		{
+			follower->offset += length;   // still inside the line
+			return length > 0;
+		}
+		if (lineEnd > cursor && !(lineEnd - cursor == 1 && *cursor == '\r'))
+		{
+			fprintf(stderr, "Warning: %s: the last row was loaded while it was still being written, skipped the rest of its line\n", follower->filename);
+		}
+		cursor = lineEnd + 1;
+		follower->skipPartial = 0;
+	}
+
+	// only complete lines are parsed, the unterminated tail is read again next time
+	char* complete = end;
+	while (complete > cursor && complete[-1] != '\n')
+	{
+		complete--;
+	}
+	if (complete == cursor && cursor == follower->buffer && length == FOLLOW_READ_BYTES)
+	{
+		fprintf(stderr, "Warning: %s: skipped a line longer than %d bytes at byte %llu\n", follower->filename, FOLLOW_READ_BYTES, follower->offset);
+		follower->malformedRows++;
+		follower->skipPartial = 1;
+		follower->offset += length;
+		return 1;
+	}
+
+	size_t count = 0;
+	while (cursor < complete)
+	{
+		char* lineEnd = (char*)findByte(cursor, complete, '\n');
+		ParsedRow row;
+
+		if (skipBlanks(cursor, lineEnd) != lineEnd && !(lineEnd - cursor == 1 && *cursor == '\r'))   // blank lines are ignored
+		{
+			const char* reason = parseRow(cursor, lineEnd, &row);
+			if (reason != NULL)
+			{
+				fprintf(stderr, "Warning: %s: skipped malformed row at byte %llu, %s\n", follower->filename,
+					follower->offset + (unsigned long long)(cursor - follower->buffer), reason);
+				follower->malformedRows++;
+			}
+			else if (findListedCountry(follower->validCountries, cursor, row.countryLength) == -1)
+			{
+				follower->filteredRows++;
+				STAT_ADD(STAT_ROWS_FILTERED, 1);
+			}
+			else
+			{
+				if (count == follower->parcelCapacity)
+				{
+					size_t capacity = follower->parcelCapacity ? follower->parcelCapacity * 2 : 4096;
+					LiveParcel* parcels = (LiveParcel*)realloc(follower->parcels, capacity * sizeof(LiveParcel));
+					if (parcels == NULL)
+					{
+						fprintf(stderr, "Error: Memory allocation failed for followed rows.\n");
+						exit(1);
+					}
+					follower->parcels = parcels;
+					follower->parcelCapacity = capacity;
+				}
+				cursor[row.countryLength] = '\0';   // the name ends at a blank or the comma, both already parsed
+				follower->parcels[count].country = cursor;
+				follower->parcels[count].weight = row.weight;
+				follower->parcels[count].valuation = row.valuation;
+				count++;
+			}
+		}
+		cursor = lineEnd + 1;
+	}
+
+	if (count > 0)
+	{
+		insertLiveBatch(follower->live, follower->parcels, count);
+		follower->ingestedRows += count;
+	}
+	follower->offset += (unsigned long long)(complete - follower->buffer);
+	return complete > follower->buffer;
+}
+
+//
+// FUNCTION: runManifestFollower
+// DESCRIPTION:
+//		This function is the loop of the follower thread. It catches up with the file, then
+//		sleeps until inotify reports a change or FOLLOW_POLL_MILLISECONDS pass, so a replaced
+//		file and systems without inotify are still noticed.
+// PARAMETERS:
+//		ManifestFollower* follower: the state of the follower.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void runManifestFollower(ManifestFollower* follower)
+{
+	while (!follower->stop.load())
+	{
+		while (!follower->stop.load() && readManifestTail(follower))
+		{
+		}
+
+#ifdef PARCEL_HAVE_INOTIFY
+		if (follower->watch >= 0)
+		{
+			struct pollfd notice;
+			notice.fd = follower->watch;
+			notice.events = POLLIN;
+			notice.revents = 0;
+			if (poll(&notice, 1, FOLLOW_POLL_MILLISECONDS) > 0)
+			{
+				char events[4096];
+				while (read(follower->watch, events, sizeof(events)) > 0)
+				{
+					// drain the events, the file is read again whatever they say
+				}
+			}
+			continue;
+		}
+#endif
+		std::this_thread::sleep_for(std::chrono::milliseconds(FOLLOW_POLL_MILLISECONDS));
+	}
+}
+
+//
+// FUNCTION: startManifestFollower
+// DESCRIPTION:
+//		This function starts a thread which inserts every row appended to a manifest into a live
+//		index. When the byte before the offset is not a newline, the last row loaded may have been
+//		cut off mid write, and the rest of its line is skipped rather than parsed as a new row.
+// PARAMETERS:
+//		ManifestFollower* follower: the follower to be started.
+//		LiveIndex* live: the index the new rows go into.
+//		const char* filename: the manifest to be followed.
+//		unsigned long long offset: the number of bytes of the manifest already loaded.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: this function does not return a value, it exits on memory allocation failure.
+//
+void startManifestFollower(ManifestFollower* follower, LiveIndex* live, const char* filename, unsigned long long offset, const CountryList* validCountries)
+{
+	FILE* file;
+
+	follower->live = live;
+	follower->filename = filename;
+	follower->validCountries = validCountries;
+	follower->offset = offset;
+	follower->skipPartial = 0;
+	follower->parcels = NULL;
+	follower->parcelCapacity = 0;
+	follower->ingestedRows = 0;
+	follower->malformedRows = 0;
+	follower->filteredRows = 0;
+	follower->stop.store(0);
+	follower->buffer = (char*)malloc(FOLLOW_READ_BYTES);
+	if (follower->buffer == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for follow buffer.\n");
+		exit(1);
+	}
+
+	if (offset > 0 && fopen_s(&file, filename, "rb") == 0)
+	{
+#ifdef _WIN32
+		int seeked = _fseeki64(file, (long long)offset - 1, SEEK_SET) == 0;
+#else
+		int seeked = fseeko(file, (off_t)offset - 1, SEEK_SET) == 0;
+#endif
+		follower->skipPartial = seeked && fgetc(file) != '\n';
+		fclose(file);
+	}
+
+	follower->watch = -1;
+#ifdef PARCEL_HAVE_INOTIFY
+	follower->watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (follower->watch >= 0 && inotify_add_watch(follower->watch, filename, IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB) < 0)
+	{
+		close(follower->watch);
+		follower->watch = -1;   // fall back to polling
+	}
+#endif
+	follower->thread = std::thread(runManifestFollower, follower);
+}
+
+//
+// FUNCTION: stopManifestFollower
+// DESCRIPTION:
+//		This function stops the follower thread and frees its buffers. The rows it inserted stay
+//		in the index.
+// PARAMETERS:
+//		ManifestFollower* follower: the follower to be stopped.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void stopManifestFollower(ManifestFollower* follower)
+{
+	follower->stop.store(1);
+	follower->thread.join();
+#ifdef PARCEL_HAVE_INOTIFY
+	if (follower->watch >= 0)
+	{
+		close(follower->watch);
+	}
+#endif
+	follower->watch = -1;
+	free(follower->buffer);
+	free(follower->parcels);
+	follower->buffer = NULL;
+	follower->parcels = NULL;
+	follower->parcelCapacity = 0;
+}
+
+//
+// FUNCTION: compareValuationEntries
+// DESCRIPTION:
+//		This function is the qsort comparator which puts entries of the valuation index in key order.
+// PARAMETERS:
+//		const void* first: the first entry.
+//		const void* second: the second entry.
+// RETURNS:
+//		int: negative, 0 or positive as the first entry comes before, with or after the second.
+//
+static int compareValuationEntries(const void* first, const void* second)
+{
+	const ValuationEntry* entry = (const ValuationEntry*)first;
+	return compareValuationKey((const ValuationEntry*)second, entry->valuation, entry->countryId, entry->weight);
+}
+
+//
+// FUNCTION: valuationSortKey
+// DESCRIPTION:
+//		This function maps a valuation to an unsigned integer with the same order, so valuations
+//		can be radix sorted by their bits.
+// PARAMETERS:
+//		Cents valuation: the valuation.
+// RETURNS:
+//		unsigned long long: the sort key.
+//
+static inline unsigned long long valuationSortKey(Cents valuation)
+{
+	return (unsigned long long)valuation ^ 0x8000000000000000ULL;   // flipping the sign bit puts negatives below positives
+}
+
+//
+// FUNCTION: sortValuationEntries
+// DESCRIPTION:
+//		This function sorts entries by valuation with a stable LSD radix sort, one byte per pass,
+//		like sortBulkRows does for weights. Entries which arrive in country and weight order are
+//		therefore left in full key order. Bytes shared by every key are skipped, so the usual
+//		valuations of a few million cents take three passes out of eight.
+// PARAMETERS:
+//		ValuationEntry* entries: the entries to be sorted.
+//		ValuationEntry* scratch: a buffer of the same length.
+//		size_t count: the number of entries.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void sortValuationEntries(ValuationEntry* entries, ValuationEntry* scratch, size_t count)
+{
+	size_t histogram[8][256];
+	ValuationEntry* source = entries;
+	ValuationEntry* target = scratch;
+
+	memset(histogram, 0, sizeof(histogram));
+	for (size_t i = 0; i < count; i++)
+	{
+		unsigned long long key = valuationSortKey(entries[i].valuation);
+		for (int pass = 0; pass < 8; pass++)
+		{
+			histogram[pass][(key >> (pass * 8)) & 0xFF]++;
+		}
+	}
+
+	for (int pass = 0; pass < 8 && count > 0; pass++)
+	{
+		int shift = pass * 8;
+		size_t offsets[256];
+		size_t total = 0;
+
+		if (histogram[pass][valuationSortKey(entries[0].valuation) >> shift & 0xFF] == count)
+		{
+			continue;   // every entry has the same byte here
+		}
+		for (int digit = 0; digit < 256; digit++)
+		{
+			offsets[digit] = total;
+			total += histogram[pass][digit];
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			target[offsets[(valuationSortKey(source[i].valuation) >> shift) & 0xFF]++] = source[i];
+		}
+
+		ValuationEntry* swap = source;
+		source = target;
+		target = swap;
+	}
+
+	if (source != entries)
+	{
+		memcpy(entries, source, count * sizeof(ValuationEntry));
+	}
+}
+
+//
+// FUNCTION: buildValuationSubtree
+// DESCRIPTION:
+//		This function links a run of entries which already sit in key order in consecutive slots
+//		into a perfectly balanced valuation tree, like buildBalancedSubtree does for parcels.
+// PARAMETERS:
+//		ValuationEntry* entries: the entries of the valuation index.
+//		ValuationSlot base: the slot of the first entry of the run.
+//		unsigned int first: the position of the first entry of the subtree in the run.
+//		unsigned int end: the position one past the last entry of the subtree in the run.
+// RETURNS:
+//		ValuationSlot: the slot of the root of the subtree, 0 if it is empty.
+//
+static ValuationSlot buildValuationSubtree(ValuationEntry* entries, ValuationSlot base, unsigned int first, unsigned int end)
+{
+	if (first >= end)
+	{
+		return 0;
+	}
+
+	unsigned int middle = first + (end - first) / 2;
+	ValuationSlot slot = base + middle;
+	entries[slot].left = buildValuationSubtree(entries, base, first, middle);
+	entries[slot].right = buildValuationSubtree(entries, base, middle + 1, end);
+	updateValuationEntry(entries, slot);
+	return slot;
+}
+
+//
+// FUNCTION: getValuationIndex
+// DESCRIPTION:
+//		This function returns the valuation index, building it on first use. Every parcel is
+//		copied into one run in country and weight order, radix sorted by valuation and linked into
+//		a balanced global tree; a stable partition of the sorted run by country gives the runs of
+//		the country trees. From then on every insert and removal keeps both trees current.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the index.
+// RETURNS:
+//		const ValuationIndex*: the valuation index or exits on memory allocation failure.
+//
+const ValuationIndex* getValuationIndex(ParcelStore* store)
+{
+	ValuationIndex* index = &store->valuations;
+	const CountryCatalog* catalog = &store->catalog;
+	size_t parcelCount = 0;
+
+	if (index->built)
+	{
+		return index;
+	}
+	for (unsigned int id = 0; id < catalog->count; id++)
+	{
+		parcelCount += catalog->parcelCounts[id];
+	}
+	if (2 * parcelCount + 1 > UINT_MAX)
+	{
+		fprintf(stderr, "Error: Too many parcels for the valuation index.\n");
+		exit(1);
+	}
+
+	index->capacity = (unsigned int)(2 * parcelCount + 1);
+	index->entryCount = index->capacity;
+	index->entries = (ValuationEntry*)malloc(index->capacity * sizeof(ValuationEntry));
+	index->countryCapacity = catalog->capacity > 0 ? catalog->capacity : 1;
+	index->countryRoots = (ValuationSlot*)calloc(index->countryCapacity, sizeof(ValuationSlot));
+	size_t* offsets = (size_t*)malloc((catalog->count + 1) * sizeof(size_t));
+	if (index->entries == NULL || index->countryRoots == NULL || offsets == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for valuation index.\n");
+		exit(1);
+	}
+	index->freeList = 0;
+
+	// the global run takes slots 1 to n, the country runs follow it
+	ValuationEntry* entries = index->entries;
+	size_t position = 1;
+	for (unsigned int id = 0; id < catalog->count; id++)
+	{
+		ParcelIterator iterator;
+		const Parcel* parcel;
+		offsets[id] = parcelCount + position;
+		initIterator(&iterator, store, catalog->roots[id]);
+		while ((parcel = nextParcel(&iterator)) != NULL)
+		{
+			entries[position].valuation = parcel->valuation;
+			entries[position].weight = parcel->weight;
+			entries[position++].countryId = parcel->countryId;
+		}
+	}
+	sortValuationEntries(entries + 1, entries + 1 + parcelCount, parcelCount);   // the country runs are not filled yet
+	for (size_t i = 1; i <= parcelCount; i++)
+	{
+		entries[offsets[entries[i].countryId]++] = entries[i];   // stable, so every country run stays sorted
+	}
+
+	index->globalRoot = buildValuationSubtree(entries, 1, 0, (unsigned int)parcelCount);
+	for (unsigned int id = 0; id < catalog->count; id++)
+	{
+		ValuationSlot base = (ValuationSlot)(offsets[id] - catalog->parcelCounts[id]);
+		index->countryRoots[id] = buildValuationSubtree(entries, base, 0, catalog->parcelCounts[id]);
+	}
+	index->built = 1;
+	free(offsets);
+	return index;
+}
+
+//
+// FUNCTION: countValuationsBelow
+// DESCRIPTION:
+//		This function counts the entries of a valuation tree below a valuation in O(log n) from
+//		the subtree counts.
+// PARAMETERS:
+//		const ValuationEntry* entries: the entries of the valuation index.
+//		ValuationSlot root: the slot of the root of the tree.
+//		Cents valuation: the valuation to compare with.
+//		int inclusive: 1 to also count the entries of exactly that valuation.
+// RETURNS:
+//		unsigned int: the number of entries below the valuation.
+//
+static unsigned int countValuationsBelow(const ValuationEntry* entries, ValuationSlot root, Cents valuation, int inclusive)
+{
+	unsigned int below = 0;
+	unsigned int visited = 0;
+
+	while (root != 0)
+	{
+		const ValuationEntry* entry = &entries[root];
+		visited++;
+		if (entry->valuation < valuation || (inclusive && entry->valuation == valuation))
+		{
+			below += 1 + (entry->left != 0 ? entries[entry->left].count : 0);   // the entry and its whole left subtree
+			root = entry->right;
+		}
+		else
+		{
+			root = entry->left;
+		}
+	}
+	STAT_ADD(STAT_NODES_VISITED, visited);
+	return below;
+}
+
+//
+// FUNCTION: collectValuationEntries
+// DESCRIPTION:
+//		This function copies a run of consecutive entries of a valuation tree in valuation order.
+//		It descends to the first position by the subtree counts and walks on in order from
+//		there, so the cost is O(log n + limit).
+// PARAMETERS:
+//		const ValuationEntry* entries: the entries of the valuation index.
+//		ValuationSlot root: the slot of the root of the tree.
+//		unsigned int position: the rank of the first entry to copy.
+//		unsigned int limit: the largest number of entries to copy.
+//		const ValuationEntry** results: the array where the entries will get stored.
+// RETURNS:
+//		unsigned int: the number of entries copied.
+//
+static unsigned int collectValuationEntries(const ValuationEntry* entries, ValuationSlot root, unsigned int position, unsigned int limit, const ValuationEntry** results)
+{
+	ValuationSlot stack[AVL_MAX_HEIGHT];   // entries still to come in order, the next one on top
+	int top = 0;
+	unsigned int collected = 0;
+	unsigned int visited = 0;
+
+	while (root != 0)
+	{
+		const ValuationEntry* entry = &entries[root];
+		visited++;
+		unsigned int leftCount = entry->left != 0 ? entries[entry->left].count : 0;
+		if (position <= leftCount)
+		{
+			stack[top++] = root;
+			if (position == leftCount)
+			{
+				break;
+			}
+			root = entry->left;
+		}
+		else
+		{
+			position -= leftCount + 1;
+			root = entry->right;
+		}
+	}
+
+	while (collected < limit && top > 0)
+	{
+		ValuationSlot slot = stack[--top];
+		results[collected++] = &entries[slot];
+		for (ValuationSlot child = entries[slot].right; child != 0; child = entries[child].left)
+		{
+			stack[top++] = child;
+		}
+	}
+	STAT_ADD(STAT_NODES_VISITED, visited);
+	STAT_ADD(STAT_PARCELS_RETURNED, collected);
+	return collected;
+}
+
+//
+// FUNCTION: valuationRoot
+// DESCRIPTION:
+//		This function picks the valuation tree of one country or the global one.
+// PARAMETERS:
+//		const ValuationIndex* index: the valuation index.
+//		int countryId: the interned id of the country, -1 for every country.
+// RETURNS:
+//		ValuationSlot: the slot of the root of the tree, 0 if it is empty.
+//
+static ValuationSlot valuationRoot(const ValuationIndex* index, int countryId)
+{
+	if (countryId < 0)
+	{
+		return index->globalRoot;
+	}
+	return (unsigned int)countryId < index->countryCapacity ? index->countryRoots[countryId] : 0;
+}
+
+//
+// FUNCTION: searchValuationRange
+// DESCRIPTION:
+//		This function answers queryValuationRange from an index which is already built, so it
+//		can be called while other threads read the store.
+// PARAMETERS:
+//		const ValuationIndex* index: the built valuation index.
+//		int countryId: the interned id of the country, -1 for every country.
+//		Cents minValuation: the lowest valuation.
+//		Cents maxValuation: the highest valuation.
+//		unsigned int offset: the number of matching parcels to skip.
+//		unsigned int limit: the largest number of parcels to return.
+//		const ValuationEntry** results: the array where the matching entries will get stored.
+//		unsigned int* totalMatches: the variable where the number of all matches will get stored, may be NULL.
+// RETURNS:
+//		unsigned int: the number of entries stored in results.
+//
+unsigned int searchValuationRange(const ValuationIndex* index, int countryId, Cents minValuation, Cents maxValuation, unsigned int offset, unsigned int limit, const ValuationEntry** results, unsigned int* totalMatches)
+{
+	ValuationSlot root = valuationRoot(index, countryId);
+	unsigned int first = countValuationsBelow(index->entries, root, minValuation, 0);
+	unsigned int end = countValuationsBelow(index->entries, root, maxValuation, 1);
+	unsigned int total = end > first ? end - first : 0;
+
+	if (totalMatches != NULL)
+	{
+		*totalMatches = total;
+	}
+	if (offset >= total)
+	{
+		return 0;
+	}
+	return collectValuationEntries(index->entries, root, first + offset, total - offset < limit ? total - offset : limit, results);
+}
+
+//
+// FUNCTION: queryValuationRange
+// DESCRIPTION:
+//		This function finds the parcels valued between two bounds, both inclusive, in ascending
+//		valuation order. Bounding ranks are counted in O(log n) and only the requested page is
+//		walked. The returned entries stay valid until the next insert or removal.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the valuation index.
+//		int countryId: the interned id of the country, -1 for every country.
+//		Cents minValuation: the lowest valuation.
+//		Cents maxValuation: the highest valuation.
+//		unsigned int offset: the number of matching parcels to skip.
+//		unsigned int limit: the largest number of parcels to return.
+//		const ValuationEntry** results: the array where the matching entries will get stored.
+//		unsigned int* totalMatches: the variable where the number of all matches will get stored, may be NULL.
+// RETURNS:
+//		unsigned int: the number of entries stored in results.
+//
+unsigned int queryValuationRange(ParcelStore* store, int countryId, Cents minValuation, Cents maxValuation, unsigned int offset, unsigned int limit, const ValuationEntry** results, unsigned int* totalMatches)
+{
+	STAT_TIME(STAT_OP_VALUATION_RANGE);
+	return searchValuationRange(getValuationIndex(store), countryId, minValuation, maxValuation, offset, limit, results, totalMatches);
+}
+
+//
+// FUNCTION: searchValuationExtremes
+// DESCRIPTION:
+//		This function answers queryValuationExtremes from an index which is already built, so it
+//		can be called while other threads read the store.
+// PARAMETERS:
+//		const ValuationIndex* index: the built valuation index.
+//		int countryId: the interned id of the country, -1 for every country.
+//		unsigned int k: the number of parcels wanted.
+//		int highest: 1 for the most valuable parcels, 0 for the least valuable.
+//		const ValuationEntry** results: the array of at least k entries where the parcels will get stored.
+// RETURNS:
+//		unsigned int: the number of entries stored, less than k if there are fewer parcels.
+//
+unsigned int searchValuationExtremes(const ValuationIndex* index, int countryId, unsigned int k, int highest, const ValuationEntry** results)
+{
+	ValuationSlot root = valuationRoot(index, countryId);
+	unsigned int count = root != 0 ? index->entries[root].count : 0;
+
+	k = k < count ? k : count;
+	unsigned int collected = collectValuationEntries(index->entries, root, highest ? count - k : 0, k, results);
+	for (unsigned int i = 0; highest && i < collected / 2; i++)
+	{
+		const ValuationEntry* swap = results[i];   // the walk is ascending, the most valuable go first
+		results[i] = results[collected - 1 - i];
+		results[collected - 1 - i] = swap;
+	}
+	return collected;
+}
+
+//
+// FUNCTION: queryValuationExtremes
+// DESCRIPTION:
+//		This function finds the k most or least valuable parcels in O(log n + k). The most
+//		valuable come first in descending order, the least valuable in ascending order. The
+//		returned entries stay valid until the next insert or removal.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the valuation index.
+//		int countryId: the interned id of the country, -1 for every country.
+//		unsigned int k: the number of parcels wanted.
+//		int highest: 1 for the most valuable parcels, 0 for the least valuable.
+//		const ValuationEntry** results: the array of at least k entries where the parcels will get stored.
+// RETURNS:
+//		unsigned int: the number of entries stored, less than k if there are fewer parcels.
+//
+unsigned int queryValuationExtremes(ParcelStore* store, int countryId, unsigned int k, int highest, const ValuationEntry** results)
+{
+	STAT_TIME(STAT_OP_TOP_K);
+	return searchValuationExtremes(getValuationIndex(store), countryId, k, highest, results);
+}
+
+//
+// FUNCTION: mergeQuantileSketch
+// DESCRIPTION:
+//		This function merges one sketch into another, so the result sketches both streams with
+//		the same error bound and the same fixed size. Every item keeps its level and the full
+//		levels are compacted as they fill up.
+// PARAMETERS:
+//		QuantileSketch* sketch: the sketch which takes in the other one.
+//		const QuantileSketch* other: the sketch to be merged.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void mergeQuantileSketch(QuantileSketch* sketch, const QuantileSketch* other)
+{
+	unsigned int end = other->itemCount;
+
+	if (other->count == 0)
+	{
+		return;
+	}
+	sketch->count += other->count;
+	sketch->minimum = other->minimum < sketch->minimum ? other->minimum : sketch->minimum;
+	sketch->maximum = other->maximum > sketch->maximum ? other->maximum : sketch->maximum;
+	for (unsigned int level = 0; level < other->levelCount; level++)   // level 0 is the last in items
+	{
+		unsigned int first = end - other->levelSizes[level];
+		for (unsigned int i = first; i < end; i++)
+		{
+			addToSketchLevel(sketch, other->items[i], level);
+		}
+		end = first;
+	}
+}
+
+//
+// FUNCTION: buildCountrySketches
+// DESCRIPTION:
+//		This function builds the weight and valuation sketches of a country from its BST.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the BST.
+//		ParcelIndex root: the arena index of the root of the country's BST.
+//		CountrySketches* sketches: the sketches to be filled.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void buildCountrySketches(const ParcelStore* store, ParcelIndex root, CountrySketches* sketches)
+{
+	ParcelIterator iterator;
+	const Parcel* parcel;
+
+	initQuantileSketch(&sketches->weights);
+	initQuantileSketch(&sketches->valuations);
+	initIterator(&iterator, store, root);
+	while ((parcel = nextParcel(&iterator)) != NULL)
+	{
+		addToQuantileSketch(&sketches->weights, parcel->weight);
+		addToQuantileSketch(&sketches->valuations, parcel->valuation);
+	}
+	sketches->stale = 0;
+}
+
+//
+// FUNCTION: findCountrySketches
+// DESCRIPTION:
+//		This function returns the sketches of a country if they were built and are current,
+//		without building them, so it can be called while other threads read the store.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the sketches.
+//		int countryId: the interned id of the country.
+// RETURNS:
+//		const CountrySketches*: the sketches, or NULL if they have to be built first or the country has no parcels.
+//
+const CountrySketches* findCountrySketches(const ParcelStore* store, int countryId)
+{
+	if (countryId < 0 || (unsigned int)countryId >= store->quantiles.capacity || store->catalog.roots[countryId] == NULL_PARCEL)
+	{
+		return NULL;
+	}
+	const CountrySketches* sketches = &store->quantiles.countries[countryId];
+	if (sketches->stale || sketches->weights.count != getParcel(&store->arena, store->catalog.roots[countryId])->subtree.count)
+	{
+		return NULL;
+	}
+	return sketches;
+}
+
+//
+// FUNCTION: getCountrySketches
+// DESCRIPTION:
+//		This function returns the sketches of a country, building them from the country's BST
+//		the first time they are needed, after a removal, or after parcels arrived by a path which
+//		does not go through insertIntoBst, like the live index. From then on inserts keep them current.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which owns the sketches.
+//		int countryId: the interned id of the country.
+// RETURNS:
+//		const CountrySketches*: the sketches, or NULL if the country has no parcels.
+//
+const CountrySketches* getCountrySketches(ParcelStore* store, int countryId)
+{
+	QuantileIndex* index = &store->quantiles;
+
+	if (countryId < 0 || store->catalog.roots[countryId] == NULL_PARCEL)
+	{
+		return NULL;
+	}
+	if ((unsigned int)countryId >= index->capacity)
+	{
+		unsigned int capacity = store->catalog.capacity;
+		CountrySketches* countries = (CountrySketches*)realloc(index->countries, capacity * sizeof(CountrySketches));
+		if (countries == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for quantile sketches.\n");
+			exit(1);
+		}
+		for (unsigned int id = index->capacity; id < capacity; id++)
+		{
+			countries[id].stale = 1;   // built when first asked for
+		}
+		index->countries = countries;
+		index->capacity = capacity;
+	}
+	index->built = 1;
+
+	CountrySketches* sketches = &index->countries[countryId];
+	if (sketches->stale || sketches->weights.count != getParcel(&store->arena, store->catalog.roots[countryId])->subtree.count)
+	{
+		buildCountrySketches(store, store->catalog.roots[countryId], sketches);
+	}
+	return sketches;
+}
+
+//
+// FUNCTION: compareSketchItems
+// DESCRIPTION:
+//		This function compares two weighted items of a sketch by value for qsort.
+// PARAMETERS:
+//		const void* first: the first item.
+//		const void* second: the second item.
+// RETURNS:
+//		int: negative, zero or positive like strcmp.
+//
+static int compareSketchItems(const void* first, const void* second)
+{
+	long long a = ((const SketchItem*)first)->value;
+	long long b = ((const SketchItem*)second)->value;
+	return (a > b) - (a < b);
+}
+
+//
+// FUNCTION: sortSketchItems
+// DESCRIPTION:
+//		This function lists the kept values of a sketch with their weights in ascending order,
+//		which answers any number of quantile and rank questions after one sort.
+// PARAMETERS:
+//		const QuantileSketch* sketch: the sketch.
+//		SketchItem* items: SKETCH_CAPACITY entries where the items will get stored.
+// RETURNS:
+//		unsigned int: the number of items stored.
+//
+unsigned int sortSketchItems(const QuantileSketch* sketch, SketchItem* items)
+{
+	unsigned int end = sketch->itemCount;
+
+	for (unsigned int level = 0; level < sketch->levelCount; level++)
+	{
+		unsigned int first = end - sketch->levelSizes[level];
+		for (unsigned int i = first; i < end; i++)
+		{
+			items[i].value = sketch->items[i];
+			items[i].weight = 1ULL << level;
+		}
+		end = first;
+	}
+	qsort(items, sketch->itemCount, sizeof(SketchItem), compareSketchItems);
+	return sketch->itemCount;
+}
+
+//
+// FUNCTION: sketchQuantile
+// DESCRIPTION:
+//		This function estimates a quantile from the sorted items of a sketch: the first value
+//		whose weights, added up from the smallest value, reach the fraction of the stream. The
+//		rank of the answer is off by about 1.7% of the stream at most; 0 and 1 give the exact extremes.
+// PARAMETERS:
+//		const QuantileSketch* sketch: the sketch.
+//		const SketchItem* items: the items of the sketch from sortSketchItems.
+//		unsigned int itemCount: the number of items.
+//		double fraction: the quantile wanted, 0.5 for the median.
+// RETURNS:
+//		long long: the estimated quantile.
+//
+long long sketchQuantile(const QuantileSketch* sketch, const SketchItem* items, unsigned int itemCount, double fraction)
+{
+	if (fraction <= 0.0)
+	{
+		return sketch->minimum;
+	}
+	if (fraction >= 1.0)
+	{
+		return sketch->maximum;
+	}
+
+	double target = fraction * (double)sketch->count;
+	unsigned long long seen = 0;
+	for (unsigned int i = 0; i < itemCount; i++)
+	{
+		seen += items[i].weight;
+		if ((double)seen >= target)
+		{
+			return items[i].value;
+		}
+	}
+	return sketch->maximum;
+}
+
+//
+// FUNCTION: sketchRank
+// DESCRIPTION:
+//		This function estimates how many values of the stream are at most a given value.
+// PARAMETERS:
+//		const QuantileSketch* sketch: the sketch.
+//		const SketchItem* items: the items of the sketch from sortSketchItems.
+//		unsigned int itemCount: the number of items.
+//		long long value: the value to compare with.
+// RETURNS:
+//		unsigned long long: the estimated number of values at most the given one.
+//
+unsigned long long sketchRank(const QuantileSketch* sketch, const SketchItem* items, unsigned int itemCount, long long value)
+{
+	unsigned long long rank = 0;
+
+	if (value >= sketch->maximum)
+	{
+		return sketch->count;   // exact at the top, so histogram buckets add up to the stream
+	}
+	for (unsigned int i = 0; i < itemCount && items[i].value <= value; i++)
+	{
+		rank += items[i].weight;
+	}
+	return rank < sketch->count ? rank : sketch->count;
+}
+
+//
+// FUNCTION: boxKey
+// DESCRIPTION:
+//		This function returns the coordinate a k-d tree level splits on.
+// PARAMETERS:
+//		const BoxPoint* point: the parcel.
+//		int byValuation: 1 for the valuation, 0 for the weight.
+// RETURNS:
+//		long long: the coordinate.
+//
+static inline long long boxKey(const BoxPoint* point, int byValuation)
+{
+	return byValuation ? (long long)point->valuation : (long long)point->weight;
+}
+
+//
+// FUNCTION: selectBoxPoints
+// DESCRIPTION:
+//		This function moves the parcel of the given rank in one coordinate to its sorted position
+//		with a quickselect, every parcel before it having a smaller or equal coordinate and every
+//		one after it a larger or equal one, in linear expected time.
+// PARAMETERS:
+//		BoxPoint* points: the parcels.
+//		unsigned int first: the position of the first parcel of the run.
+//		unsigned int end: the position past the last parcel of the run.
+//		unsigned int nth: the rank to be selected, first <= nth < end.
+//		int byValuation: 1 to select by valuation, 0 by weight.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void selectBoxPoints(BoxPoint* points, unsigned int first, unsigned int end, unsigned int nth, int byValuation)
+{
+	while (end - first > 1)
+	{
+		long long a = boxKey(&points[first], byValuation);
+		long long b = boxKey(&points[first + (end - first) / 2], byValuation);
+		long long c = boxKey(&points[end - 1], byValuation);
+		long long pivot = a < b ? (b < c ? b : a < c ? c : a) : (a < c ? a : b < c ? c : b);   // median of three
+		long long low = first;
+		long long high = (long long)end - 1;
+
+		while (low <= high)
+		{
+			while (boxKey(&points[low], byValuation) < pivot)
+			{
+				low++;
+			}
+			while (boxKey(&points[high], byValuation) > pivot)
+			{
+				high--;
+			}
+			if (low <= high)
+			{
+				BoxPoint swap = points[low];
+				points[low++] = points[high];
+				points[high--] = swap;
+			}
+		}
+
+		// [first, high] holds the keys up to the pivot, [low, end) the keys from it on, between them only the pivot
+		if ((long long)nth <= high)
+		{
+			end = (unsigned int)high + 1;
+		}
+		else if ((long long)nth >= low)
+		{
+			first = (unsigned int)low;
+		}
+		else
+		{
+			return;
+		}
+	}
+}
+
+//
+// FUNCTION: buildBoxNode
+// DESCRIPTION:
+//		This function builds one node of a k-d tree and everything below it. A run of more than
+//		BOX_LEAF_SIZE parcels is split at its median, by weight on even levels and by valuation
+//		on odd ones, and every node records the bounding box and totals of its parcels.
+// PARAMETERS:
+//		CountryBoxes* boxes: the k-d tree being built.
+//		unsigned int node: the number of the node.
+//		unsigned int first: the position of the first parcel of the node.
+//		unsigned int end: the position past the last parcel of the node.
+//		int level: the depth of the node, the root is level 0.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void buildBoxNode(CountryBoxes* boxes, unsigned int node, unsigned int first, unsigned int end, int level)
+{
+	BoxNode* summary = &boxes->nodes[node];
+
+	if (end - first <= BOX_LEAF_SIZE)
+	{
+		summary->minWeight = INT_MAX;
+		summary->maxWeight = INT_MIN;
+		summary->minValuation = LLONG_MAX;
+		summary->maxValuation = LLONG_MIN;
+		summary->weightSum = 0;
+		summary->valuationSum = 0;
+		summary->count = end - first;
+		for (unsigned int i = first; i < end; i++)
+		{
+			const BoxPoint* point = &boxes->points[i];
+			summary->minWeight = point->weight < summary->minWeight ? point->weight : summary->minWeight;
+			summary->maxWeight = point->weight > summary->maxWeight ? point->weight : summary->maxWeight;
+			summary->minValuation = point->valuation < summary->minValuation ? point->valuation : summary->minValuation;
+			summary->maxValuation = point->valuation > summary->maxValuation ? point->valuation : summary->maxValuation;
+			summary->weightSum += point->weight;
+			summary->valuationSum += point->valuation;
+		}
+		return;
+	}
+
+	unsigned int middle = first + (end - first) / 2;
+	selectBoxPoints(boxes->points, first, end, middle, level & 1);
+	buildBoxNode(boxes, 2 * node, first, middle, level + 1);
+	buildBoxNode(boxes, 2 * node + 1, middle, end, level + 1);
+
+	const BoxNode* left = &boxes->nodes[2 * node];
+	const BoxNode* right = &boxes->nodes[2 * node + 1];
+	summary->minWeight = left->minWeight < right->minWeight ? left->minWeight : right->minWeight;
+	summary->maxWeight = left->maxWeight > right->maxWeight ? left->maxWeight : right->maxWeight;
+	summary->minValuation = left->minValuation < right->minValuation ? left->minValuation : right->minValuation;
+	summary->maxValuation = left->maxValuation > right->maxValuation ? left->maxValuation : right->maxValuation;
+	summary->weightSum = left->weightSum + right->weightSum;
+	summary->valuationSum = left->valuationSum + right->valuationSum;
+	summary->count = left->count + right->count;
+}
+
+//
+// FUNCTION: findCountryBoxes
+// DESCRIPTION:
+//		This function returns the k-d tree of a country if it was built and is current, without
+//		building it, so it can be called while other threads read the store.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		int countryId: the interned id of the country, -1 for an unknown country.
+// RETURNS:
+//		const CountryBoxes*: the k-d tree, or NULL if it has to be built first or the country has no parcels.
+//
+const CountryBoxes* findCountryBoxes(const ParcelStore* store, int countryId)
+{
+	if (countryId < 0 || (unsigned int)countryId >= store->boxes.capacity || store->catalog.roots[countryId] == NULL_PARCEL)
+	{
+		return NULL;
+	}
+	const CountryBoxes* boxes = &store->boxes.countries[countryId];
+	if (boxes->points == NULL || boxes->count != getParcel(&store->arena, store->catalog.roots[countryId])->subtree.count)
+	{
+		return NULL;
+	}
+	return boxes;
+}
+
+//
+// FUNCTION: getCountryBoxes
+// DESCRIPTION:
+//		This function returns the k-d tree of a country over weight and valuation, building it
+//		from the country's BST in O(n log n) the first time it is needed or after the country
+//		changed. Inserts are noticed by the parcel count, removals and re-weighs drop the tree.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		int countryId: the interned id of the country, -1 for an unknown country.
+// RETURNS:
+//		const CountryBoxes*: the k-d tree, or NULL if the country has no parcels, it exits on
+//		memory allocation failure.
+//
+const CountryBoxes* getCountryBoxes(ParcelStore* store, int countryId)
+{
+	if (countryId < 0 || store->catalog.roots[countryId] == NULL_PARCEL)
+	{
+		return NULL;
+	}
+	const CountryBoxes* current = findCountryBoxes(store, countryId);
+	if (current != NULL)
+	{
+		return current;
+	}
+
+	if ((unsigned int)countryId >= store->boxes.capacity)
+	{
+		unsigned int capacity = store->catalog.capacity;   // one tree per country id
+		CountryBoxes* countries = (CountryBoxes*)realloc(store->boxes.countries, capacity * sizeof(CountryBoxes));
+		if (countries == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for box index.\n");
+			exit(1);
+		}
+		memset(countries + store->boxes.capacity, 0, (capacity - store->boxes.capacity) * sizeof(CountryBoxes));
+		store->boxes.countries = countries;
+		store->boxes.capacity = capacity;
+	}
+
+	CountryBoxes* boxes = &store->boxes.countries[countryId];
+	unsigned int count = getParcel(&store->arena, store->catalog.roots[countryId])->subtree.count;
+	unsigned int levels = 1;
+	for (unsigned int size = count; size > BOX_LEAF_SIZE; size = (size + 1) / 2)
+	{
+		levels++;   // a node of level d holds at most ceil(count / 2^d) parcels
+	}
+	freeCountryBoxes(boxes);
+	boxes->nodeCount = 1u << levels;
+	boxes->points = (BoxPoint*)malloc(count * sizeof(BoxPoint));
+	boxes->nodes = (BoxNode*)malloc(boxes->nodeCount * sizeof(BoxNode));
+	if (boxes->points == NULL || boxes->nodes == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for box index.\n");
+		exit(1);
+	}
+
+	ParcelIterator iterator;
+	const Parcel* parcel;
+	unsigned int position = 0;
+	initIterator(&iterator, store, store->catalog.roots[countryId]);
+	while ((parcel = nextParcel(&iterator)) != NULL)
+	{
+		boxes->points[position].weight = parcel->weight;
+		boxes->points[position++].valuation = parcel->valuation;
+	}
+	buildBoxNode(boxes, 1, 0, count, 0);
+	boxes->count = count;
+	return boxes;
+}
+
+//
+// FUNCTION: queryBoxNode
+// DESCRIPTION:
+//		This function adds the parcels of one k-d tree node which lie inside a box. A node whose
+//		bounding box misses the box is skipped, and one which lies inside it is added from its
+//		totals unless its parcels are wanted, so a count costs O(sqrt n) nodes.
+// PARAMETERS:
+//		const CountryBoxes* boxes: the k-d tree.
+//		unsigned int node: the number of the node.
+//		unsigned int first: the position of the first parcel of the node.
+//		unsigned int end: the position past the last parcel of the node.
+//		const BoxRange* range: the box.
+//		BoxTotals* totals: the totals the parcels are added to.
+//		BoxPoint* matches: where the parcels are copied to from position totals->count on, may be NULL.
+//		unsigned int* visited: the number of visited nodes, counted up.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void queryBoxNode(const CountryBoxes* boxes, unsigned int node, unsigned int first, unsigned int end, const BoxRange* range, BoxTotals* totals, BoxPoint* matches, unsigned int* visited)
+{
+	const BoxNode* summary = &boxes->nodes[node];
+	(*visited)++;
+
+	if (summary->maxWeight < range->minWeight || summary->minWeight > range->maxWeight
+		|| summary->maxValuation < range->minValuation || summary->minValuation > range->maxValuation)
+	{
+		return;   // no parcel of the node is inside
+	}
+	int inside = summary->minWeight >= range->minWeight && summary->maxWeight <= range->maxWeight
+		&& summary->minValuation >= range->minValuation && summary->maxValuation <= range->maxValuation;
+	if (inside && matches == NULL)
+	{
+		totals->count += summary->count;
+		totals->weightSum += summary->weightSum;
+		totals->valuationSum += summary->valuationSum;
+		return;
+	}
+
+	if (inside || end - first <= BOX_LEAF_SIZE)
+	{
+		for (unsigned int i = first; i < end; i++)
+		{
+			const BoxPoint* point = &boxes->points[i];
+			if (point->weight >= range->minWeight && point->weight <= range->maxWeight
+				&& point->valuation >= range->minValuation && point->valuation <= range->maxValuation)
+			{
+				if (matches != NULL)
+				{
+					matches[totals->count] = *point;
+				}
+				totals->count++;
+				totals->weightSum += point->weight;
+				totals->valuationSum += point->valuation;
+			}
+		}
+		return;
+	}
+
+	unsigned int middle = first + (end - first) / 2;
+	queryBoxNode(boxes, 2 * node, first, middle, range, totals, matches, visited);
+	queryBoxNode(boxes, 2 * node + 1, middle, end, range, totals, matches, visited);
+}
+
+//
+// FUNCTION: queryCountryBoxes
+// DESCRIPTION:
+//		This function finds the parcels of a country inside a weight and valuation box from its
+//		k-d tree, adding them to the totals and optionally copying them out, in no fixed order.
+// PARAMETERS:
+//		const CountryBoxes* boxes: the k-d tree of the country.
+//		const BoxRange* range: the box.
+//		BoxTotals* totals: the totals the parcels are added to.
+//		BoxPoint* matches: where the parcels are copied to from position totals->count on, may be NULL.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void queryCountryBoxes(const CountryBoxes* boxes, const BoxRange* range, BoxTotals* totals, BoxPoint* matches)
+{
+	unsigned int visited = 0;
+	if (boxes->count > 0 && range->minWeight <= range->maxWeight && range->minValuation <= range->maxValuation)
+	{
+		queryBoxNode(boxes, 1, 0, boxes->count, range, totals, matches, &visited);
+	}
+	STAT_ADD(STAT_NODES_VISITED, visited);
+}
+
+//
+// FUNCTION: scanWeightValuationBox
+// DESCRIPTION:
+//		This function finds the parcels of a country inside a weight and valuation box by walking
+//		the weight range of its BST and filtering on valuation. It is the answer when no current
+//		k-d tree can be used, and the baseline the k-d trees are measured against.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		ParcelIndex root: the arena index of the root of the country's BST.
+//		const BoxRange* range: the box.
+//		BoxTotals* totals: the totals the parcels are added to.
+//		BoxPoint* matches: where the parcels are copied to from position totals->count on, may be NULL.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void scanWeightValuationBox(const ParcelStore* store, ParcelIndex root, const BoxRange* range, BoxTotals* totals, BoxPoint* matches)
+{
+	if (root == NULL_PARCEL || range->minWeight > range->maxWeight || range->minValuation > range->maxValuation)
+	{
+		return;
+	}
+	unsigned int first = countWeightsBelow(store, root, range->minWeight, 0);
+	unsigned int end = countWeightsBelow(store, root, range->maxWeight, 1);
+	ParcelIterator iterator;
+
+	seekIterator(&iterator, store, root, first);
+	for (unsigned int position = first; position < end; position++)
+	{
+		const Parcel* parcel = nextParcel(&iterator);
+		if (parcel->valuation >= range->minValuation && parcel->valuation <= range->maxValuation)
+		{
+			if (matches != NULL)
+			{
+				matches[totals->count].weight = parcel->weight;
+				matches[totals->count].valuation = parcel->valuation;
+			}
+			totals->count++;
+			totals->weightSum += parcel->weight;
+			totals->valuationSum += parcel->valuation;
+		}
+	}
+	STAT_ADD(STAT_NODES_VISITED, end > first ? end - first : 0);
+}
+
+//
+// FUNCTION: compareBoxPoints
+// DESCRIPTION:
+//		This function is the comparator of qsort to list the parcels of a box by weight, and by
+//		valuation among equal weights.
+// PARAMETERS:
+//		const void* a: pointer to the first parcel.
+//		const void* b: pointer to the second parcel.
+// RETURNS:
+//		int: negative, zero or positive as the first parcel sorts before, with or after the second.
+//
+int compareBoxPoints(const void* a, const void* b)
+{
+	const BoxPoint* first = (const BoxPoint*)a;
+	const BoxPoint* second = (const BoxPoint*)b;
+	if (first->weight != second->weight)
+	{
+		return first->weight < second->weight ? -1 : 1;
+	}
+	return first->valuation < second->valuation ? -1 : first->valuation > second->valuation ? 1 : 0;
+}
+
+//
+// FUNCTION: queryWeightValuationBox
+// DESCRIPTION:
+//		This function finds the parcels of a country inside a weight and valuation box, from its
+//		k-d tree when a current one exists and by scanning the weight range otherwise. The
+//		matches, when wanted, come out sorted by weight and valuation either way.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		int countryId: the interned id of the country, -1 for an unknown country.
+//		const BoxRange* range: the box.
+//		BoxTotals* totals: the variable where the totals will get stored.
+//		BoxPoint* matches: at least totals->count entries where the parcels will get stored, may be NULL.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void queryWeightValuationBox(const ParcelStore* store, int countryId, const BoxRange* range, BoxTotals* totals, BoxPoint* matches)
+{
+	const CountryBoxes* boxes = findCountryBoxes(store, countryId);
+
+	memset(totals, 0, sizeof(*totals));
+	if (boxes != NULL)
+	{
+		queryCountryBoxes(boxes, range, totals, matches);
+	}
+	else if (countryId >= 0)
+	{
+		scanWeightValuationBox(store, store->catalog.roots[countryId], range, totals, matches);
+	}
+	if (matches != NULL && totals->count > 1)
+	{
+		qsort(matches, totals->count, sizeof(BoxPoint), compareBoxPoints);
+	}
+	STAT_ADD(STAT_PARCELS_RETURNED, matches != NULL ? totals->count : 0);
+}
+
+//
+// FUNCTION: findFirstAtLeast
+// DESCRIPTION:
+//		This function finds the first parcel in weight order whose weight is at least the given weight.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: the arena index of the root of the BST to be searched.
+//		int weight: the smallest weight to accept.
+// RETURNS:
+//		ParcelIndex: the arena index of the parcel, or NULL_PARCEL if every parcel is lighter.
+//
+ParcelIndex findFirstAtLeast(const ParcelStore* store, ParcelIndex root, int weight)
+{
+	ParcelIndex result = NULL_PARCEL;
+	unsigned int visited = 0;
+	while (root != NULL_PARCEL)
+	{
+		const Parcel* parcel = getParcel(&store->arena, root);
+		visited++;
+		if (parcel->weight >= weight)
+		{
+			result = root;   // candidate, an earlier match can only be on the left
+			root = parcel->left;
+		}
+		else
+		{
+			root = parcel->right;
+		}
+	}
+	STAT_ADD(STAT_NODES_VISITED, visited);
+	return result;
+}
+
+//
+// FUNCTION: aggregateWeightRange
+// DESCRIPTION:
+//		This function computes the count, totals and valuation extremes of the parcels whose
+//		weight lies in [minWeight, maxWeight] in O(log n). It finds the node where the two bounds
+//		split and then walks each boundary, adding whole subtrees that lie inside the range.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: the arena index of the root of the BST.
+//		int minWeight: the smallest weight in the range.
+//		int maxWeight: the largest weight in the range.
+//		ParcelAggregate* result: the variable where the aggregates will get stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void aggregateWeightRange(const ParcelStore* store, ParcelIndex root, int minWeight, int maxWeight, ParcelAggregate* result)
+{
+	const ParcelArena* arena = &store->arena;
+	ParcelAggregate before;   // parcels of the range left of the split node, in weight order
+	ParcelAggregate after;   // parcels of the range right of the split node, in weight order
+	ParcelAggregate piece;
+	unsigned int visited = 0;
+
+	memset(result, 0, sizeof(*result));
+	memset(&before, 0, sizeof(before));
+	memset(&after, 0, sizeof(after));
+
+	// descend to the first node inside the range, where the two boundary paths split
+	while (root != NULL_PARCEL)
+	{
+		const Parcel* parcel = getParcel(arena, root);
+		visited++;
+		if (parcel->weight < minWeight)
+		{
+			root = parcel->right;
+		}
+		else if (parcel->weight > maxWeight)
+		{
+			root = parcel->left;
+		}
+		else
+		{
+			break;
+		}
+	}
+	if (root == NULL_PARCEL || minWeight > maxWeight)
+	{
+		STAT_ADD(STAT_NODES_VISITED, visited);
+		return;
+	}
+
+	// left boundary: every node at least minWeight brings its whole right subtree along
+	for (ParcelIndex index = getParcel(arena, root)->left; index != NULL_PARCEL; )
+	{
+		const Parcel* parcel = getParcel(arena, index);
+		visited++;
+		if (parcel->weight >= minWeight)
+		{
+			nodeAggregate(arena, index, &piece);
+			if (parcel->right != NULL_PARCEL)
+			{
+				mergeAggregate(&piece, &getParcel(arena, parcel->right)->subtree);
+			}
+			mergeAggregate(&piece, &before);   // this piece comes before what was already found
+			before = piece;
+			index = parcel->left;
+		}
+		else
+		{
+			index = parcel->right;
+		}
+	}
+
+	// right boundary: every node at most maxWeight brings its whole left subtree along
+	for (ParcelIndex index = getParcel(arena, root)->right; index != NULL_PARCEL; )
+	{
+		const Parcel* parcel = getParcel(arena, index);
+		visited++;
+		if (parcel->weight <= maxWeight)
+		{
+			if (parcel->left != NULL_PARCEL)
+			{
+				mergeAggregate(&after, &getParcel(arena, parcel->left)->subtree);
+			}
+			nodeAggregate(arena, index, &piece);
+			mergeAggregate(&after, &piece);
+			index = parcel->right;
+		}
+		else
+		{
+			index = parcel->left;
+		}
+	}
+
+	*result = before;
+	nodeAggregate(arena, root, &piece);
+	mergeAggregate(result, &piece);
+	mergeAggregate(result, &after);
+	STAT_ADD(STAT_NODES_VISITED, visited);
+}
+
+//
+// FUNCTION: cpuSupportsAvx2
+// DESCRIPTION:
+//		This function checks once whether the processor and the operating system support AVX2,
+//		so the column kernels can pick their widest implementation at run time.
+// PARAMETERS:
+//		void: this function is not taking any parameters.
+// RETURNS:
+//		int: returns 1 if AVX2 can be used else 0.
+//
+int cpuSupportsAvx2()
+{
+	static int supported = -1;   // detected on the first call
+
+	if (supported == -1)
+	{
+		supported = 0;
+#if defined(PARCEL_HAVE_AVX2) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6)   // OSXSAVE, AVX and YMM state saved by the OS
+		{
+			__cpuidex(info, 7, 0);
+			supported = (info[1] & (1 << 5)) != 0;
+		}
+#elif defined(PARCEL_HAVE_AVX2)
+		__builtin_cpu_init();
+		supported = __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+	return supported;
+}
+
+#ifdef PARCEL_HAVE_AVX2
+//
+// FUNCTION: sumWeightColumnAvx2
+// DESCRIPTION:
+//		This function adds up a weight column eight weights at a time, widening to 64-bit lanes.
+// PARAMETERS:
+//		const int* weights: the weight column.
+//		size_t count: the number of weights.
+// RETURNS:
+//		long long: the total weight.
+//
+PARCEL_AVX2_FUNCTION static long long sumWeightColumnAvx2(const int* weights, size_t count)
+{
+	__m256i low = _mm256_setzero_si256();
+	__m256i high = _mm256_setzero_si256();
+	long long lanes[4];
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i*)(weights + i));
+		low = _mm256_add_epi64(low, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(block)));
+		high = _mm256_add_epi64(high, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(block, 1)));
+	}
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(low, high));
+
+	long long total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	for (; i < count; i++)
+	{
+		total += weights[i];
+	}
+	return total;
+}
+
+//
+// FUNCTION: sumValuationColumnAvx2
+// DESCRIPTION:
+//		This function adds up a valuation column eight valuations at a time, widening to 64-bit
+//		lanes so the total is exact.
+// PARAMETERS:
+//		const ParcelCents* valuations: the valuation column.
+//		size_t count: the number of valuations.
+// RETURNS:
+//		Cents: the total valuation.
+//
+PARCEL_AVX2_FUNCTION static Cents sumValuationColumnAvx2(const ParcelCents* valuations, size_t count)
+{
+	__m256i low = _mm256_setzero_si256();
+	__m256i high = _mm256_setzero_si256();
+	long long lanes[4];
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i*)(valuations + i));
+		low = _mm256_add_epi64(low, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(block)));
+		high = _mm256_add_epi64(high, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(block, 1)));
+	}
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(low, high));
+
+	Cents total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	for (; i < count; i++)
+	{
+		total += valuations[i];
+	}
+	return total;
+}
+
+//
+// FUNCTION: valuationBoundsAvx2
+// DESCRIPTION:
+//		This function finds the lowest and highest valuation of a column eight at a time with
+//		32-bit min and max.
+// PARAMETERS:
+//		const ParcelCents* valuations: the valuation column, at least one entry.
+//		size_t count: the number of valuations.
+//		ParcelCents* lowest: the variable where the lowest valuation will get stored.
+//		ParcelCents* highest: the variable where the highest valuation will get stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+PARCEL_AVX2_FUNCTION static void valuationBoundsAvx2(const ParcelCents* valuations, size_t count, ParcelCents* lowest, ParcelCents* highest)
+{
+	ParcelCents low = valuations[0];
+	ParcelCents high = valuations[0];
+	size_t i = 0;
+
+	if (count >= 8)
+	{
+		__m256i minimum = _mm256_loadu_si256((const __m256i*)valuations);
+		__m256i maximum = minimum;
+		int lanes[8];
+
+		for (i = 8; i + 8 <= count; i += 8)
+		{
+			__m256i block = _mm256_loadu_si256((const __m256i*)(valuations + i));
+			minimum = _mm256_min_epi32(minimum, block);
+			maximum = _mm256_max_epi32(maximum, block);
+		}
+		_mm256_storeu_si256((__m256i*)lanes, minimum);
+		for (int lane = 0; lane < 8; lane++)
+		{
+			low = lanes[lane] < low ? lanes[lane] : low;
+		}
+		_mm256_storeu_si256((__m256i*)lanes, maximum);
+		for (int lane = 0; lane < 8; lane++)
+		{
+			high = lanes[lane] > high ? lanes[lane] : high;
+		}
+	}
+	for (; i < count; i++)
+	{
+		low = valuations[i] < low ? valuations[i] : low;
+		high = valuations[i] > high ? valuations[i] : high;
+	}
+	*lowest = low;
+	*highest = high;
+}
+#endif
+
+//
+// FUNCTION: sumWeightColumn
+// DESCRIPTION:
+//		This function adds up a weight column with the widest SIMD kernel the processor supports.
+// PARAMETERS:
+//		const int* weights: the weight column.
+//		size_t count: the number of weights.
+// RETURNS:
+//		long long: the total weight.
+//
+long long sumWeightColumn(const int* weights, size_t count)
+{
+	size_t i = 0;
+	long long total = 0;
+
+#ifdef PARCEL_HAVE_AVX2
+	if (cpuSupportsAvx2())
+	{
+		return sumWeightColumnAvx2(weights, count);
+	}
+#endif
+#ifdef PARCEL_HAVE_SSE2
+	__m128i sum = _mm_setzero_si128();
+	long long lanes[2];
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)(weights + i));
+		__m128i sign = _mm_srai_epi32(block, 31);   // sign extend the four weights to 64 bits
+		sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(block, sign), _mm_unpackhi_epi32(block, sign)));
+	}
+	_mm_storeu_si128((__m128i*)lanes, sum);
+	total = lanes[0] + lanes[1];
+#endif
+	for (; i < count; i++)
+	{
+		total += weights[i];
+	}
+	return total;
+}
+
+//
+// FUNCTION: sumValuationColumn
+// DESCRIPTION:
+//		This function adds up a valuation column exactly with the widest SIMD kernel the
+//		processor supports, widening the 32-bit valuations to 64-bit sums.
+// PARAMETERS:
+//		const ParcelCents* valuations: the valuation column.
+//		size_t count: the number of valuations.
+// RETURNS:
+//		Cents: the total valuation.
+//
+Cents sumValuationColumn(const ParcelCents* valuations, size_t count)
+{
+	size_t i = 0;
+	Cents total = 0;
+
+#ifdef PARCEL_HAVE_AVX2
+	if (cpuSupportsAvx2())
+	{
+		return sumValuationColumnAvx2(valuations, count);
+	}
+#endif
+#ifdef PARCEL_HAVE_SSE2
+	__m128i sum = _mm_setzero_si128();
+	long long lanes[2];
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)(valuations + i));
+		__m128i sign = _mm_srai_epi32(block, 31);   // sign extend the four valuations to 64 bits
+		sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(block, sign), _mm_unpackhi_epi32(block, sign)));
+	}
+	_mm_storeu_si128((__m128i*)lanes, sum);
+	total = lanes[0] + lanes[1];
+#endif
+	for (; i < count; i++)
+	{
+		total += valuations[i];
+	}
+	return total;
+}
+
+//
+// FUNCTION: findValuationExtremes
+// DESCRIPTION:
+//		This function finds the positions of the cheapest and most expensive parcels of a
+//		valuation column. The bounds are found with SIMD min and max when AVX2 is available (SSE2
+//		has no 32-bit min and max), then the first position holding each bound is located, so
+//		ties resolve to the first parcel in weight order.
+// PARAMETERS:
+//		const ParcelCents* valuations: the valuation column, at least one entry.
+//		size_t count: the number of valuations.
+//		size_t* cheapest: the variable where the position of the cheapest parcel will get stored.
+//		size_t* mostExpensive: the variable where the position of the most expensive parcel will get stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void findValuationExtremes(const ParcelCents* valuations, size_t count, size_t* cheapest, size_t* mostExpensive)
+{
+	ParcelCents lowest = valuations[0];
+	ParcelCents highest = valuations[0];
+	size_t i = 0;
+
+#ifdef PARCEL_HAVE_AVX2
+	if (cpuSupportsAvx2())
+	{
+		valuationBoundsAvx2(valuations, count, &lowest, &highest);
+		i = count;
+	}
+#endif
+	for (; i < count; i++)
+	{
+		lowest = valuations[i] < lowest ? valuations[i] : lowest;
+		highest = valuations[i] > highest ? valuations[i] : highest;
+	}
+
+	for (*cheapest = 0; valuations[*cheapest] != lowest; (*cheapest)++);   // first parcel holding the bound
+	for (*mostExpensive = 0; valuations[*mostExpensive] != highest; (*mostExpensive)++);
+}
+
+//
+// FUNCTION: columnRank
+// DESCRIPTION:
+//		This function binary searches a sorted weight column for the number of weights lighter
+//		than a weight (or not heavier, when inclusive).
+// PARAMETERS:
+//		const int* weights: the weight column, sorted ascending.
+//		size_t count: the number of weights.
+//		int weight: the weight to compare with.
+//		int inclusive: 1 to also count weights equal to the weight.
+// RETURNS:
+//		size_t: the position of the first weight past the bound.
+//
+size_t columnRank(const int* weights, size_t count, int weight, int inclusive)
+{
+	size_t low = 0;
+	size_t high = count;
+
+	while (low < high)
+	{
+		size_t middle = low + (high - low) / 2;
+		if (weights[middle] < weight || (inclusive && weights[middle] == weight))
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low;
+}
+
+//
+// FUNCTION: encodeCountryColumns
+// DESCRIPTION:
+//		This function encodes the parcels of a country as compressed columns for cold data. The
+//		weights are cut into blocks of COLUMN_BLOCK_SIZE: a block keeps its first weight and every
+//		other weight is the LEB128 varint of its difference to the one before, mostly one byte
+//		since the weights are sorted. The valuations are frame-of-reference bit packed, the cents
+//		above the lowest valuation in as many bits as the widest one needs, so any position can be
+//		read directly.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the BST.
+//		ParcelIndex root: the arena index of the root of the country's BST.
+//		unsigned int count: the number of parcels in the BST, at least one.
+//		CountryColumns* columns: the empty columns to be filled.
+// RETURNS:
+//		void: this function does not return a value, it exits on memory allocation failure.
+//
+void encodeCountryColumns(const ParcelStore* store, ParcelIndex root, unsigned int count, CountryColumns* columns)
+{
+	const ParcelAggregate* subtree = &getParcel(&store->arena, root)->subtree;
+	unsigned int blockCount = (count + COLUMN_BLOCK_SIZE - 1) / COLUMN_BLOCK_SIZE;
+	unsigned long long spread = (unsigned long long)subtree->maxValuation - (unsigned long long)subtree->minValuation;
+	unsigned int bits = 0;
+	while (bits < 64 && (spread >> bits) != 0)
+	{
+		bits++;
+	}
+	size_t wordCount = ((size_t)count * bits + 63) / 64 + 1;   // one spare word so a read never checks the end
+
+	columns->blocks = (ColumnBlock*)malloc(blockCount * sizeof(ColumnBlock));
+	columns->weightDeltas = (unsigned char*)malloc((size_t)count * 5 + 1);   // a delta of up to 32 bits takes at most 5 bytes
+	columns->packedValuations = (unsigned long long*)calloc(wordCount, sizeof(unsigned long long));
+	if (columns->blocks == NULL || columns->weightDeltas == NULL || columns->packedValuations == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for columns.\n");
+		exit(1);
+	}
+	columns->valuationBase = subtree->minValuation;
+	columns->valuationBits = bits;
+
+	ParcelIterator iterator;
+	const Parcel* parcel;
+	unsigned int position = 0;
+	size_t length = 0;
+	int previous = 0;
+	initIterator(&iterator, store, root);
+	while ((parcel = nextParcel(&iterator)) != NULL)
+	{
+		if (position % COLUMN_BLOCK_SIZE == 0)
+		{
+			columns->blocks[position / COLUMN_BLOCK_SIZE].firstWeight = parcel->weight;
+			columns->blocks[position / COLUMN_BLOCK_SIZE].deltaOffset = (unsigned int)length;
+		}
+		else
+		{
+			unsigned int delta = (unsigned int)parcel->weight - (unsigned int)previous;   // in-order walk gives weight order
+			while (delta >= 0x80)
+			{
+				columns->weightDeltas[length++] = (unsigned char)(delta | 0x80);
+				delta >>= 7;
+			}
+			columns->weightDeltas[length++] = (unsigned char)delta;
+		}
+		previous = parcel->weight;
+
+		if (bits > 0)
+		{
+			unsigned long long value = (unsigned long long)parcel->valuation - (unsigned long long)subtree->minValuation;
+			size_t bit = (size_t)position * bits;
+			columns->packedValuations[bit / 64] |= value << (bit % 64);
+			if (bit % 64 + bits > 64)
+			{
+				columns->packedValuations[bit / 64 + 1] |= value >> (64 - bit % 64);   // straddles two words
+			}
+		}
+		position++;
+	}
+
+	unsigned char* shrunk = (unsigned char*)realloc(columns->weightDeltas, length + 1);
+	columns->weightDeltas = shrunk != NULL ? shrunk : columns->weightDeltas;
+	columns->deltaBytes = length;
+	columns->count = count;
+}
+
+//
+// FUNCTION: getCountryColumns
+// DESCRIPTION:
+//		This function returns the weight sorted columns of a country, copying them out of the
+//		country's BST the first time they are needed or after the country got new parcels. A store
+//		which keeps its columns compressed gets them encoded by encodeCountryColumns instead.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		int countryId: the interned id of the country, -1 for an unknown country.
+// RETURNS:
+//		const CountryColumns*: the columns of the country, or NULL if the country has no parcels.
+//
+const CountryColumns* getCountryColumns(ParcelStore* store, int countryId)
+{
+	if (countryId < 0 || store->catalog.roots[countryId] == NULL_PARCEL)
+	{
+		return NULL;
+	}
+
+	if ((unsigned int)countryId >= store->columnCapacity)
+	{
+		unsigned int capacity = store->catalog.capacity;   // one column set per country id
+		CountryColumns* columns = (CountryColumns*)realloc(store->columns, capacity * sizeof(CountryColumns));
+		if (columns == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for columns.\n");
+			exit(1);
+		}
+		memset(columns + store->columnCapacity, 0, (capacity - store->columnCapacity) * sizeof(CountryColumns));
+		store->columns = columns;
+		store->columnCapacity = capacity;
+	}
+
+	CountryColumns* columns = &store->columns[countryId];
+	unsigned int count = getParcel(&store->arena, store->catalog.roots[countryId])->subtree.count;
+	if ((store->compressed ? columns->blocks != NULL : columns->weights != NULL) && columns->count == count)
+	{
+		return columns;   // still current
+	}
+
+	freeCountryColumns(columns);
+	if (store->compressed)
+	{
+		encodeCountryColumns(store, store->catalog.roots[countryId], count, columns);
+		return columns;
+	}
+	columns->weights = (int*)malloc(count * sizeof(int));
+	columns->valuations = (ParcelCents*)malloc(count * sizeof(ParcelCents));
+	if (columns->weights == NULL || columns->valuations == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for columns.\n");
+		exit(1);
+	}
+
+	ParcelIterator iterator;
+	const Parcel* parcel;
+	unsigned int position = 0;
+	initIterator(&iterator, store, store->catalog.roots[countryId]);
+	while ((parcel = nextParcel(&iterator)) != NULL)
+	{
+		columns->weights[position] = parcel->weight;   // in-order walk gives weight order
+		columns->valuations[position++] = parcel->valuation;
+	}
+	columns->count = count;
+	return columns;
+}
+
+//
+// FUNCTION: packedValuationAt
+// DESCRIPTION:
+//		This function reads one valuation of a compressed column.
+// PARAMETERS:
+//		const CountryColumns* columns: the compressed columns.
+//		size_t position: the position of the parcel in weight order.
+// RETURNS:
+//		Cents: the valuation of the parcel.
+//
+static inline Cents packedValuationAt(const CountryColumns* columns, size_t position)
+{
+	unsigned int bits = columns->valuationBits;
+	if (bits == 0)
+	{
+		return columns->valuationBase;
+	}
+
+	size_t bit = position * bits;
+	unsigned long long value = columns->packedValuations[bit / 64] >> (bit % 64);
+	if (bit % 64 + bits > 64)
+	{
+		value |= columns->packedValuations[bit / 64 + 1] << (64 - bit % 64);
+	}
+	if (bits < 64)
+	{
+		value &= (1ULL << bits) - 1;
+	}
+	return (Cents)((unsigned long long)columns->valuationBase + value);
+}
+
+//
+// FUNCTION: decodeColumnBlock
+// DESCRIPTION:
+//		This function decodes one block of compressed columns into plain arrays.
+// PARAMETERS:
+//		const CountryColumns* columns: the compressed columns.
+//		unsigned int block: the number of the block.
+//		int* weights: COLUMN_BLOCK_SIZE entries which receive the weights of the block.
+//		Cents* valuations: COLUMN_BLOCK_SIZE entries which receive the valuations, or NULL.
+// RETURNS:
+//		unsigned int: the number of parcels in the block.
+//
+unsigned int decodeColumnBlock(const CountryColumns* columns, unsigned int block, int* weights, Cents* valuations)
+{
+	size_t first = (size_t)block * COLUMN_BLOCK_SIZE;
+	unsigned int count = columns->count - first < COLUMN_BLOCK_SIZE ? (unsigned int)(columns->count - first) : COLUMN_BLOCK_SIZE;
+	const unsigned char* delta = columns->weightDeltas + columns->blocks[block].deltaOffset;
+	unsigned int weight = (unsigned int)columns->blocks[block].firstWeight;
+
+	weights[0] = (int)weight;
+	for (unsigned int i = 1; i < count; i++)
+	{
+		unsigned int value = *delta & 0x7F;
+		for (int shift = 7; *delta++ & 0x80; shift += 7)
+		{
+			value |= (unsigned int)(*delta & 0x7F) << shift;
+		}
+		weight += value;
+		weights[i] = (int)weight;
+	}
+	if (valuations != NULL && columns->valuationBits == 0)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			valuations[i] = columns->valuationBase;
+		}
+	}
+	else if (valuations != NULL)
+	{
+		// walk the packed words in order instead of locating every value on its own
+		unsigned int bits = columns->valuationBits;
+		unsigned long long mask = bits < 64 ? (1ULL << bits) - 1 : ~0ULL;
+		size_t bit = first * bits;
+		const unsigned long long* word = columns->packedValuations + bit / 64;
+		unsigned int shift = (unsigned int)(bit % 64);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			unsigned long long value = word[0] >> shift;
+			if (shift + bits > 64)
+			{
+				value |= word[1] << (64 - shift);
+			}
+			valuations[i] = (Cents)((unsigned long long)columns->valuationBase + (value & mask));
+			shift += bits;
+			word += shift / 64;
+			shift %= 64;
+		}
+	}
+	return count;
+}
+
+//
+// FUNCTION: compressedRank
+// DESCRIPTION:
+//		This function is columnRank for compressed columns: it binary searches the first weights
+//		of the blocks, then decodes the one block which holds the bound.
+// PARAMETERS:
+//		const CountryColumns* columns: the compressed columns.
+//		int weight: the weight to compare with.
+//		int inclusive: 1 to also count weights equal to the weight.
+// RETURNS:
+//		size_t: the position of the first weight past the bound.
+//
+size_t compressedRank(const CountryColumns* columns, int weight, int inclusive)
+{
+	unsigned int blockCount = (columns->count + COLUMN_BLOCK_SIZE - 1) / COLUMN_BLOCK_SIZE;
+	unsigned int low = 0;
+	unsigned int high = blockCount;
+	int weights[COLUMN_BLOCK_SIZE];
+
+	while (low < high)   // count the blocks which start below the bound
+	{
+		unsigned int middle = low + (high - low) / 2;
+		int first = columns->blocks[middle].firstWeight;
+		if (first < weight || (inclusive && first == weight))
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	if (low == 0)
+	{
+		return 0;
+	}
+
+	unsigned int count = decodeColumnBlock(columns, low - 1, weights, NULL);   // the bound falls inside the block before
+	return (size_t)(low - 1) * COLUMN_BLOCK_SIZE + columnRank(weights, count, weight, inclusive);
+}
+
+//
+// FUNCTION: compressedParcelAt
+// DESCRIPTION:
+//		This function decodes the parcel at one position of compressed columns.
+// PARAMETERS:
+//		const CountryColumns* columns: the compressed columns.
+//		size_t position: the position of the parcel in weight order.
+//		int* weight: the variable where the weight will get stored.
+//		Cents* valuation: the variable where the valuation will get stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void compressedParcelAt(const CountryColumns* columns, size_t position, int* weight, Cents* valuation)
+{
+	int weights[COLUMN_BLOCK_SIZE];
+	decodeColumnBlock(columns, (unsigned int)(position / COLUMN_BLOCK_SIZE), weights, NULL);
+	*weight = weights[position % COLUMN_BLOCK_SIZE];
+	*valuation = packedValuationAt(columns, position);
+}
+
+//
+// FUNCTION: summarizeCompressedColumns
+// DESCRIPTION:
+//		This function adds up a slice of compressed columns and finds its first cheapest and most
+//		expensive parcels, decoding a block at a time. The sums are exact like the tree aggregates.
+// PARAMETERS:
+//		const CountryColumns* columns: the compressed columns.
+//		size_t first: the position of the first parcel of the slice.
+//		size_t end: the position one past the last parcel of the slice, above first.
+//		ColumnSummary* summary: the variable where the totals and extremes will get stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void summarizeCompressedColumns(const CountryColumns* columns, size_t first, size_t end, ColumnSummary* summary)
+{
+	int weights[COLUMN_BLOCK_SIZE];
+	Cents valuations[COLUMN_BLOCK_SIZE];
+
+	memset(summary, 0, sizeof(*summary));
+	summary->minValuation = LLONG_MAX;
+	summary->maxValuation = LLONG_MIN;
+	for (size_t block = first / COLUMN_BLOCK_SIZE; block * COLUMN_BLOCK_SIZE < end; block++)
+	{
+		size_t base = block * COLUMN_BLOCK_SIZE;
+		unsigned int count = decodeColumnBlock(columns, (unsigned int)block, weights, valuations);
+		size_t from = first > base ? first - base : 0;
+		size_t to = end - base < count ? end - base : count;
+		for (size_t i = from; i < to; i++)
+		{
+			summary->weightSum += weights[i];
+			summary->valuationSum += valuations[i];
+			if (valuations[i] < summary->minValuation)
+			{
+				summary->minValuation = valuations[i];
+				summary->cheapestWeight = weights[i];
+			}
+			if (valuations[i] > summary->maxValuation)
+			{
+				summary->maxValuation = valuations[i];
+				summary->mostExpensiveWeight = weights[i];
+			}
+		}
+	}
+}
+
+//
+// FUNCTION: printCompressedParcels
+// DESCRIPTION:
+//		This function prints a slice of compressed columns one parcel per line, decoding a block at a time.
+// PARAMETERS:
+//		const CountryColumns* columns: the compressed columns.
+//		const char* country: the name of the country of the parcels.
+//		size_t first: the position of the first parcel to be printed.
+//		size_t end: the position one past the last parcel to be printed.
+//		int decimals: 2 for the usual %.2f, 0 for the %2.f of the parcel listing.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void printCompressedParcels(const CountryColumns* columns, const char* country, size_t first, size_t end, int decimals)
+{
+	int weights[COLUMN_BLOCK_SIZE];
+	Cents valuations[COLUMN_BLOCK_SIZE];
+
+	for (size_t block = first / COLUMN_BLOCK_SIZE; block * COLUMN_BLOCK_SIZE < end; block++)
+	{
+		size_t base = block * COLUMN_BLOCK_SIZE;
+		unsigned int count = decodeColumnBlock(columns, (unsigned int)block, weights, valuations);
+		size_t from = first > base ? first - base : 0;
+		size_t to = end - base < count ? end - base : count;
+		for (size_t i = from; i < to; i++)
+		{
+			if (decimals == 0)
+			{
+				printf("Destoination: %s, Weight: %d, Valuation: %2.f\n", country, weights[i], centsToDollars(valuations[i]));
+			}
+			else
+			{
+				printf("Destination: %s, Weight: %d, Valuation: %.2f\n", country, weights[i], centsToDollars(valuations[i]));
+			}
+		}
+	}
+}
+
+//
+// FUNCTION: countryColumnBytes
+// DESCRIPTION:
+//		This function measures the memory held by the columns of a country, plain or compressed.
+// PARAMETERS:
+//		const CountryColumns* columns: the columns to be measured.
+// RETURNS:
+//		size_t: the number of bytes allocated for the columns.
+//
+size_t countryColumnBytes(const CountryColumns* columns)
+{
+	if (columns->blocks != NULL)
+	{
+		size_t blockCount = (columns->count + COLUMN_BLOCK_SIZE - 1) / COLUMN_BLOCK_SIZE;
+		size_t wordCount = ((size_t)columns->count * columns->valuationBits + 63) / 64 + 1;
+		return blockCount * sizeof(ColumnBlock) + columns->deltaBytes + 1 + wordCount * sizeof(unsigned long long);
+	}
+	return columns->weights != NULL ? (size_t)columns->count * (sizeof(int) + sizeof(ParcelCents)) : 0;
+}
+
+// 
+// FUNCTION: inOrderTraversal
+// DESCRIPTION:
+//		This function performs an iterative in-order traversal of the BST and prints
+//		the details of each parcel.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena and the country catalog.
+//		ParcelIndex root: the arena index of the root of the BST to be traversed.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void inOrderTraversal(const ParcelStore* store, ParcelIndex root)
+{
+	ParcelIterator iterator;
+	const Parcel* parcel;
+	unsigned int listed = 0;
+
+	initIterator(&iterator, store, root);
+	while ((parcel = nextParcel(&iterator)) != NULL)   // visit the parcels in weight order
+	{
+		printf("Destoination: %s, Weight: %d, Valuation: %2.f\n", store->catalog.names[parcel->countryId], parcel->weight, centsToDollars(parcel->valuation));   // print the parcel details
+		listed++;
+	}
+	STAT_ADD(STAT_PARCELS_RETURNED, listed);
+}
+
+//
+// FUNCTION: isValidCountry
+// DESCRIPTION: 
+//		This function checks if the provided country is in the list of valid countries.
+// PARAMETERS: 
+//		const char* country: the name of the country for checking.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		int: return 1 if the country is valid else return 0.
+//
+int isValidCountry(const char* country, const CountryList* validCountries)
+{
+	return findListedCountry(validCountries, country, strlen(country)) != -1;
+}
+
+//
+// FUNCTION: getValidWeight
+// DESCRIPTION:
+//		This function gets a valid weight input from user, verifying it is a number.
+// PARAMETERS:
+//		void: this function is not taking any parameters.
+// RETURNS:
+//		int: returns the valid weight entered by the user.
+//
+int getValidWeight()
+{
+	int weight;
+	int result;
+
+	while (1)
+	{
+		printf("Enter weight: ");
+		result = scanf_s("%d", &weight);
+
+		// clear the input buffer
+		while (getchar() != '\n');
+
+		if (result == 1 && weight > 0)
+		{
+			return weight;   // returns the valid weight
+		}
+		else
+		{
+			printf("Invalid input, please enter a valid weight.\n");
+		}
+	}
+}
+
+// 
+// FUNCTION: displayParcelsByCountry
+// DESCRIPTION:
+//		This function displays all parcels for given country by performing an in-order traversal of the BST.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which is cointaining the parcels.
+//		char* country: the name of the country whose parcels will get displayed.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void displayParcelsByCountry(ParcelStore* store, char* country, const CountryList* validCountries)
+{
+	STAT_TIME(STAT_OP_LIST);
+	if (!isValidCountry(country, validCountries))
+	{
+		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
+		return;
+	}
+
+	ParcelIndex root = loadCountryRoot(store, country);   // look up the BST of exactly this country
+	if (root != NULL_PARCEL && store->columnar)
+	{
+		const CountryColumns* columns = getCountryColumns(store, findCountryId(&store->catalog, country));
+		printf("Parcels for %s:\n", country);   // print country name
+		if (columns->blocks != NULL)
+		{
+			printCompressedParcels(columns, country, 0, columns->count, 0);
+		}
+		for (unsigned int i = 0; columns->blocks == NULL && i < columns->count; i++)   // the columns are already in weight order
+		{
+			printf("Destoination: %s, Weight: %d, Valuation: %2.f\n", country, columns->weights[i], centsToDollars(columns->valuations[i]));
+		}
+	}
+	else if (root != NULL_PARCEL)
+	{
+		printf("Parcels for %s:\n", country);   // print country name
+		inOrderTraversal(store, root);   // perform in-order traversal of BST to print all parcels
+	}
+	else
+	{
+		printf("No parcels found for %s.\n", country);   // print a message if no parcels are found
+	}
+}
+
+//
+// FUNCTION: findAndDisplayParcelsByWeight
+// DESCRIPTION: 
+//		This is the helper function which queries the BST for parcels based on the
+//		weight condition (higher or lower) and displays them page by page.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena and the country catalog.
+//		ParcelIndex root: the arena index of the root of the BST to be queried.
+//		int weight: the weight condition to check.
+//		int higher: flag indicating whether to check for weights higher (1) 
+//		or lower (2) that the provided weight.
+// RETURNS:
+//		int: returns 1 if matching parcel got found else o.
+//
+int findAndDisplayParcelsByWeight(const ParcelStore* store, ParcelIndex root, int weight, int higher)
+{
+	WeightRange range;
+	const Parcel* page[RANGE_PAGE_SIZE];
+	unsigned int offset = 0;
+	unsigned int count;
+
+	// strictly higher is (weight, INT_MAX], strictly lower is [INT_MIN, weight)
+	range.minWeight = higher ? weight : INT_MIN;
+	range.maxWeight = higher ? INT_MAX : weight;
+	range.minInclusive = !higher;
+	range.maxInclusive = higher;
+
+	while ((count = queryWeightRange(store, root, &range, offset, RANGE_PAGE_SIZE, page, NULL)) > 0)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			printf("Destination: %s, Weight: %d, Valuation: %.2f\n", store->catalog.names[page[i]->countryId], page[i]->weight, centsToDollars(page[i]->valuation));
+		}
+		offset += count;
+	}
+
+	return offset > 0;
+}
+
+//
+// FUNCTION: displayParcelsByCountryAndWeight
+// DESCRIPTION:
+//		This function displays parcels for a given country based on weight.(higher or lower than provided weight).
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which is cointaining the parcels.
+//		char* country: the name of the country whose parcels will get displayed.
+//		int weight: the weight condition to check.
+//		int higher: flag indicating whether to check for weights higher (1) 
+//		or lower (2) that the provided weight.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void displayPrcelsByCountryAndWeight(ParcelStore* store, char* country, int weight, int higher, const CountryList* validCountries)
+{
+	STAT_TIME(STAT_OP_WEIGHT);
+	if (!isValidCountry(country, validCountries))
+	{
+		printf("Erros: Given country name is not in the list.\n");
+		return;
+	}
+
+	ParcelIndex root = loadCountryRoot(store, country);   // look up the BST of exactly this country
+	int found;
+
+	if (store->columnar)
+	{
+		// strictly higher starts past the last equal weight, strictly lower ends before the first one
+		const CountryColumns* columns = getCountryColumns(store, findCountryId(&store->catalog, country));
+		found = 0;
+		if (columns != NULL)
+		{
+			size_t first;
+			size_t end;
+			if (columns->blocks != NULL)
+			{
+				first = higher ? compressedRank(columns, weight, 1) : 0;
+				end = higher ? columns->count : compressedRank(columns, weight, 0);
+				printCompressedParcels(columns, country, first, end, 2);
+			}
+			else
+			{
+				first = higher ? columnRank(columns->weights, columns->count, weight, 1) : 0;
+				end = higher ? columns->count : columnRank(columns->weights, columns->count, weight, 0);
+			}
+			for (size_t i = first; columns->blocks == NULL && i < end; i++)
+			{
+				printf("Destination: %s, Weight: %d, Valuation: %.2f\n", country, columns->weights[i], centsToDollars(columns->valuations[i]));
+			}
+			found = end > first;
+		}
+	}
+	else
+	{
+		// Traverse the BST to find and display parcels based on the weight condition
+		found = findAndDisplayParcelsByWeight(store, root, weight, higher);
+	}
+
+	if (!found)
+	{
+		printf("No parcel is found for specific weight conditon.\n");
+	}
+}
+
+//
+// FUNCTION: calculateTotalLoadAndValuation
+// DESCRIPTION:
+//		This is helper function to calculates the total weight and valuation of parcels in the BST.
+//		The totals are read from the aggregates of the root in O(1) instead of walking the tree.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: the arena index of the root of the BST.
+//		long long* totalWeight: a pointer to the variable where total weight will get stored.
+//		Cents* totalValuation: a pointer to the variable where total valuation will get stored.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void calculateTotalLoadAndValuation(const ParcelStore* store, ParcelIndex root, long long* totalweight, Cents* totalvaluation)
+{
+	if (root == NULL_PARCEL)
+	{
+		return;
+	}
+
+	// add the aggregates of the whole tree to the total
+	const ParcelAggregate* subtree = &getParcel(&store->arena, root)->subtree;
+	*totalweight += subtree->weightSum;
+	*totalvaluation += subtree->valuationSum;
+}
+
+//
+// FUNCTION: displayTotalLoadAndValuation
+// DESCRIPTION: 
+//		This function calculates and displays the total weight and valuation of all parcels for a given country.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which is cointaining the parcels.
+//		char* country: the name of the country whose total load and valuation of parcels will get displayed.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//
+void displayTotalLoadAndValuation(ParcelStore* store, char* country, const CountryList* validCountries)
+{
+	STAT_TIME(STAT_OP_TOTALS);
+	if (!isValidCountry(country, validCountries))
+	{
+		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
+		return;
+	}
+
+	ParcelIndex root = loadCountryRoot(store, country);   // look up the BST of exactly this country
+	long long totalWeight = 0;
+	Cents totalValuation = 0;
+
+	if (store->columnar)
+	{
+		// add up the columns with the SIMD kernels
+		const CountryColumns* columns = getCountryColumns(store, findCountryId(&store->catalog, country));
+		if (columns != NULL && columns->blocks != NULL)
+		{
+			ColumnSummary summary;
+			summarizeCompressedColumns(columns, 0, columns->count, &summary);
+			totalWeight = summary.weightSum;
+			totalValuation = summary.valuationSum;
+		}
+		else if (columns != NULL)
+		{
+			totalWeight = sumWeightColumn(columns->weights, columns->count);
+			totalValuation = sumValuationColumn(columns->valuations, columns->count);
+		}
+	}
+	else
+	{
+		// read the sum of the weight and valuations from the BST
+		calculateTotalLoadAndValuation(store, root, &totalWeight, &totalValuation);
+	}
+
+	// print the total weight and valuation for the country
+	if (totalWeight > 0 || totalValuation > 0)
+	{
+		printf("Total load for %s: %lld grams\n", country, totalWeight);
+		printf("Total valuation for %s: $%.2f\n", country, centsToDollars(totalValuation));
+	}
+	else
+	{
+		printf("No parcels found for %s.\n", country);   // print a message if no parcels are found
+	}
+}
+
+//
+// FUNCTION: findCheapestAndMostExpensive
+// DESCRIPTION: 
+//		This function finds cheapest and most expensive parcel in the BST in O(1)
+//		from the aggregates of the root.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: arena index of the root of BST.
+//		const Parcel** cheapest: double pointer to the variable where cheapest parcel will get stored.
+//		const Parcel** mostExpensive: double pointer to variable where most expensive parcel will get stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void findCheapestAndMostExpensive(const ParcelStore* store, ParcelIndex root, const Parcel** cheapest, const Parcel** mostExpensive)
+{
+	if (root == NULL_PARCEL)
+	{
+		return;
+	}
+
+	const ParcelAggregate* subtree = &getParcel(&store->arena, root)->subtree;
+	const Parcel* treeCheapest = getParcel(&store->arena, subtree->cheapest);
+	const Parcel* treeMostExpensive = getParcel(&store->arena, subtree->mostExpensive);
+
+	// check if the cheapest parcel of the tree is cheapest
+	if (*cheapest == NULL || treeCheapest->valuation < (*cheapest)->valuation)
+	{
+		*cheapest = treeCheapest;
+	}
+
+	// check if the most expensive parcel of the tree is most expensive
+	if (*mostExpensive == NULL || treeMostExpensive->valuation > (*mostExpensive)->valuation)
+	{
+		*mostExpensive = treeMostExpensive;
+	}
+}
+
+//
+// FUNCTION: displayCheapestAndMostExpensive
+// DESCRIPTION:
+//		This function finds and displays the cheapest and most expensive parcels for a given country.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		char* country: the name of the country whose cheapest and most expensive parcels are to be displayed.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS :
+//		void: This function does not return a value.
+//
+void displayCheapestAndMostExpensive(ParcelStore* store, char* country, const CountryList* validCountries) 
+{
+	STAT_TIME(STAT_OP_CHEAPEST);
+	if (!isValidCountry(country, validCountries)) 
+	{
+		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
+		return;
+	}
+
+	ParcelIndex root = loadCountryRoot(store, country);   // look up the BST of exactly this country
+	const Parcel* cheapest = NULL;
+	const Parcel* mostExpensive = NULL;
+
+	if (store->columnar && root != NULL_PARCEL)
+	{
+		const CountryColumns* columns = getCountryColumns(store, findCountryId(&store->catalog, country));
+		size_t low;
+		size_t high;
+		if (columns->blocks != NULL)
+		{
+			ColumnSummary summary;
+			summarizeCompressedColumns(columns, 0, columns->count, &summary);
+			printf("Cheapest parcel for %s: Weight: %d, Valuation: %.2f\n", country, summary.cheapestWeight, centsToDollars(summary.minValuation));
+			printf("Most expensive parcel for %s: Weight: %d, Valuation: %.2f\n", country, summary.mostExpensiveWeight, centsToDollars(summary.maxValuation));
+			return;
+		}
+		findValuationExtremes(columns->valuations, columns->count, &low, &high);
+		printf("Cheapest parcel for %s: Weight: %d, Valuation: %.2f\n", country, columns->weights[low], centsToDollars(columns->valuations[low]));
+		printf("Most expensive parcel for %s: Weight: %d, Valuation: %.2f\n", country, columns->weights[high], centsToDollars(columns->valuations[high]));
+		return;
+	}
+
+	// Read the cheapest and most expensive parcels from the BST aggregates
+	findCheapestAndMostExpensive(store, root, &cheapest, &mostExpensive);
+
+	// Print the details of the cheapest and most expensive parcels
+	if (cheapest && mostExpensive) 
+	{
+		printf("Cheapest parcel for %s: Weight: %d, Valuation: %.2f\n", country, cheapest->weight, centsToDollars(cheapest->valuation));
+		printf("Most expensive parcel for %s: Weight: %d, Valuation: %.2f\n", country, mostExpensive->weight, centsToDollars(mostExpensive->valuation));
+	}
+	else 
+	{
+		printf("No parcels found for %s.\n", country);  // print a message if no parcels are found
+	}
+}
+
+//
+// FUNCTION: findLighestAndHeaviest
+// DESCRIPTION: 
+//		This function find the lightest and heaviest parcel in BST in O(log n). The lightest
+//		parcel is the leftmost node and the heaviest is the first node holding the largest weight.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: arena index of the root of BST to be searched.
+//		const Parcel** lightest: double pointer to variable where lightest parcel will get stored.
+//		const Parcel** heaviest: double pointer to variable where heaviest parcel will get stored.
+// RETURN:
+//		void: this function does not return a value.
+//
+void findLightestAndHeaviest(const ParcelStore* store, ParcelIndex root, const Parcel** lightest, const Parcel** heaviest)
+{
+	if (root == NULL_PARCEL)
+	{
+		return;
+	}
+
+	ParcelIndex first = root;
+	ParcelIndex last = root;
+	while (getParcel(&store->arena, first)->left != NULL_PARCEL)
+	{
+		first = getParcel(&store->arena, first)->left;   // leftmost node holds the smallest weight
+	}
+	while (getParcel(&store->arena, last)->right != NULL_PARCEL)
+	{
+		last = getParcel(&store->arena, last)->right;   // rightmost node holds the largest weight
+	}
+
+	const Parcel* treeLightest = getParcel(&store->arena, first);
+	const Parcel* treeHeaviest = getParcel(&store->arena, findFirstAtLeast(store, root, getParcel(&store->arena, last)->weight));
+
+	// check if the lightest parcel of the tree is the lightest
+	if (*lightest == NULL || treeLightest->weight < (*lightest)->weight)
+	{
+		*lightest = treeLightest;
+	}
+
+	// check if the heaviest parcel of the tree is the heaviest
+	if (*heaviest == NULL || treeHeaviest->weight > (*heaviest)->weight)
+	{
+		*heaviest = treeHeaviest;
+	}
+}
+
+//
+// FUNCTION: displayLightestAndHeaviest
+// DESCRIPTION:
+//		This function finds and displays the lightest and heaviest parcels for a given country.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		char* country: the name of the country whose lightest and heaviest parcels are to be displayed.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void displayLightestAndHeaviest(ParcelStore* store, char* country, const CountryList* validCountries)
+	{
+	STAT_TIME(STAT_OP_LIGHTEST);
+	 if (!isValidCountry(country, validCountries)) 
+	 {
+		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
+		return;
+	 }
+
+	ParcelIndex root = loadCountryRoot(store, country);   // look up the BST of exactly this country
+	const Parcel* lightest = NULL;
+	const Parcel* heaviest = NULL;
+
+	if (store->columnar && root != NULL_PARCEL)
+	{
+		// the first position is the lightest, the heaviest is the first position holding the last weight
+		const CountryColumns* columns = getCountryColumns(store, findCountryId(&store->catalog, country));
+		if (columns->blocks != NULL)
+		{
+			int weight;
+			Cents valuation;
+			compressedParcelAt(columns, columns->count - 1, &weight, &valuation);
+			compressedParcelAt(columns, compressedRank(columns, weight, 0), &weight, &valuation);
+			printf("Lightest parcel for %s: Weight: %d, Valuation: %.2f\n", country, columns->blocks[0].firstWeight, centsToDollars(packedValuationAt(columns, 0)));
+			printf("Heaviest parcel for %s: Weight: %d, Valuation: %.2f\n", country, weight, centsToDollars(valuation));
+			return;
+		}
+		size_t last = columnRank(columns->weights, columns->count, columns->weights[columns->count - 1], 0);
+		printf("Lightest parcel for %s: Weight: %d, Valuation: %.2f\n", country, columns->weights[0], centsToDollars(columns->valuations[0]));
+		printf("Heaviest parcel for %s: Weight: %d, Valuation: %.2f\n", country, columns->weights[last], centsToDollars(columns->valuations[last]));
+		return;
+	}
+
+	// Search the BST for the lightest and heaviest parcels
+	findLightestAndHeaviest(store, root, &lightest, &heaviest);
+
+	// Print the details of the lightest and heaviest parcels
+	if (lightest && heaviest) 
+	{
+		printf("Lightest parcel for %s: Weight: %d, Valuation: %.2f\n", country, lightest->weight, centsToDollars(lightest->valuation));
+		printf("Heaviest parcel for %s: Weight: %d, Valuation: %.2f\n", country, heaviest->weight, centsToDollars(heaviest->valuation));
+	}
+	else 
+	{
+		printf("No parcels found for %s.\n", country);  // print a message if no parcels are found
+	} 
+}
+
+//
+// FUNCTION: displayColumnRangeSummary
+// DESCRIPTION:
+//		This function displays the weight range summary from the columnar segment of a country,
+//		binary searching the range bounds and running the SIMD kernels over the slice between them.
+// PARAMETERS:
+//		const CountryColumns* columns: the columns of the country, or NULL if it has no parcels.
+//		const char* country: the name of the country whose parcels are summarized.
+//		int minWeight: the smallest weight in the range.
+//		int maxWeight: the largest weight in the range.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void displayColumnRangeSummary(const CountryColumns* columns, const char* country, int minWeight, int maxWeight)
+{
+	size_t first = 0;
+	size_t end = 0;
+
+	if (columns != NULL && minWeight <= maxWeight && columns->blocks != NULL)
+	{
+		first = compressedRank(columns, minWeight, 0);
+		end = compressedRank(columns, maxWeight, 1);
+	}
+	else if (columns != NULL && minWeight <= maxWeight)
+	{
+		first = columnRank(columns->weights, columns->count, minWeight, 0);
+		end = columnRank(columns->weights, columns->count, maxWeight, 1);
+	}
+
+	if (end <= first)
+	{
+		printf("No parcels found for %s between %d and %d grams.\n", country, minWeight, maxWeight);
+		return;
+	}
+
+	if (columns->blocks != NULL)
+	{
+		ColumnSummary summary;
+		summarizeCompressedColumns(columns, first, end, &summary);
+		printf("Parcels for %s between %d and %d grams: %u\n", country, minWeight, maxWeight, (unsigned int)(end - first));
+		printf("Total load: %lld grams, total valuation: $%.2f\n", summary.weightSum, centsToDollars(summary.valuationSum));
+		printf("Cheapest parcel: Weight: %d, Valuation: %.2f\n", summary.cheapestWeight, centsToDollars(summary.minValuation));
+		printf("Most expensive parcel: Weight: %d, Valuation: %.2f\n", summary.mostExpensiveWeight, centsToDollars(summary.maxValuation));
+		return;
+	}
+
+	size_t cheapest;
+	size_t mostExpensive;
+	findValuationExtremes(columns->valuations + first, end - first, &cheapest, &mostExpensive);
+	cheapest += first;
+	mostExpensive += first;
+	printf("Parcels for %s between %d and %d grams: %u\n", country, minWeight, maxWeight, (unsigned int)(end - first));
+	printf("Total load: %lld grams, total valuation: $%.2f\n", sumWeightColumn(columns->weights + first, end - first),
+		centsToDollars(sumValuationColumn(columns->valuations + first, end - first)));
+	printf("Cheapest parcel: Weight: %d, Valuation: %.2f\n", columns->weights[cheapest], centsToDollars(columns->valuations[cheapest]));
+	printf("Most expensive parcel: Weight: %d, Valuation: %.2f\n", columns->weights[mostExpensive], centsToDollars(columns->valuations[mostExpensive]));
+}
+
+//
+// FUNCTION: displayWeightRangeSummary
+// DESCRIPTION:
+//		This function displays the count, total load, total valuation and the cheapest and most
+//		expensive parcels of a country within a weight range, using the O(log n) range aggregates.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		char* country: the name of the country whose parcels are summarized.
+//		int minWeight: the smallest weight in the range.
+//		int maxWeight: the largest weight in the range.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void displayWeightRangeSummary(ParcelStore* store, char* country, int minWeight, int maxWeight, const CountryList* validCountries)
+{
+	STAT_TIME(STAT_OP_RANGE);
+	if (!isValidCountry(country, validCountries))
+	{
+		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
+		return;
+	}
+
+	ParcelIndex root = loadCountryRoot(store, country);   // look up the BST of exactly this country
+	if (store->columnar)
+	{
+		displayColumnRangeSummary(getCountryColumns(store, findCountryId(&store->catalog, country)), country, minWeight, maxWeight);
+		return;
+	}
+
+	ParcelAggregate range;
+	aggregateWeightRange(store, root, minWeight, maxWeight, &range);
+
+	if (range.count == 0)
+	{
+		printf("No parcels found for %s between %d and %d grams.\n", country, minWeight, maxWeight);
+		return;
+	}
+
+	const Parcel* cheapest = getParcel(&store->arena, range.cheapest);
+	const Parcel* mostExpensive = getParcel(&store->arena, range.mostExpensive);
+	printf("Parcels for %s between %d and %d grams: %u\n", country, minWeight, maxWeight, range.count);
+	printf("Total load: %lld grams, total valuation: $%.2f\n", range.weightSum, centsToDollars(range.valuationSum));
+	printf("Cheapest parcel: Weight: %d, Valuation: %.2f\n", cheapest->weight, centsToDollars(cheapest->valuation));
+	printf("Most expensive parcel: Weight: %d, Valuation: %.2f\n", mostExpensive->weight, centsToDollars(mostExpensive->valuation));
+}
+
+//
+// FUNCTION: getValidValuation
+// DESCRIPTION:
+//		This function reads a valuation from the user until a valid one is entered. It is parsed
+//		the same way as the manifest, so it matches the stored valuation of a parcel exactly.
+// PARAMETERS:
+//		void: this function does not take any parameters.
+// RETURNS:
+//		Cents: the valuation entered by the user.
+//
+Cents getValidValuation()
+{
+	char text[32];
+	Cents valuation;
+	int result;
+
+	while (1)
+	{
+		printf("Enter valuation: ");
+		result = scanf_s("%31s", text, (unsigned)_countof(text));
+
+		// clear the input buffer
+		while (getchar() != '\n');
+
+		const char* cursor = text;
+		if (result == 1 && parseCents(&cursor, text + strlen(text), &valuation) && *cursor == '\0' && valuation >= 0 && valuation <= PARCEL_MAX_VALUATION)
+		{
+			return valuation;   // returns the valid valuation
+		}
+		else
+		{
+			printf("Invalid input, please enter a valid valuation.\n");
+		}
+	}
+}
+
+//
+// FUNCTION: dispatchParcel
+// DESCRIPTION:
+//		This function removes a dispatched parcel of the given country, weight and valuation.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which is cointaining the parcels.
+//		char* country: the name of the country of the parcel.
+//		int weight: the weight of the parcel in grams.
+//		Cents valuation: the valuation of the parcel.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void dispatchParcel(ParcelStore* store, char* country, int weight, Cents valuation, const CountryList* validCountries)
+{
+	if (!isValidCountry(country, validCountries))
+	{
+		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
+		return;
+	}
+
+	ParcelIndex id = findParcel(store, loadCountryRoot(store, country), weight, valuation);
+	if (!removeParcel(store, id))
+	{
+		printf("No parcel of %d grams valued at $%.2f found for %s.\n", weight, centsToDollars(valuation), country);
+		return;
+	}
+	printf("Removed the parcel of %d grams valued at $%.2f for %s.\n", weight, centsToDollars(valuation), country);
+}
+
+//
+// FUNCTION: reweighParcel
+// DESCRIPTION:
+//		This function gives the parcel of the given country, weight and valuation a new weight
+//		and valuation.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which is cointaining the parcels.
+//		char* country: the name of the country of the parcel.
+//		int weight: the current weight of the parcel in grams.
+//		Cents valuation: the current valuation of the parcel.
+//		int newWeight: the new weight of the parcel in grams.
+//		Cents newValuation: the new valuation of the parcel.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void reweighParcel(ParcelStore* store, char* country, int weight, Cents valuation, int newWeight, Cents newValuation, const CountryList* validCountries)
+{
+	if (!isValidCountry(country, validCountries))
+	{
+		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
+		return;
+	}
+
+	ParcelIndex id = findParcel(store, loadCountryRoot(store, country), weight, valuation);
+	if (!updateParcel(store, id, newWeight, newValuation))
+	{
+		printf("No parcel of %d grams valued at $%.2f found for %s.\n", weight, centsToDollars(valuation), country);
+		return;
+	}
+	printf("The parcel for %s now weighs %d grams and is valued at $%.2f.\n", country, newWeight, centsToDollars(newValuation));
+}
+
+//
+// FUNCTION: getValidCount
+// DESCRIPTION:
+//		This function reads a number of parcels from the user until a valid one is entered.
+// PARAMETERS:
+//		void: this function does not take any parameters.
+// RETURNS:
+//		int: the number entered by the user.
+//
+int getValidCount()
+{
+	int count;
+	int result;
+
+	while (1)
+	{
+		printf("Enter number of parcels: ");
+		result = scanf_s("%d", &count);
+
+		// clear the input buffer
+		while (getchar() != '\n');
+
+		if (result == 1 && count > 0)
+		{
+			return count;   // returns the valid count
+		}
+		else
+		{
+			printf("Invalid input, please enter a valid number of parcels.\n");
+		}
+	}
+}
+
+//
+// FUNCTION: findValuationCountry
+// DESCRIPTION:
+//		This function turns the country name of a valuation query into a country id, accepting
+//		"all" for the parcels of every country, and builds the BSTs the query reads when the store
+//		is loaded lazily.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		const char* country: the name entered by the user.
+//		const CountryList* validCountries: the list of valid countries.
+//		int* countryId: the variable where the id will get stored, -1 for every country.
+// RETURNS:
+//		int: returns 1 if the name is valid and has parcels else 0, after telling the user why.
+//
+int findValuationCountry(ParcelStore* store, const char* country, const CountryList* validCountries, int* countryId)
+{
+	if (strcmp(country, "all") == 0)
+	{
+		*countryId = -1;
+		materializeAllCountries(store);
+		return 1;
+	}
+	if (!isValidCountry(country, validCountries))
+	{
+		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
+		return 0;
+	}
+	*countryId = findCountryId(&store->catalog, country);
+	if (*countryId < 0)
+	{
+		printf("No parcels found for %s.\n", country);   // a valid country which never got a parcel
+		return 0;
+	}
+	if (store->lazy.active)
+	{
+		materializeCountry(store, *countryId);
+	}
+	return 1;
+}
+
+//
+// FUNCTION: displayValuationExtremes
+// DESCRIPTION:
+//		This function displays the most or least valuable parcels of a country, or of every
+//		country, from the valuation index.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which is cointaining the parcels.
+//		char* country: the name of the country, or "all".
+//		int count: the number of parcels to display.
+//		int highest: 1 for the most valuable parcels, 0 for the least valuable.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void displayValuationExtremes(ParcelStore* store, char* country, int count, int highest, const CountryList* validCountries)
+{
+	int countryId;
+
+	if (!findValuationCountry(store, country, validCountries, &countryId))
+	{
+		return;
+	}
+
+	const ValuationEntry** results = (const ValuationEntry**)malloc((size_t)count * sizeof(ValuationEntry*));
+	if (results == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for valuation query.\n");
+		return;
+	}
+	unsigned int found = queryValuationExtremes(store, countryId, (unsigned int)count, highest, results);
+	if (found == 0)
+	{
+		printf("No parcels found for %s.\n", country);
+	}
+	else
+	{
+		printf("The %u %s valuable parcels for %s:\n", found, highest ? "most" : "least", country);
+	}
+	for (unsigned int i = 0; i < found; i++)
+	{
+		printf("Destination: %s, Weight: %d, Valuation: %.2f\n", store->catalog.names[results[i]->countryId], results[i]->weight, centsToDollars(results[i]->valuation));
+	}
+	free((void*)results);
+}
+
+//
+// FUNCTION: displayValuationRange
+// DESCRIPTION:
+//		This function displays the parcels of a country, or of every country, valued between two
+//		bounds in ascending valuation order, fetching them page by page from the valuation index.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which is cointaining the parcels.
+//		char* country: the name of the country, or "all".
+//		Cents minValuation: the lowest valuation.
+//		Cents maxValuation: the highest valuation.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void displayValuationRange(ParcelStore* store, char* country, Cents minValuation, Cents maxValuation, const CountryList* validCountries)
+{
+	const ValuationEntry* page[RANGE_PAGE_SIZE];
+	unsigned int offset = 0;
+	unsigned int total = 0;
+	unsigned int count;
+	int countryId;
+
+	if (!findValuationCountry(store, country, validCountries, &countryId))
+	{
+		return;
+	}
+
+	while ((count = queryValuationRange(store, countryId, minValuation, maxValuation, offset, RANGE_PAGE_SIZE, page, &total)) > 0)
+	{
+		if (offset == 0)
+		{
+			printf("Parcels for %s valued between $%.2f and $%.2f: %u\n", country, centsToDollars(minValuation), centsToDollars(maxValuation), total);
+		}
+		for (unsigned int i = 0; i < count; i++)
+		{
+			printf("Destination: %s, Weight: %d, Valuation: %.2f\n", store->catalog.names[page[i]->countryId], page[i]->weight, centsToDollars(page[i]->valuation));
+		}
+		offset += count;
+	}
+	if (offset == 0)
+	{
+		printf("No parcels found for %s between $%.2f and $%.2f.\n", country, centsToDollars(minValuation), centsToDollars(maxValuation));
+	}
+}
+
+//
+// FUNCTION: displayWeightValuationBox
+// DESCRIPTION:
+//		This function displays the count and totals of the parcels of a country, or of every
+//		country, inside a weight range and a valuation range, followed by the parcels themselves
+//		by weight. Both bounds are answered together from the k-d trees, so no parcel outside the
+//		box has to be read.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which is cointaining the parcels.
+//		char* country: the name of the country, or "all".
+//		int minWeight: the smallest weight.
+//		int maxWeight: the largest weight.
+//		Cents minValuation: the lowest valuation.
+//		Cents maxValuation: the highest valuation.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void displayWeightValuationBox(ParcelStore* store, char* country, int minWeight, int maxWeight, Cents minValuation, Cents maxValuation, const CountryList* validCountries)
+{
+	STAT_TIME(STAT_OP_BOX);
+	BoxRange box = { minWeight, maxWeight, minValuation, maxValuation };
+	const BoxRange* range = &box;
+	BoxTotals all;
+	BoxTotals totals;
+	unsigned int largest = 0;
+	int countryId;
+
+	if (!findValuationCountry(store, country, validCountries, &countryId))
+	{
+		return;
+	}
+
+	// count first, so the parcels of the largest country fit into one buffer
+	memset(&all, 0, sizeof(all));
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		if ((countryId < 0 || (int)id == countryId) && getCountryBoxes(store, (int)id) != NULL)
+		{
+			queryWeightValuationBox(store, (int)id, range, &totals, NULL);
+			all.count += totals.count;
+			all.weightSum += totals.weightSum;
+			all.valuationSum += totals.valuationSum;
+			largest = totals.count > largest ? totals.count : largest;
+		}
+	}
+	if (all.count == 0)
+	{
+		printf("No parcels found for %s between %d and %d grams valued between $%.2f and $%.2f.\n", country, range->minWeight,
+			range->maxWeight, centsToDollars(range->minValuation), centsToDollars(range->maxValuation));
+		return;
+	}
+
+	BoxPoint* matches = (BoxPoint*)malloc((size_t)largest * sizeof(BoxPoint));
+	if (matches == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for box query.\n");
+		return;
+	}
+	printf("Parcels for %s between %d and %d grams valued between $%.2f and $%.2f: %u\n", country, range->minWeight,
+		range->maxWeight, centsToDollars(range->minValuation), centsToDollars(range->maxValuation), all.count);
+	printf("Total load: %lld grams, total valuation: $%.2f\n", all.weightSum, centsToDollars(all.valuationSum));
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		if ((countryId < 0 || (int)id == countryId) && store->catalog.roots[id] != NULL_PARCEL)
+		{
+			queryWeightValuationBox(store, (int)id, range, &totals, matches);
+			for (unsigned int i = 0; i < totals.count; i++)
+			{
+				printf("Destination: %s, Weight: %d, Valuation: %.2f\n", store->catalog.names[id], matches[i].weight, centsToDollars(matches[i].valuation));
+			}
+		}
+	}
+	free(matches);
+}
+
+//
+// FUNCTION: initOutputBuffer
+// DESCRIPTION:
+//		This function sets up a large output buffer in front of a stream, so results are
+//		written with a few big fwrite calls instead of one printf per row.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to be set up.
+//		FILE* file: the stream the buffer is flushed to, NULL to only collect the output in memory.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void initOutputBuffer(OutputBuffer* out, FILE* file)
+{
+	out->capacity = OUTPUT_BUFFER_SIZE;
+	out->used = 0;
+	out->file = file;
+	out->data = (char*)malloc(out->capacity);
+	if (out->data == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for output buffer.\n");
+		exit(1);
+	}
+}
+
+//
+// FUNCTION: flushOutputBuffer
+// DESCRIPTION:
+//		This function writes the buffered bytes to the stream of the buffer. A buffer without a
+//		stream keeps its bytes and grows instead.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to be flushed.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void flushOutputBuffer(OutputBuffer* out)
+{
+	if (out->file != NULL && out->used > 0)
+	{
+		fwrite(out->data, 1, out->used, out->file);
+		out->used = 0;
+	}
+}
+
+//
+// FUNCTION: reserveOutput
+// DESCRIPTION:
+//		This function makes room for a number of bytes at the end of the buffer, flushing
+//		or growing it when needed.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		size_t length: the number of bytes about to be written.
+// RETURNS:
+//		char*: where the bytes have to be written.
+//
+static char* reserveOutput(OutputBuffer* out, size_t length)
+{
+	if (out->used + length > out->capacity)
+	{
+		flushOutputBuffer(out);
+		if (out->used + length > out->capacity)
+		{
+			size_t capacity = out->capacity * 2 > out->used + length ? out->capacity * 2 : out->used + length;
+			char* data = (char*)realloc(out->data, capacity);
+			if (data == NULL)
+			{
+				fprintf(stderr, "Error: Memory allocation failed for output buffer.\n");
+				exit(1);
+			}
+			out->data = data;
+			out->capacity = capacity;
+		}
+	}
+	return out->data + out->used;
+}
+
+//
+// FUNCTION: writeBytes
+// DESCRIPTION:
+//		This function appends bytes to the output buffer.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		const char* bytes: the bytes to be written.
+//		size_t length: the number of bytes.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeBytes(OutputBuffer* out, const char* bytes, size_t length)
+{
+	memcpy(reserveOutput(out, length), bytes, length);
+	out->used += length;
+}
+
+//
+// FUNCTION: writeString
+// DESCRIPTION:
+//		This function appends a NUL terminated string to the output buffer.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		const char* text: the string to be written.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeString(OutputBuffer* out, const char* text)
+{
+	writeBytes(out, text, strlen(text));
+}
+
+//
+// FUNCTION: writeInteger
+// DESCRIPTION:
+//		This function appends the decimal digits of an integer to the output buffer, the
+//		same text printf gives for %lld.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		long long value: the integer to be written.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeInteger(OutputBuffer* out, long long value)
+{
+	char digits[24];
+	int length = 0;
+	unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+
+	do
+	{
+		digits[sizeof(digits) - 1 - length++] = (char)('0' + magnitude % 10);   // digits are produced from the right
+		magnitude /= 10;
+	} while (magnitude > 0);
+	if (value < 0)
+	{
+		digits[sizeof(digits) - 1 - length++] = '-';
+	}
+	writeBytes(out, digits + sizeof(digits) - length, (size_t)length);
+}
+
+//
+// FUNCTION: writeCents
+// DESCRIPTION:
+//		This function appends an amount of cents in dollars with a fixed number of decimals, the
+//		same text printf gives for %.0f or %.2f of the amount. The digits come straight from the
+//		integer, so no amount is ever rounded on the way; whole dollars round half to even like printf.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		Cents value: the amount to be written.
+//		int decimals: the number of decimals, 0 or 2.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeCents(OutputBuffer* out, Cents value, int decimals)
+{
+	int negative = value < 0;
+	unsigned long long whole = negative ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+
+	if (decimals == 0)
+	{
+		unsigned long long fraction = whole % 100;
+		whole /= 100;
+		if (fraction > 50 || (fraction == 50 && (whole & 1) != 0))
+		{
+			whole++;
+		}
+	}
+
+	char digits[32];
+	int length = 0;
+	if (decimals > 0)
+	{
+		digits[sizeof(digits) - 1 - length++] = (char)('0' + whole % 10);
+		digits[sizeof(digits) - 1 - length++] = (char)('0' + whole / 10 % 10);
+		digits[sizeof(digits) - 1 - length++] = '.';
+		whole /= 100;
+	}
+	do
+	{
+		digits[sizeof(digits) - 1 - length++] = (char)('0' + whole % 10);
+		whole /= 10;
+	} while (whole > 0);
+	if (negative)
+	{
+		digits[sizeof(digits) - 1 - length++] = '-';
+	}
+	writeBytes(out, digits + sizeof(digits) - length, (size_t)length);
+}
+
+//
+// FUNCTION: writeSketchDistribution
+// DESCRIPTION:
+//		This function writes the median, p90 and p99 of one sketch and a histogram of equal
+//		width buckets between its smallest and largest value, with the estimated parcels per bucket.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		const char* label: the name of the measure, "Weight" or "Valuation".
+//		const QuantileSketch* sketch: the sketch, not empty.
+//		int money: 1 to write the values as dollars, 0 as grams.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeSketchDistribution(OutputBuffer* out, const char* label, const QuantileSketch* sketch, int money)
+{
+	static const double fractions[] = { 0.0, 0.5, 0.9, 0.99, 1.0 };
+	static const char* const names[] = { "min", "p50", "p90", "p99", "max" };
+	char line[160];
+	SketchItem* items = (SketchItem*)malloc(SKETCH_CAPACITY * sizeof(SketchItem));
+	if (items == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for quantile query.\n");
+		return;
+	}
+	unsigned int itemCount = sortSketchItems(sketch, items);
+
+	writeString(out, label);
+	writeBytes(out, ":", 1);
+	for (int i = 0; i < 5; i++)
+	{
+		long long value = sketchQuantile(sketch, items, itemCount, fractions[i]);
+		if (money)
+		{
+			snprintf(line, sizeof(line), " %s $%.2f", names[i], centsToDollars(value));
+		}
+		else
+		{
+			snprintf(line, sizeof(line), " %s %lld", names[i], value);
+		}
+		writeString(out, line);
+		writeString(out, i < 4 ? "," : money ? "\n" : " grams\n");
+	}
+
+	long long width = (sketch->maximum - sketch->minimum) / SKETCH_HISTOGRAM_BUCKETS + 1;
+	unsigned long long below = 0;
+	writeString(out, label);
+	writeString(out, " histogram:\n");
+	for (long long lower = sketch->minimum; lower <= sketch->maximum; lower += width)
+	{
+		long long upper = sketch->maximum - lower < width ? sketch->maximum : lower + width - 1;
+		unsigned long long rank = sketchRank(sketch, items, itemCount, upper);
+		if (money)
+		{
+			snprintf(line, sizeof(line), "  $%.2f to $%.2f: about %llu parcels\n", centsToDollars(lower), centsToDollars(upper), rank - below);
+		}
+		else
+		{
+			snprintf(line, sizeof(line), "  %lld to %lld grams: about %llu parcels\n", lower, upper, rank - below);
+		}
+		writeString(out, line);
+		below = rank;
+		if (upper == sketch->maximum)
+		{
+			break;
+		}
+	}
+	free(items);
+}
+
+//
+// FUNCTION: writeQuantileReport
+// DESCRIPTION:
+//		This function writes the weight and valuation distributions of merged sketches as the
+//		interactive menu shows them.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		const char* country: the name of the country, or "all".
+//		const CountrySketches* merged: the sketches of the country, or of every country.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeQuantileReport(OutputBuffer* out, const char* country, const CountrySketches* merged)
+{
+	char line[160];
+
+	if (merged->weights.count == 0)
+	{
+		snprintf(line, sizeof(line), "No parcels found for %s.\n", country);
+		writeString(out, line);
+		return;
+	}
+	snprintf(line, sizeof(line), "Distribution for %s, %llu parcels (ranks within about 1.7%%):\n", country, merged->weights.count);
+	writeString(out, line);
+	writeSketchDistribution(out, "Weight", &merged->weights, 0);
+	writeSketchDistribution(out, "Valuation", &merged->valuations, 1);
+}
+
+//
+// FUNCTION: displayQuantiles
+// DESCRIPTION:
+//		This function displays the weight and valuation distributions of a country from its
+//		quantile sketches, or of every country by merging the sketches of all of them, without
+//		scanning or sorting the parcels.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store which is cointaining the parcels.
+//		char* country: the name of the country, or "all".
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void displayQuantiles(ParcelStore* store, char* country, const CountryList* validCountries)
+{
+	STAT_TIME(STAT_OP_QUANTILES);
+	int countryId;
+
+	if (!findValuationCountry(store, country, validCountries, &countryId))
+	{
+		return;
+	}
+
+	CountrySketches* merged = (CountrySketches*)malloc(sizeof(CountrySketches));
+	if (merged == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for quantile query.\n");
+		return;
+	}
+	initQuantileSketch(&merged->weights);
+	initQuantileSketch(&merged->valuations);
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		const CountrySketches* sketches = countryId < 0 || (int)id == countryId ? getCountrySketches(store, (int)id) : NULL;
+		if (sketches != NULL)
+		{
+			mergeQuantileSketch(&merged->weights, &sketches->weights);
+			mergeQuantileSketch(&merged->valuations, &sketches->valuations);
+		}
+	}
+
+	OutputBuffer out;
+	initOutputBuffer(&out, stdout);
+	writeQuantileReport(&out, country, merged);
+	flushOutputBuffer(&out);
+	free(out.data);
+	free(merged);
+}
+
+//
+// FUNCTION: writeQuoted
+// DESCRIPTION:
+//		This function appends a string as a JSON string literal, or as a CSV field quoted
+//		only when it holds a separator or a quote.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		const char* text: the string to be written.
+//		OutputFormat format: OUTPUT_JSON or OUTPUT_CSV.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeQuoted(OutputBuffer* out, const char* text, OutputFormat format)
+{
+	if (format == OUTPUT_CSV && strpbrk(text, ",\"\r\n") == NULL)
+	{
+		writeString(out, text);
+		return;
+	}
+
+	writeBytes(out, "\"", 1);
+	for (const char* p = text; *p != '\0'; p++)
+	{
+		if (*p == '"')
+		{
+			writeBytes(out, format == OUTPUT_JSON ? "\\\"" : "\"\"", 2);
+		}
+		else if (format == OUTPUT_JSON && *p == '\\')
+		{
+			writeBytes(out, "\\\\", 2);
+		}
+		else if (format == OUTPUT_JSON && (unsigned char)*p < 0x20)
+		{
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)*p);
+			writeString(out, escape);
+		}
+		else
+		{
+			writeBytes(out, p, 1);
+		}
+	}
+	writeBytes(out, "\"", 1);
+}
+
+//
+// FUNCTION: parseBatchQuery
+// DESCRIPTION:
+//		This function parses one line of a batch file. The fields are separated by commas like
+//		the rows of couriers.txt, the first one names the operation by menu number or by word:
+//			list,<country>                    (1)
+//			weight,<country>,higher|lower,<grams>   (2)
+//			totals,<country>                  (3)
+//			cheapest,<country>                (4)
+//			lightest,<country>                (5)
+//			range,<country>,<min>,<max>       (9)
+//			top-k,<country|all>,<count>,most|least   (12)
+//			valuation-range,<country|all>,<lowest>,<highest>   (13)
+//			quantiles,<country|all>           (15)
+//			box,<country>,<min>,<max>,<lowest>,<highest>   (16)
+// PARAMETERS:
+//		const char* line: the first character of the line.
+//		const char* end: one past the last character of the line, without the newline.
+//		BatchQuery* query: the variable where the parsed query will get stored.
+// RETURNS:
+//		const char*: NULL if the line got parsed, else the reason why it is malformed.
+//
+const char* parseBatchQuery(const char* line, const char* end, BatchQuery* query)
+{
+	const char* fields[6];
+	size_t lengths[6];
+	int fieldCount = 0;
+
+	memset(query, 0, sizeof(*query));
+	while (fieldCount < 6)
+	{
+		const char* fieldEnd = findByte(line, end, ',');
+		line = skipBlanks(line, fieldEnd);
+		const char* last = fieldEnd;
+		while (last > line && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+		{
+			last--;   // trailing blanks and the CR of a CRLF file
+		}
+		fields[fieldCount] = line;
+		lengths[fieldCount++] = (size_t)(last - line);
+		if (fieldEnd == end)
+		{
+			break;
+		}
+		line = fieldEnd + 1;
+		if (fieldCount == 6)
+		{
+			return "too many fields";
+		}
+	}
+
+	for (int type = 1; type < QUERY_TYPE_COUNT && query->type == 0; type++)
+	{
+		const char* name = batchQueryNames[type];
+		if (name[0] != '\0' && ((lengths[0] == strlen(name) && strncmp(fields[0], name, lengths[0]) == 0)
+			|| (lengths[0] == 1 && fields[0][0] == '0' + type)
+			|| (lengths[0] == 2 && fields[0][0] == '0' + type / 10 && fields[0][1] == '0' + type % 10)))
+		{
+			query->type = (QueryType)type;
+		}
+	}
+	if (query->type == 0)
+	{
+		return "unknown query";
+	}
+
+	int expected = query->type == QUERY_BOX ? 6 : query->type == QUERY_WEIGHT || query->type == QUERY_RANGE
+		|| query->type == QUERY_TOP_K || query->type == QUERY_VALUATION_RANGE ? 4 : 2;
+	if (fieldCount != expected)
+	{
+		return expected == 6 ? "expected six fields" : expected == 4 ? "expected four fields" : "expected two fields";
+	}
+	if (lengths[1] == 0 || lengths[1] > MAX_COUNTRY_NAME_LENGTH)
+	{
+		return "missing or overlong country name";
+	}
+	memcpy(query->country, fields[1], lengths[1]);
+	query->country[lengths[1]] = '\0';
+
+	if (query->type == QUERY_WEIGHT)
+	{
+		if ((lengths[2] == 6 && strncmp(fields[2], "higher", 6) == 0) || (lengths[2] == 1 && fields[2][0] == '1'))
+		{
+			query->higher = 1;
+		}
+		else if (!((lengths[2] == 5 && strncmp(fields[2], "lower", 5) == 0) || (lengths[2] == 1 && fields[2][0] == '2')))
+		{
+			return "expected higher or lower";
+		}
+	}
+	if (query->type == QUERY_WEIGHT || query->type == QUERY_RANGE || query->type == QUERY_BOX)
+	{
+		const char* number = fields[3];
+		int* target = query->type == QUERY_WEIGHT ? &query->weight : &query->maxWeight;
+		if (!parseInteger(&number, fields[3] + lengths[3], target) || number != fields[3] + lengths[3])
+		{
+			return "invalid weight";
+		}
+	}
+	if (query->type == QUERY_RANGE || query->type == QUERY_BOX)
+	{
+		const char* number = fields[2];
+		if (!parseInteger(&number, fields[2] + lengths[2], &query->weight) || number != fields[2] + lengths[2])
+		{
+			return "invalid weight";
+		}
+	}
+	if (query->type == QUERY_BOX || query->type == QUERY_VALUATION_RANGE)
+	{
+		int first = query->type == QUERY_BOX ? 4 : 2;   // the valuations follow the weights of a box
+		const char* number = fields[first];
+		if (!parseCents(&number, fields[first] + lengths[first], &query->minValuation) || number != fields[first] + lengths[first])
+		{
+			return "invalid valuation";
+		}
+		number = fields[first + 1];
+		if (!parseCents(&number, fields[first + 1] + lengths[first + 1], &query->maxValuation) || number != fields[first + 1] + lengths[first + 1])
+		{
+			return "invalid valuation";
+		}
+	}
+	if (query->type == QUERY_TOP_K)
+	{
+		const char* number = fields[2];
+		int count;
+		if (!parseInteger(&number, fields[2] + lengths[2], &count) || number != fields[2] + lengths[2] || count <= 0)
+		{
+			return "invalid count";
+		}
+		query->count = (unsigned int)count;
+		if ((lengths[3] == 4 && strncmp(fields[3], "most", 4) == 0) || (lengths[3] == 1 && fields[3][0] == '1'))
+		{
+			query->higher = 1;
+		}
+		else if (!((lengths[3] == 5 && strncmp(fields[3], "least", 5) == 0) || (lengths[3] == 1 && fields[3][0] == '2')))
+		{
+			return "expected most or least";
+		}
+	}
+	return NULL;
+}
+
+//
+// FUNCTION: writeRecordStart
+// DESCRIPTION:
+//		This function starts one machine readable output record with the fields every record shares.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		OutputFormat format: OUTPUT_JSON or OUTPUT_CSV.
+//		size_t queryNumber: the line number of the query in the batch file.
+//		const BatchQuery* query: the query, NULL for a line which did not parse.
+//		const char* kind: what the record describes, for example parcel or total.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void writeRecordStart(OutputBuffer* out, OutputFormat format, size_t queryNumber, const BatchQuery* query, const char* kind)
+{
+	const char* operation = query != NULL ? batchQueryNames[query->type] : "";
+	const char* country = query != NULL ? query->country : "";
+
+	if (format == OUTPUT_JSON)
+	{
+		writeString(out, "{\"query\":");
+		writeInteger(out, (long long)queryNumber);
+		writeString(out, ",\"op\":\"");
+		writeString(out, operation);
+		writeString(out, "\",\"country\":");
+		writeQuoted(out, country, format);
+		writeString(out, ",\"kind\":\"");
+		writeString(out, kind);
+		writeString(out, "\"");
+	}
+	else
+	{
+		writeInteger(out, (long long)queryNumber);
+		writeBytes(out, ",", 1);
+		writeString(out, operation);
+		writeBytes(out, ",", 1);
+		writeQuoted(out, country, format);
+		writeBytes(out, ",", 1);
+		writeString(out, kind);
+	}
+}
+
+//
+// FUNCTION: writeParcelRecord
+// DESCRIPTION:
+//		This function writes one machine readable record holding a weight and a valuation.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		OutputFormat format: OUTPUT_JSON or OUTPUT_CSV.
+//		size_t queryNumber: the line number of the query in the batch file.
+//		const BatchQuery* query: the query which produced the record.
+//		const char* kind: what the record describes.
+//		long long weight: the weight in grams.
+//		Cents valuation: the valuation.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void writeParcelRecord(OutputBuffer* out, OutputFormat format, size_t queryNumber, const BatchQuery* query, const char* kind, long long weight, Cents valuation)
+{
+	writeRecordStart(out, format, queryNumber, query, kind);
+	writeString(out, format == OUTPUT_JSON ? ",\"weight\":" : ",");
+	writeInteger(out, weight);
+	writeString(out, format == OUTPUT_JSON ? ",\"valuation\":" : ",");
+	writeCents(out, valuation, 2);
+	writeString(out, format == OUTPUT_JSON ? "}\n" : ",,\n");
+}
+
+//
+// FUNCTION: writeMessageRecord
+// DESCRIPTION:
+//		This function writes one machine readable record without a parcel, such as an empty
+//		result, a count or an error.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		OutputFormat format: OUTPUT_JSON or OUTPUT_CSV.
+//		size_t queryNumber: the line number of the query in the batch file.
+//		const BatchQuery* query: the query, NULL for a line which did not parse.
+//		const char* kind: what the record describes.
+//		long long count: the count to be reported, or -1 for none.
+//		const char* message: the message to be reported, or NULL for none.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void writeMessageRecord(OutputBuffer* out, OutputFormat format, size_t queryNumber, const BatchQuery* query, const char* kind, long long count, const char* message)
+{
+	writeRecordStart(out, format, queryNumber, query, kind);
+	if (format == OUTPUT_JSON)
+	{
+		if (count >= 0)
+		{
+			writeString(out, ",\"count\":");
+			writeInteger(out, count);
+		}
+		if (message != NULL)
+		{
+			writeString(out, ",\"message\":");
+			writeQuoted(out, message, format);
+		}
+		writeString(out, "}\n");
+	}
+	else
+	{
+		writeString(out, ",,,");
+		if (count >= 0)
+		{
+			writeInteger(out, count);
+		}
+		writeBytes(out, ",", 1);
+		if (message != NULL)
+		{
+			writeQuoted(out, message, format);
+		}
+		writeBytes(out, "\n", 1);
+	}
+}
+
+//
+// FUNCTION: writeHumanParcel
+// DESCRIPTION:
+//		This function writes one parcel line of the interactive menu, prefix, weight and valuation.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		const char* prefix: the text before the weight, ending in "Weight: ".
+//		int weight: the weight in grams.
+//		Cents valuation: the valuation.
+//		int decimals: 2 for the usual %.2f, 0 for the %2.f of the parcel listing.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void writeHumanParcel(OutputBuffer* out, const char* prefix, int weight, Cents valuation, int decimals)
+{
+	writeString(out, prefix);
+	writeInteger(out, weight);
+	writeString(out, ", Valuation: ");
+	if (decimals == 0 && valuation >= 0 && valuation < 950)
+	{
+		writeBytes(out, " ", 1);   // %2.f pads a single digit to two characters, $9.50 already rounds to 10
+	}
+	writeCents(out, valuation, decimals);
+	writeBytes(out, "\n", 1);
+}
+
+//
+// FUNCTION: writeQuantileRecords
+// DESCRIPTION:
+//		This function writes the parcel count of merged sketches and one machine readable record
+//		per quantile, the minimum, p50, p90, p99 and maximum, holding the weight and the valuation
+//		of that rank.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		OutputFormat format: OUTPUT_JSON or OUTPUT_CSV.
+//		size_t queryNumber: the line number of the query in the batch file.
+//		const BatchQuery* query: the query which produced the records.
+//		const CountrySketches* merged: the sketches of the country, or of every country, not empty.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void writeQuantileRecords(OutputBuffer* out, OutputFormat format, size_t queryNumber, const BatchQuery* query, const CountrySketches* merged)
+{
+	static const double fractions[] = { 0.0, 0.5, 0.9, 0.99, 1.0 };
+	static const char* const names[] = { "min", "p50", "p90", "p99", "max" };
+	SketchItem* weightItems = (SketchItem*)malloc(2 * SKETCH_CAPACITY * sizeof(SketchItem));
+	if (weightItems == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for quantile query.\n");
+		exit(1);
+	}
+	SketchItem* valuationItems = weightItems + SKETCH_CAPACITY;
+	unsigned int weightCount = sortSketchItems(&merged->weights, weightItems);
+	unsigned int valuationCount = sortSketchItems(&merged->valuations, valuationItems);
+
+	writeMessageRecord(out, format, queryNumber, query, "count", (long long)merged->weights.count, NULL);
+	for (int i = 0; i < 5; i++)
+	{
+		writeParcelRecord(out, format, queryNumber, query, names[i], sketchQuantile(&merged->weights, weightItems, weightCount, fractions[i]),
+			sketchQuantile(&merged->valuations, valuationItems, valuationCount, fractions[i]));
+	}
+	free(weightItems);
+}
+
+//
+// FUNCTION: findScanBounds
+// DESCRIPTION:
+//		This function finds the positions, in weight order, of the first and one past the last
+//		parcel a listing or weight filter query returns, counting with the subtree aggregates.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		ParcelIndex root: the arena index of the root of the country's BST.
+//		const BatchQuery* query: a QUERY_LIST or QUERY_WEIGHT query.
+//		unsigned int* first: the variable where the first position will get stored.
+//		unsigned int* end: the variable where the position past the last parcel will get stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void findScanBounds(const ParcelStore* store, ParcelIndex root, const BatchQuery* query, unsigned int* first, unsigned int* end)
+{
+	unsigned int count = root != NULL_PARCEL ? getParcel(&store->arena, root)->subtree.count : 0;
+
+	*first = 0;
+	*end = count;
+	if (query->type == QUERY_WEIGHT && query->higher)
+	{
+		*first = countWeightsBelow(store, root, query->weight, 1);   // strictly heavier starts past the equal weights
+	}
+	else if (query->type == QUERY_WEIGHT)
+	{
+		*end = countWeightsBelow(store, root, query->weight, 0);   // strictly lighter ends before them
+	}
+}
+
+//
+// FUNCTION: writeParcelSlice
+// DESCRIPTION:
+//		This function writes the parcel rows of a listing or weight filter query between two
+//		positions in weight order, so a long scan can be written in independent pieces.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		ParcelIndex root: the arena index of the root of the country's BST.
+//		const BatchQuery* query: a QUERY_LIST or QUERY_WEIGHT query.
+//		size_t queryNumber: the line number of the query in the batch file.
+//		OutputFormat format: the output format.
+//		OutputBuffer* out: the buffer the rows are written to.
+//		unsigned int first: position of the first parcel to be written.
+//		unsigned int end: position past the last parcel to be written.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeParcelSlice(const ParcelStore* store, ParcelIndex root, const BatchQuery* query, size_t queryNumber, OutputFormat format, OutputBuffer* out, unsigned int first, unsigned int end)
+{
+	ParcelIterator iterator;
+	char prefix[96];
+	int listing = query->type == QUERY_LIST;
+
+	// the listing keeps the spelling and %2.f of the original menu
+	snprintf(prefix, sizeof(prefix), listing ? "Destoination: %s, Weight: " : "Destination: %s, Weight: ", query->country);
+	seekIterator(&iterator, store, root, first);
+	for (unsigned int position = first; position < end; position++)
+	{
+		const Parcel* parcel = nextParcel(&iterator);
+		if (format == OUTPUT_HUMAN)
+		{
+			writeHumanParcel(out, prefix, parcel->weight, parcel->valuation, listing ? 0 : 2);
+		}
+		else
+		{
+			writeParcelRecord(out, format, queryNumber, query, "parcel", parcel->weight, parcel->valuation);
+		}
+	}
+	STAT_ADD(STAT_PARCELS_RETURNED, end - first);
+}
+
+//
+// FUNCTION: executeBatchQuery
+// DESCRIPTION:
+//		This function runs one batch query against the loaded index and writes its result,
+//		either as the text the interactive menu prints or as JSON lines or CSV records.
+//		It only reads the store, so queries can run side by side.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		const BatchQuery* query: the query to run.
+//		size_t queryNumber: the line number of the query in the batch file.
+//		OutputFormat format: the output format.
+//		OutputBuffer* out: the buffer the result is written to.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void executeBatchQuery(const ParcelStore* store, const BatchQuery* query, size_t queryNumber, OutputFormat format, OutputBuffer* out, const CountryList* validCountries)
+{
+	STAT_TIME(batchQueryOperations[query->type]);
+	const char* country = query->country;
+	int valuationQuery = query->type == QUERY_TOP_K || query->type == QUERY_VALUATION_RANGE || query->type == QUERY_QUANTILES;
+	int everyCountry = valuationQuery && strcmp(country, "all") == 0;
+	char line[160];
+
+	if (!everyCountry && !isValidCountry(country, validCountries))
+	{
+		if (format == OUTPUT_HUMAN)
+		{
+			writeString(out, "Error: Given country name is not in the list, please enter a valid country name.\n");
+		}
+		else
+		{
+			writeMessageRecord(out, format, queryNumber, query, "error", -1, "country is not in the list");
+		}
+		return;
+	}
+
+	ParcelIndex root = findCountryRoot(store, country);
+	int countryId = everyCountry ? -1 : findCountryId(&store->catalog, country);
+	if (valuationQuery ? countryId < 0 && !everyCountry
+		: root == NULL_PARCEL && query->type != QUERY_WEIGHT && query->type != QUERY_RANGE && query->type != QUERY_BOX)
+	{
+		if (format == OUTPUT_HUMAN)
+		{
+			snprintf(line, sizeof(line), "No parcels found for %s.\n", country);
+			writeString(out, line);
+		}
+		else
+		{
+			writeMessageRecord(out, format, queryNumber, query, "none", 0, NULL);
+		}
+		return;
+	}
+
+	switch (query->type)
+	{
+	case QUERY_LIST:
+		if (format == OUTPUT_HUMAN)
+		{
+			snprintf(line, sizeof(line), "Parcels for %s:\n", country);
+			writeString(out, line);
+		}
+		writeParcelSlice(store, root, query, queryNumber, format, out, 0, getParcel(&store->arena, root)->subtree.count);
+		break;
+	case QUERY_WEIGHT:
+	{
+		unsigned int first;
+		unsigned int end;
+		findScanBounds(store, root, query, &first, &end);
+		if (end > first)
+		{
+			writeParcelSlice(store, root, query, queryNumber, format, out, first, end);
+		}
+		else if (format == OUTPUT_HUMAN)
+		{
+			writeString(out, "No parcel is found for specific weight conditon.\n");
+		}
+		else
+		{
+			writeMessageRecord(out, format, queryNumber, query, "none", 0, NULL);
+		}
+		break;
+	}
+	case QUERY_TOTALS:
+	{
+		long long totalWeight = 0;
+		Cents totalValuation = 0;
+		calculateTotalLoadAndValuation(store, root, &totalWeight, &totalValuation);
+		if (format != OUTPUT_HUMAN)
+		{
+			writeParcelRecord(out, format, queryNumber, query, "total", totalWeight, totalValuation);
+		}
+		else if (totalWeight > 0 || totalValuation > 0)
+		{
+			snprintf(line, sizeof(line), "Total load for %s: %lld grams\n", country, totalWeight);
+			writeString(out, line);
+			snprintf(line, sizeof(line), "Total valuation for %s: $%.2f\n", country, centsToDollars(totalValuation));
+			writeString(out, line);
+		}
+		else
+		{
+			snprintf(line, sizeof(line), "No parcels found for %s.\n", country);
+			writeString(out, line);
+		}
+		break;
+	}
+	case QUERY_VALUATION_EXTREMES:
+	case QUERY_WEIGHT_EXTREMES:
+	{
+		const Parcel* first = NULL;
+		const Parcel* second = NULL;
+		int valuation = query->type == QUERY_VALUATION_EXTREMES;
+		if (valuation)
+		{
+			findCheapestAndMostExpensive(store, root, &first, &second);
+		}
+		else
+		{
+			findLightestAndHeaviest(store, root, &first, &second);
+		}
+		if (format == OUTPUT_HUMAN)
+		{
+			snprintf(line, sizeof(line), "%s parcel for %s: Weight: ", valuation ? "Cheapest" : "Lightest", country);
+			writeHumanParcel(out, line, first->weight, first->valuation, 2);
+			snprintf(line, sizeof(line), "%s parcel for %s: Weight: ", valuation ? "Most expensive" : "Heaviest", country);
+			writeHumanParcel(out, line, second->weight, second->valuation, 2);
+		}
+		else
+		{
+			writeParcelRecord(out, format, queryNumber, query, valuation ? "cheapest" : "lightest", first->weight, first->valuation);
+			writeParcelRecord(out, format, queryNumber, query, valuation ? "most_expensive" : "heaviest", second->weight, second->valuation);
+		}
+		break;
+	}
+	case QUERY_RANGE:
+	{
+		ParcelAggregate range;
+		aggregateWeightRange(store, root, query->weight, query->maxWeight, &range);
+		if (range.count == 0)
+		{
+			if (format == OUTPUT_HUMAN)
+			{
+				snprintf(line, sizeof(line), "No parcels found for %s between %d and %d grams.\n", country, query->weight, query->maxWeight);
+				writeString(out, line);
+			}
+			else
+			{
+				writeMessageRecord(out, format, queryNumber, query, "none", 0, NULL);
+			}
+			break;
+		}
+
+		const Parcel* cheapest = getParcel(&store->arena, range.cheapest);
+		const Parcel* mostExpensive = getParcel(&store->arena, range.mostExpensive);
+		if (format == OUTPUT_HUMAN)
+		{
+			snprintf(line, sizeof(line), "Parcels for %s between %d and %d grams: %u\n", country, query->weight, query->maxWeight, range.count);
+			writeString(out, line);
+			snprintf(line, sizeof(line), "Total load: %lld grams, total valuation: $%.2f\n", range.weightSum, centsToDollars(range.valuationSum));
+			writeString(out, line);
+			writeHumanParcel(out, "Cheapest parcel: Weight: ", cheapest->weight, cheapest->valuation, 2);
+			writeHumanParcel(out, "Most expensive parcel: Weight: ", mostExpensive->weight, mostExpensive->valuation, 2);
+		}
+		else
+		{
+			writeMessageRecord(out, format, queryNumber, query, "count", range.count, NULL);
+			writeParcelRecord(out, format, queryNumber, query, "total", range.weightSum, range.valuationSum);
+			writeParcelRecord(out, format, queryNumber, query, "cheapest", cheapest->weight, cheapest->valuation);
+			writeParcelRecord(out, format, queryNumber, query, "most_expensive", mostExpensive->weight, mostExpensive->valuation);
+		}
+		break;
+	}
+	case QUERY_BOX:
+	{
+		BoxRange range = { query->weight, query->maxWeight, query->minValuation, query->maxValuation };
+		BoxTotals totals;
+		queryWeightValuationBox(store, countryId, &range, &totals, NULL);
+		if (totals.count == 0)
+		{
+			if (format == OUTPUT_HUMAN)
+			{
+				snprintf(line, sizeof(line), "No parcels found for %s between %d and %d grams valued between $%.2f and $%.2f.\n", country,
+					range.minWeight, range.maxWeight, centsToDollars(range.minValuation), centsToDollars(range.maxValuation));
+				writeString(out, line);
+			}
+			else
+			{
+				writeMessageRecord(out, format, queryNumber, query, "none", 0, NULL);
+			}
+			break;
+		}
+
+		BoxPoint* matches = (BoxPoint*)malloc((size_t)totals.count * sizeof(BoxPoint));
+		if (matches == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for box query.\n");
+			exit(1);
+		}
+		queryWeightValuationBox(store, countryId, &range, &totals, matches);
+		if (format == OUTPUT_HUMAN)
+		{
+			char prefix[96];
+			snprintf(line, sizeof(line), "Parcels for %s between %d and %d grams valued between $%.2f and $%.2f: %u\n", country,
+				range.minWeight, range.maxWeight, centsToDollars(range.minValuation), centsToDollars(range.maxValuation), totals.count);
+			writeString(out, line);
+			snprintf(line, sizeof(line), "Total load: %lld grams, total valuation: $%.2f\n", totals.weightSum, centsToDollars(totals.valuationSum));
+			writeString(out, line);
+			snprintf(prefix, sizeof(prefix), "Destination: %s, Weight: ", country);
+			for (unsigned int i = 0; i < totals.count; i++)
+			{
+				writeHumanParcel(out, prefix, matches[i].weight, matches[i].valuation, 2);
+			}
+		}
+		else
+		{
+			writeMessageRecord(out, format, queryNumber, query, "count", totals.count, NULL);
+			writeParcelRecord(out, format, queryNumber, query, "total", totals.weightSum, totals.valuationSum);
+			for (unsigned int i = 0; i < totals.count; i++)
+			{
+				writeParcelRecord(out, format, queryNumber, query, "parcel", matches[i].weight, matches[i].valuation);
+			}
+		}
+		free(matches);
+		break;
+	}
+	case QUERY_TOP_K:
+	case QUERY_VALUATION_RANGE:
+	{
+		const ValuationIndex* index = &store->valuations;   // built by prepareBatchIndexes or the server
+		const ValuationEntry* page[RANGE_PAGE_SIZE];
+		BatchQuery entryQuery = *query;
+		unsigned int offset = 0;
+		unsigned int total = 0;
+		unsigned int count;
+		char prefix[96];
+		int topK = query->type == QUERY_TOP_K;
+		ValuationSlot slot = valuationRoot(index, countryId);
+		unsigned int wanted = slot == 0 ? 0 : query->count < index->entries[slot].count ? query->count : index->entries[slot].count;
+		const ValuationEntry** results = page;
+
+		if (topK)
+		{
+			if (wanted > RANGE_PAGE_SIZE)
+			{
+				results = (const ValuationEntry**)malloc((size_t)wanted * sizeof(ValuationEntry*));
+				if (results == NULL)
+				{
+					fprintf(stderr, "Error: Memory allocation failed for valuation query.\n");
+					exit(1);
+				}
+			}
+			count = total = searchValuationExtremes(index, countryId, wanted, query->higher, results);
+		}
+		else
+		{
+			count = searchValuationRange(index, countryId, query->minValuation, query->maxValuation, 0, RANGE_PAGE_SIZE, page, &total);
+		}
+		if (total == 0)
+		{
+			if (format != OUTPUT_HUMAN)
+			{
+				writeMessageRecord(out, format, queryNumber, query, "none", 0, NULL);
+			}
+			else if (topK)
+			{
+				snprintf(line, sizeof(line), "No parcels found for %s.\n", country);
+				writeString(out, line);
+			}
+			else
+			{
+				snprintf(line, sizeof(line), "No parcels found for %s between $%.2f and $%.2f.\n", country, centsToDollars(query->minValuation), centsToDollars(query->maxValuation));
+				writeString(out, line);
+			}
+			break;
+		}
+
+		if (format != OUTPUT_HUMAN)
+		{
+			writeMessageRecord(out, format, queryNumber, query, "count", total, NULL);
+		}
+		else if (topK)
+		{
+			snprintf(line, sizeof(line), "The %u %s valuable parcels for %s:\n", total, query->higher ? "most" : "least", country);
+			writeString(out, line);
+		}
+		else
+		{
+			snprintf(line, sizeof(line), "Parcels for %s valued between $%.2f and $%.2f: %u\n", country, centsToDollars(query->minValuation), centsToDollars(query->maxValuation), total);
+			writeString(out, line);
+		}
+		while (count > 0)
+		{
+			for (unsigned int i = 0; i < count; i++)
+			{
+				const char* destination = store->catalog.names[results[i]->countryId];
+				if (format == OUTPUT_HUMAN)
+				{
+					snprintf(prefix, sizeof(prefix), "Destination: %s, Weight: ", destination);
+					writeHumanParcel(out, prefix, results[i]->weight, results[i]->valuation, 2);
+				}
+				else
+				{
+					strcpy(entryQuery.country, destination);   // the records of "all" name the country of each parcel
+					writeParcelRecord(out, format, queryNumber, &entryQuery, "parcel", results[i]->weight, results[i]->valuation);
+				}
+			}
+			offset += count;
+			count = topK ? 0 : searchValuationRange(index, countryId, query->minValuation, query->maxValuation, offset, RANGE_PAGE_SIZE, page, NULL);
+		}
+		STAT_ADD(STAT_PARCELS_RETURNED, offset);
+		if (results != page)
+		{
+			free((void*)results);
+		}
+		break;
+	}
+	case QUERY_QUANTILES:
+	{
+		CountrySketches* merged = (CountrySketches*)malloc(sizeof(CountrySketches));
+		if (merged == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for quantile query.\n");
+			exit(1);
+		}
+		initQuantileSketch(&merged->weights);
+		initQuantileSketch(&merged->valuations);
+		for (unsigned int id = 0; id < store->catalog.count; id++)
+		{
+			// built by prepareBatchIndexes or the server, the workers must not build them
+			const CountrySketches* sketches = countryId < 0 || (int)id == countryId ? findCountrySketches(store, (int)id) : NULL;
+			if (sketches != NULL)
+			{
+				mergeQuantileSketch(&merged->weights, &sketches->weights);
+				mergeQuantileSketch(&merged->valuations, &sketches->valuations);
+			}
+		}
+		if (format == OUTPUT_HUMAN)
+		{
+			writeQuantileReport(out, country, merged);
+		}
+		else if (merged->weights.count == 0)
+		{
+			writeMessageRecord(out, format, queryNumber, query, "none", 0, NULL);
+		}
+		else
+		{
+			writeQuantileRecords(out, format, queryNumber, query, merged);
+		}
+		free(merged);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+//
+// FUNCTION: parseBatchItems
+// DESCRIPTION:
+//		This function parses every line of a batch file. Blank lines and lines starting with #
+//		are skipped, malformed lines are kept with the reason so they are reported in place.
+// PARAMETERS:
+//		const char* data: the contents of the batch file.
+//		size_t size: the size of the batch file in bytes.
+//		size_t* count: the variable where the number of items will get stored.
+// RETURNS:
+//		BatchItem*: the parsed lines in file order, to be freed by the caller.
+//
+BatchItem* parseBatchItems(const char* data, size_t size, size_t* count)
+{
+	const char* cursor = data;
+	const char* end = data + size;
+	size_t capacity = 64;
+	size_t lineNumber = 0;
+	BatchItem* items = (BatchItem*)malloc(capacity * sizeof(BatchItem));
+
+	*count = 0;
+	while (items != NULL && cursor < end)
+	{
+		const char* lineEnd = findByte(cursor, end, '\n');
+		const char* line = skipBlanks(cursor, lineEnd);
+		lineNumber++;
+		cursor = lineEnd < end ? lineEnd + 1 : end;
+		if (line == lineEnd || *line == '#' || *line == '\r')
+		{
+			continue;
+		}
+
+		if (*count == capacity)
+		{
+			capacity *= 2;
+			BatchItem* grown = (BatchItem*)realloc(items, capacity * sizeof(BatchItem));
+			if (grown == NULL)
+			{
+				free(items);
+				items = NULL;
+				break;
+			}
+			items = grown;
+		}
+		items[*count].line = lineNumber;
+		items[*count].error = parseBatchQuery(line, lineEnd, &items[*count].query);
+		(*count)++;
+	}
+
+	if (items == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for batch queries.\n");
+		exit(1);
+	}
+	return items;
+}
+
+//
+// FUNCTION: planBatchTasks
+// DESCRIPTION:
+//		This function turns the batch into tasks for the thread pool. Every query is one task,
+//		except listings and weight filters over more than BATCH_SPLIT_PARCELS parcels, which are
+//		cut into slices of consecutive positions in weight order. Tasks are numbered in
+//		submission order, so writing their output in task order gives the serial output.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		const BatchItem* items: the parsed batch.
+//		size_t itemCount: the number of items.
+//		const CountryList* validCountries: the list of valid countries.
+//		size_t* taskCount: the variable where the number of tasks will get stored.
+// RETURNS:
+//		BatchTask*: the tasks in submission order, to be freed by the caller.
+//
+BatchTask* planBatchTasks(const ParcelStore* store, const BatchItem* items, size_t itemCount, const CountryList* validCountries, size_t* taskCount)
+{
+	size_t capacity = itemCount + 16;
+	BatchTask* tasks = (BatchTask*)malloc(capacity * sizeof(BatchTask));
+
+	*taskCount = 0;
+	for (size_t i = 0; tasks != NULL && i < itemCount; i++)
+	{
+		const BatchQuery* query = &items[i].query;
+		unsigned int first = 0;
+		unsigned int end = 0;
+		ParcelIndex root = NULL_PARCEL;
+
+		if (items[i].error == NULL && (query->type == QUERY_LIST || query->type == QUERY_WEIGHT)
+			&& isValidCountry(query->country, validCountries))
+		{
+			root = findCountryRoot(store, query->country);
+			findScanBounds(store, root, query, &first, &end);
+		}
+
+		unsigned int slices = end - first > BATCH_SPLIT_PARCELS ? (end - first + BATCH_SPLIT_PARCELS - 1) / BATCH_SPLIT_PARCELS : 1;
+		if (*taskCount + slices > capacity)
+		{
+			capacity = (*taskCount + slices) * 2;
+			BatchTask* grown = (BatchTask*)realloc(tasks, capacity * sizeof(BatchTask));
+			if (grown == NULL)
+			{
+				free(tasks);
+				tasks = NULL;
+				break;
+			}
+			tasks = grown;
+		}
+
+		for (unsigned int slice = 0; slice < slices; slice++)
+		{
+			BatchTask* task = &tasks[(*taskCount)++];
+			task->item = (unsigned int)i;
+			task->root = root;
+			task->first = first + slice * BATCH_SPLIT_PARCELS;
+			task->end = slice == slices - 1 ? end : task->first + BATCH_SPLIT_PARCELS;
+			task->kind = slices == 1 ? TASK_WHOLE : slice == 0 ? TASK_FIRST_SLICE : TASK_SLICE;
+		}
+	}
+
+	if (tasks == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for batch tasks.\n");
+		exit(1);
+	}
+	return tasks;
+}
+
+//
+// FUNCTION: executeBatchTask
+// DESCRIPTION:
+//		This function runs one task of the batch and writes its output.
+// PARAMETERS:
+//		const BatchExecutor* executor: the batch being run.
+//		const BatchTask* task: the task to run.
+//		OutputBuffer* out: the buffer the output is written to.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void executeBatchTask(const BatchExecutor* executor, const BatchTask* task, OutputBuffer* out)
+{
+	const BatchItem* item = &executor->items[task->item];
+
+	if (item->error != NULL)
+	{
+		if (executor->format == OUTPUT_HUMAN)
+		{
+			char message[96];
+			snprintf(message, sizeof(message), "Error: Batch line %zu: %s.\n", item->line, item->error);
+			writeString(out, message);
+		}
+		else
+		{
+			writeMessageRecord(out, executor->format, item->line, NULL, "error", -1, item->error);
+		}
+	}
+	else if (task->kind == TASK_WHOLE)
+	{
+		executeBatchQuery(executor->store, &item->query, item->line, executor->format, out, executor->validCountries);
+	}
+	else
+	{
+		if (task->kind == TASK_FIRST_SLICE && item->query.type == QUERY_LIST && executor->format == OUTPUT_HUMAN)
+		{
+			char header[96];
+			snprintf(header, sizeof(header), "Parcels for %s:\n", item->query.country);
+			writeString(out, header);
+		}
+		writeParcelSlice(executor->store, task->root, &item->query, item->line, executor->format, out, task->first, task->end);
+	}
+}
+
+//
+// FUNCTION: takeBatchTask
+// DESCRIPTION:
+//		This function hands the next task to a worker of the pool. Every worker owns a range of
+//		task numbers packed into one atomic word and takes tasks from its front. A worker whose
+//		range is empty steals the back half of another worker's range, so work moves to idle
+//		threads in large pieces while every thread mostly runs consecutive tasks.
+// PARAMETERS:
+//		BatchExecutor* executor: the batch being run.
+//		int worker: the number of the calling worker.
+//		unsigned int* task: the variable where the task number will get stored.
+// RETURNS:
+//		int: returns 1 if a task got taken, 0 when no task is left anywhere.
+//
+int takeBatchTask(BatchExecutor* executor, int worker, unsigned int* task)
+{
+	std::atomic<unsigned long long>* own = &executor->ranges[worker];
+	unsigned long long range = own->load();
+
+	while ((unsigned int)(range >> 32) < (unsigned int)range)
+	{
+		if (own->compare_exchange_weak(range, range + (1ULL << 32)))   // advance the front of our own range
+		{
+			*task = (unsigned int)(range >> 32);
+			return 1;
+		}
+	}
+
+	for (int step = 1; step < executor->workerCount; step++)
+	{
+		std::atomic<unsigned long long>* victim = &executor->ranges[(worker + step) % executor->workerCount];
+		unsigned long long seen = victim->load();
+		while ((unsigned int)(seen >> 32) < (unsigned int)seen)
+		{
+			unsigned int begin = (unsigned int)(seen >> 32);
+			unsigned int end = (unsigned int)seen;
+			unsigned int split = end - (end - begin + 1) / 2;   // the victim keeps [begin, split)
+			if (victim->compare_exchange_weak(seen, ((unsigned long long)begin << 32) | split))
+			{
+				own->store(((unsigned long long)(split + 1) << 32) | end);   // the rest of the stolen half becomes our range
+				*task = split;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+//
+// FUNCTION: runBatchWorker
+// DESCRIPTION:
+//		This function is the loop of one pool thread: it takes tasks until none is left,
+//		runs each into its own output buffer and marks it done for the writer.
+// PARAMETERS:
+//		BatchExecutor* executor: the batch being run.
+//		int worker: the number of this worker.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void runBatchWorker(BatchExecutor* executor, int worker)
+{
+	unsigned int task;
+
+	while (takeBatchTask(executor, worker, &task))
+	{
+		initOutputBuffer(&executor->results[task], NULL);
+		executeBatchTask(executor, &executor->tasks[task], &executor->results[task]);
+		{
+			std::lock_guard<std::mutex> guard(executor->lock);
+			executor->done[task] = 1;
+		}
+		executor->progress.notify_one();
+	}
+}
+
+//
+// FUNCTION: emitBatchOutput
+// DESCRIPTION:
+//		This function passes finished output on to the stream of the batch, and folds it into
+//		the checksum and byte count used to compare runs.
+// PARAMETERS:
+//		BatchOutcome* outcome: the totals of the run.
+//		FILE* output: the stream the output goes to, NULL to only count it.
+//		const char* data: the output bytes.
+//		size_t length: the number of output bytes.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void emitBatchOutput(BatchOutcome* outcome, FILE* output, const char* data, size_t length)
+{
+	if (output != NULL && length > 0)
+	{
+		fwrite(data, 1, length, output);
+	}
+	for (size_t i = 0; i < length; i++)
+	{
+		outcome->checksum = (outcome->checksum ^ (unsigned char)data[i]) * 0x100000001b3ULL;   // byte wise, so it does not depend on how the output was cut
+	}
+	outcome->bytes += length;
+}
+
+//
+// FUNCTION: runBatch
+// DESCRIPTION:
+//		This function runs every query of a batch file and writes the results in the order of the
+//		file. With one thread the tasks run in order on the calling thread through one buffered
+//		writer. With more threads they fan out over a work-stealing pool, each task writing into
+//		its own buffer, while the calling thread writes the finished buffers in task order.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		const char* data: the contents of the batch file.
+//		size_t size: the size of the batch file in bytes.
+//		OutputFormat format: the output format.
+//		FILE* output: the stream the results are written to, NULL to only count them.
+//		int threadCount: the number of pool threads, 0 for one per hardware thread.
+//		const CountryList* validCountries: the list of valid countries.
+//		BatchOutcome* outcome: the variable where the totals of the run will get stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void runBatch(const ParcelStore* store, const char* data, size_t size, OutputFormat format, FILE* output, int threadCount, const CountryList* validCountries, BatchOutcome* outcome)
+{
+	BatchExecutor executor;
+	size_t itemCount;
+	size_t taskCount;
+
+	memset(outcome, 0, sizeof(*outcome));
+	outcome->checksum = SNAPSHOT_CHECKSUM_SEED;
+	executor.store = store;
+	executor.results = NULL;
+	executor.done = NULL;
+	executor.format = format;
+	executor.validCountries = validCountries;
+	executor.items = parseBatchItems(data, size, &itemCount);
+	executor.tasks = planBatchTasks(store, executor.items, itemCount, validCountries, &taskCount);
+	outcome->queries = itemCount;
+	outcome->tasks = taskCount;
+	for (size_t i = 0; i < itemCount; i++)
+	{
+		outcome->malformed += executor.items[i].error != NULL;
+	}
+
+	if (threadCount <= 0)
+	{
+		threadCount = (int)std::thread::hardware_concurrency();
+	}
+	if ((size_t)threadCount > taskCount)
+	{
+		threadCount = (int)taskCount;   // a thread without a task has nothing to steal either
+	}
+	threadCount = threadCount < 1 ? 1 : threadCount > BATCH_MAX_THREADS ? BATCH_MAX_THREADS : threadCount;
+	executor.workerCount = threadCount;
+
+	OutputBuffer out;
+	initOutputBuffer(&out, NULL);
+	if (format == OUTPUT_CSV)
+	{
+		writeString(&out, "query,op,country,kind,weight,valuation,count,message\n");
+	}
+
+	if (threadCount == 1)
+	{
+		for (size_t task = 0; task < taskCount; task++)
+		{
+			executeBatchTask(&executor, &executor.tasks[task], &out);
+			if (out.used >= OUTPUT_BUFFER_SIZE / 2)
+			{
+				emitBatchOutput(outcome, output, out.data, out.used);
+				out.used = 0;
+			}
+		}
+		emitBatchOutput(outcome, output, out.data, out.used);
+	}
+	else
+	{
+		emitBatchOutput(outcome, output, out.data, out.used);
+		executor.results = (OutputBuffer*)calloc(taskCount, sizeof(OutputBuffer));
+		executor.done = (unsigned char*)calloc(taskCount, 1);
+		if (executor.results == NULL || executor.done == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for batch results.\n");
+			exit(1);
+		}
+
+		// hand every worker an equal run of consecutive tasks, stealing evens out the rest
+		for (int worker = 0; worker < threadCount; worker++)
+		{
+			unsigned long long begin = taskCount * worker / threadCount;
+			unsigned long long end = taskCount * (worker + 1) / threadCount;
+			executor.ranges[worker].store((begin << 32) | end);
+		}
+
+		std::thread workers[BATCH_MAX_THREADS];
+		for (int worker = 0; worker < threadCount; worker++)
+		{
+			workers[worker] = std::thread(runBatchWorker, &executor, worker);
+		}
+
+		// write the results in submission order as soon as each one is finished
+		for (size_t task = 0; task < taskCount; task++)
+		{
+			{
+				std::unique_lock<std::mutex> guard(executor.lock);
+				while (!executor.done[task])
+				{
+					executor.progress.wait(guard);
+				}
+			}
+			emitBatchOutput(outcome, output, executor.results[task].data, executor.results[task].used);
+			free(executor.results[task].data);
+		}
+
+		for (int worker = 0; worker < threadCount; worker++)
+		{
+			workers[worker].join();
+		}
+		free(executor.results);
+		free(executor.done);
+	}
+
+	free(out.data);
+	free((void*)executor.tasks);
+	free((void*)executor.items);
+}
+
+//
+// FUNCTION: benchmarkBatchScaling
+// DESCRIPTION:
+//		This function runs the same batch with 1, 2, 4 ... up to the given number of threads,
+//		discarding the output, and reports the throughput of each run. Every run must produce
+//		the same bytes as the single threaded one.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		const char* data: the contents of the batch file.
+//		size_t size: the size of the batch file in bytes.
+//		OutputFormat format: the output format.
+//		int maxThreads: the largest number of threads, 0 for one per hardware thread.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		int: returns 0 when every run agreed else 1.
+//
+int benchmarkBatchScaling(const ParcelStore* store, const char* data, size_t size, OutputFormat format, int maxThreads, const CountryList* validCountries)
+{
+	typedef std::chrono::steady_clock Clock;
+	BatchOutcome baseline;
+	double baselineSeconds = 0.0;
+	int mismatches = 0;
+
+	if (maxThreads <= 0)
+	{
+		maxThreads = (int)std::thread::hardware_concurrency();
+	}
+	maxThreads = maxThreads < 1 ? 1 : maxThreads > BATCH_MAX_THREADS ? BATCH_MAX_THREADS : maxThreads;
+
+	printf("Batch scaling benchmark, %u hardware threads:\n", std::thread::hardware_concurrency());
+	for (int threads = 1; threads <= maxThreads; threads = threads == maxThreads ? maxThreads + 1 : threads * 2 > maxThreads ? maxThreads : threads * 2)
+	{
+		BatchOutcome outcome;
+		Clock::time_point start = Clock::now();
+		runBatch(store, data, size, format, NULL, threads, validCountries, &outcome);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		if (threads == 1)
+		{
+			baseline = outcome;
+			baselineSeconds = seconds;
+			printf("%zu queries in %zu tasks, %zu output bytes\n", outcome.queries, outcome.tasks, outcome.bytes);
+		}
+		int same = outcome.bytes == baseline.bytes && outcome.checksum == baseline.checksum;
+		mismatches += !same;
+		printf("Threads: %3d, time: %9.3f ms, %10.0f queries/s, speedup: %5.2fx%s\n", threads, seconds * 1e3,
+			seconds > 0 ? outcome.queries / seconds : 0.0, seconds > 0 ? baselineSeconds / seconds : 0.0, same ? "" : " (output differs)");
+	}
+	return mismatches > 0;
+}
+
+//
+// FUNCTION: prepareBatchIndexes
+// DESCRIPTION:
+//		This function builds the k-d trees of the countries the box queries of a batch ask about,
+//		before the pool threads start, since the queries only read the store and would otherwise
+//		scan the weight range of every such country. The valuation index and the quantile sketches
+//		the top-k, valuation range and quantile queries read are built here too. A lazily loaded
+//		store also builds the BST of every country the batch asks about, or of every country for "all".
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		const char* data: the contents of the batch file.
+//		size_t size: the size of the batch file in bytes.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void prepareBatchIndexes(ParcelStore* store, const char* data, size_t size, const CountryList* validCountries)
+{
+	size_t itemCount;
+	BatchItem* items = parseBatchItems(data, size, &itemCount);
+
+	for (size_t i = 0; i < itemCount; i++)
+	{
+		QueryType type = items[i].query.type;
+		int valuationQuery = type == QUERY_TOP_K || type == QUERY_VALUATION_RANGE || type == QUERY_QUANTILES;
+		if (items[i].error == NULL && valuationQuery && strcmp(items[i].query.country, "all") == 0)
+		{
+			materializeAllCountries(store);
+		}
+		if (items[i].error == NULL && isValidCountry(items[i].query.country, validCountries))
+		{
+			loadCountryRoot(store, items[i].query.country);   // a lazily loaded store builds the BSTs the batch reads
+		}
+		if (items[i].error == NULL && type == QUERY_BOX && isValidCountry(items[i].query.country, validCountries))
+		{
+			getCountryBoxes(store, findCountryId(&store->catalog, items[i].query.country));
+		}
+	}
+	for (size_t i = 0; i < itemCount; i++)
+	{
+		// after the loop above, so the index and the sketches cover every country it loaded
+		if (items[i].error == NULL && (items[i].query.type == QUERY_TOP_K || items[i].query.type == QUERY_VALUATION_RANGE))
+		{
+			getValuationIndex(store);
+		}
+		if (items[i].error == NULL && items[i].query.type == QUERY_QUANTILES)
+		{
+			int all = strcmp(items[i].query.country, "all") == 0;
+			int countryId = all ? -1 : findCountryId(&store->catalog, items[i].query.country);
+			for (unsigned int id = 0; id < store->catalog.count; id++)
+			{
+				if (all || (int)id == countryId)
+				{
+					getCountrySketches(store, (int)id);
+				}
+			}
+		}
+	}
+	free(items);
+}
+
+//
+// FUNCTION: runBatchFile
+// DESCRIPTION:
+//		This function reads a batch file, or standard input for "-", and runs its queries,
+//		or times them with an increasing number of threads.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+//		const char* filename: the name of the batch file, "-" for standard input.
+//		OutputFormat format: the output format.
+//		int threadCount: the number of pool threads, 0 for one per hardware thread.
+//		int benchmark: 1 to run the scaling benchmark instead of printing the results.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		int: returns 0 if every line ran, 1 if the file could not be read or had malformed lines.
+//
+int runBatchFile(ParcelStore* store, const char* filename, OutputFormat format, int threadCount, int benchmark, const CountryList* validCountries)
+{
+	MappedFile file;
+	char* data = NULL;
+	size_t size = 0;
+	int mapped = strcmp(filename, "-") != 0;
+
+	if (mapped)
+	{
+		if (!mapFile(&file, filename, 0))
+		{
+			fprintf(stderr, "Error: Unable to open file %s\n", filename);
+			return 1;
+		}
+	}
+	else
+	{
+		size_t capacity = 1 << 16;
+		size_t length;
+		data = (char*)malloc(capacity);
+		while (data != NULL && (length = fread(data + size, 1, capacity - size, stdin)) > 0)
+		{
+			size += length;
+			if (size == capacity)
+			{
+				char* grown = (char*)realloc(data, capacity * 2);   // standard input can not be mapped, read it whole
+				if (grown == NULL)
+				{
+					free(data);
+					data = NULL;
+					break;
+				}
+				data = grown;
+				capacity *= 2;
+			}
+		}
+		if (data == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for batch input.\n");
+			return 1;
+		}
+	}
+
+	int result;
+	prepareBatchIndexes(store, mapped ? file.data : data, mapped ? file.size : size, validCountries);
+	if (benchmark)
+	{
+		result = benchmarkBatchScaling(store, mapped ? file.data : data, mapped ? file.size : size, format, threadCount, validCountries);
+	}
+	else
+	{
+		BatchOutcome outcome;
+		runBatch(store, mapped ? file.data : data, mapped ? file.size : size, format, stdout, threadCount, validCountries, &outcome);
+		fflush(stdout);
+		if (outcome.malformed > 0)
+		{
+			fprintf(stderr, "Warning: %s: %zu malformed batch lines\n", filename, outcome.malformed);
+		}
+		result = outcome.malformed > 0;
+	}
+
+	if (mapped)
+	{
+		unmapFile(&file);
+	}
+	free(data);
+	return result;
+}
+
+//
+// FUNCTION: computeRollupRows
+// DESCRIPTION:
+//		This function fills in the rollup rows of a slice of the country ids. The count, the totals
+//		and the cheapest and most expensive parcels come from the aggregates cached at the root of
+//		each BST, the lightest and heaviest from the two spines, so every country costs O(log n)
+//		and no parcel outside those paths is read. A country without parcels gets a count of 0.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		unsigned int first: the first country id of the slice.
+//		unsigned int end: one past the last country id of the slice.
+//		RollupRow* rows: the rows indexed by country id.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void computeRollupRows(const ParcelStore* store, unsigned int first, unsigned int end, RollupRow* rows)
+{
+	for (unsigned int id = first; id < end; id++)
+	{
+		RollupRow* row = &rows[id];
+		ParcelIndex root = store->catalog.roots[id];
+		row->country = store->catalog.names[id];
+		row->count = 0;
+		if (root == NULL_PARCEL)
+		{
+			continue;
+		}
+
+		const ParcelAggregate* all = &getParcel(&store->arena, root)->subtree;
+		const Parcel* lightest = NULL;
+		const Parcel* heaviest = NULL;
+		findLightestAndHeaviest(store, root, &lightest, &heaviest);
+		row->count = all->count;
+		row->weightSum = all->weightSum;
+		row->valuationSum = all->valuationSum;
+		row->cheapest = getParcel(&store->arena, all->cheapest);
+		row->mostExpensive = getParcel(&store->arena, all->mostExpensive);
+		row->lightest = lightest;
+		row->heaviest = heaviest;
+	}
+}
+
+//
+// FUNCTION: compareRollupRows
+// DESCRIPTION:
+//		This function orders two rollup rows by country name for qsort.
+// PARAMETERS:
+//		const void* first: the first row.
+//		const void* second: the second row.
+// RETURNS:
+//		int: negative, zero or positive like strcmp.
+//
+static int compareRollupRows(const void* first, const void* second)
+{
+	return strcmp(((const RollupRow*)first)->country, ((const RollupRow*)second)->country);
+}
+
+//
+// FUNCTION: buildRollupReport
+// DESCRIPTION:
+//		This function computes the rollup rows of every country with parcels in one pass over the
+//		catalog, split into contiguous slices of country ids over the threads, and sorts them by
+//		country name. A slice is at least ROLLUP_MIN_COUNTRIES countries, below that a thread costs
+//		more to start than its countries take. The store is only read.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		int threadCount: the number of threads, 0 for one per hardware thread.
+//		unsigned int* rowCount: the variable where the number of rows will get stored.
+// RETURNS:
+//		RollupRow*: the rows, to be freed by the caller.
+//
+RollupRow* buildRollupReport(const ParcelStore* store, int threadCount, unsigned int* rowCount)
+{
+	unsigned int countries = store->catalog.count;
+	RollupRow* rows = (RollupRow*)malloc((countries > 0 ? countries : 1) * sizeof(RollupRow));
+	std::thread workers[BATCH_MAX_THREADS];
+
+	if (rows == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for rollup report.\n");
+		exit(1);
+	}
+	if (threadCount <= 0)
+	{
+		threadCount = (int)std::thread::hardware_concurrency();
+	}
+	threadCount = threadCount < 1 ? 1 : threadCount > BATCH_MAX_THREADS ? BATCH_MAX_THREADS : threadCount;
+	if ((unsigned int)threadCount > countries / ROLLUP_MIN_COUNTRIES)
+	{
+		threadCount = countries / ROLLUP_MIN_COUNTRIES > 0 ? (int)(countries / ROLLUP_MIN_COUNTRIES) : 1;
+	}
+
+	// the calling thread takes the first slice itself
+	unsigned int slice = (countries + (unsigned int)threadCount - 1) / (unsigned int)threadCount;
+	for (int i = 1; i < threadCount; i++)
+	{
+		unsigned int first = (unsigned int)i * slice < countries ? (unsigned int)i * slice : countries;
+		unsigned int end = first + slice < countries ? first + slice : countries;
+		workers[i] = std::thread(computeRollupRows, store, first, end, rows);
+	}
+	computeRollupRows(store, 0, slice < countries ? slice : countries, rows);
+	for (int i = 1; i < threadCount; i++)
+	{
+		workers[i].join();
+	}
+
+	unsigned int kept = 0;
+	for (unsigned int id = 0; id < countries; id++)
+	{
+		if (rows[id].count > 0)
+		{
+			rows[kept++] = rows[id];   // drop countries whose parcels were all removed
+		}
+	}
+	qsort(rows, kept, sizeof(RollupRow), compareRollupRows);
+	*rowCount = kept;
+	return rows;
+}
+
+//
+// FUNCTION: writeRollupParcel
+// DESCRIPTION:
+//		This function writes one extreme parcel of a rollup row, a line of the human report or the
+//		weight and valuation fields of a machine readable record.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		OutputFormat format: the output format.
+//		const char* name: what the parcel is, such as "cheapest".
+//		const char* prefix: the text before the weight in the human report.
+//		const Parcel* parcel: the parcel.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void writeRollupParcel(OutputBuffer* out, OutputFormat format, const char* name, const char* prefix, const Parcel* parcel)
+{
+	if (format == OUTPUT_HUMAN)
+	{
+		writeHumanParcel(out, prefix, parcel->weight, parcel->valuation, 2);
+		return;
+	}
+	if (format == OUTPUT_JSON)
+	{
+		writeString(out, ",\"");
+		writeString(out, name);
+		writeString(out, "_weight\":");
+		writeInteger(out, parcel->weight);
+		writeString(out, ",\"");
+		writeString(out, name);
+		writeString(out, "_valuation\":");
+	}
+	else
+	{
+		writeBytes(out, ",", 1);
+		writeInteger(out, parcel->weight);
+		writeBytes(out, ",", 1);
+	}
+	writeCents(out, parcel->valuation, 2);
+}
+
+//
+// FUNCTION: writeRollupReport
+// DESCRIPTION:
+//		This function writes the rollup report, one block or record per country. JSON gets one
+//		object per line and CSV a header and one line per country.
+// PARAMETERS:
+//		OutputBuffer* out: the buffer to write to.
+//		OutputFormat format: the output format.
+//		const RollupRow* rows: the rows, sorted by country name.
+//		unsigned int rowCount: the number of rows.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeRollupReport(OutputBuffer* out, OutputFormat format, const RollupRow* rows, unsigned int rowCount)
+{
+	if (format == OUTPUT_HUMAN)
+	{
+		unsigned long long parcels = 0;
+		for (unsigned int i = 0; i < rowCount; i++)
+		{
+			parcels += rows[i].count;
+		}
+		char header[96];
+		snprintf(header, sizeof(header), "Rollup report for %u countries, %llu parcels\n", rowCount, parcels);
+		writeString(out, header);
+	}
+	else if (format == OUTPUT_CSV)
+	{
+		writeString(out, "country,count,weight,valuation,cheapest_weight,cheapest_valuation,most_expensive_weight,"
+			"most_expensive_valuation,lightest_weight,lightest_valuation,heaviest_weight,heaviest_valuation\n");
+	}
+
+	for (unsigned int i = 0; i < rowCount; i++)
+	{
+		const RollupRow* row = &rows[i];
+		if (format == OUTPUT_HUMAN)
+		{
+			writeString(out, "\nCountry: ");
+			writeString(out, row->country);
+			writeString(out, ", Parcels: ");
+			writeInteger(out, row->count);
+			writeString(out, "\nTotal load: ");
+			writeInteger(out, row->weightSum);
+			writeString(out, " grams, total valuation: $");
+			writeCents(out, row->valuationSum, 2);
+			writeBytes(out, "\n", 1);
+		}
+		else
+		{
+			writeString(out, format == OUTPUT_JSON ? "{\"country\":" : "");
+			writeQuoted(out, row->country, format);
+			writeString(out, format == OUTPUT_JSON ? ",\"count\":" : ",");
+			writeInteger(out, row->count);
+			writeString(out, format == OUTPUT_JSON ? ",\"weight\":" : ",");
+			writeInteger(out, row->weightSum);
+			writeString(out, format == OUTPUT_JSON ? ",\"valuation\":" : ",");
+			writeCents(out, row->valuationSum, 2);
+		}
+		writeRollupParcel(out, format, "cheapest", "Cheapest parcel: Weight: ", row->cheapest);
+		writeRollupParcel(out, format, "most_expensive", "Most expensive parcel: Weight: ", row->mostExpensive);
+		writeRollupParcel(out, format, "lightest", "Lightest parcel: Weight: ", row->lightest);
+		writeRollupParcel(out, format, "heaviest", "Heaviest parcel: Weight: ", row->heaviest);
+		if (format != OUTPUT_HUMAN)
+		{
+			writeString(out, format == OUTPUT_JSON ? "}\n" : "\n");
+		}
+	}
+}
+
+//
+// FUNCTION: displayRollupReport
+// DESCRIPTION:
+//		This function computes and prints the rollup report of every country: count, totals,
+//		cheapest, most expensive, lightest and heaviest parcel, in one pass instead of running
+//		menu options 3, 4 and 5 once per country.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store containing the parcels.
+//		OutputFormat format: the output format.
+//		int threadCount: the number of threads, 0 for one per hardware thread.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void displayRollupReport(const ParcelStore* store, OutputFormat format, int threadCount)
+{
+	OutputBuffer out;
+	unsigned int rowCount;
+	RollupRow* rows;
+
+	{
+		STAT_TIME(STAT_OP_ROLLUP);
+		rows = buildRollupReport(store, threadCount, &rowCount);
+	}
+	if (rowCount == 0 && format == OUTPUT_HUMAN)
+	{
+		printf("No parcels found.\n");
+		free(rows);
+		return;
+	}
+	initOutputBuffer(&out, stdout);
+	writeRollupReport(&out, format, rows, rowCount);
+	flushOutputBuffer(&out);
+	fflush(stdout);
+	free(out.data);
+	free(rows);
+}
+
+//
+// FUNCTION: cleanupMemory
+// DESCRIPTION:
+//		This function releases all memory owned by the parcel store in bulk, 
+//		freeing whole arena slabs instead of walking every tree node.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store to be cleaned up.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void cleanupMemory(ParcelStore* store) 
+{
+	for (unsigned int i = 0; i < store->arena.chunkCount; i++) 
+	{
+		if (i >= store->arena.mappedChunks)
+		{
+			free(store->arena.chunks[i]);   // one free per slab of parcel nodes
+		}
+		store->arena.chunks[i] = NULL;
+	}
+	store->arena.chunkCount = 0;
+	store->arena.mappedChunks = 0;
+	store->arena.nextIndex = 0;
+	if (store->snapshot.data != NULL)
+	{
+		unmapFile(&store->snapshot);   // the mapped slabs go away with the snapshot
+	}
+
+	freeCountryCatalog(&store->catalog);
+	freeValuationIndex(&store->valuations);
+	freeQuantileIndex(&store->quantiles);
+	for (unsigned int i = 0; i < store->boxes.capacity; i++)
+	{
+		freeCountryBoxes(&store->boxes.countries[i]);
+	}
+	free(store->boxes.countries);
+	store->boxes.countries = NULL;
+	store->boxes.capacity = 0;
+
+	for (unsigned int i = 0; i < store->columnCapacity; i++)
+	{
+		freeCountryColumns(&store->columns[i]);   // free the columnar segments
+	}
+	free(store->columns);
+	store->columns = NULL;
+	store->columnCapacity = 0;
+	freeLazyIndex(&store->lazy);
+}
+
+//
+// FUNCTION: displayMemoryFootprint
+// DESCRIPTION:
+//		This function reports the memory used by the arena storage and compares it with
+//		the original layout of one malloc'd node plus one malloc'd destination string per parcel.
+//		The share of the subtree aggregates is shown on its own, they are most of every node.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store to be measured.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void displayMemoryFootprint(const ParcelStore* store)
+{
+	size_t parcelCount = store->arena.nextIndex > 0 ? store->arena.nextIndex - 1 - store->arena.freeCount : 0;   // slot 0 is never handed out, released nodes hold no parcel
+	size_t legacyNameBytes = 0;
+
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		legacyNameBytes += (size_t)store->catalog.parcelCounts[id] * (strlen(store->catalog.names[id]) + 1);   // every old node had its own copy
+	}
+
+	size_t legacyNodeBytes = parcelCount * (sizeof(LegacyParcel) + HEAP_BLOCK_OVERHEAD);
+	size_t legacyTotal = legacyNodeBytes + legacyNameBytes + parcelCount * HEAP_BLOCK_OVERHEAD;
+	size_t arenaUsed = parcelCount * sizeof(Parcel);
+	size_t arenaReserved = (size_t)store->arena.chunkCount * ARENA_CHUNK_SIZE * sizeof(Parcel);
+	size_t catalogBytes = store->catalog.nameBytes + store->catalog.count * HEAP_BLOCK_OVERHEAD
+		+ store->catalog.capacity * (sizeof(char*) + sizeof(unsigned int) + sizeof(ParcelIndex))
+		+ store->catalog.slotCount * sizeof(CountrySlot);
+	size_t newTotal = arenaUsed + catalogBytes;
+
+	printf("Memory footprint for %zu parcels in %u countries:\n", parcelCount, store->catalog.count);
+	printf("Old layout: %zu bytes per node + destination copy, %zu allocations, %zu bytes total\n",
+		sizeof(LegacyParcel), parcelCount * 2, legacyTotal);
+	printf("New layout: %zu bytes per node, %u slabs, %zu bytes used, %zu bytes reserved\n",
+		sizeof(Parcel), store->arena.chunkCount, arenaUsed, arenaReserved);
+	printf("Subtree aggregates: %zu of the %zu bytes per node, %zu bytes used, the price of O(log n) range totals and extremes\n",
+		sizeof(ParcelAggregate), sizeof(Parcel), parcelCount * sizeof(ParcelAggregate));
+	printf("Country catalog: %zu bytes for %u interned names\n", catalogBytes, store->catalog.count);
+	if (store->valuations.built)
+	{
+		printf("Valuation index: %zu bytes per entry, two entries per parcel, %zu bytes reserved\n", sizeof(ValuationEntry),
+			(size_t)store->valuations.capacity * sizeof(ValuationEntry) + store->valuations.countryCapacity * sizeof(ValuationSlot));
+	}
+	if (store->quantiles.built)
+	{
+		printf("Quantile sketches: %zu bytes per country whatever its parcel count, %zu bytes reserved\n", sizeof(CountrySketches),
+			(size_t)store->quantiles.capacity * sizeof(CountrySketches));
+	}
+	size_t boxBytes = 0;
+	size_t boxParcels = 0;
+	for (unsigned int id = 0; id < store->boxes.capacity; id++)
+	{
+		const CountryBoxes* boxes = &store->boxes.countries[id];
+		boxBytes += boxes->points != NULL ? (size_t)boxes->count * sizeof(BoxPoint) + (size_t)boxes->nodeCount * sizeof(BoxNode) : 0;
+		boxParcels += boxes->points != NULL ? boxes->count : 0;
+	}
+	if (boxParcels > 0)
+	{
+		printf("Box index: %zu bytes for %zu parcels, %.2f bytes per parcel\n", boxBytes, boxParcels, (double)boxBytes / (double)boxParcels);
+	}
+	if (store->lazy.active)
+	{
+		unsigned int built = 0;
+		size_t offsetBytes = store->lazy.capacity * sizeof(LazyCountry);
+		for (unsigned int id = 0; id < store->catalog.count; id++)
+		{
+			built += store->lazy.countries[id].built;
+			offsetBytes += store->lazy.countries[id].capacity * sizeof(unsigned long long);
+		}
+		printf("Lazy index: %u of %u countries built, %zu bytes of row offsets, %u builds, %u evictions\n", built,
+			store->catalog.count, offsetBytes, store->lazy.builds, store->lazy.evictions);
+		if (store->lazy.budget > 0)
+		{
+			printf("Built trees: %zu bytes of a %zu byte budget\n", store->lazy.used, store->lazy.budget);
+		}
+	}
+	size_t columnBytes = 0;
+	size_t columnParcels = 0;
+	for (unsigned int id = 0; id < store->columnCapacity; id++)
+	{
+		columnBytes += countryColumnBytes(&store->columns[id]);
+		columnParcels += store->columns[id].weights != NULL || store->columns[id].blocks != NULL ? store->columns[id].count : 0;
+	}
+	if (columnParcels > 0)
+	{
+		printf("%s columns: %zu bytes for %zu parcels, %.2f bytes per parcel\n", store->compressed ? "Compressed" : "Plain",
+			columnBytes, columnParcels, (double)columnBytes / (double)columnParcels);
+	}
+	printf("New layout total: %zu bytes in use", newTotal);
+	if (newTotal > 0 && legacyTotal > 0)
+	{
+		printf(" (%.2f%% of the old layout, %.2f%% without the subtree aggregates)", 100.0 * (double)newTotal / (double)legacyTotal,
+			100.0 * (double)(newTotal - parcelCount * sizeof(ParcelAggregate)) / (double)legacyTotal);
+	}
+	printf("\n");
+}
+
+//
+// FUNCTION: collectTreeStats
+// DESCRIPTION:
+//		This function walks a BST iteratively and measures its depth and balance.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store which owns the arena.
+//		ParcelIndex root: the arena index of the root of the BST to be measured.
+//		TreeStats* stats: the variable where the statistics will get stored.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void collectTreeStats(const ParcelStore* store, ParcelIndex root, TreeStats* stats)
+{
+	ParcelIndex stack[AVL_MAX_HEIGHT + 1];   // pre-order walk keeps at most one pending sibling per level
+	int depths[AVL_MAX_HEIGHT + 1];
+	int top = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	if (root == NULL_PARCEL)
+	{
+		return;
+	}
+
+	stack[top] = root;
+	depths[top++] = 1;
+	while (top > 0)
+	{
+		const Parcel* parcel = getParcel(&store->arena, stack[--top]);
+		int depth = depths[top];
+		int imbalance = nodeHeight(&store->arena, parcel->left) - nodeHeight(&store->arena, parcel->right);
+
+		stats->nodes++;
+		stats->depthSum += (unsigned long long)depth;
+		if (depth > stats->height)
+		{
+			stats->height = depth;
+		}
+		if (imbalance < 0)
+		{
+			imbalance = -imbalance;
+		}
+		if (imbalance > stats->maxImbalance)
+		{
+			stats->maxImbalance = imbalance;
+		}
+		if (parcel->left == NULL_PARCEL && parcel->right == NULL_PARCEL && (stats->minLeafDepth == 0 || depth < stats->minLeafDepth))
+		{
+			stats->minLeafDepth = depth;
+		}
+
+		if (parcel->right != NULL_PARCEL)
+		{
+			stack[top] = parcel->right;
+			depths[top++] = depth + 1;
+		}
+		if (parcel->left != NULL_PARCEL)
+		{
+			stack[top] = parcel->left;
+			depths[top++] = depth + 1;
+		}
+	}
+}
+
+//
+// FUNCTION: collectCountryTableStats
+// DESCRIPTION:
+//		This function measures how well the country hash table spreads the countries: how many
+//		were displaced from their home slot and how many slots a lookup of each one inspects.
+// PARAMETERS:
+//		const CountryCatalog* catalog: the catalog whose table is measured.
+//		CountryTableStats* stats: the structure where the statistics will get stored.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void collectCountryTableStats(const CountryCatalog* catalog, CountryTableStats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	for (unsigned int slot = 0; slot < catalog->slotCount; slot++)
+	{
+		if (catalog->slots[slot].countryId == -1)
+		{
+			continue;
+		}
+
+		unsigned int home = slotForHash(catalog->slots[slot].hashValue, catalog->slotCount);
+		unsigned int probe = ((slot - home) & (catalog->slotCount - 1)) + 1;   // slots inspected by a successful lookup
+		stats->probeSum += probe;
+		if (probe > 1)
+		{
+			stats->collisions++;   // the country was displaced from its home slot
+		}
+		if (probe > stats->maxProbe)
+		{
+			stats->maxProbe = probe;
+		}
+	}
+}
+
+//
+// FUNCTION: displayIndexStatistics
+// DESCRIPTION:
+//		This function dumps the collision and probe length statistics of the country hash table
+//		and the depth and balance statistics of every country's BST, together with the smallest
+//		height possible for the same number of parcels.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store to be measured.
+// RETURNS:
+//		void: This function does not return a value.
+//
+void displayIndexStatistics(const ParcelStore* store)
+{
+	int worstHeight = 0;
+	int worstImbalance = 0;
+	int trees = 0;
+	const CountryCatalog* catalog = &store->catalog;
+	CountryTableStats table;
+
+	collectCountryTableStats(catalog, &table);
+	printf("Country table: %u countries in %u slots (%.1f%% load), %u collisions, average probe length %.2f, longest probe %u\n",
+		catalog->count, catalog->slotCount, catalog->slotCount ? 100.0 * catalog->count / catalog->slotCount : 0.0,
+		table.collisions, catalog->count ? (double)table.probeSum / catalog->count : 0.0, table.maxProbe);
+
+	printf("Index depth and balance statistics:\n");
+	for (unsigned int id = 0; id < catalog->count; id++)
+	{
+		TreeStats stats;
+		collectTreeStats(store, catalog->roots[id], &stats);
+		if (stats.nodes == 0)
+		{
+			continue;   // skip countries without parcels
+		}
+
+		int minimumHeight = 0;
+		while (((unsigned long long)1 << minimumHeight) <= stats.nodes)
+		{
+			minimumHeight++;   // a perfect tree of this height holds 2^height - 1 nodes
+		}
+
+		printf("%-20s %u parcels, height %d (minimum %d), shallowest leaf %d, average depth %.2f, max balance factor %d\n",
+			catalog->names[id], stats.nodes, stats.height, minimumHeight, stats.minLeafDepth, (double)stats.depthSum / stats.nodes, stats.maxImbalance);
+
+		trees++;
+		if (stats.height > worstHeight)
+		{
+			worstHeight = stats.height;
+		}
+		if (stats.maxImbalance > worstImbalance)
+		{
+			worstImbalance = stats.maxImbalance;
+		}
+	}
+	printf("%d trees, tallest tree %d levels, worst balance factor %d\n", trees, worstHeight, worstImbalance);
+}
+
+//
+// FUNCTION: histogramPercentile
+// DESCRIPTION:
+//		This function estimates a percentile of an operation's time from its histogram, as the
+//		upper bound of the bucket holding that call, so it is at most twice the true value.
+// PARAMETERS:
+//		const unsigned long long* buckets: the STATS_BUCKETS counts of the histogram.
+//		unsigned long long calls: the number of calls in the histogram.
+//		unsigned int percent: the percentile, 100 for the slowest call.
+// RETURNS:
+//		unsigned long long: the estimate in nanoseconds, 0 without calls.
+//
+unsigned long long histogramPercentile(const unsigned long long* buckets, unsigned long long calls, unsigned int percent)
+{
+	unsigned long long rank = calls * percent / 100;
+	unsigned long long seen = 0;
+
+	if (calls == 0)
+	{
+		return 0;
+	}
+	rank = rank < calls ? rank : calls - 1;   // the rank of the call, counted from 0
+	for (int bucket = 0; bucket < STATS_BUCKETS; bucket++)
+	{
+		seen += buckets[bucket];
+		if (seen > rank)
+		{
+			return 2ULL << bucket;
+		}
+	}
+	return 2ULL << (STATS_BUCKETS - 1);
+}
+
+//
+// FUNCTION: writeRuntimeStatistics
+// DESCRIPTION:
+//		This function reports what the engine has done so far and the shape of the index: the
+//		counters and time histograms summed over every thread's slot, the occupancy of the
+//		country hash table and arena, and the depth of every country's tree. The human form is
+//		a summary for the menu, the JSON form one object with every number and histogram. The
+//		counters and histograms are left out when the statistics are compiled out.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store to be described.
+//		OutputBuffer* out: the buffer the report is written to.
+//		OutputFormat format: OUTPUT_HUMAN or OUTPUT_JSON.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeRuntimeStatistics(const ParcelStore* store, OutputBuffer* out, OutputFormat format)
+{
+	const CountryCatalog* catalog = &store->catalog;
+	const ValuationIndex* valuations = &store->valuations;
+	int json = format == OUTPUT_JSON;
+	char text[256];
+
+	writeString(out, json ? "{" : "");
+#ifdef PARCEL_STATS
+	unsigned long long counters[STAT_COUNTER_COUNT];
+	int threads = 0;
+	memset(counters, 0, sizeof(counters));
+	for (int i = 0; i <= STATS_MAX_THREADS; i++)
+	{
+		int used = 0;
+		for (int counter = 0; counter < STAT_COUNTER_COUNT; counter++)
+		{
+			unsigned long long value = statSlots[i].counters[counter].load(std::memory_order_relaxed);
+			counters[counter] += value;
+			used |= value != 0;
+		}
+		for (int operation = 0; operation < STAT_OPERATION_COUNT; operation++)
+		{
+			used |= statSlots[i].calls[operation].load(std::memory_order_relaxed) != 0;
+		}
+		threads += used;
+	}
+
+	snprintf(text, sizeof(text), json ? "\"thread_slots\":%d,\"counters\":{" : "Runtime statistics, counted in %d thread slots:\n", threads);
+	writeString(out, text);
+	for (int counter = 0; counter < STAT_COUNTER_COUNT; counter++)
+	{
+		snprintf(text, sizeof(text), json ? "%s\"%s\":%llu" : "%s%-18s %llu\n", json && counter > 0 ? "," : "", statCounterNames[counter], counters[counter]);
+		writeString(out, text);
+	}
+	if (counters[STAT_COUNTRY_LOOKUPS] > 0 && !json)
+	{
+		snprintf(text, sizeof(text), "Country lookups inspect %.2f slots on average\n", (double)counters[STAT_COUNTRY_PROBES] / counters[STAT_COUNTRY_LOOKUPS]);
+		writeString(out, text);
+	}
+
+	writeString(out, json ? "},\"operations\":{" : "Operation             calls      mean ns    p50 <= ns    p99 <= ns    max <= ns\n");
+	int written = 0;
+	for (int operation = 0; operation < STAT_OPERATION_COUNT; operation++)
+	{
+		unsigned long long buckets[STATS_BUCKETS];
+		unsigned long long calls = 0;
+		unsigned long long nanoseconds = 0;
+		for (int i = 0; i <= STATS_MAX_THREADS; i++)
+		{
+			calls += statSlots[i].calls[operation].load(std::memory_order_relaxed);
+			nanoseconds += statSlots[i].nanoseconds[operation].load(std::memory_order_relaxed);
+		}
+		if (calls == 0)
+		{
+			continue;   // only operations which ran are reported
+		}
+		int lastBucket = 0;
+		for (int bucket = 0; bucket < STATS_BUCKETS; bucket++)
+		{
+			buckets[bucket] = 0;
+			for (int i = 0; i <= STATS_MAX_THREADS; i++)
+			{
+				buckets[bucket] += statSlots[i].buckets[operation][bucket].load(std::memory_order_relaxed);
+			}
+			lastBucket = buckets[bucket] != 0 ? bucket : lastBucket;
+		}
+
+		snprintf(text, sizeof(text), json ? "%s\"%s\":{\"calls\":%llu,\"mean_ns\":%.0f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu,\"histogram\":["
+			: "%s%-16s %10llu %12.0f %12llu %12llu %12llu\n", json && written > 0 ? "," : "", statOperationNames[operation], calls, (double)nanoseconds / calls,
+			histogramPercentile(buckets, calls, 50), histogramPercentile(buckets, calls, 99), histogramPercentile(buckets, calls, 100));
+		writeString(out, text);
+		for (int bucket = 0; json && bucket <= lastBucket; bucket++)
+		{
+			if (bucket > 0)
+			{
+				writeString(out, ",");
+			}
+			writeInteger(out, (long long)buckets[bucket]);   // bucket b counts calls of [2^b, 2^(b+1)) ns
+		}
+		writeString(out, json ? "]}" : "");
+		written++;
+	}
+	writeString(out, json ? "}," : "");
+#else
+	writeString(out, json ? "" : "Runtime counters and timers are compiled out (PARCEL_NO_STATS).\n");
+#endif
+
+	CountryTableStats table;
+	collectCountryTableStats(catalog, &table);
+	snprintf(text, sizeof(text), json ? "\"country_table\":{\"countries\":%u,\"slots\":%u,\"collisions\":%u,\"mean_probe\":%.3f,\"longest_probe\":%u},"
+		: "Country table: %u countries in %u slots, %u collisions, average probe length %.2f, longest probe %u\n",
+		catalog->count, catalog->slotCount, table.collisions, catalog->count ? (double)table.probeSum / catalog->count : 0.0, table.maxProbe);
+	writeString(out, text);
+	snprintf(text, sizeof(text), json ? "\"arena\":{\"slots\":%u,\"free\":%u,\"chunks\":%u},\"valuation_index\":{\"built\":%d,\"entries\":%u},"
+		: "Arena: %u parcel slots, %u free, %u slabs; valuation index: built %d, %u entries\n",
+		store->arena.nextIndex > 0 ? store->arena.nextIndex - 1 : 0, store->arena.freeCount, store->arena.chunkCount,
+		valuations->built, valuations->built ? valuations->entryCount - 1 : 0);
+	writeString(out, text);
+
+	writeString(out, json ? "\"trees\":[" : "");
+	int tallest = -1;
+	int tallestHeight = 0;
+	unsigned long long depthSum = 0;
+	unsigned long long nodes = 0;
+	for (unsigned int id = 0; id < catalog->count; id++)
+	{
+		TreeStats stats;
+		collectTreeStats(store, catalog->roots[id], &stats);
+		depthSum += stats.depthSum;
+		nodes += stats.nodes;
+		if (stats.height > tallestHeight)
+		{
+			tallest = (int)id;
+			tallestHeight = stats.height;
+		}
+		if (json)
+		{
+			writeString(out, id > 0 ? ",{\"country\":" : "{\"country\":");
+			writeQuoted(out, catalog->names[id], format);
+			snprintf(text, sizeof(text), ",\"parcels\":%u,\"height\":%d,\"shallowest_leaf\":%d,\"mean_depth\":%.3f,\"max_balance\":%d}",
+				stats.nodes, stats.height, stats.minLeafDepth, stats.nodes ? (double)stats.depthSum / stats.nodes : 0.0, stats.maxImbalance);
+			writeString(out, text);
+		}
+	}
+	if (json)
+	{
+		writeString(out, "]}\n");
+	}
+	else
+	{
+		snprintf(text, sizeof(text), "Trees: %u, tallest %d levels (%s), average depth %.2f\n", catalog->count, tallestHeight,
+			tallest >= 0 ? catalog->names[tallest] : "none", nodes ? (double)depthSum / nodes : 0.0);
+		writeString(out, text);
+	}
+}
+
+//
+// FUNCTION: displayRuntimeStatistics
+// DESCRIPTION:
+//		This function prints the runtime statistics for the menu.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store to be described.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void displayRuntimeStatistics(const ParcelStore* store)
+{
+	OutputBuffer out;
+	initOutputBuffer(&out, stdout);
+	writeRuntimeStatistics(store, &out, OUTPUT_HUMAN);
+	flushOutputBuffer(&out);
+	free(out.data);
+}
+
+//
+// FUNCTION: dumpRuntimeStatistics
+// DESCRIPTION:
+//		This function writes the runtime statistics as JSON, for --stats when the program ends.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store to be described.
+//		const char* path: the file to write, "-" for standard output, NULL to do nothing.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void dumpRuntimeStatistics(const ParcelStore* store, const char* path)
+{
+	FILE* file = stdout;
+	OutputBuffer out;
+
+	if (path == NULL)
+	{
+		return;
+	}
+	if (strcmp(path, "-") != 0 && fopen_s(&file, path, "wb") != 0)
+	{
+		fprintf(stderr, "Warning: Unable to write statistics to %s\n", path);
+		return;
+	}
+	initOutputBuffer(&out, file);
+	writeRuntimeStatistics(store, &out, OUTPUT_JSON);
+	flushOutputBuffer(&out);
+	free(out.data);
+	if (file != stdout)
+	{
+		fclose(file);
+	}
+}
+
+//
+// FUNCTION: benchmarkColumnarScans
+// DESCRIPTION:
+//		This function times full country scans (total load, total valuation and the valuation
+//		extremes) walking the trees against the SIMD kernels over the columnar segments, and
+//		weight range summaries through the tree aggregates against the columns, then repeats the
+//		columns side with the compressed segments and compares their memory. Every side must
+//		agree on the answers, otherwise the benchmark reports the mismatch.
+// PARAMETERS:
+//		ParcelStore* store: the loaded parcel store.
+// RETURNS:
+//		int: returns 0 when both layouts agree else 1.
+//
+int benchmarkColumnarScans(ParcelStore* store)
+{
+	typedef std::chrono::steady_clock Clock;
+	size_t parcelCount = store->arena.nextIndex > 0 ? store->arena.nextIndex - 1 - store->arena.freeCount : 0;
+	int rounds = parcelCount > 0 ? (int)(20000000 / parcelCount) + 1 : 1;   // scan roughly twenty million parcels per layout
+	int mismatches = 0;
+	long long checksum = 0;   // keeps the optimizer from dropping the timed loops
+	Cents valuationDifference = 0;   // cents add up exactly in any order
+	int compressed = store->compressed;
+
+	store->compressed = 0;   // plain columns first
+	Clock::time_point start = Clock::now();
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		getCountryColumns(store, (int)id);
+	}
+	double buildSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	start = Clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		for (unsigned int id = 0; id < store->catalog.count; id++)
+		{
+			ParcelIterator iterator;
+			const Parcel* parcel;
+			const Parcel* cheapest = NULL;
+			const Parcel* mostExpensive = NULL;
+			long long weightSum = 0;
+			Cents valuationSum = 0;
+
+			initIterator(&iterator, store, store->catalog.roots[id]);
+			while ((parcel = nextParcel(&iterator)) != NULL)
+			{
+				weightSum += parcel->weight;
+				valuationSum += parcel->valuation;
+				cheapest = cheapest == NULL || parcel->valuation < cheapest->valuation ? parcel : cheapest;
+				mostExpensive = mostExpensive == NULL || parcel->valuation > mostExpensive->valuation ? parcel : mostExpensive;
+			}
+			checksum += weightSum + (cheapest != NULL ? (long long)cheapest->weight + (long long)mostExpensive->weight : 0);
+			valuationDifference += valuationSum;
+		}
+	}
+	double treeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	start = Clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		for (unsigned int id = 0; id < store->catalog.count; id++)
+		{
+			const CountryColumns* columns = getCountryColumns(store, (int)id);
+			if (columns == NULL)
+			{
+				continue;
+			}
+
+			size_t cheapest;
+			size_t mostExpensive;
+			long long weightSum = sumWeightColumn(columns->weights, columns->count);
+			Cents valuationSum = sumValuationColumn(columns->valuations, columns->count);
+			findValuationExtremes(columns->valuations, columns->count, &cheapest, &mostExpensive);
+			checksum -= weightSum + columns->weights[cheapest] + columns->weights[mostExpensive];
+			valuationDifference -= valuationSum;
+		}
+	}
+	double columnSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+	if (checksum != 0 || valuationDifference != 0)
+	{
+		mismatches++;
+	}
+
+	// weight range summaries: O(log n) tree aggregates against binary search plus a kernel pass
+	const int rangeQueries = 20000;
+	unsigned int seed = 12345;
+	double rangeTreeSeconds = 0.0;
+	double rangeColumnSeconds = 0.0;
+	for (int query = 0; query < rangeQueries && store->catalog.count > 0; query++)
+	{
+		seed = seed * 1103515245u + 12345u;   // fixed sequence so runs are comparable
+		unsigned int id = (seed >> 8) % store->catalog.count;
+		const CountryColumns* columns = getCountryColumns(store, (int)id);
+		if (columns == NULL)
+		{
+			continue;
+		}
+		seed = seed * 1103515245u + 12345u;
+		int minWeight = columns->weights[(seed >> 8) % columns->count];
+		seed = seed * 1103515245u + 12345u;
+		int maxWeight = columns->weights[(seed >> 8) % columns->count];
+		if (minWeight > maxWeight)
+		{
+			int swap = minWeight;
+			minWeight = maxWeight;
+			maxWeight = swap;
+		}
+
+		ParcelAggregate range;
+		start = Clock::now();
+		aggregateWeightRange(store, store->catalog.roots[id], minWeight, maxWeight, &range);
+		rangeTreeSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+		start = Clock::now();
+		size_t first = columnRank(columns->weights, columns->count, minWeight, 0);
+		size_t end = columnRank(columns->weights, columns->count, maxWeight, 1);
+		long long weightSum = sumWeightColumn(columns->weights + first, end - first);
+		rangeColumnSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+		if (range.count != end - first || range.weightSum != weightSum)
+		{
+			mismatches++;
+		}
+	}
+
+	size_t plainBytes = 0;
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		plainBytes += countryColumnBytes(&store->columns[id]);
+	}
+
+	// the same scans and ranges over the compressed segments, checked against the trees
+	store->compressed = 1;
+	start = Clock::now();
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		getCountryColumns(store, (int)id);
+	}
+	double packSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+	size_t packedBytes = 0;
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		packedBytes += countryColumnBytes(&store->columns[id]);
+	}
+
+	start = Clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		for (unsigned int id = 0; id < store->catalog.count; id++)
+		{
+			const CountryColumns* columns = getCountryColumns(store, (int)id);
+			if (columns == NULL)
+			{
+				continue;
+			}
+
+			ColumnSummary summary;
+			summarizeCompressedColumns(columns, 0, columns->count, &summary);
+			const ParcelAggregate* tree = &getParcel(&store->arena, store->catalog.roots[id])->subtree;
+			if (summary.weightSum != tree->weightSum || summary.valuationSum != tree->valuationSum
+				|| summary.minValuation != tree->minValuation || summary.maxValuation != tree->maxValuation)
+			{
+				mismatches++;
+			}
+		}
+	}
+	double packedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	seed = 12345;
+	double rangePackedSeconds = 0.0;
+	for (int query = 0; query < rangeQueries && store->catalog.count > 0; query++)
+	{
+		seed = seed * 1103515245u + 12345u;
+		unsigned int id = (seed >> 8) % store->catalog.count;
+		const CountryColumns* columns = getCountryColumns(store, (int)id);
+		if (columns == NULL)
+		{
+			continue;
+		}
+		int minWeight;
+		int maxWeight;
+		Cents valuation;
+		seed = seed * 1103515245u + 12345u;
+		compressedParcelAt(columns, (seed >> 8) % columns->count, &minWeight, &valuation);
+		seed = seed * 1103515245u + 12345u;
+		compressedParcelAt(columns, (seed >> 8) % columns->count, &maxWeight, &valuation);
+		if (minWeight > maxWeight)
+		{
+			int swap = minWeight;
+			minWeight = maxWeight;
+			maxWeight = swap;
+		}
+
+		ParcelAggregate range;
+		aggregateWeightRange(store, store->catalog.roots[id], minWeight, maxWeight, &range);
+
+		start = Clock::now();
+		ColumnSummary summary;
+		size_t first = compressedRank(columns, minWeight, 0);
+		size_t end = compressedRank(columns, maxWeight, 1);
+		summarizeCompressedColumns(columns, first, end, &summary);
+		rangePackedSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+		if (range.count != end - first || range.weightSum != summary.weightSum || range.valuationSum != summary.valuationSum)
+		{
+			mismatches++;
+		}
+	}
+	store->compressed = compressed;
+
+	double scanned = (double)parcelCount * rounds;
+	printf("Columnar benchmark: %zu parcels in %u countries, %d rounds, %s kernels\n", parcelCount, store->catalog.count, rounds,
+		cpuSupportsAvx2() ? "AVX2" :
+#ifdef PARCEL_HAVE_SSE2
+		"SSE2"
+#else
+		"scalar"
+#endif
+	);
+	printf("Column build: %.3f ms\n", buildSeconds * 1e3);
+	if (scanned > 0)
+	{
+		printf("Full scan, tree walk: %.3f ns/parcel\n", treeSeconds * 1e9 / scanned);
+		printf("Full scan, columns:   %.3f ns/parcel (%.1fx)\n", columnSeconds * 1e9 / scanned, columnSeconds > 0 ? treeSeconds / columnSeconds : 0.0);
+		printf("Full scan, compressed: %.3f ns/parcel (%.1fx)\n", packedSeconds * 1e9 / scanned, packedSeconds > 0 ? treeSeconds / packedSeconds : 0.0);
+	}
+	printf("Range summary, tree aggregates: %.1f ns/query\n", rangeTreeSeconds * 1e9 / rangeQueries);
+	printf("Range summary, columns:         %.1f ns/query\n", rangeColumnSeconds * 1e9 / rangeQueries);
+	printf("Range summary, compressed:      %.1f ns/query\n", rangePackedSeconds * 1e9 / rangeQueries);
+	if (parcelCount > 0)
+	{
+		printf("Memory: tree nodes %.2f bytes/parcel, columns %.2f bytes/parcel, compressed %.2f bytes/parcel (%.1fx smaller, packed in %.3f ms)\n",
+			(double)sizeof(Parcel), (double)plainBytes / parcelCount, (double)packedBytes / parcelCount,
+			packedBytes > 0 ? (double)plainBytes / packedBytes : 0.0, packSeconds * 1e3);
+	}
+	if (mismatches > 0)
+	{
+		printf("Error: %d results differ between the tree and the columns.\n", mismatches);
+	}
+	return mismatches > 0;
+}
+
+//
+// FUNCTION: checkParcelStore
+// DESCRIPTION:
+//		This function checks the whole store after a stress test: every tree must be a balanced
+//		search tree, every node's height and aggregates must follow from its children, the
+//		per-country counts must match, and every arena slot must be either in a tree or on the
+//		free list, so no node leaked.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store to be checked.
+//		size_t* parcelCount: the variable where the number of parcels in the trees will get stored.
+// RETURNS:
+//		unsigned long long: the number of violations found, 0 for a consistent store.
+//
+unsigned long long checkParcelStore(const ParcelStore* store, size_t* parcelCount)
+{
+	const ParcelArena* arena = &store->arena;
+	unsigned long long violations = 0;
+	size_t reachable = 0;
+	size_t freeNodes = 0;
+
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		ParcelIndex root = store->catalog.roots[id];
+		ParcelIterator iterator;
+		const Parcel* parcel;
+		TreeStats stats;
+		unsigned int count = 0;
+		int previous = INT_MIN;
+
+		initIterator(&iterator, store, root);
+		while ((parcel = nextParcel(&iterator)) != NULL)
+		{
+			violations += parcel->weight < previous || parcel->countryId != id;
+			previous = parcel->weight;
+			count++;
+		}
+		collectTreeStats(store, root, &stats);
+		violations += stats.maxImbalance > 1 || count != store->catalog.parcelCounts[id];
+		reachable += count;
+	}
+
+	for (ParcelIndex index = 1; index < arena->nextIndex; index++)
+	{
+		const Parcel* node = getParcel(arena, index);
+		if (node->height == 0)
+		{
+			freeNodes++;
+			continue;
+		}
+
+		int height = 0;
+		unsigned int count = 1;
+		long long weightSum = node->weight;
+		Cents minValuation = node->valuation;
+		Cents maxValuation = node->valuation;
+		ParcelIndex children[2] = { node->left, node->right };
+		for (int i = 0; i < 2; i++)
+		{
+			if (children[i] != NULL_PARCEL)
+			{
+				const Parcel* child = getParcel(arena, children[i]);
+				height = child->height > height ? child->height : height;
+				count += child->subtree.count;
+				weightSum += child->subtree.weightSum;
+				minValuation = child->subtree.minValuation < minValuation ? child->subtree.minValuation : minValuation;
+				maxValuation = child->subtree.maxValuation > maxValuation ? child->subtree.maxValuation : maxValuation;
+			}
+		}
+		violations += node->height != height + 1 || node->subtree.count != count || node->subtree.weightSum != weightSum
+			|| node->subtree.minValuation != minValuation || node->subtree.maxValuation != maxValuation
+			|| getParcel(arena, node->subtree.cheapest)->valuation != minValuation
+			|| getParcel(arena, node->subtree.mostExpensive)->valuation != maxValuation;
+	}
+
+	size_t slots = arena->nextIndex > 0 ? (size_t)arena->nextIndex - 1 : 0;
+	violations += freeNodes != arena->freeCount || reachable + freeNodes != slots;
+	*parcelCount = reachable;
+	return violations;
+}
+
+//
+// FUNCTION: runLiveBenchReader
+// DESCRIPTION:
+//		This function is the loop of one reader thread of the live ingest benchmark. Each query
+//		pins a version and checks that it is consistent while the writers keep inserting: the
+//		root count must match the parcel count published with it, and a range aggregate must
+//		match the same range counted by rank. Now and then a whole country is walked in order.
+// PARAMETERS:
+//		LiveBenchWorker* worker: the state of the thread.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void runLiveBenchReader(LiveBenchWorker* worker)
+{
+	typedef std::chrono::steady_clock Clock;
+	LiveIndex* live = worker->live;
+	const ParcelStore* store = live->store;
+	unsigned int seed = 2654435761u * (unsigned int)(worker->id + 1);
+	int reader = registerLiveReader(live);
+
+	if (reader < 0)
+	{
+		return;
+	}
+	while (!worker->stop->load(std::memory_order_relaxed))
+	{
+		Clock::time_point start = Clock::now();
+		const IndexVersion* version = beginLiveRead(live, reader);
+
+		seed = seed * 1103515245u + 12345u;
+		unsigned int id = version->catalog.count > 0 ? (seed >> 8) % version->catalog.count : 0;
+		ParcelIndex root = version->catalog.count > 0 ? version->catalog.roots[id] : NULL_PARCEL;
+		if (root != NULL_PARCEL)
+		{
+			seed = seed * 1103515245u + 12345u;
+			int minWeight = (int)((seed >> 8) % 50000);
+			seed = seed * 1103515245u + 12345u;
+			int maxWeight = minWeight + (int)((seed >> 8) % 10000);
+			ParcelAggregate range;
+
+			aggregateWeightRange(store, root, minWeight, maxWeight, &range);
+			unsigned int ranked = countWeightsBelow(store, root, maxWeight, 1) - countWeightsBelow(store, root, minWeight, 0);
+			worker->violations += getParcel(&store->arena, root)->subtree.count != version->catalog.parcelCounts[id];
+			worker->violations += range.count != ranked;
+
+			if ((worker->operations & 1023) == 0)
+			{
+				ParcelIterator iterator;
+				const Parcel* parcel;
+				unsigned int count = 0;
+				int previous = INT_MIN;
+				initIterator(&iterator, store, root);
+				while ((parcel = nextParcel(&iterator)) != NULL)
+				{
+					worker->violations += parcel->weight < previous;   // weight order must hold on every version
+					previous = parcel->weight;
+					count++;
+				}
+				worker->violations += count != version->catalog.parcelCounts[id];
+			}
+		}
+
+		endLiveRead(live, reader);
+		unsigned long long nanoseconds = (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+		worker->latencies[worker->operations % LIVE_BENCH_SAMPLES] = nanoseconds > UINT_MAX ? UINT_MAX : (unsigned int)nanoseconds;
+		worker->operations++;
+	}
+	unregisterLiveReader(live, reader);
+}
+
+//
+// FUNCTION: runLiveBenchWriter
+// DESCRIPTION:
+//		This function is the loop of one writer thread of the live ingest benchmark, inserting
+//		batches of random parcels for the countries the index started with.
+// PARAMETERS:
+//		LiveBenchWorker* worker: the state of the thread.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void runLiveBenchWriter(LiveBenchWorker* worker)
+{
+	LiveParcel batch[LIVE_BATCH_SIZE];
+	unsigned int seed = 40503u * (unsigned int)(worker->id + 1);
+
+	while (!worker->stop->load(std::memory_order_relaxed))
+	{
+		for (int i = 0; i < LIVE_BATCH_SIZE; i++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			batch[i].country = worker->countries[(seed >> 8) % worker->countryCount];
+			seed = seed * 1103515245u + 12345u;
+			batch[i].weight = (int)((seed >> 8) % 50000) + 1;
+			seed = seed * 1103515245u + 12345u;
+			batch[i].valuation = (Cents)((seed >> 8) % 200000);
+		}
+		insertLiveBatch(worker->live, batch, LIVE_BATCH_SIZE);
+		worker->operations += LIVE_BATCH_SIZE;
+	}
+}
+
+//
+// FUNCTION: compareLatencies
+// DESCRIPTION:
+//		This function orders two latency samples for qsort.
+// PARAMETERS:
+//		const void* first: the first sample.
+//		const void* second: the second sample.
+// RETURNS:
+//		int: negative, zero or positive like strcmp.
+//
+static int compareLatencies(const void* first, const void* second)
+{
+	unsigned int a = *(const unsigned int*)first;
+	unsigned int b = *(const unsigned int*)second;
+	return a < b ? -1 : a > b;
+}
+
+//
+// FUNCTION: runLiveBenchPhase
+// DESCRIPTION:
+//		This function runs readers, and optionally writers, against the live index for a fixed
+//		time and prints the read throughput and latency percentiles.
+// PARAMETERS:
+//		LiveIndex* live: the live index.
+//		int readerCount: the number of reader threads.
+//		int writerCount: the number of writer threads, 0 for a read only phase.
+//		const char** countries: the country names the writers pick from.
+//		unsigned int countryCount: the number of country names.
+//		unsigned long long* inserted: the variable the number of inserted parcels is added to.
+// RETURNS:
+//		unsigned long long: the number of consistency violations the readers saw.
+//
+unsigned long long runLiveBenchPhase(LiveIndex* live, int readerCount, int writerCount, const char** countries, unsigned int countryCount, unsigned long long* inserted)
+{
+	LiveBenchWorker workers[LIVE_MAX_READERS];
+	std::thread threads[LIVE_MAX_READERS];
+	std::atomic<int> stop(0);
+	int total = readerCount + writerCount;
+
+	for (int i = 0; i < total; i++)
+	{
+		workers[i].live = live;
+		workers[i].id = i;
+		workers[i].stop = &stop;
+		workers[i].countries = countries;
+		workers[i].countryCount = countryCount;
+		workers[i].operations = 0;
+		workers[i].violations = 0;
+		workers[i].latencies = i < readerCount ? (unsigned int*)malloc(LIVE_BENCH_SAMPLES * sizeof(unsigned int)) : NULL;
+		if (i < readerCount && workers[i].latencies == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for latency samples.\n");
+			exit(1);
+		}
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < total; i++)
+	{
+		threads[i] = std::thread(i < readerCount ? runLiveBenchReader : runLiveBenchWriter, &workers[i]);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(LIVE_BENCH_MILLISECONDS));
+	stop.store(1);
+	for (int i = 0; i < total; i++)
+	{
+		threads[i].join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// merge the latency samples of all readers
+	unsigned long long reads = 0;
+	unsigned long long writes = 0;
+	unsigned long long violations = 0;
+	size_t sampleCount = 0;
+	unsigned int* samples = (unsigned int*)malloc((size_t)readerCount * LIVE_BENCH_SAMPLES * sizeof(unsigned int));
+	if (samples == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for latency samples.\n");
+		exit(1);
+	}
+	for (int i = 0; i < total; i++)
+	{
+		if (i < readerCount)
+		{
+			size_t kept = workers[i].operations < LIVE_BENCH_SAMPLES ? (size_t)workers[i].operations : LIVE_BENCH_SAMPLES;
+			memcpy(samples + sampleCount, workers[i].latencies, kept * sizeof(unsigned int));
+			sampleCount += kept;
+			reads += workers[i].operations;
+			violations += workers[i].violations;
+			free(workers[i].latencies);
+		}
+		else
+		{
+			writes += workers[i].operations;
+		}
+	}
+	qsort(samples, sampleCount, sizeof(unsigned int), compareLatencies);
+
+	printf("%-16s %10.0f reads/s", writerCount > 0 ? "Reads + writes:" : "Reads only:", reads / seconds);
+	if (sampleCount > 0)
+	{
+		printf(", p50 %u ns, p99 %u ns, p99.9 %u ns", samples[sampleCount / 2], samples[sampleCount * 99 / 100], samples[sampleCount * 999 / 1000]);
+	}
+	if (writerCount > 0)
+	{
+		printf(", %.0f parcels inserted/s", writes / seconds);
+	}
+	printf("\n");
+
+	free(samples);
+	*inserted += writes;
+	return violations;
+}
+
+//
+// FUNCTION: benchmarkLiveIngest
+// DESCRIPTION:
+//		This function stress tests the live index: readers query it alone first, then while
+//		writers insert as fast as they can, comparing the read latency of both phases. The
+//		readers check every version they see, and at the end every tree is walked to check the
+//		aggregates, the AVL balance and that every arena node is either in a tree or free.
+// PARAMETERS:
+//		ParcelStore* store: the loaded parcel store, which receives the inserted parcels.
+//		int readerCount: the number of reader threads, 0 for one per hardware thread.
+// RETURNS:
+//		int: returns 0 when no inconsistency was found else 1.
+//
+int benchmarkLiveIngest(ParcelStore* store, int readerCount)
+{
+	LiveIndex* live = new LiveIndex;   // holds atomics and a mutex, so it is constructed rather than malloc'd
+	unsigned long long inserted = 0;
+	unsigned long long violations = 0;
+	size_t initialParcels = 0;
+
+	if (readerCount <= 0)
+	{
+		readerCount = (int)std::thread::hardware_concurrency();
+	}
+	readerCount = readerCount < 2 ? 2 : readerCount > LIVE_MAX_READERS / 2 ? LIVE_MAX_READERS / 2 : readerCount;
+	int writerCount = readerCount / 2;
+	if (store->catalog.count == 0)
+	{
+		internCountry(&store->catalog, "Japan");   // writers need at least one country
+	}
+
+	// writers pick from a private copy of the names, since the published tables are reclaimed as versions retire
+	unsigned int countryCount = store->catalog.count;
+	const char** countries = (const char**)malloc(countryCount * sizeof(char*));
+	if (countries == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for benchmark countries.\n");
+		delete live;
+		return 1;
+	}
+	memcpy(countries, store->catalog.names, countryCount * sizeof(char*));
+
+	initLiveIndex(live, store);
+	initialParcels = live->current.load()->parcelCount;
+
+	printf("Live ingest benchmark: %zu parcels, %d readers, %d writers, %d ms per phase\n", initialParcels, readerCount, writerCount, LIVE_BENCH_MILLISECONDS);
+	violations += runLiveBenchPhase(live, readerCount, 0, countries, countryCount, &inserted);
+	violations += runLiveBenchPhase(live, readerCount, writerCount, countries, countryCount, &inserted);
+	printf("Nodes copied for readers: %llu, reclaimed: %llu\n", live->copiedNodes, live->reclaimedNodes);
+	destroyLiveIndex(live);
+	delete live;
+	free((void*)countries);
+
+	// every tree must be a balanced search tree whose aggregates match its parcels
+	size_t reachable;
+	violations += checkParcelStore(store, &reachable);
+	violations += reachable != initialParcels + inserted;
+
+	printf("Final index: %zu parcels, %u nodes on the free list\n", reachable, store->arena.freeCount);
+	if (violations > 0)
+	{
+		printf("Error: %llu consistency violations.\n", violations);
+	}
+	else
+	{
+		printf("Consistency: every version and the final index checked out.\n");
+	}
+	return violations > 0;
+}
+
+//
+// FUNCTION: benchmarkMixedWorkload
+// DESCRIPTION:
+//		This function times a random mix of inserts, removals, re-weighs and range queries on the
+//		loaded index, then checks that the trees and their aggregates are still consistent and
+//		that the removed nodes got reused instead of growing the arena.
+// PARAMETERS:
+//		ParcelStore* store: the loaded parcel store.
+// RETURNS:
+//		int: returns 0 if the index checked out else 1.
+//
+int benchmarkMixedWorkload(ParcelStore* store)
+{
+	typedef std::chrono::steady_clock Clock;
+	static const char* const kinds[] = { "insert", "remove", "re-weigh", "query" };
+	static const unsigned int mix[] = { 30, 60, 70, 100 };   // cumulative percentages of the kinds
+	unsigned long long operations[4] = { 0, 0, 0, 0 };
+	double seconds[4] = { 0.0, 0.0, 0.0, 0.0 };
+	unsigned long long checksum = 0;
+	unsigned int seed = 12345u;
+	size_t parcelCount;
+
+	if (store->catalog.count == 0)
+	{
+		internCountry(&store->catalog, "Japan");   // inserts need at least one country
+	}
+	checkParcelStore(store, &parcelCount);
+	ParcelIndex arenaSlots = store->arena.nextIndex;
+	printf("Mixed workload benchmark: %zu parcels in %u countries, %d operations\n", parcelCount, store->catalog.count, MIXED_BENCH_OPERATIONS);
+
+	for (int i = 0; i < MIXED_BENCH_OPERATIONS; i++)
+	{
+		seed = seed * 1103515245u + 12345u;
+		unsigned int roll = (seed >> 8) % 100;
+		int kind = 0;
+		while (roll >= mix[kind])
+		{
+			kind++;
+		}
+		seed = seed * 1103515245u + 12345u;
+		unsigned short countryId = (unsigned short)((seed >> 8) % store->catalog.count);
+		seed = seed * 1103515245u + 12345u;
+		int weight = 1 + (int)((seed >> 8) % 50000);
+		Cents valuation = (Cents)((seed >> 4) % 100000);
+		ParcelIndex id = NULL_PARCEL;
+		if (kind == 1 || kind == 2)
+		{
+			for (int attempt = 0; attempt < 8 && !isStoredParcel(store, id); attempt++)
+			{
+				seed = seed * 1103515245u + 12345u;
+				id = store->arena.nextIndex > 1 ? 1 + (ParcelIndex)(((unsigned long long)seed * (store->arena.nextIndex - 1)) >> 32) : NULL_PARCEL;
+			}
+		}
+
+		Clock::time_point start = Clock::now();
+		switch (kind)
+		{
+		case 0:
+			insertIntoBst(store, &store->catalog.roots[countryId], createParcelForCountry(store, countryId, weight, valuation));
+			break;
+		case 1:
+			checksum += (unsigned long long)removeParcel(store, id);
+			break;
+		case 2:
+			checksum += (unsigned long long)updateParcel(store, id, weight, valuation);
+			break;
+		default:
+		{
+			ParcelAggregate range;
+			aggregateWeightRange(store, store->catalog.roots[countryId], weight, weight + 1000, &range);
+			checksum += range.count + countWeightsBelow(store, store->catalog.roots[countryId], weight, 0);
+			break;
+		}
+		}
+		seconds[kind] += std::chrono::duration<double>(Clock::now() - start).count();
+		operations[kind]++;
+	}
+
+	double totalSeconds = seconds[0] + seconds[1] + seconds[2] + seconds[3];
+	for (int kind = 0; kind < 4; kind++)
+	{
+		printf("%-9s %10llu operations, %8.0f ns each\n", kinds[kind], operations[kind],
+			operations[kind] > 0 ? seconds[kind] * 1e9 / (double)operations[kind] : 0.0);
+	}
+	printf("Total: %.0f operations/s (checksum %llu)\n", totalSeconds > 0.0 ? MIXED_BENCH_OPERATIONS / totalSeconds : 0.0, checksum);
+
+	unsigned long long violations = checkParcelStore(store, &parcelCount);
+	printf("Final index: %zu parcels, arena grew by %u slots, %u nodes on the free list\n", parcelCount,
+		store->arena.nextIndex - arenaSlots, store->arena.freeCount);
+	if (violations > 0)
+	{
+		printf("Error: %llu consistency violations.\n", violations);
+	}
+	else
+	{
+		printf("Consistency: every tree, aggregate and free node checked out.\n");
+	}
+	return violations > 0;
+}
+
+//
+// FUNCTION: checkValuationIndex
+// DESCRIPTION:
+//		This function checks the valuation index against the parcel trees: the global tree must
+//		hold exactly the parcels of the store in key order, every country tree exactly the parcels
+//		of its country, and every entry must be balanced with a correct height and count.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store whose index is checked, it is built if it is not yet.
+// RETURNS:
+//		unsigned long long: the number of violations found, 0 for a consistent index.
+//
+unsigned long long checkValuationIndex(ParcelStore* store)
+{
+	const ValuationIndex* index = getValuationIndex(store);
+	const ValuationEntry* entries = index->entries;
+	unsigned long long violations = 0;
+	size_t parcelCount = 0;
+	size_t usedSlots = 0;
+	size_t freeSlots = 0;
+
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		parcelCount += store->catalog.parcelCounts[id];
+	}
+	ValuationEntry* expected = (ValuationEntry*)malloc((parcelCount + 1) * sizeof(ValuationEntry));
+	const ValuationEntry** walked = (const ValuationEntry**)malloc((parcelCount + 1) * sizeof(ValuationEntry*));
+	if (expected == NULL || walked == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for valuation check.\n");
+		exit(1);
+	}
+
+	size_t position = 0;
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		ParcelIterator iterator;
+		const Parcel* parcel;
+		initIterator(&iterator, store, store->catalog.roots[id]);
+		while ((parcel = nextParcel(&iterator)) != NULL)
+		{
+			expected[position].valuation = parcel->valuation;
+			expected[position].weight = parcel->weight;
+			expected[position++].countryId = parcel->countryId;
+		}
+	}
+	qsort(expected, parcelCount, sizeof(ValuationEntry), compareValuationEntries);
+
+	unsigned int globalCount = index->globalRoot != 0 ? entries[index->globalRoot].count : 0;
+	violations += globalCount != parcelCount;
+	unsigned int walkedCount = collectValuationEntries(entries, index->globalRoot, 0, (unsigned int)parcelCount, walked);
+	for (unsigned int i = 0; i < walkedCount; i++)
+	{
+		violations += compareValuationKey(walked[i], expected[i].valuation, expected[i].countryId, expected[i].weight) != 0;
+	}
+
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		ValuationSlot root = valuationRoot(index, (int)id);
+		unsigned int count = root != 0 ? entries[root].count : 0;
+		violations += count != store->catalog.parcelCounts[id];
+		walkedCount = collectValuationEntries(entries, root, 0, count, walked);
+		for (unsigned int i = 0; i < walkedCount; i++)
+		{
+			violations += walked[i]->countryId != id;
+			violations += i > 0 && compareValuationKey(walked[i - 1], walked[i]->valuation, walked[i]->countryId, walked[i]->weight) < 0;
+		}
+	}
+
+	for (ValuationSlot slot = 1; slot < index->entryCount; slot++)
+	{
+		const ValuationEntry* entry = &entries[slot];
+		if (entry->height == 0)
+		{
+			freeSlots++;
+			continue;
+		}
+		int leftHeight = valuationHeight(entries, entry->left);
+		int rightHeight = valuationHeight(entries, entry->right);
+		unsigned int count = 1 + (entry->left != 0 ? entries[entry->left].count : 0) + (entry->right != 0 ? entries[entry->right].count : 0);
+		violations += entry->height != (leftHeight > rightHeight ? leftHeight : rightHeight) + 1 || entry->count != count
+			|| leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1;
+		usedSlots++;
+	}
+	violations += usedSlots != 2 * parcelCount || usedSlots + freeSlots + 1 != index->entryCount;
+
+	free(expected);
+	free((void*)walked);
+	return violations;
+}
+
+//
+// FUNCTION: benchmarkValuationIndex
+// DESCRIPTION:
+//		This function times the valuation index: building it, top-k and range queries over every
+//		country and over one country against a full scan of the trees, and the extra cost it adds
+//		to inserts and removals. The index is checked against the trees at the end.
+// PARAMETERS:
+//		ParcelStore* store: the loaded parcel store.
+// RETURNS:
+//		int: returns 0 if the index checked out else 1.
+//
+int benchmarkValuationIndex(ParcelStore* store)
+{
+	typedef std::chrono::steady_clock Clock;
+	const ValuationEntry* results[VALUATION_BENCH_TOP];
+	Cents best[VALUATION_BENCH_TOP];
+	ParcelIndex* inserted = (ParcelIndex*)malloc(VALUATION_BENCH_UPDATES * sizeof(ParcelIndex));
+	unsigned long long checksum = 0;
+	unsigned int seed = 12345u;
+	size_t parcelCount;
+
+	if (inserted == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for benchmark.\n");
+		return 1;
+	}
+	if (store->catalog.count == 0)
+	{
+		internCountry(&store->catalog, "Japan");   // inserts need at least one country
+	}
+	freeValuationIndex(&store->valuations);
+	checkParcelStore(store, &parcelCount);
+	printf("Valuation index benchmark: %zu parcels in %u countries\n", parcelCount, store->catalog.count);
+
+	// inserts and removals before and after the index exists show what keeping it current costs
+	for (int withIndex = 0; withIndex < 2; withIndex++)
+	{
+		Clock::time_point start = Clock::now();
+		if (withIndex)
+		{
+			getValuationIndex(store);
+			printf("Build: %.1f ms\n", std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+			start = Clock::now();
+		}
+		for (int i = 0; i < VALUATION_BENCH_UPDATES; i++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			unsigned short countryId = (unsigned short)((seed >> 8) % store->catalog.count);
+			seed = seed * 1103515245u + 12345u;
+			inserted[i] = createParcelForCountry(store, countryId, 1 + (int)((seed >> 8) % 50000), (Cents)((seed >> 4) % 200000));
+			insertIntoBst(store, &store->catalog.roots[countryId], inserted[i]);
+		}
+		double insertSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+		start = Clock::now();
+		for (int i = 0; i < VALUATION_BENCH_UPDATES; i++)
+		{
+			checksum += (unsigned long long)removeParcel(store, inserted[i]);
+		}
+		double removeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+		printf("%s index: insert %.0f ns, remove %.0f ns\n", withIndex ? "With" : "Without",
+			insertSeconds * 1e9 / VALUATION_BENCH_UPDATES, removeSeconds * 1e9 / VALUATION_BENCH_UPDATES);
+	}
+
+	// the k most valuable parcels of every country, from the index and by scanning every tree
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < VALUATION_BENCH_QUERIES; i++)
+	{
+		checksum += queryValuationExtremes(store, -1, VALUATION_BENCH_TOP, i & 1, results);
+	}
+	double indexSeconds = std::chrono::duration<double>(Clock::now() - start).count() / VALUATION_BENCH_QUERIES;
+	start = Clock::now();
+	for (int round = 0; round < VALUATION_BENCH_SCANS; round++)
+	{
+		unsigned int kept = 0;
+		for (unsigned int id = 0; id < store->catalog.count; id++)
+		{
+			ParcelIterator iterator;
+			const Parcel* parcel;
+			initIterator(&iterator, store, store->catalog.roots[id]);
+			while ((parcel = nextParcel(&iterator)) != NULL)
+			{
+				if (kept == VALUATION_BENCH_TOP && parcel->valuation <= best[0])
+				{
+					continue;
+				}
+				unsigned int slot = kept < VALUATION_BENCH_TOP ? kept++ : 0;   // best is ascending, the smallest gives way
+				while (slot + 1 < kept && best[slot + 1] < parcel->valuation)
+				{
+					best[slot] = best[slot + 1];
+					slot++;
+				}
+				while (slot > 0 && best[slot - 1] > parcel->valuation)
+				{
+					best[slot] = best[slot - 1];
+					slot--;
+				}
+				best[slot] = parcel->valuation;
+			}
+		}
+		checksum += kept;
+	}
+	double scanSeconds = std::chrono::duration<double>(Clock::now() - start).count() / VALUATION_BENCH_SCANS;
+	printf("Top %d of every country: index %.2f us, full scan %.2f ms (%.0fx)\n", VALUATION_BENCH_TOP,
+		indexSeconds * 1e6, scanSeconds * 1e3, indexSeconds > 0.0 ? scanSeconds / indexSeconds : 0.0);
+
+	// the parcels worth $1500 to $2000, first page from the index and counted by a scan
+	unsigned int total = 0;
+	start = Clock::now();
+	for (int i = 0; i < VALUATION_BENCH_QUERIES; i++)
+	{
+		checksum += queryValuationRange(store, -1, 150000, 200000, 0, VALUATION_BENCH_TOP, results, &total);
+	}
+	indexSeconds = std::chrono::duration<double>(Clock::now() - start).count() / VALUATION_BENCH_QUERIES;
+	start = Clock::now();
+	for (int round = 0; round < VALUATION_BENCH_SCANS; round++)
+	{
+		unsigned int matches = 0;
+		for (unsigned int id = 0; id < store->catalog.count; id++)
+		{
+			ParcelIterator iterator;
+			const Parcel* parcel;
+			initIterator(&iterator, store, store->catalog.roots[id]);
+			while ((parcel = nextParcel(&iterator)) != NULL)
+			{
+				matches += parcel->valuation >= 150000 && parcel->valuation <= 200000;
+			}
+		}
+		checksum += matches;
+	}
+	scanSeconds = std::chrono::duration<double>(Clock::now() - start).count() / VALUATION_BENCH_SCANS;
+	printf("$1500-$2000 over every country (%u parcels, first %d): index %.2f us, full scan %.2f ms (%.0fx)\n", total,
+		VALUATION_BENCH_TOP, indexSeconds * 1e6, scanSeconds * 1e3, indexSeconds > 0.0 ? scanSeconds / indexSeconds : 0.0);
+
+	// the same for single countries, which a scan answers from one tree
+	start = Clock::now();
+	for (int i = 0; i < VALUATION_BENCH_QUERIES; i++)
+	{
+		checksum += queryValuationExtremes(store, (int)(i % store->catalog.count), VALUATION_BENCH_TOP, 1, results);
+	}
+	indexSeconds = std::chrono::duration<double>(Clock::now() - start).count() / VALUATION_BENCH_QUERIES;
+	printf("Top %d of one country: index %.2f us\n", VALUATION_BENCH_TOP, indexSeconds * 1e6);
+
+	unsigned long long violations = checkParcelStore(store, &parcelCount) + checkValuationIndex(store);
+	printf("Checksum %llu\n", checksum);
+	free(inserted);
+	if (violations > 0)
+	{
+		printf("Error: %llu consistency violations.\n", violations);
+	}
+	else
+	{
+		printf("Consistency: the valuation index matches the trees.\n");
+	}
+	return violations > 0;
+}
+
+//
+// FUNCTION: measureSketchError
+// DESCRIPTION:
+//		This function compares the quantiles a sketch estimates with the exact ones of the sorted
+//		values it was built from, at the percentiles operations asks for and in between.
+// PARAMETERS:
+//		const QuantileSketch* sketch: the sketch.
+//		long long* values: the values the sketch was built from, sorted here.
+//		size_t count: the number of values, at least one.
+// RETURNS:
+//		double: the largest rank error as a fraction of the values, 0.01 for a quantile one percent off.
+//
+double measureSketchError(const QuantileSketch* sketch, long long* values, size_t count)
+{
+	static const double fractions[] = { 0.01, 0.05, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0.99 };
+	SketchItem* items = (SketchItem*)malloc(SKETCH_CAPACITY * sizeof(SketchItem));
+	double worst = 0.0;
+
+	if (items == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for benchmark.\n");
+		exit(1);
+	}
+	qsort(values, count, sizeof(long long), compareSketchValues);
+	unsigned int itemCount = sortSketchItems(sketch, items);
+	for (size_t i = 0; i < sizeof(fractions) / sizeof(fractions[0]); i++)
+	{
+		long long estimate = sketchQuantile(sketch, items, itemCount, fractions[i]);
+		size_t bounds[2];   // the estimate is right for any rank from the values below it up to the values at most it
+		for (int inclusive = 0; inclusive < 2; inclusive++)
+		{
+			size_t low = 0;
+			size_t high = count;
+			while (low < high)
+			{
+				size_t middle = low + (high - low) / 2;
+				if (values[middle] < estimate || (inclusive && values[middle] == estimate))
+				{
+					low = middle + 1;
+				}
+				else
+				{
+					high = middle;
+				}
+			}
+			bounds[inclusive] = low;
+		}
+		size_t below = bounds[0];
+		size_t atMost = bounds[1];
+
+		double target = fractions[i] * (double)count;
+		double error = target < (double)below ? (double)below - target : target > (double)atMost ? target - (double)atMost : 0.0;
+		worst = error / (double)count > worst ? error / (double)count : worst;
+	}
+	free(items);
+	return worst;
+}
+
+//
+// FUNCTION: benchmarkQuantileSketches
+// DESCRIPTION:
+//		This function times building the quantile sketches, what keeping them current adds to an
+//		insert, and median, p90 and p99 queries from the sketches against sorting the parcels,
+//		per country and over every country. The estimates are checked against the exact quantiles.
+// PARAMETERS:
+//		ParcelStore* store: the loaded parcel store.
+// RETURNS:
+//		int: returns 0 if every estimate stayed within 2% of the parcels in rank else 1.
+//
+int benchmarkQuantileSketches(ParcelStore* store)
+{
+	typedef std::chrono::steady_clock Clock;
+	ParcelIndex* inserted = (ParcelIndex*)malloc(VALUATION_BENCH_UPDATES * sizeof(ParcelIndex));
+	SketchItem* items = (SketchItem*)malloc(SKETCH_CAPACITY * sizeof(SketchItem));
+	CountrySketches* merged = (CountrySketches*)malloc(sizeof(CountrySketches));
+	unsigned long long checksum = 0;
+	unsigned int seed = 12345u;
+	size_t parcelCount;
+
+	if (inserted == NULL || items == NULL || merged == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for benchmark.\n");
+		return 1;
+	}
+	if (store->catalog.count == 0)
+	{
+		internCountry(&store->catalog, "Japan");   // inserts need at least one country
+	}
+	freeQuantileIndex(&store->quantiles);
+	checkParcelStore(store, &parcelCount);
+	printf("Quantile sketch benchmark: %zu parcels in %u countries, %zu bytes of sketches per country\n",
+		parcelCount, store->catalog.count, sizeof(CountrySketches));
+
+	// inserts before and after the sketches exist show what keeping them current costs
+	for (int withSketches = 0; withSketches < 2; withSketches++)
+	{
+		Clock::time_point start = Clock::now();
+		if (withSketches)
+		{
+			for (unsigned int id = 0; id < store->catalog.count; id++)
+			{
+				getCountrySketches(store, (int)id);
+			}
+			printf("Build: %.1f ms\n", std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+			start = Clock::now();
+		}
+		for (int i = 0; i < VALUATION_BENCH_UPDATES; i++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			unsigned short countryId = (unsigned short)((seed >> 8) % store->catalog.count);
+			seed = seed * 1103515245u + 12345u;
+			inserted[i] = createParcelForCountry(store, countryId, 1 + (int)((seed >> 8) % 50000), (Cents)((seed >> 4) % 200000));
+			insertIntoBst(store, &store->catalog.roots[countryId], inserted[i]);
+		}
+		double insertSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+		printf("%s sketches: insert %.0f ns\n", withSketches ? "With" : "Without", insertSeconds * 1e9 / VALUATION_BENCH_UPDATES);
+		if (!withSketches)
+		{
+			for (int i = 0; i < VALUATION_BENCH_UPDATES; i++)
+			{
+				checksum += (unsigned long long)removeParcel(store, inserted[i]);
+			}
+		}
+	}
+
+	// median, p90 and p99 of one country: sort the sketch items against sorting the parcels
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < QUANTILE_BENCH_QUERIES; i++)
+	{
+		const CountrySketches* sketches = getCountrySketches(store, (int)(i % store->catalog.count));
+		if (sketches != NULL)
+		{
+			unsigned int itemCount = sortSketchItems(&sketches->valuations, items);
+			checksum += (unsigned long long)(sketchQuantile(&sketches->valuations, items, itemCount, 0.5)
+				+ sketchQuantile(&sketches->valuations, items, itemCount, 0.9) + sketchQuantile(&sketches->valuations, items, itemCount, 0.99));
+		}
+	}
+	double sketchSeconds = std::chrono::duration<double>(Clock::now() - start).count() / QUANTILE_BENCH_QUERIES;
+
+	checkParcelStore(store, &parcelCount);   // the second round of inserts stays in
+	long long* values = (long long*)malloc((parcelCount + 1) * sizeof(long long));
+	long long* allWeights = (long long*)malloc((parcelCount + 1) * sizeof(long long));
+	long long* allValuations = (long long*)malloc((parcelCount + 1) * sizeof(long long));
+	if (values == NULL || allWeights == NULL || allValuations == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for benchmark.\n");
+		exit(1);
+	}
+	int sorts = 0;
+	start = Clock::now();
+	for (unsigned int id = 0; id < store->catalog.count && sorts < 50; id++, sorts++)
+	{
+		ParcelIterator iterator;
+		const Parcel* parcel;
+		size_t count = 0;
+		initIterator(&iterator, store, store->catalog.roots[id]);
+		while ((parcel = nextParcel(&iterator)) != NULL)
+		{
+			values[count++] = parcel->valuation;
+		}
+		qsort(values, count, sizeof(long long), compareSketchValues);
+		checksum += count > 0 ? (unsigned long long)(values[count / 2] + values[count * 9 / 10] + values[count * 99 / 100]) : 0;
+	}
+	double sortSeconds = sorts > 0 ? std::chrono::duration<double>(Clock::now() - start).count() / sorts : 0.0;
+	printf("Median, p90 and p99 of one country: sketch %.2f us, sorting the parcels %.2f ms (%.0fx)\n",
+		sketchSeconds * 1e6, sortSeconds * 1e3, sketchSeconds > 0.0 ? sortSeconds / sketchSeconds : 0.0);
+
+	// the global view merges every country's sketch
+	start = Clock::now();
+	for (int i = 0; i < QUANTILE_BENCH_QUERIES / 20; i++)
+	{
+		initQuantileSketch(&merged->valuations);
+		for (unsigned int id = 0; id < store->catalog.count; id++)
+		{
+			const CountrySketches* sketches = getCountrySketches(store, (int)id);
+			if (sketches != NULL)
+			{
+				mergeQuantileSketch(&merged->valuations, &sketches->valuations);
+			}
+		}
+		unsigned int itemCount = sortSketchItems(&merged->valuations, items);
+		checksum += (unsigned long long)sketchQuantile(&merged->valuations, items, itemCount, 0.5);
+	}
+	double mergeSeconds = std::chrono::duration<double>(Clock::now() - start).count() / (QUANTILE_BENCH_QUERIES / 20);
+
+	// accuracy of every country and of the merged sketches against the exact quantiles
+	double worstCountry = 0.0;
+	size_t total = 0;
+	initQuantileSketch(&merged->weights);
+	initQuantileSketch(&merged->valuations);
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		const CountrySketches* sketches = getCountrySketches(store, (int)id);
+		if (sketches == NULL)
+		{
+			continue;
+		}
+		ParcelIterator iterator;
+		const Parcel* parcel;
+		size_t count = 0;
+		initIterator(&iterator, store, store->catalog.roots[id]);
+		while ((parcel = nextParcel(&iterator)) != NULL)
+		{
+			allWeights[total] = parcel->weight;
+			allValuations[total++] = parcel->valuation;
+			values[count++] = parcel->weight;
+		}
+		double error = measureSketchError(&sketches->weights, values, count);
+		worstCountry = error > worstCountry ? error : worstCountry;
+		count = 0;
+		initIterator(&iterator, store, store->catalog.roots[id]);
+		while ((parcel = nextParcel(&iterator)) != NULL)
+		{
+			values[count++] = parcel->valuation;
+		}
+		error = measureSketchError(&sketches->valuations, values, count);
+		worstCountry = error > worstCountry ? error : worstCountry;
+		mergeQuantileSketch(&merged->weights, &sketches->weights);
+		mergeQuantileSketch(&merged->valuations, &sketches->valuations);
+	}
+	double worstGlobal = 0.0;
+	if (total > 0)
+	{
+		double weightError = measureSketchError(&merged->weights, allWeights, total);
+		double valuationError = measureSketchError(&merged->valuations, allValuations, total);
+		worstGlobal = weightError > valuationError ? weightError : valuationError;
+	}
+	start = Clock::now();
+	qsort(allValuations, total, sizeof(long long), compareSketchValues);   // already sorted by the check, the cheapest exact case
+	double globalSortSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+	printf("Median of every country: merging the sketches %.2f us, sorting every parcel %.2f ms\n", mergeSeconds * 1e6, globalSortSeconds * 1e3);
+	printf("Largest rank error: %.3f%% in a country, %.3f%% over every country\n", worstCountry * 100.0, worstGlobal * 100.0);
+	printf("Checksum %llu\n", checksum);
+
+	free(values);
+	free(allWeights);
+	free(allValuations);
+	free(merged);
+	free(items);
+	free(inserted);
+	if (worstCountry > 0.02 || worstGlobal > 0.02)
+	{
+		printf("Error: a quantile estimate is further off than 2%% of the parcels.\n");
+		return 1;
+	}
+	return 0;
+}
+
+//
+// FUNCTION: benchmarkBoxQueries
+// DESCRIPTION:
+//		This function times weight and valuation box queries answered by the k-d trees against
+//		walking the weight range of the BST and filtering on valuation, with random wide boxes
+//		and with narrow boxes a tenth of a country's weights and valuations across, and checks
+//		that both give the same count and totals.
+// PARAMETERS:
+//		ParcelStore* store: the parcel store containing the parcels.
+// RETURNS:
+//		int: returns 0 if every query agreed else 1.
+//
+int benchmarkBoxQueries(ParcelStore* store)
+{
+	typedef std::chrono::steady_clock Clock;
+	static const char* const shapes[] = { "Wide", "Narrow" };
+	BoxRange* ranges = (BoxRange*)malloc(BOX_BENCH_QUERIES * sizeof(BoxRange));
+	int* countries = (int*)malloc(BOX_BENCH_QUERIES * sizeof(int));
+	unsigned int seed = 12345u;
+	unsigned int withParcels = 0;
+	size_t parcelCount;
+	size_t boxBytes = 0;
+	int mismatches = 0;
+
+	if (ranges == NULL || countries == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for benchmark.\n");
+		return 1;
+	}
+	checkParcelStore(store, &parcelCount);
+	Clock::time_point start = Clock::now();
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		const CountryBoxes* boxes = getCountryBoxes(store, (int)id);
+		if (boxes != NULL)
+		{
+			boxBytes += (size_t)boxes->count * sizeof(BoxPoint) + (size_t)boxes->nodeCount * sizeof(BoxNode);
+			withParcels++;
+		}
+	}
+	printf("Box query benchmark: %zu parcels in %u countries\n", parcelCount, withParcels);
+	printf("Build: %.1f ms, %.2f bytes per parcel\n", std::chrono::duration<double, std::milli>(Clock::now() - start).count(),
+		parcelCount > 0 ? (double)boxBytes / (double)parcelCount : 0.0);
+	if (withParcels == 0)
+	{
+		free(ranges);
+		free(countries);
+		return 0;
+	}
+
+	for (int shape = 0; shape < 2; shape++)
+	{
+		unsigned long long matched = 0;
+		for (int i = 0; i < BOX_BENCH_QUERIES; i++)
+		{
+			do
+			{
+				seed = seed * 1103515245u + 12345u;
+				countries[i] = (int)((seed >> 8) % store->catalog.count);
+			} while (store->catalog.roots[countries[i]] == NULL_PARCEL);
+
+			const Parcel* lightest = NULL;
+			const Parcel* heaviest = NULL;
+			const ParcelAggregate* all = &getParcel(&store->arena, store->catalog.roots[countries[i]])->subtree;
+			findLightestAndHeaviest(store, store->catalog.roots[countries[i]], &lightest, &heaviest);
+			long long weightSpan = (long long)heaviest->weight - lightest->weight + 1;
+			long long valuationSpan = (long long)all->maxValuation - all->minValuation + 1;
+			long long bounds[4];
+			for (int b = 0; b < 4; b++)
+			{
+				seed = seed * 1103515245u + 12345u;
+				bounds[b] = (long long)(seed >> 4);
+			}
+			if (shape == 0)
+			{
+				long long a = lightest->weight + bounds[0] % weightSpan;
+				long long b = lightest->weight + bounds[1] % weightSpan;
+				ranges[i].minWeight = (int)(a < b ? a : b);
+				ranges[i].maxWeight = (int)(a < b ? b : a);
+				a = all->minValuation + bounds[2] % valuationSpan;
+				b = all->minValuation + bounds[3] % valuationSpan;
+				ranges[i].minValuation = a < b ? a : b;
+				ranges[i].maxValuation = a < b ? b : a;
+			}
+			else
+			{
+				ranges[i].minWeight = (int)(lightest->weight + bounds[0] % weightSpan);
+				ranges[i].maxWeight = (int)(ranges[i].minWeight + weightSpan / 10);
+				ranges[i].minValuation = all->minValuation + bounds[2] % valuationSpan;
+				ranges[i].maxValuation = ranges[i].minValuation + valuationSpan / 10;
+			}
+		}
+
+		BoxTotals indexed[2];
+		double seconds[2];
+		unsigned long long checks[2] = { 0, 0 };
+		for (int scan = 0; scan < 2; scan++)
+		{
+			start = Clock::now();
+			for (int i = 0; i < BOX_BENCH_QUERIES; i++)
+			{
+				memset(&indexed[scan], 0, sizeof(indexed[scan]));
+				if (scan)
+				{
+					scanWeightValuationBox(store, store->catalog.roots[countries[i]], &ranges[i], &indexed[scan], NULL);
+				}
+				else
+				{
+					queryCountryBoxes(&store->boxes.countries[countries[i]], &ranges[i], &indexed[scan], NULL);
+				}
+				checks[scan] = checks[scan] * 31 + indexed[scan].count * 7 + (unsigned long long)indexed[scan].weightSum
+					+ (unsigned long long)indexed[scan].valuationSum;
+				matched += scan ? 0 : indexed[scan].count;
+			}
+			seconds[scan] = std::chrono::duration<double>(Clock::now() - start).count() / BOX_BENCH_QUERIES;
+		}
+		int same = checks[0] == checks[1];
+		mismatches += !same;
+		printf("%s boxes: %.1f parcels each, k-d tree %.2f us, scan and filter %.2f us, speedup %.1fx%s\n", shapes[shape],
+			(double)matched / BOX_BENCH_QUERIES, seconds[0] * 1e6, seconds[1] * 1e6, seconds[0] > 0 ? seconds[1] / seconds[0] : 0.0,
+			same ? "" : " (results differ)");
+	}
+
+	free(ranges);
+	free(countries);
+	return mismatches > 0;
 }
 
 //
-// FUNCTION: insertIntoBst
-// DRSCRIPTION: 
-//		This function insert a new parcel into the BST based on weight of the parcel.
+// FUNCTION: nextGeneratorRandom
+// DESCRIPTION:
+//		This function steps the splitmix64 generator behind generated files and the benchmark
+//		suite, so a seed always gives the same sequence on every platform.
+// PARAMETERS:
+//		unsigned long long* state: the state of the generator.
+// RETURNS:
+//		unsigned long long: the next 64 random bits.
+//
+static inline unsigned long long nextGeneratorRandom(unsigned long long* state)
+{
+	unsigned long long value = (*state += 0x9e3779b97f4a7c15ULL);
+	value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+	return value ^ (value >> 31);
+}
+
+//
+// FUNCTION: generateParcelFile
+// DESCRIPTION:
+//		This function writes a synthetic parcel file in the format of couriers.txt. Countries are
+//		drawn from the valid list with a Zipf distribution, so the country of rank r gets a share
+//		of the rows proportional to 1 / r^skew, and weights follow the requested order. The file
+//		only depends on the options, so runs on different machines read the same data.
+// PARAMETERS:
+//		const char* filename: the name of the file to be written.
+//		const GeneratorOptions* options: the number of rows, seed, skew and weight order.
+//		const CountryList* validCountries: the list of valid countries, in rank order.
+// RETURNS:
+//		int: returns 0 if the file was written else 1.
+//
+int generateParcelFile(const char* filename, const GeneratorOptions* options, const CountryList* validCountries)
+{
+	unsigned long long state = options->seed;
+	unsigned long long span = GENERATOR_MAX_WEIGHT - GENERATOR_MIN_WEIGHT + 1;
+	double* cumulative;
+	int duplicates[GENERATOR_DUPLICATE_WEIGHTS];
+	double total = 0.0;
+	OutputBuffer out;
+	FILE* file;
+
+	if (validCountries->count == 0)
+	{
+		fprintf(stderr, "Error: No countries to generate parcels for.\n");
+		return 1;
+	}
+	cumulative = (double*)malloc(validCountries->count * sizeof(double));
+	if (cumulative == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for country distribution.\n");
+		exit(1);
+	}
+	for (size_t rank = 0; rank < validCountries->count; rank++)
+	{
+		total += 1.0 / pow((double)(rank + 1), options->skew);
+		cumulative[rank] = total;
+	}
+	for (int i = 0; i < GENERATOR_DUPLICATE_WEIGHTS; i++)
+	{
+		duplicates[i] = GENERATOR_MIN_WEIGHT + (int)(nextGeneratorRandom(&state) % span);
+	}
+
+	if (fopen_s(&file, filename, "wb") != 0)
+	{
+		fprintf(stderr, "Error: Unable to create file %s\n", filename);
+		free(cumulative);
+		return 1;
+	}
+	initOutputBuffer(&out, file);
+
+	for (unsigned long long row = 0; row < options->rows; row++)
+	{
+		double pick = (double)(nextGeneratorRandom(&state) >> 11) * (total / 9007199254740992.0);   // 53 random bits scaled to [0, total)
+		size_t low = 0;
+		size_t high = validCountries->count - 1;
+		while (low < high)
+		{
+			size_t middle = low + (high - low) / 2;
+			if (cumulative[middle] > pick)
+			{
+				high = middle;
+			}
+			else
+			{
+				low = middle + 1;
+			}
+		}
+
+		unsigned long long random = nextGeneratorRandom(&state);
+		int weight;
+		switch (options->order)
+		{
+		case WEIGHT_ORDER_SORTED:
+			weight = GENERATOR_MIN_WEIGHT + (int)(row * span / options->rows);
+			break;
+		case WEIGHT_ORDER_REVERSE:
+			weight = GENERATOR_MAX_WEIGHT - (int)(row * span / options->rows);
+			break;
+		case WEIGHT_ORDER_DUPLICATES:
+			weight = duplicates[random % GENERATOR_DUPLICATE_WEIGHTS];
+			break;
+		default:
+			weight = GENERATOR_MIN_WEIGHT + (int)(random % span);
+		}
+		long long cents = GENERATOR_MIN_CENTS + (long long)((random >> 32) % (GENERATOR_MAX_CENTS - GENERATOR_MIN_CENTS + 1));
+		char fraction[4] = { '.', (char)('0' + cents / 10 % 10), (char)('0' + cents % 10), '\n' };
+
+		writeString(&out, validCountries->names[low]);
+		writeBytes(&out, ", ", 2);
+		writeInteger(&out, weight);
+		writeBytes(&out, ", ", 2);
+		writeInteger(&out, cents / 100);
+		writeBytes(&out, fraction, sizeof(fraction));
+	}
+
+	flushOutputBuffer(&out);
+	free(out.data);
+	free(cumulative);
+	int failed = ferror(file) != 0;
+	failed |= fclose(file) != 0;
+	if (failed)
+	{
+		fprintf(stderr, "Error: Unable to write file %s\n", filename);
+		return 1;
+	}
+	printf("Generated %llu rows in %s (seed %llu, skew %.2f, %s weights)\n", options->rows, filename, options->seed, options->skew, weightOrderNames[options->order]);
+	return 0;
+}
+
+//
+// FUNCTION: peakResidentBytes
+// DESCRIPTION:
+//		This function asks the operating system for the largest amount of memory the process has
+//		held resident so far.
+// PARAMETERS:
+//		void: this function does not take any parameters.
+// RETURNS:
+//		size_t: the peak resident memory in bytes, 0 if it is not known.
+//
+size_t peakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;   // bytes on macOS
+#else
+	return (size_t)usage.ru_maxrss * 1024;   // kilobytes elsewhere
+#endif
+#endif
+}
+
+//
+// FUNCTION: compareDurations
+// DESCRIPTION:
+//		This function orders two call times of the benchmark suite for qsort.
+// PARAMETERS:
+//		const void* first: the first time.
+//		const void* second: the second time.
+// RETURNS:
+//		int: negative, zero or positive like strcmp.
+//
+static int compareDurations(const void* first, const void* second)
+{
+	unsigned long long a = *(const unsigned long long*)first;
+	unsigned long long b = *(const unsigned long long*)second;
+	return a < b ? -1 : a > b;
+}
+
+//
+// FUNCTION: finishSuiteResult
+// DESCRIPTION:
+//		This function fills in the result of one operation of the benchmark suite from the times
+//		of its calls.
+// PARAMETERS:
+//		SuiteResult* result: the result to be filled in.
+//		const char* name: the name of the operation.
+//		const char* unit: what the throughput counts.
+//		unsigned long long items: the rows or calls handled by all calls.
+//		unsigned long long* samples: the time of every call in nanoseconds, sorted in place.
+//		unsigned long long calls: the number of calls.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void finishSuiteResult(SuiteResult* result, const char* name, const char* unit, unsigned long long items, unsigned long long* samples, unsigned long long calls)
+{
+	unsigned long long total = 0;
+	for (unsigned long long i = 0; i < calls; i++)
+	{
+		total += samples[i];
+	}
+	qsort(samples, (size_t)calls, sizeof(samples[0]), compareDurations);
+
+	result->name = name;
+	result->unit = unit;
+	result->calls = calls;
+	result->items = items;
+	result->seconds = (double)total * 1e-9;
+	result->p50 = calls > 0 ? samples[calls / 2] : 0;
+	result->p99 = calls > 0 ? samples[calls * 99 / 100] : 0;
+	result->peakResident = peakResidentBytes();
+}
+
+//
+// FUNCTION: writeSuiteReport
+// DESCRIPTION:
+//		This function prints the results of the benchmark suite as a table, or as one JSON object
+//		or CSV record per operation so runs can be compared by a script. JSON starts with a line
+//		describing the data set.
+// PARAMETERS:
+//		const SuiteResult* results: the results in the order they were measured.
+//		size_t resultCount: the number of results.
+//		const char* filename: the name of the data file.
+//		size_t fileBytes: the size of the data file.
+//		size_t parcelCount: the number of parcels loaded.
+//		unsigned int countryCount: the number of countries loaded.
+//		unsigned long long checksum: a checksum of the query results, to compare runs.
+//		OutputFormat format: the format of the report.
+// RETURNS:
+//		void: this function does not return a value.
+//
+void writeSuiteReport(const SuiteResult* results, size_t resultCount, const char* filename, size_t fileBytes, size_t parcelCount, unsigned int countryCount, unsigned long long checksum, OutputFormat format)
+{
+	OutputBuffer out;
+	char text[256];
+
+	initOutputBuffer(&out, stdout);
+	if (format == OUTPUT_HUMAN)
+	{
+		snprintf(text, sizeof(text), "Benchmark suite: %zu parcels in %u countries, %zu bytes of text (checksum %llu)\n", parcelCount, countryCount, fileBytes, checksum);
+		writeString(&out, text);
+	}
+	else if (format == OUTPUT_JSON)
+	{
+		writeString(&out, "{\"file\":");
+		writeQuoted(&out, filename, format);
+		snprintf(text, sizeof(text), ",\"bytes\":%zu,\"parcels\":%zu,\"countries\":%u,\"threads\":%u,\"checksum\":%llu}\n", fileBytes, parcelCount, countryCount, std::thread::hardware_concurrency(), checksum);
+		writeString(&out, text);
+	}
+	else
+	{
+		writeString(&out, "operation,unit,calls,items,seconds,throughput,p50_ns,p99_ns,peak_resident_bytes\n");
+	}
+
+	for (size_t i = 0; i < resultCount; i++)
+	{
+		const SuiteResult* result = &results[i];
+		double throughput = result->seconds > 0.0 ? (double)result->items / result->seconds : 0.0;
+		if (format == OUTPUT_HUMAN)
+		{
+			snprintf(text, sizeof(text), "%-16s %9llu calls %14.0f %s/s   p50 %11llu ns   p99 %11llu ns   peak %8.1f MB\n", result->name, result->calls,
+				throughput, result->unit, result->p50, result->p99, result->peakResident / 1048576.0);
+		}
+		else if (format == OUTPUT_JSON)
+		{
+			snprintf(text, sizeof(text), "{\"operation\":\"%s\",\"unit\":\"%s\",\"calls\":%llu,\"items\":%llu,\"seconds\":%.6f,\"throughput\":%.1f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"peak_resident_bytes\":%zu}\n",
+				result->name, result->unit, result->calls, result->items, result->seconds, throughput, result->p50, result->p99, result->peakResident);
+		}
+		else
+		{
+			snprintf(text, sizeof(text), "%s,%s,%llu,%llu,%.6f,%.1f,%llu,%llu,%zu\n", result->name, result->unit, result->calls, result->items,
+				result->seconds, throughput, result->p50, result->p99, result->peakResident);
+		}
+		writeString(&out, text);
+	}
+	flushOutputBuffer(&out);
+	free(out.data);
+}
+
+//
+// FUNCTION: runBenchmarkSuite
+// DESCRIPTION:
+//		This function times loading the data file and every operation behind the menu, and prints
+//		the throughput, median and 99th percentile time of a call, and peak resident memory of
+//		each. The file is loaded SUITE_LOAD_RUNS times; every other operation is called with
+//		random arguments for SUITE_MILLISECONDS, at most SUITE_OPERATIONS times. The arguments
+//		come from a fixed seed, so two runs on the same file do the same work. The inserts are
+//		timed on the store's one insert path, the same calls insertLiveBatch makes per parcel.
+// PARAMETERS:
+//		const char* filename: the name of the data file.
+//		OutputFormat format: the format of the report.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		int: returns 0 if the index checked out after the updates else 1.
+//
+int runBenchmarkSuite(const char* filename, OutputFormat format, const CountryList* validCountries)
+{
+	typedef std::chrono::steady_clock Clock;
+	// the operations after loading, named like the batch queries and in menu order
+	static const char* const kinds[] = { "list", "weight", "totals", "cheapest", "lightest", "statistics", "range",
+		"remove", "re-weigh", "top-k", "valuation-range", "insert" };
+	const int kindCount = (int)(sizeof(kinds) / sizeof(kinds[0]));
+	SuiteResult results[sizeof(kinds) / sizeof(kinds[0]) + 2];
+	size_t resultCount = 0;
+	unsigned long long* samples = (unsigned long long*)malloc(SUITE_OPERATIONS * sizeof(unsigned long long));
+	ParcelIndex* inserted = (ParcelIndex*)malloc(SUITE_OPERATIONS * sizeof(ParcelIndex));
+	unsigned long long seed = 12345u;
+	unsigned long long checksum = 0;
+	size_t fileBytes = 0;
+	size_t parcelCount = 0;
+	ParcelStore store;
+
+	if (samples == NULL || inserted == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for benchmark samples.\n");
+		exit(1);
+	}
+
+	initParcelStore(&store);
+	for (int run = 0; run < SUITE_LOAD_RUNS; run++)
+	{
+		if (run > 0)
+		{
+			cleanupMemory(&store);
+			initParcelStore(&store);
+		}
+		Clock::time_point start = Clock::now();
+		fileBytes = loadData(&store, filename, validCountries);
+		samples[run] = (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+	}
+	checkParcelStore(&store, &parcelCount);
+	finishSuiteResult(&results[resultCount++], "load", "rows", (unsigned long long)parcelCount * SUITE_LOAD_RUNS, samples, SUITE_LOAD_RUNS);
+
+	if (store.catalog.count == 0)
+	{
+		internCountry(&store.catalog, "Japan");   // inserts need at least one country
+	}
+	unsigned int countryCount = store.catalog.count;
+
+	for (int kind = 0; kind < kindCount; kind++)
+	{
+		unsigned long long calls = 0;
+		unsigned long long insertedCount = 0;
+		Clock::time_point begin = Clock::now();
+
+		if (strcmp(kinds[kind], "top-k") == 0)
+		{
+			Clock::time_point start = Clock::now();
+			getValuationIndex(&store);   // built by the first valuation query of the menu
+			samples[0] = (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+			finishSuiteResult(&results[resultCount++], "valuation-index", "calls", 1, samples, 1);
+			begin = Clock::now();
+		}
+
+		while (calls < SUITE_OPERATIONS && (calls == 0 || Clock::now() - begin < std::chrono::milliseconds(SUITE_MILLISECONDS)))
+		{
+			unsigned short countryId = (unsigned short)(nextGeneratorRandom(&seed) % countryCount);
+			char* country = store.catalog.names[countryId];
+			unsigned long long random = nextGeneratorRandom(&seed);
+			int weight = GENERATOR_MIN_WEIGHT + (int)(random % (GENERATOR_MAX_WEIGHT - GENERATOR_MIN_WEIGHT + 1));
+			Cents valuation = GENERATOR_MIN_CENTS + (Cents)((random >> 32) % (GENERATOR_MAX_CENTS - GENERATOR_MIN_CENTS + 1));
+			Parcel target;
+			int picked = 0;
+			if (strcmp(kinds[kind], "remove") == 0 || strcmp(kinds[kind], "re-weigh") == 0)
+			{
+				// the menu finds the parcel by country, weight and valuation, so pick a stored one first
+				for (int attempt = 0; attempt < 16 && !picked; attempt++)
+				{
+					ParcelIndex id = 1 + (ParcelIndex)(nextGeneratorRandom(&seed) % (store.arena.nextIndex > 1 ? store.arena.nextIndex - 1 : 1));
+					picked = isStoredParcel(&store, id);
+					target = picked ? *getParcel(&store.arena, id) : target;
+				}
+				if (!picked)
+				{
+					break;   // the store is (nearly) empty
+				}
+				country = store.catalog.names[target.countryId];
+			}
+
+			Clock::time_point start = Clock::now();
+			switch (kind)
+			{
+			case 0:   // menu option 1
+			{
+				ParcelIterator iterator;
+				const Parcel* parcel;
+				initIterator(&iterator, &store, findCountryRoot(&store, country));
+				while ((parcel = nextParcel(&iterator)) != NULL)
+				{
+					checksum += (unsigned long long)parcel->weight;
+				}
+				break;
+			}
+			case 1:   // menu option 2
+			{
+				WeightRange range;
+				const Parcel* page[RANGE_PAGE_SIZE];
+				unsigned int offset = 0;
+				unsigned int count;
+				int higher = (int)(random >> 63);
+				range.minWeight = higher ? weight : INT_MIN;
+				range.maxWeight = higher ? INT_MAX : weight;
+				range.minInclusive = !higher;
+				range.maxInclusive = higher;
+				while ((count = queryWeightRange(&store, findCountryRoot(&store, country), &range, offset, RANGE_PAGE_SIZE, page, NULL)) > 0)
+				{
+					offset += count;
+				}
+				checksum += offset;
+				break;
+			}
+			case 2:   // menu option 3
+			{
+				long long totalWeight = 0;
+				Cents totalValuation = 0;
+				calculateTotalLoadAndValuation(&store, findCountryRoot(&store, country), &totalWeight, &totalValuation);
+				checksum += (unsigned long long)totalWeight;
+				break;
+			}
+			case 3:   // menu option 4
+			{
+				const Parcel* cheapest = NULL;
+				const Parcel* mostExpensive = NULL;
+				findCheapestAndMostExpensive(&store, findCountryRoot(&store, country), &cheapest, &mostExpensive);
+				checksum += cheapest != NULL ? (unsigned long long)cheapest->weight : 0;
+				break;
+			}
+			case 4:   // menu option 5
+			{
+				const Parcel* lightest = NULL;
+				const Parcel* heaviest = NULL;
+				findLightestAndHeaviest(&store, findCountryRoot(&store, country), &lightest, &heaviest);
+				checksum += heaviest != NULL ? (unsigned long long)heaviest->weight : 0;
+				break;
+			}
+			case 5:   // menu option 8
+			{
+				for (unsigned int id = 0; id < store.catalog.count; id++)
+				{
+					TreeStats stats;
+					collectTreeStats(&store, store.catalog.roots[id], &stats);
+					checksum += stats.depthSum;
+				}
+				break;
+			}
+			case 6:   // menu option 9
+			{
+				ParcelAggregate range;
+				aggregateWeightRange(&store, findCountryRoot(&store, country), weight, weight + 5000, &range);
+				checksum += range.count;
+				break;
+			}
+			case 7:   // menu option 10, the parcels are put back after timing
+				checksum += (unsigned long long)removeParcel(&store, findParcel(&store, findCountryRoot(&store, country), target.weight, target.valuation));
+				break;
+			case 8:   // menu option 11
+				checksum += (unsigned long long)updateParcel(&store, findParcel(&store, findCountryRoot(&store, country), target.weight, target.valuation), weight, valuation);
+				break;
+			case 9:   // menu option 12, every country or one
+			{
+				const ValuationEntry* top[SUITE_TOP];
+				checksum += queryValuationExtremes(&store, (calls & 1) ? -1 : countryId, SUITE_TOP, (int)(random >> 63), top);
+				break;
+			}
+			case 10:   // menu option 13, the first page
+			{
+				const ValuationEntry* page[SUITE_TOP];
+				unsigned int matches = 0;
+				checksum += queryValuationRange(&store, (calls & 1) ? -1 : countryId, valuation, valuation + 5000, 0, SUITE_TOP, page, &matches) + matches;
+				break;
+			}
+			default:   // a single insert through createParcelForCountry and insertIntoBst, the insert path of every loader and writer
+			{
+				ParcelIndex id = createParcelForCountry(&store, countryId, weight, valuation);
+				insertIntoBst(&store, &store.catalog.roots[countryId], id);
+				inserted[insertedCount++] = id;
+			}
+			}
+			samples[calls++] = (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+			if (kind == 7)
+			{
+				// put the parcel back untimed, so later operations see a store of the same size
+				insertIntoBst(&store, &store.catalog.roots[target.countryId], createParcelForCountry(&store, target.countryId, target.weight, target.valuation));
+			}
+		}
+		finishSuiteResult(&results[resultCount++], kinds[kind], "calls", calls, samples, calls);
+
+		for (unsigned long long i = 0; i < insertedCount; i++)
+		{
+			removeParcel(&store, inserted[i]);   // leave the store as it was loaded
+		}
+	}
+
+	unsigned long long violations = checkParcelStore(&store, &parcelCount) + checkValuationIndex(&store);
+	writeSuiteReport(results, resultCount, filename, fileBytes, parcelCount, store.catalog.count, checksum, format);
+	if (violations > 0)
+	{
+		fprintf(stderr, "Error: %llu consistency violations after the benchmark suite.\n", violations);
+	}
+
+	free(samples);
+	free(inserted);
+	cleanupMemory(&store);
+	return violations > 0;
+}
+
+//
+// FUNCTION: checksumParcelStore
+// DESCRIPTION:
+//		This function checksums the contents of a store: the countries in id order, and the weight
+//		and valuation of their parcels in tree order, so two loads of the same rows agree exactly.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store.
+// RETURNS:
+//		unsigned long long: the checksum of the store.
+//
+unsigned long long checksumParcelStore(const ParcelStore* store)
+{
+	unsigned long long checksum = 14695981039346656037ULL;
+	for (unsigned int id = 0; id < store->catalog.count; id++)
+	{
+		ParcelIterator iterator;
+		const Parcel* parcel;
+		checksum = checksumBytes(store->catalog.names[id], strlen(store->catalog.names[id]), checksum);
+		initIterator(&iterator, store, store->catalog.roots[id]);
+		while ((parcel = nextParcel(&iterator)) != NULL)
+		{
+			checksum = checksumBytes(&parcel->weight, sizeof(parcel->weight), checksum);
+			checksum = checksumBytes(&parcel->valuation, sizeof(parcel->valuation), checksum);
+		}
+	}
+	return checksum;
+}
+
+//
+// FUNCTION: benchmarkShardedIngest
+// DESCRIPTION:
+//		This function splits the data file into 1 up to INGEST_BENCH_MAX_FILES files of consecutive
+//		lines next to it, loads them with one thread and with every thread, and compares the time
+//		and the loaded store with a plain load of the whole file. The split files are removed again.
+// PARAMETERS:
+//		const char* filename: the name of the data file.
+//		int threadCount: the largest number of threads, 0 for one per hardware thread.
+//		const CountryList* validCountries: the list of valid countries.
+// RETURNS:
+//		int: returns 0 if every sharded load matched the plain load else 1.
+//
+int benchmarkShardedIngest(const char* filename, int threadCount, const CountryList* validCountries)
+{
+	typedef std::chrono::steady_clock Clock;
+	MappedFile file;
+	ParcelStore store;
+	int mismatches = 0;
+
+	if (!mapFile(&file, filename, 0))
+	{
+		fprintf(stderr, "Error: Unable to open file %s\n", filename);
+		return 1;
+	}
+	if (threadCount <= 0)
+	{
+		threadCount = (int)std::thread::hardware_concurrency();
+	}
+	threadCount = threadCount < 1 ? 1 : threadCount > PARSE_MAX_THREADS ? PARSE_MAX_THREADS : threadCount;
+
+	initParcelStore(&store);
+	Clock::time_point start = Clock::now();
+	loadData(&store, filename, validCountries);
+	double baselineSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+	unsigned long long baseline = checksumParcelStore(&store);
+	cleanupMemory(&store);
+	printf("Sharded ingest benchmark, %u hardware threads, %zu bytes:\n", std::thread::hardware_concurrency(), file.size);
+	printf("Single file:                 time: %9.3f ms, %8.1f MB/s\n", baselineSeconds * 1e3,
+		baselineSeconds > 0 ? file.size / baselineSeconds / 1e6 : 0.0);
+
+	size_t pathLength = strlen(filename) + sizeof(".shard00");
+	char* path = (char*)malloc(pathLength);
+	if (path == NULL)
+	{
+		fprintf(stderr, "Error: Memory allocation failed for shard name.\n");
+		exit(1);
+	}
+	for (int shards = 1; shards <= INGEST_BENCH_MAX_FILES; shards *= 2)
+	{
+		FileList files = { NULL, 0, 0 };
+		size_t begin = 0;
+		int written = 1;
+		for (int s = 0; s < shards; s++)
+		{
+			size_t end = s == shards - 1 ? file.size : file.size / shards * (s + 1);
+			while (end > begin && end < file.size && file.data[end - 1] != '\n')
+			{
+				end++;   // split on line boundaries only
+			}
+			end = end < begin ? begin : end;
+			snprintf(path, pathLength, "%s.shard%02d", filename, s);
+			FILE* shard = fopen(path, "wb");
+			if (shard == NULL || fwrite(file.data + begin, 1, end - begin, shard) != end - begin)
+			{
+				fprintf(stderr, "Error: Unable to write shard file %s\n", path);
+				written = 0;
+			}
+			if (shard != NULL)
+			{
+				fclose(shard);
+			}
+			addFileName(&files, path);
+			begin = end;
+		}
+
+		for (int threads = 1; written && threads <= threadCount; threads = threads == threadCount ? threadCount + 1 : threadCount)
+		{
+			initParcelStore(&store);
+			start = Clock::now();
+			loadDataFiles(&store, &files, threads, validCountries);
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			int same = checksumParcelStore(&store) == baseline;
+			cleanupMemory(&store);
+			mismatches += !same;
+			printf("Files: %3d, threads: %3d, time: %9.3f ms, %8.1f MB/s, speedup: %5.2fx%s\n", shards, threads, seconds * 1e3,
+				seconds > 0 ? file.size / seconds / 1e6 : 0.0, seconds > 0 ? baselineSeconds / seconds : 0.0, same ? "" : " (store differs)");
+		}
+
+		for (size_t s = 0; s < files.count; s++)
+		{
+			remove(files.names[s]);
+		}
+		freeFileList(&files);
+		mismatches += !written;
+	}
+	free(path);
+	unmapFile(&file);
+	return mismatches > 0;
+}
+
+#ifdef PARCEL_HAVE_EPOLL
+static int serverStopEvent = -1;   // eventfd the signal handler wakes the event loop of the server with
+
+//
+// FUNCTION: requestServerStop
+// DESCRIPTION:
+//		This function is the handler of SIGINT and SIGTERM while the query server runs. It only
+//		wakes the event loop, which shuts the server down cleanly.
+// PARAMETERS:
+//		int signalNumber: the number of the signal.
+// RETURNS:
+//		void: this function does not return a value.
+//
+static void requestServerStop(int signalNumber)
+{
+	unsigned long long one = 1;
+	ssize_t written = write(serverStopEvent, &one, sizeof(one));   // write is safe inside a signal handler
+	(void)signalNumber;
+	(void)written;
+}
+
+//
+// FUNCTION: openServerSocket
+// DESCRIPTION:
+//		This function opens the socket of the query server or a connection to it. An address of
+//		digits only is a TCP port on the loopback interface, any other address is the path of a
+//		Unix domain socket. A listening socket replaces a socket file left behind by an earlier server.
 // PARAMETERS:
-//		Parcel** root: double pointer to the root of the BST where the parcel is to be inserted.
-//		Parcel* newParcel: a pointer to the parcel that needs to be inserted into the BST.
+//		const char* address: the port or the socket path.
+//		int listening: 1 to listen on the address, 0 to connect to it.
 // RETURNS:
-//		void: this function does not return a value.
+//		int: the descriptor of the socket, or -1 after telling the user why it failed.
 //
-void insertIntoBst(Parcel** root, Parcel* newParcel)
+int openServerSocket(const char* address, int listening)
 {
-	if (*root == NULL)
+	int tcp = address[0] != '\0' && strspn(address, "0123456789") == strlen(address);
+	int descriptor = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	int result;
+
+	if (descriptor < 0)
 	{
-		*root = newParcel;   // if the root is NULL, insert new parcel here
+		fprintf(stderr, "Error: Unable to create a socket: %s\n", strerror(errno));
+		return -1;
 	}
-	else if (newParcel->weight < (*root)->weight)
+	if (tcp)
 	{
-		insertIntoBst(&(*root)->left, newParcel);   // recursively insert into the left subtree if weight is less
+		struct sockaddr_in inet;
+		int one = 1;
+		memset(&inet, 0, sizeof(inet));
+		inet.sin_family = AF_INET;
+		inet.sin_port = htons((unsigned short)atoi(address));
+		inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);   // the server is for analysts on this machine
+		setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // answers are small, send them at once
+		result = listening ? bind(descriptor, (struct sockaddr*)&inet, sizeof(inet)) : connect(descriptor, (struct sockaddr*)&inet, sizeof(inet));
 	}
 	else
 	{
-		insertIntoBst(&(*root)->right, newParcel);   // recursively insert into the right subtree if weight is more or equal
+		struct sockaddr_un local;
+		struct stat info;
+		memset(&local, 0, sizeof(local));
+		local.sun_family = AF_UNIX;
+		if (strlen(address) >= sizeof(local.sun_path))
+		{
+			fprintf(stderr, "Error: Socket path %s is too long.\n", address);
+			close(descriptor);
+			return -1;
+		}
+		strcpy(local.sun_path, address);
+		if (listening && stat(address, &info) == 0 && S_ISSOCK(info.st_mode))
+		{
+			unlink(address);   // left behind by a server which did not shut down
+		}
+		result = listening ? bind(descriptor, (struct sockaddr*)&local, sizeof(local)) : connect(descriptor, (struct sockaddr*)&local, sizeof(local));
+	}
+	if (result != 0 || (listening && listen(descriptor, SERVER_BACKLOG) != 0))
+	{
+		fprintf(stderr, "Error: Unable to %s %s: %s\n", listening ? "listen on" : "connect to", address, strerror(errno));
+		close(descriptor);
+		return -1;
 	}
+	return descriptor;
 }
 
 //
-// FUNCTION: insertIntoHashTable
-// DESCRIPTIPN: 
-//		This function inserts a parcel into the hash table based on the country name.
-// PARAMETERS: 
-//		Parcel* hashTable[]: the hash table where the parcel will get inserted.
-//		char* country: the destination country of the parcel.
-//		int weight: the weight of the parcel in grams.
-//		float valuation: the valuation of the parcel in dollars.
+// FUNCTION: watchServerConnection
+// DESCRIPTION:
+//		This function watches a connection for what it can do next: for requests while its input
+//		buffer has room, and for room to send while responses are waiting.
+// PARAMETERS:
+//		QueryServer* server: the query server.
+//		ServerConnection* connection: the connection.
 // RETURNS:
 //		void: this function does not return a value.
 //
-void insertIntoHashTable(Parcel* hashTable[], char* country, int weight, float valuation) 
+void watchServerConnection(QueryServer* server, ServerConnection* connection)
 {
-	unsigned long index = hash(country);   // generate a hash value based on the country name
-	Parcel* newParcel = createParcel(country, weight, valuation);   // create a new parcel
-	insertIntoBst(&hashTable[index], newParcel);   // insert the parcel into the appropriate BST within the hash table
+	unsigned int events = (connection->inputUsed < SERVER_INPUT_BYTES ? (unsigned int)EPOLLIN : 0u) | (connection->sent < connection->output.used ? (unsigned int)EPOLLOUT : 0u);
+	if (events != connection->events && !connection->closed)
+	{
+		struct epoll_event event;
+		event.events = events;
+		event.data.ptr = connection;
+		epoll_ctl(server->epoll, EPOLL_CTL_MOD, connection->descriptor, &event);
+		connection->events = events;
+	}
 }
 
-// 
-// FUNCTION: loadData
-// DESCRIPTION: 
-//		This function loads data from a file into the hash table.
-// PARAMETERS: 
-//		Parcel* hashTable[]: the hash table where the data will be loaded.
-//		const char* filename: the name of the file which is containing data.
-//		const char* validCountries[]: the list of valid country names.
-//		size_t numCountries: the number of valid countries.
+//
+// FUNCTION: closeServerConnection
+// DESCRIPTION:
+//		This function closes a connection. A connection whose request is still with a worker is
+//		freed once the answer comes back.
+// PARAMETERS:
+//		QueryServer* server: the query server.
+//		ServerConnection* connection: the connection.
 // RETURNS:
 //		void: this function does not return a value.
 //
-void loadData(Parcel* hashTable[], const char* filename, const char* validCountries[], size_t numCountries)
+void closeServerConnection(QueryServer* server, ServerConnection* connection)
 {
-	FILE* file;
-	fopen_s(&file, filename, "r");   // open the file for reading
-	if (!file)
+	if (!connection->closed)
 	{
-		fprintf(stderr, "Error: Unable to open file %s\n", filename);   // print error message if file can't be opened
-		exit(1);
+		close(connection->descriptor);   // also takes it out of the epoll set
+		connection->closed = 1;
 	}
-
-	char country[21];
-	int weight;
-	float valuation;
-
-	// reading each line pf the file and insert data into the hash table
-	while (fscanf_s(file, "%20[^,], %d, %f\n", country, (unsigned)_countof(country), &weight, &valuation) != EOF)
+	if (!connection->busy)
 	{
-		insertIntoHashTable(hashTable, country, weight, valuation);
+		if (connection->previousLive != NULL)
+		{
+			connection->previousLive->nextLive = connection->nextLive;
+		}
+		else
+		{
+			server->live = connection->nextLive;
+		}
+		if (connection->nextLive != NULL)
+		{
+			connection->nextLive->previousLive = connection->previousLive;
+		}
+		free(connection->output.data);
+		free(connection->result.data);
+		free(connection);
 	}
-
-	fclose(file);   // close the file after reading all data
 }
 
-// 
-// FUNCTION: inOrderTraversal
+//
+// FUNCTION: sendServerOutput
 // DESCRIPTION:
-//		This function performs an in-order traversal of the BST and prints
-//		the details of each parcel.
+//		This function sends as much of the waiting responses of a connection as the socket takes.
 // PARAMETERS:
-//		Parcel* root: a pointer to the root of the BST to be traversed.
+//		ServerConnection* connection: the connection.
 // RETURNS:
-//		void: this function does not return a value.
+//		int: returns 1 if the connection is still usable, 0 if it failed.
 //
-void inOrderTraversal(Parcel* root)
+int sendServerOutput(ServerConnection* connection)
 {
-	if (root != NULL)
+	while (connection->sent < connection->output.used)
 	{
-		inOrderTraversal(root->left);   // travesrse the left subtree
-		printf("Destoination: %s, Weight: %d, Valuation: %2.f\n", root->destination, root->weight, root->valuation);   // print the parcel details
-		inOrderTraversal(root->right);   // traverse the right subtree
+		ssize_t count = send(connection->descriptor, connection->output.data + connection->sent, connection->output.used - connection->sent, MSG_NOSIGNAL);
+		if (count < 0)
+		{
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		}
+		connection->sent += (size_t)count;
 	}
+	connection->output.used = 0;   // everything is out, start over at the front
+	connection->sent = 0;
+	return 1;
 }
 
 //
-// FUNCTION: isValidCountry
-// DESCRIPTION: 
-//		This function checks if the provided country is in the list of valid countries.
-// PARAMETERS: 
-//		const char* country: the name of the country for checking.
-//		const char* validCountries[]: the list of valid country names.
-//		size_t numCountries: the number of valid countries.
+// FUNCTION: takeServerRequest
+// DESCRIPTION:
+//		This function hands the next complete request line of a connection to the workers. A
+//		connection has one request at a time with the workers, and only once its earlier answers
+//		are sent, so pipelined requests are answered in order and a slow reader holds back only
+//		itself. Blank lines and lines starting with # are skipped like in a batch file.
+// PARAMETERS:
+//		QueryServer* server: the query server.
+//		ServerConnection* connection: the connection.
 // RETURNS:
-//		int: return 1 if the country is valid else return 0.
+//		int: returns 1 if the connection is still usable, 0 if its request line is too long.
 //
-int isValidCountry(const char* country, const char* validCountries[], size_t numCountries)
+int takeServerRequest(QueryServer* server, ServerConnection* connection)
 {
-	for (size_t i = 0; i < numCountries; i++)
+	while (!connection->busy && connection->sent == connection->output.used)
 	{
-		if (strcmp(validCountries[i], country) == 0)
+		char* newline = (char*)memchr(connection->input, '\n', connection->inputUsed);
+		if (newline == NULL)
+		{
+			return connection->inputUsed < SERVER_INPUT_BYTES;
+		}
+
+		const char* line = skipBlanks(connection->input, newline);
+		if (line != newline && *line != '#' && *line != '\r')
 		{
-			return 1;   // country got found in the list
+			connection->error = parseBatchQuery(line, newline, &connection->query);
+			connection->requests++;
+			connection->busy = 1;
+			connection->next = NULL;
+			std::lock_guard<std::mutex> guard(server->lock);
+			if (server->queuedTail != NULL)
+			{
+				server->queuedTail->next = connection;
+			}
+			else
+			{
+				server->queued = connection;
+			}
+			server->queuedTail = connection;
+			server->pending.notify_one();
 		}
+		size_t length = (size_t)(newline - connection->input) + 1;
+		memmove(connection->input, newline + 1, connection->inputUsed - length);
+		connection->inputUsed -= length;
 	}
-	return 0;   // country got not found in the list
+	return 1;
 }
 
 //
-// FUNCTION: getValidWeight
+// FUNCTION: runServerWorker
 // DESCRIPTION:
-//		This function gets a valid weight input from user, verifying it is a number.
+//		This function is run by every worker thread of the query server. It answers queued
+//		requests with the batch query code until the server stops, and hands the answers back to
+//		the event loop. The store is only read, so the workers run side by side.
 // PARAMETERS:
-//		void: this function is not taking any parameters.
+//		QueryServer* server: the query server.
 // RETURNS:
-//		int: returns the valid weight entered by the user.
+//		void: this function does not return a value.
 //
-int getValidWeight()
+void runServerWorker(QueryServer* server)
 {
-	int weight;
-	int result;
-
 	while (1)
 	{
-		printf("Enter weight: ");
-		result = scanf_s("%d", &weight);
-
-		// clear the input buffer
-		while (getchar() != '\n');
+		ServerConnection* connection;
+		{
+			std::unique_lock<std::mutex> guard(server->lock);
+			while (server->queued == NULL && !server->stopping)
+			{
+				server->pending.wait(guard);
+			}
+			if (server->queued == NULL)
+			{
+				return;
+			}
+			connection = server->queued;
+			server->queued = connection->next;
+			server->queuedTail = server->queued != NULL ? server->queuedTail : NULL;
+		}
 
-		if (result == 1 && weight > 0)
+		connection->result.used = 0;
+		if (connection->error == NULL)
 		{
-			return weight;   // returns the valid weight
+			executeBatchQuery(server->store, &connection->query, connection->requests, server->format, &connection->result, server->validCountries);
+		}
+		else if (server->format == OUTPUT_HUMAN)
+		{
+			char message[96];
+			snprintf(message, sizeof(message), "Error: Request %zu: %s.\n", connection->requests, connection->error);
+			writeString(&connection->result, message);
 		}
 		else
 		{
-			printf("Invalid input, please enter a valid weight.\n");
+			writeMessageRecord(&connection->result, server->format, connection->requests, NULL, "error", -1, connection->error);
+		}
+
+		unsigned long long one = 1;
+		{
+			std::lock_guard<std::mutex> guard(server->lock);
+			connection->next = server->answered;
+			server->answered = connection;
 		}
+		ssize_t written = write(server->wakeup, &one, sizeof(one));
+		(void)written;
 	}
 }
 
-// 
-// FUNCTION: displayParcelsByCountry
+//
+// FUNCTION: acceptServerConnections
 // DESCRIPTION:
-//		This function displays all parcels for given country by performing an in-order traversal of the BST.
+//		This function accepts every connection waiting on the listening socket.
 // PARAMETERS:
-//		Parcel* hashTable[]: the hash table which is cointaining the parcels.
-//		char* country: the name of the country whose parcels will get displayed.
-//		const char* validCountries[]: the list of valid country names.
-//		size_t numCountries: the number of valid countries.
+//		QueryServer* server: the query server.
 // RETURNS:
-//		void: this function does not return a value.
+//		void: this function does not return a value, connections which cannot be set up are closed.
 //
-void displayParcelsByCountry(Parcel* hashTable[], char* country, const char* validCountries[], size_t numCountries)
+void acceptServerConnections(QueryServer* server)
 {
-	if (!isValidCountry(country, validCountries, numCountries))
+	while (1)
 	{
-		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
-		return;
-	}
+		int descriptor = accept4(server->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (descriptor < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			{
+				fprintf(stderr, "Warning: Unable to accept a connection: %s\n", strerror(errno));
+			}
+			return;
+		}
+		int one = 1;
+		setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // fails harmlessly on a Unix socket
 
-	unsigned long index = hash(country);   // generate the hash value for the country
-	if (hashTable[index] != NULL)
-	{
-		printf("Parcels for %s:\n", country);   // print country name
-		inOrderTraversal(hashTable[index]);   // perform in-order traversal of BST to print all parcels
-	}
-	else
-	{
-		printf("No parcels found for %s.\n", country);   // print a message if no parcels are found
+		ServerConnection* connection = (ServerConnection*)calloc(1, sizeof(ServerConnection));
+		if (connection == NULL)
+		{
+			close(descriptor);
+			continue;
+		}
+		connection->descriptor = descriptor;
+		connection->events = EPOLLIN;
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.ptr = connection;
+		if (epoll_ctl(server->epoll, EPOLL_CTL_ADD, descriptor, &event) != 0)
+		{
+			close(descriptor);
+			free(connection);
+			continue;
+		}
+		connection->nextLive = server->live;
+		if (server->live != NULL)
+		{
+			server->live->previousLive = connection;
+		}
+		server->live = connection;
+		server->accepted++;
 	}
 }
 
 //
-// FUNCTION: findAndDisplayParcelsByWeight
-// DESCRIPTION: 
-//		This is the helper function which traverse the BST and
-//		display parcels based on the weight condition (higher or lower).
+// FUNCTION: readServerConnection
+// DESCRIPTION:
+//		This function reads what a client sent into the input buffer of its connection.
 // PARAMETERS:
-//		Parcel* root: a pointer to the root of the BST to be traversed.
-//		int weight: the weight condition to check.
-//		int higher: flag indicating whether to check for weights higher (1) 
-//		or lower (2) that the provided weight.
+//		ServerConnection* connection: the connection.
 // RETURNS:
-//		int: returns 1 if matching parcel got found else o.
+//		int: returns 1 if the connection is still open, 0 if the client hung up or it failed.
 //
-int findAndDisplayParcelsByWeight(Parcel* root, int weight, int higher)
+int readServerConnection(ServerConnection* connection)
 {
-	int found = 0;
-
-	if (root == NULL)
-	{
-		return found;
-	}
-
-	// traverse the left subtree
-	found |= findAndDisplayParcelsByWeight(root->left, weight, higher);
-
-	// chech if the current node meets the weight condition
-	if ((higher && root->weight > weight) || (!higher && root->weight < weight))
+	while (connection->inputUsed < SERVER_INPUT_BYTES)
 	{
-		printf("Destination: %s, Weight: %d, Valuation: %.2f\n", root->destination, root->weight, root->valuation);
-		found = 1;
+		ssize_t count = read(connection->descriptor, connection->input + connection->inputUsed, SERVER_INPUT_BYTES - connection->inputUsed);
+		if (count == 0)
+		{
+			return 0;
+		}
+		if (count < 0)
+		{
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		}
+		connection->inputUsed += (size_t)count;
 	}
-
-	// traverse the right subtree
-	found |= findAndDisplayParcelsByWeight(root->right, weight, higher);
-
-	return found;
+	return 1;
 }
 
 //
-// FUNCTION: displayParcelsByCountryAndWeight
+// FUNCTION: runQueryServer
 // DESCRIPTION:
-//		This function displays parcels for a given country based on weight.(higher or lower than provided weight).
+//		This function serves the loaded index over a Unix domain socket or a loopback TCP port
+//		until SIGINT or SIGTERM. A request is one line in the syntax of a batch file, for example
+//		"totals,Germany" or "box,Germany,10000,20000,1500,100000". The response is the byte
+//		count of the answer in decimal and a newline, followed by the answer in the --format of
+//		the server, exactly what a batch file prints for the line. One thread runs a
+//		non-blocking epoll event loop over every connection and the queries run on a pool of
+//		worker threads. The k-d trees of the box queries, the valuation index of the top-k and
+//		valuation range queries and the quantile sketches are built before the first connection.
 // PARAMETERS:
-//		Parcel* hashTable[]: the hash table which is cointaining the parcels.
-//		char* country: the name of the country whose parcels will get displayed.
-//		int weight: the weight condition to check.
-//		int higher: flag indicating whether to check for weights higher (1) 
-//		or lower (2) that the provided weight.
-//		const char* validCountries[]: the list of valid country names.
-//		size_t numCountries: the number of valid countries.
+//		ParcelStore* store: the parcel store containing the parcels.
+//		const char* address: the port or the socket path to listen on.
+//		OutputFormat format: the format of the answers.
+//		int threadCount: the number of worker threads, 0 for one per hardware thread.
+//		const CountryList* validCountries: the list of valid countries.
 // RETURNS:
-//		void: This function does not return a value.
+//		int: returns 0 after a clean shutdown, 1 if the server could not be started.
 //
-void displayPrcelsByCountryAndWeight(Parcel* hashTable[], char* country, int weight, int higher, const char* validCountries[], size_t numCountries)
+int runQueryServer(ParcelStore* store, const char* address, OutputFormat format, int threadCount, const CountryList* validCountries)
 {
-	if (!isValidCountry(country, validCountries, numCountries))
+	QueryServer* server = new QueryServer;
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	struct epoll_event event;
+	int stop = 0;
+
+	getValuationIndex(store);   // the workers only read the store
+	for (unsigned int id = 0; id < store->catalog.count; id++)
 	{
-		printf("Erros: Given country name is not in the list.\n");
-		return;
+		getCountryBoxes(store, (int)id);
+		getCountrySketches(store, (int)id);
 	}
-
-	unsigned long index = hash(country); //generate the hash value for the country
-	Parcel* root = hashTable[index];
-
-	// Traverse the BST to find and display parcels based on the weight condition
-	int found = findAndDisplayParcelsByWeight(root, weight, higher);
-
-	if (!found)
+	if (threadCount <= 0)
 	{
-		printf("No parcel is found for specific weight conditon.\n");
+		threadCount = (int)std::thread::hardware_concurrency();
 	}
-}
-
-//
-// FUNCTION: calculateTotalLoadAndValuation
-// DESCRIPTION:
-//		This is helper function to calculates the total weight and valuation of parcels in the BST.
-// PARAMETERS:
-//		Parcel*root: a pointer to the root of the BST to be traversed.
-//		int* totalWeight: a pointer to the variable where total weight will get stored.
-//		float* totalValuation: a pointer to the variable where total valuation will get stored.
-// RETURNS:
-//		void: This function does not return a value.
-//
-void calculateTotalLoadAndValuation(Parcel* root, int* totalweight, float* totalvaluation)
-{
-	if (root == NULL)
+	server->workerCount = threadCount < 1 ? 1 : threadCount > BATCH_MAX_THREADS ? BATCH_MAX_THREADS : threadCount;
+	server->store = store;
+	server->validCountries = validCountries;
+	server->format = format;
+	server->queued = server->queuedTail = server->answered = server->live = NULL;
+	server->stopping = 0;
+	server->served = 0;
+	server->accepted = 0;
+	server->listener = openServerSocket(address, 1);
+	server->epoll = epoll_create1(EPOLL_CLOEXEC);
+	server->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	serverStopEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (server->listener < 0 || server->epoll < 0 || server->wakeup < 0 || serverStopEvent < 0)
 	{
-		return;
+		if (server->listener >= 0)
+		{
+			close(server->listener);
+		}
+		delete server;
+		return 1;
 	}
+	fcntl(server->listener, F_SETFL, fcntl(server->listener, F_GETFL) | O_NONBLOCK);
 
-	// traverse the left subtree
-	calculateTotalLoadAndValuation(root->left, totalweight, totalvaluation);
+	// the three descriptors of the server itself are told apart from connections by their own address
+	event.events = EPOLLIN;
+	event.data.ptr = &server->listener;
+	epoll_ctl(server->epoll, EPOLL_CTL_ADD, server->listener, &event);
+	event.data.ptr = &server->wakeup;
+	epoll_ctl(server->epoll, EPOLL_CTL_ADD, server->wakeup, &event);
+	event.data.ptr = &serverStopEvent;
+	epoll_ctl(server->epoll, EPOLL_CTL_ADD, serverStopEvent, &event);
+	signal(SIGINT, requestServerStop);
+	signal(SIGTERM, requestServerStop);
 
-	// add weight and valuation of the current node to the total
-	*totalweight += root->weight;
-	*totalvaluation += root->valuation;
-
-	// traverse the right subtree
-	calculateTotalLoadAndValuation(root->right, totalweight, totalvaluation);
-}
-
-//
-// FUNCTION: displayTotalLoadAndValuation
-// DESCRIPTION: 
-//		This function calculates and displays the total weight and valuation of all parcels for a given country.
-// PARAMETERS:
-//		Parcel* hashTable[]: the hash table which is cointaining the parcels.
-//		char* country: the name of the country whose total load and valuation of parcels will get displayed.
-//		const char* validCountries[]: the list of valid country names.
-//		size_t numCountries: the number of valid countries.
-// RETURNS:
-//
-void displayTotalLoadAndValuation(Parcel* hashTable[], char* country, const char* validCountries[], size_t numCountries)
-{
-	if (!isValidCountry(country, validCountries, numCountries))
+	for (int i = 0; i < server->workerCount; i++)
 	{
-		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
-		return;
+		server->workers[i] = std::thread(runServerWorker, server);
 	}
+	printf("Serving %s with %d worker threads, stop with Ctrl+C.\n", address, server->workerCount);
+	fflush(stdout);
 
-	unsigned long index = hash(country);  // generate the hash value for the country
-	Parcel* root = hashTable[index];
-	int totalWeight = 0;
-	float totalValuation = 0.0;
+	while (!stop)
+	{
+		int count = epoll_wait(server->epoll, events, SERVER_MAX_EVENTS, -1);
+		for (int i = 0; i < count; i++)
+		{
+			void* source = events[i].data.ptr;
+			if (source == &server->listener)
+			{
+				acceptServerConnections(server);
+			}
+			else if (source == &serverStopEvent)
+			{
+				stop = 1;
+			}
+			else if (source == &server->wakeup)
+			{
+				unsigned long long signals;
+				ssize_t readBytes = read(server->wakeup, &signals, sizeof(signals));
+				(void)readBytes;
+				ServerConnection* answered;
+				{
+					std::lock_guard<std::mutex> guard(server->lock);
+					answered = server->answered;
+					server->answered = NULL;
+				}
+				while (answered != NULL)
+				{
+					ServerConnection* connection = answered;
+					answered = answered->next;
+					connection->busy = 0;
+					server->served++;
+					if (connection->closed)
+					{
+						closeServerConnection(server, connection);   // the client left while its request ran
+						continue;
+					}
 
-	// traverse the BST to do sum the weight and valuations
-	calculateTotalLoadAndValuation(root, &totalWeight, &totalValuation);
+					char header[24];
+					snprintf(header, sizeof(header), "%zu\n", connection->result.used);
+					writeString(&connection->output, header);
+					writeBytes(&connection->output, connection->result.data, connection->result.used);
+					if (!sendServerOutput(connection) || !takeServerRequest(server, connection))
+					{
+						closeServerConnection(server, connection);
+						continue;
+					}
+					watchServerConnection(server, connection);
+				}
+			}
+			else
+			{
+				ServerConnection* connection = (ServerConnection*)source;
+				int open = 1;
+				if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				{
+					open = readServerConnection(connection);
+				}
+				if (open && (events[i].events & EPOLLOUT))
+				{
+					open = sendServerOutput(connection);
+				}
+				if (!open || !takeServerRequest(server, connection))
+				{
+					closeServerConnection(server, connection);
+					continue;
+				}
+				watchServerConnection(server, connection);
+			}
+		}
+	}
 
-	// print the total weight and valuation for the country
-	if (totalWeight > 0 || totalValuation > 0.0)
 	{
-		printf("Total load for %s: %d grams\n", country, totalWeight);
-		printf("Total valuation for %s: $%.2f\n", country, totalValuation);
+		std::lock_guard<std::mutex> guard(server->lock);
+		server->stopping = 1;
+		server->pending.notify_all();
 	}
-	else
+	for (int i = 0; i < server->workerCount; i++)
 	{
-		printf("No parcels found for %s.\n", country);   // print a message if no parcels are found
+		server->workers[i].join();   // a worker finishes the queue before it returns
+	}
+	while (server->live != NULL)
+	{
+		server->live->busy = 0;   // the workers are gone, nothing runs any more
+		closeServerConnection(server, server->live);
 	}
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	printf("Served %llu requests on %llu connections.\n", server->served, server->accepted);
+	close(server->listener);
+	close(server->epoll);
+	close(server->wakeup);
+	close(serverStopEvent);
+	serverStopEvent = -1;
+	if (strspn(address, "0123456789") != strlen(address))
+	{
+		unlink(address);
+	}
+	delete server;
+	return 0;
 }
 
 //
-// FUNCTION: findCheapestAndMostExpensive
-// DESCRIPTION: 
-//		This function finds cheapest and most expensive parcel in the BST.
+// FUNCTION: sendLoadRequest
+// DESCRIPTION:
+//		This function sends what is left of the current request of a load generator connection.
 // PARAMETERS:
-//		Parcel* root: pointer to the root of BST to be traversed.
-//		Parcel** cheapest: double pointer to the variable where cheapest parcel will get stored.
-//		Parcel** mostExpensive: double pointer to variable where most expensive parcel will get stored.
+//		LoadConnection* connection: the connection.
 // RETURNS:
-//		void: this function does not return a value.
+//		int: returns 1 if the connection is still usable, 0 if it failed.
 //
-void findCheapestAndMostExpensive(Parcel* root, Parcel** cheapest, Parcel** mostExpensive)
+int sendLoadRequest(LoadConnection* connection)
 {
-	if (root == NULL)
-	{
-		return;
-	}
-
-	// traverse left subtree
-	findCheapestAndMostExpensive(root->left, cheapest, mostExpensive);
-
-	// check if the current node is cheapest
-	if (*cheapest == NULL || root->valuation < (*cheapest)->valuation)
+	while (connection->requestSent < connection->requestLength)
 	{
-		*cheapest = root;
-	}
-
-	// check if the current node is most expensive
-	if (*mostExpensive == NULL || root->valuation > (*mostExpensive)->valuation)
-	{
-		*mostExpensive = root;
+		ssize_t count = send(connection->descriptor, connection->request + connection->requestSent,
+			connection->requestLength - connection->requestSent, MSG_NOSIGNAL);
+		if (count < 0)
+		{
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		}
+		connection->requestSent += (size_t)count;
 	}
-
-	// traverse right subtree
-	findCheapestAndMostExpensive(root->right, cheapest, mostExpensive);
+	return 1;
 }
 
 //
-// FUNCTION: displayCheapestAndMostExpensive
+// FUNCTION: runLoadGenerator
 // DESCRIPTION:
-//		This function finds and displays the cheapest and most expensive parcels for a given country.
+//		This function measures a running query server. It opens the requested number of
+//		connections, and every connection sends a request, waits for the answer and sends the
+//		next one, for LOAD_SECONDS seconds. The requests are a fixed mix of totals, cheapest,
+//		lightest, range and box queries over the valid countries. One thread drives every
+//		connection with epoll, so the client costs little next to the server on the same machine.
 // PARAMETERS:
-//		Parcel* hashTable[]: the hash table containing the parcels.
-//		char* country: the name of the country whose cheapest and most expensive parcels are to be displayed.
-//		const char* validCountries[]: the list of valid country names.
-//		size_t numCountries: the number of valid countries.
-// RETURNS :
-//		void: This function does not return a value.
+//		const char* address: the port or the socket path of the server.
+//		int connectionCount: the number of connections kept busy at the same time.
+//		const CountryList* validCountries: the list of valid countries the requests ask about.
+// RETURNS:
+//		int: returns 0 if answers came back, else 1.
 //
-void displayCheapestAndMostExpensive(Parcel* hashTable[], char* country, const char* validCountries[], size_t numCountries) 
+int runLoadGenerator(const char* address, int connectionCount, const CountryList* validCountries)
 {
-	if (!isValidCountry(country, validCountries, numCountries)) 
+	typedef std::chrono::steady_clock Clock;
+	static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+	LoadConnection* connections = (LoadConnection*)calloc((size_t)connectionCount, sizeof(LoadConnection));
+	char* requests = (char*)malloc((size_t)LOAD_REQUESTS * 96);
+	size_t offsets[LOAD_REQUESTS + 1];
+	size_t sampleCapacity = 65536;
+	size_t sampleCount = 0;
+	unsigned long long* samples = (unsigned long long*)malloc(sampleCapacity * sizeof(unsigned long long));
+	unsigned long long state = 42;
+	unsigned long long failed = 0;
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	char buffer[65536];
+	int open = 0;
+	int epoll = epoll_create1(EPOLL_CLOEXEC);
+
+	if (connections == NULL || requests == NULL || samples == NULL || epoll < 0)
 	{
-		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
-		return;
+		fprintf(stderr, "Error: Memory allocation failed for load generator.\n");
+		exit(1);
 	}
 
-	unsigned long index = hash(country);  // generate the hash value for the country
-	Parcel* root = hashTable[index];
-	Parcel* cheapest = NULL;
-	Parcel* mostExpensive = NULL;
-
-	// Traverse the BST to find the cheapest and most expensive parcels
-	findCheapestAndMostExpensive(root, &cheapest, &mostExpensive);
+	// a fixed mix of the read only operations, the same on every run
+	offsets[0] = 0;
+	for (int i = 0; i < LOAD_REQUESTS; i++)
+	{
+		const char* country = validCountries->names[nextGeneratorRandom(&state) % validCountries->count];
+		int a = GENERATOR_MIN_WEIGHT + (int)(nextGeneratorRandom(&state) % (GENERATOR_MAX_WEIGHT - GENERATOR_MIN_WEIGHT + 1));
+		int b = GENERATOR_MIN_WEIGHT + (int)(nextGeneratorRandom(&state) % (GENERATOR_MAX_WEIGHT - GENERATOR_MIN_WEIGHT + 1));
+		long long c = GENERATOR_MIN_CENTS + (long long)(nextGeneratorRandom(&state) % (GENERATOR_MAX_CENTS - GENERATOR_MIN_CENTS + 1));
+		long long d = GENERATOR_MIN_CENTS + (long long)(nextGeneratorRandom(&state) % (GENERATOR_MAX_CENTS - GENERATOR_MIN_CENTS + 1));
+		char* line = requests + offsets[i];
+		int length;
+		switch (i % 5)
+		{
+		case 0:
+			length = snprintf(line, 96, "totals,%s\n", country);
+			break;
+		case 1:
+			length = snprintf(line, 96, "cheapest,%s\n", country);
+			break;
+		case 2:
+			length = snprintf(line, 96, "lightest,%s\n", country);
+			break;
+		case 3:
+			length = snprintf(line, 96, "range,%s,%d,%d\n", country, a < b ? a : b, a < b ? b : a);
+			break;
+		default:
+			length = snprintf(line, 96, "box,%s,%d,%d,%lld.%02lld,%lld.%02lld\n", country, a < b ? a : b, a < b ? b : a,
+				(c < d ? c : d) / 100, (c < d ? c : d) % 100, (c < d ? d : c) / 100, (c < d ? d : c) % 100);
+			break;
+		}
+		offsets[i + 1] = offsets[i] + (size_t)length;
+	}
 
-	// Print the details of the cheapest and most expensive parcels
-	if (cheapest && mostExpensive) 
+	for (int i = 0; i < connectionCount; i++)
 	{
-		printf("Cheapest parcel for %s: Weight: %d, Valuation: %.2f\n", country, cheapest->weight, cheapest->valuation);
-		printf("Most expensive parcel for %s: Weight: %d, Valuation: %.2f\n", country, mostExpensive->weight, mostExpensive->valuation);
+		LoadConnection* connection = &connections[i];
+		connection->descriptor = openServerSocket(address, 0);
+		if (connection->descriptor < 0)
+		{
+			failed++;
+			if (open == 0)
+			{
+				break;   // no server to measure
+			}
+			continue;
+		}
+		fcntl(connection->descriptor, F_SETFL, fcntl(connection->descriptor, F_GETFL) | O_NONBLOCK);
+		size_t request = (size_t)i % LOAD_REQUESTS;
+		connection->request = requests + offsets[request];
+		connection->requestLength = offsets[request + 1] - offsets[request];
+		connection->remaining = SIZE_MAX;
+		connection->length = 0;
+
+		struct epoll_event event;
+		event.events = EPOLLIN | EPOLLOUT;
+		event.data.ptr = connection;
+		epoll_ctl(epoll, EPOLL_CTL_ADD, connection->descriptor, &event);
+		open++;
 	}
-	else 
+	if (open == 0)
 	{
-		printf("No parcels found for %s.\n", country);  // print a message if no parcels are found
+		close(epoll);
+		free(connections);
+		free(requests);
+		free(samples);
+		return 1;
 	}
-}
 
-//
-// FUNCTION: findLighestAndHeaviest
-// DESCRIPTION: 
-//		This function find the lightest and heaviest parcel in BST.
-// PARAMETERS:
-//		Parcel* root: pointer to the root of BST to be traversed.
-//		Parcel** lightest: double pointer to variable where lightest parcel will get stored.
-//		Parcel** heaviest: double pointer to variable where heaviest parcel will get stored.
-// RETURN:
-//		void: this function does not return a value.
-//
-void findLightestAndHeaviest(Parcel* root, Parcel** lightest, Parcel** heaviest)
-{
-	if (root == NULL)
+	printf("Load: %d connections to %s for %d seconds\n", open, address, LOAD_SECONDS);
+	fflush(stdout);
+	size_t nextRequest = (size_t)connectionCount;
+	Clock::time_point start = Clock::now();
+	Clock::time_point finish = start + std::chrono::seconds(LOAD_SECONDS);
+	for (int i = 0; i < connectionCount; i++)
 	{
-		return;
+		if (connections[i].descriptor >= 0 && connections[i].request != NULL)
+		{
+			connections[i].started = start;
+			if (!sendLoadRequest(&connections[i]))
+			{
+				close(connections[i].descriptor);
+				connections[i].descriptor = -1;
+				failed++;
+				open--;
+			}
+		}
 	}
 
-	// traverse left subtree
-	findLightestAndHeaviest(root->left, lightest, heaviest);
+	Clock::time_point now = start;
+	while (open > 0 && now < finish)
+	{
+		int timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(finish - now).count() + 1;
+		int count = epoll_wait(epoll, events, SERVER_MAX_EVENTS, timeout);
+		now = Clock::now();
+		for (int e = 0; e < count; e++)
+		{
+			LoadConnection* connection = (LoadConnection*)events[e].data.ptr;
+			int usable = 1;
+			if (events[e].events & EPOLLOUT)
+			{
+				usable = sendLoadRequest(connection);
+			}
+			while (usable && (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+			{
+				ssize_t readBytes = read(connection->descriptor, buffer, sizeof(buffer));
+				if (readBytes <= 0)
+				{
+					usable = readBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+					break;
+				}
+				// an answer is its byte count, a newline and that many bytes
+				for (size_t p = 0; p < (size_t)readBytes && usable; )
+				{
+					if (connection->remaining == SIZE_MAX)
+					{
+						if (buffer[p] == '\n')
+						{
+							connection->remaining = connection->length;
+						}
+						else if (buffer[p] >= '0' && buffer[p] <= '9')
+						{
+							connection->length = connection->length * 10 + (size_t)(buffer[p] - '0');
+						}
+						else
+						{
+							usable = 0;   // not an answer of the query server
+						}
+						p++;
+					}
+					else
+					{
+						size_t take = (size_t)readBytes - p < connection->remaining ? (size_t)readBytes - p : connection->remaining;
+						connection->remaining -= take;
+						p += take;
+					}
+
+					if (connection->remaining == 0)
+					{
+						now = Clock::now();   // the next answer may arrive within this read loop, so time each one
+						if (sampleCount == sampleCapacity)
+						{
+							sampleCapacity *= 2;
+							samples = (unsigned long long*)realloc(samples, sampleCapacity * sizeof(unsigned long long));
+							if (samples == NULL)
+							{
+								fprintf(stderr, "Error: Memory allocation failed for load generator.\n");
+								exit(1);
+							}
+						}
+						samples[sampleCount++] = (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(now - connection->started).count();
 
-	// check if current node is the lightest
-	if (*lightest == NULL || root->weight < (*lightest)->weight)
-	{
-		*lightest = root;
+						size_t request = nextRequest++ % LOAD_REQUESTS;
+						connection->request = requests + offsets[request];
+						connection->requestLength = offsets[request + 1] - offsets[request];
+						connection->requestSent = 0;
+						connection->remaining = SIZE_MAX;
+						connection->length = 0;
+						connection->started = now;
+						usable = sendLoadRequest(connection);
+					}
+				}
+			}
+			if (!usable)
+			{
+				close(connection->descriptor);   // also takes it out of the epoll set
+				connection->descriptor = -1;
+				failed++;
+				open--;
+			}
+		}
 	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
 
-	// check if current node is the heaviest
-	if (*heaviest == NULL || root->weight > (*heaviest)->weight)
+	for (int i = 0; i < connectionCount; i++)
 	{
-		*heaviest = root;
+		if (connections[i].descriptor >= 0 && connections[i].request != NULL)
+		{
+			close(connections[i].descriptor);
+		}
 	}
+	close(epoll);
 
-	// traverse right subtree
-	findLightestAndHeaviest(root->right, lightest, heaviest);
-}
-
-//
-// FUNCTION: displayLightestAndHeaviest
-// DESCRIPTION:
-//		This function finds and displays the lightest and heaviest parcels for a given country.
-// PARAMETERS:
-//		Parcel* hashTable[]: the hash table containing the parcels.
-//		char* country: the name of the country whose lightest and heaviest parcels are to be displayed.
-//		const char* validCountries[]: the list of valid country names.
-//		size_t numCountries: the number of valid countries.
-// RETURNS:
-//		void: This function does not return a value.
-//
-void displayLightestAndHeaviest(Parcel* hashTable[], char* country, const char* validCountries[], size_t numCountries)
-	{
-	 if (!isValidCountry(country, validCountries, numCountries)) 
-	 {
-		printf("Error: Given country name is not in the list, please enter a valid country name.\n");
-		return;
-	 }
-
-	unsigned long index = hash(country);  // generate the hash value for the country
-	Parcel* root = hashTable[index];
-	Parcel* lightest = NULL;
-	Parcel* heaviest = NULL;
-
-	// Traverse the BST to find the lightest and heaviest parcels
-	findLightestAndHeaviest(root, &lightest, &heaviest);
-
-	// Print the details of the lightest and heaviest parcels
-	if (lightest && heaviest) 
+	printf("Requests: %zu in %.2f s, %.0f per second\n", sampleCount, seconds, seconds > 0 ? (double)sampleCount / seconds : 0.0);
+	if (sampleCount > 0)
 	{
-		printf("Lightest parcel for %s: Weight: %d, Valuation: %.2f\n", country, lightest->weight, lightest->valuation);
-		printf("Heaviest parcel for %s: Weight: %d, Valuation: %.2f\n", country, heaviest->weight, heaviest->valuation);
+		qsort(samples, sampleCount, sizeof(unsigned long long), compareDurations);
+		printf("Latency:");
+		for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+		{
+			size_t rank = (size_t)(percentiles[i] / 100.0 * (double)(sampleCount - 1));
+			printf(" p%g %.1f us,", percentiles[i], samples[rank] / 1000.0);
+		}
+		printf(" max %.1f us\n", samples[sampleCount - 1] / 1000.0);
 	}
-	else 
+	if (failed > 0)
 	{
-		printf("No parcels found for %s.\n", country);  // print a message if no parcels are found
-	} 
+		printf("Failed connections: %llu\n", failed);
+	}
+
+	int result = sampleCount == 0;
+	free(connections);
+	free(requests);
+	free(samples);
+	return result;
 }
+#else
 
 //
-// FUNCTION: cleanupBst
-// DESCRIPTION: 
-//		This function recursively free memory allocated for BST.
+// FUNCTION: runQueryServer
+// DESCRIPTION:
+//		This function stands in for the query server, which is built on epoll and only exists on Linux.
 // PARAMETERS:
-//		Parcel*root: pointer to root of BST to cleaned up.
+//		ParcelStore* store: the parcel store containing the parcels.
+//		const char* address: the port or the socket path to listen on.
+//		OutputFormat format: the format of the answers.
+//		int threadCount: the number of worker threads.
+//		const CountryList* validCountries: the list of valid countries.
 // RETURNS:
-//		void: This function does not return a value.
+//		int: always 1.
 //
-void cleanupBst(Parcel* root)
+int runQueryServer(ParcelStore* store, const char* address, OutputFormat format, int threadCount, const CountryList* validCountries)
 {
-	if (root != NULL)
-	{
-		cleanupBst(root->left);   // recursively free left subtree
-		cleanupBst(root->right);   // recursively free right subtree
-		free(root->destination);   // free dynamically allocated memory 
-		free(root);   // free Parcel structure
-	}
+	(void)store;
+	(void)address;
+	(void)format;
+	(void)threadCount;
+	(void)validCountries;
+	fprintf(stderr, "Error: The query server needs Linux (epoll).\n");
+	return 1;
 }
 
 //
-// FUNCTION: cleanupMemory
+// FUNCTION: runLoadGenerator
 // DESCRIPTION:
-//		This function cleans up all memory allocated for the hash table.
+//		This function stands in for the load generator, which is built on epoll and only exists on Linux.
 // PARAMETERS:
-//		Parcel* hashTable[]: the hash table to be cleaned up.
+//		const char* address: the port or the socket path of the server.
+//		int connectionCount: the number of connections.
+//		const CountryList* validCountries: the list of valid countries.
 // RETURNS:
-//		void: This function does not return a value.
+//		int: always 1.
 //
-void cleanupMemory(Parcel* hashTable[]) 
+int runLoadGenerator(const char* address, int connectionCount, const CountryList* validCountries)
 {
-	for (int i = 0; i < HASH_TABLE_SIZE; i++) 
-	{
-		cleanupBst(hashTable[i]);  // clean up each BST in the hashtable
-	}
+	(void)address;
+	(void)connectionCount;
+	(void)validCountries;
+	fprintf(stderr, "Error: The load generator needs Linux (epoll).\n");
+	return 1;
 }
+#endif
 
 //
 // FUNCTION: displayMenu
@@ -622,6 +14444,39 @@ void displayMenu()
 	printf("4. Enter the country name and display cheapest and most expensive parcel's details\n");
 	printf("5. Enter the country name and display lightest and heaviest parcel for the country\n");
 	printf("6. Exit the application\n");
+	printf("7. Display the memory footprint of the parcel storage\n");
+	printf("8. Display the depth and balance statistics of the index\n");
+	printf("9. Enter country and weight range and display its totals and extremes\n");
+	printf("10. Enter country, weight and valuation and remove the dispatched parcel\n");
+	printf("11. Enter country, weight and valuation and re-weigh the parcel\n");
+	printf("12. Enter country or all and display the most or least valuable parcels\n");
+	printf("13. Enter country or all and valuation range and display its parcels\n");
+	printf("14. Display the runtime statistics of the engine\n");
+	printf("15. Enter country or all and display its weight and valuation distribution\n");
+	printf("16. Enter country or all, weight range and valuation range and display its parcels\n");
+	printf("17. Display the totals and extremes of every country\n");
+}
+
+//
+// FUNCTION: isReadOnlyMenuOption
+// DESCRIPTION:
+//		This function tells whether a menu option only walks the trees, so it can run on a pinned
+//		version while the follower keeps inserting. The re-weigh and dispatch options change the
+//		trees, and the options backed by the valuation, quantile, box or columnar indexes build
+//		them inside the store on first use; those still run under the writer mutex.
+// PARAMETERS:
+//		const ParcelStore* store: the parcel store.
+//		int option: the menu option selected by user.
+// RETURNS:
+//		int: returns 1 if the option never writes to the store else 0.
+//
+int isReadOnlyMenuOption(const ParcelStore* store, int option)
+{
+	if (store->columnar)
+	{
+		return option == 7 || option == 8 || option == 14;   // every query builds the segment of its country
+	}
+	return (option >= 1 && option <= 5) || (option >= 7 && option <= 9) || option == 14;
 }
 
 //
@@ -629,17 +14484,19 @@ void displayMenu()
 // DESCRIPTION:
 //		This function handle user menu selection. 
 // PARAMETERS:
-//		Parcel* hashTable[]: the hash table containing the parcels.
+//		ParcelStore* store: the parcel store containing the parcels.
 //		int option: the menu option selected by user.
-//		const char* validCountries[]: list of valid country name.
-//		size_t numCountries: number of valid countries.
+//		const CountryList* validCountries: the list of valid countries.
 // RETURNS:
 //		void: this function does not return a value.
 //
-void handleMenuOption(Parcel* hashTable[], int option, const char* validCountries[], size_t numCountries)
+void handleMenuOption(ParcelStore* store, int option, const CountryList* validCountries)
 {
 	char country[21];
 	int weight;
+	int maxWeight;
+	Cents valuation;
+	Cents newValuation;
 	int higher;
 	int result;
 
@@ -649,12 +14506,12 @@ void handleMenuOption(Parcel* hashTable[], int option, const char* validCountrie
 	case 1:
 		printf("Enter country name: ");
 		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
-		displayParcelsByCountry(hashTable, country, validCountries, numCountries);  // display all parcel for country
+		displayParcelsByCountry(store, country, validCountries);  // display all parcel for country
 		break;
 	case 2:
 		printf("Enter country name: ");
 		scanf_s("%20s", country, (unsigned)_countof(country));  // read the country name from user
-		if (!isValidCountry(country, validCountries, numCountries))
+		if (!isValidCountry(country, validCountries))
 		{
 			printf("Error: Given country name is not in the list, please enter a valid country name.\n");
 			break;   // exit case if country is not valid
@@ -680,62 +14537,554 @@ void handleMenuOption(Parcel* hashTable[], int option, const char* validCountrie
 			}
 		}
 
-		displayPrcelsByCountryAndWeight(hashTable, country, weight, higher == 1, validCountries, numCountries);   // display parcel based on weight condition
+		displayPrcelsByCountryAndWeight(store, country, weight, higher == 1, validCountries);   // display parcel based on weight condition
 		break;
 	case 3:
 		printf("Enter country name: ");
 		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
-		displayTotalLoadAndValuation(hashTable, country, validCountries, numCountries);   // display total load and valuation of country
+		displayTotalLoadAndValuation(store, country, validCountries);   // display total load and valuation of country
 		break;
 	case 4:
 		printf("Enter country name: ");
 		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
-		displayCheapestAndMostExpensive(hashTable, country, validCountries, numCountries);   // display cheapest and expensive parcel of country
+		displayCheapestAndMostExpensive(store, country, validCountries);   // display cheapest and expensive parcel of country
 		break;
 	case 5:
 		printf("Enter country name: ");
 		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
-		displayLightestAndHeaviest(hashTable, country, validCountries, numCountries);   // display lightest and heaviest parcel of country
+		displayLightestAndHeaviest(store, country, validCountries);   // display lightest and heaviest parcel of country
 		break;
 	case 6:
-		cleanupMemory(hashTable);   // clean up all allocated memory
+		cleanupMemory(store);   // clean up all allocated memory
 		exit(0);   // exti application
+	case 7:
+		displayMemoryFootprint(store);   // compare the arena storage with the old pointer layout
+		break;
+	case 8:
+		displayIndexStatistics(store);   // confirm the trees stay flat
+		break;
+	case 9:
+		printf("Enter country name: ");
+		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
+		weight = getValidWeight();   // smallest weight of the range
+		maxWeight = getValidWeight();   // largest weight of the range
+		displayWeightRangeSummary(store, country, weight, maxWeight, validCountries);
+		break;
+	case 10:
+		printf("Enter country name: ");
+		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
+		weight = getValidWeight();
+		valuation = getValidValuation();
+		dispatchParcel(store, country, weight, valuation, validCountries);
+		break;
+	case 11:
+		printf("Enter country name: ");
+		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
+		weight = getValidWeight();   // current details of the parcel
+		valuation = getValidValuation();
+		printf("Enter the new details of the parcel.\n");
+		maxWeight = getValidWeight();
+		newValuation = getValidValuation();
+		reweighParcel(store, country, weight, valuation, maxWeight, newValuation, validCountries);
+		break;
+	case 12:
+		printf("Enter country name or all: ");
+		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
+		weight = getValidCount();   // number of parcels to display
+
+		// loop to ensure user select a valid option for most or least valuable
+		while (1)
+		{
+			printf("Select an option:\n1. Most valuable 2. Least valuable: ");
+			result = scanf_s("%d", &higher);
+
+			// clear input buffer if non-integer input entered
+			while (getchar() != '\n');
+
+			if (result == 1 && (higher == 1 || higher == 2))
+			{
+				break;
+			}
+			printf("Invalid option. Please try again.\n");
+		}
+		displayValuationExtremes(store, country, weight, higher == 1, validCountries);
+		break;
+	case 13:
+		printf("Enter country name or all: ");
+		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
+		valuation = getValidValuation();   // lowest valuation of the range
+		newValuation = getValidValuation();   // highest valuation of the range
+		displayValuationRange(store, country, valuation, newValuation, validCountries);
+		break;
+	case 14:
+		displayRuntimeStatistics(store);
+		break;
+	case 15:
+		printf("Enter country name or all: ");
+		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
+		displayQuantiles(store, country, validCountries);
+		break;
+	case 16:
+		printf("Enter country name or all: ");
+		scanf_s("%20s", country, (unsigned)_countof(country));   // read the country name from user
+		weight = getValidWeight();   // smallest weight of the box
+		maxWeight = getValidWeight();   // largest weight of the box
+		valuation = getValidValuation();   // lowest valuation of the box
+		newValuation = getValidValuation();   // highest valuation of the box
+		displayWeightValuationBox(store, country, weight, maxWeight, valuation, newValuation, validCountries);
+		break;
+	case 17:
+		materializeAllCountries(store);
+		displayRollupReport(store, OUTPUT_HUMAN, 0);
+		break;
 	default:
 		printf("Invalid option. Please try again.\n");
 	}
+	trimLazyIndex(store);   // the parcels of the option are not needed any more
 }
 
 //
 // FUNCTION: main
 // DESCRIPTION:
 //		This is main function that run application, display menu and handle user input.
+//		Options: --columnar answers the queries from the columnar segments, --compressed keeps those
+//		segments delta and bit packed, --bench-columnar times the columns against the trees and
+//		exits, and optional file names or wildcard patterns replace couriers.txt; several files are
+//		loaded in parallel, one thread per file, without a snapshot.
+//		The index is loaded from the snapshot next to the data file (or --snapshot <file>) while it
+//		is current, and the snapshot is rewritten after a text load; --no-snapshot skips both and
+//		--verify-snapshot checks every parcel of the snapshot before using it. --batch <file> runs
+//		the queries of a file ("-" for standard input) instead of the menu, printing them in the
+//		format given by --format human|json|csv, on --threads <n> threads (one per hardware thread
+//		by default). --bench-batch times the batch with 1 up to that many threads instead.
+//		--bench-live stress tests inserts into the live index while --threads readers query it.
+//		--bench-mixed times a mix of inserts, removals, re-weighs and queries and checks the index.
+//		--bench-valuation times the valuation index against full scans and checks it.
+//		--bench-quantiles times the quantile sketches against sorting and checks their error.
+//		--bench-box times the weight and valuation k-d trees against scanning and filtering.
+//		--bench-ingest splits the data file into 1 up to 32 files and times loading them together.
+//		--follow keeps inserting the rows appended to the data file while the menu is in use.
+//		--bench-suite times loading and every menu operation and reports them in the --format
+//		given. --generate <file> <rows> writes a synthetic data file instead, with --seed <n>,
+//		Zipf country skew --skew <s> (1 by default) and --order random|sorted|reverse|duplicates.
+//		--lazy only scans the data file for the rows of each country at startup and builds the BST
+//		of a country on the first query which needs it; --memory-budget <MB> implies it and evicts
+//		the least recently used BSTs after each menu option while the built ones take more.
+//		--rollup prints the totals and extremes of every country in the --format given, on --threads.
+//		--serve <port|socket> answers batch query lines from clients on a loopback TCP port or a Unix
+//		socket until Ctrl+C, in the --format given on --threads workers; --bench-server <port|socket>
+//		measures such a server with --connections <n> clients (256 by default) instead of loading data.
+//		--stats <file> writes the runtime statistics as JSON ("-" for standard output) on exit.
+//		--countries <file> replaces the built-in list of accepted countries with one name per line,
+//		rows of other countries are skipped while loading.
 // PARAMETERS:
-//		void: this function is not taking any parameters.
+//		int argc: the number of command line arguments.
+//		char* argv[]: the command line arguments.
 // RETURNS:
 //		void: returns o upon successful completion.
 //
-int main()
+int main(int argc, char* argv[])
 {
-	Parcel* hashTable[HASH_TABLE_SIZE] = { NULL };   // initialize hash table with NULL pointer
+	ParcelStore store;
+	initParcelStore(&store);   // initialize hash table with NULL roots and an empty arena
 
-	const char* validCountries[] = 
+	const char* filename = "couriers.txt";
+	const char* snapshotPath = NULL;
+	char* defaultSnapshotPath = NULL;
+	int benchmark = 0;
+	int useSnapshot = 1;
+	int verifySnapshot = 0;
+	const char* batchPath = NULL;
+	OutputFormat format = OUTPUT_HUMAN;
+	int threadCount = 0;
+	int benchmarkBatch = 0;
+	int benchmarkLive = 0;
+	int benchmarkMixed = 0;
+	int benchmarkValuation = 0;
+	int benchmarkQuantiles = 0;
+	int benchmarkIngest = 0;
+	int benchmarkBox = 0;
+	int follow = 0;
+	int benchmarkSuite = 0;
+	const char* statsPath = NULL;
+	const char* generatePath = NULL;
+	const char* countriesPath = NULL;
+	int rollup = 0;
+	int lazy = 0;
+	size_t memoryBudget = 0;
+	const char* serveAddress = NULL;
+	const char* loadAddress = NULL;
+	int connectionCount = LOAD_CONNECTIONS;
+	GeneratorOptions generator = { 0, 1, 1.0, WEIGHT_ORDER_RANDOM };
+	unsigned long long loadedBytes = 0;
+	LiveIndex* live = NULL;
+	ManifestFollower* follower = NULL;
+	int menuReader = -1;   // reader slot of the menu while following
+	FileList dataFiles = { NULL, 0, 0 };
+	for (int i = 1; i < argc; i++)
 	{
-		"Azerbaijan", "Italy", "Ukraine", "Germany", "Australia", "Vanuatu", "Bulgaria", "Mongolia", "Armenia",
-		"Yemen", "Bahamas", "Trinidad & Tobago", "Spain", "Russian Federation", "Djobouti", "Ethiopia",
-		"Eswatini", "Slovakia", "Aruba", "Nepal", "India", "Gambia", "Israel", "Kosovo", "Burkina", "Barbados",
-		"Algeria", "Afghanistan", "Albania", "San Marino", "Costa Rica", "Marshall Islands", "Iceland",
-		"Kuwait", "Japan", "Canada", "Oman", "Liberia", "Vietnam", "Taiwan", "Bhutan", "Indonesia",
-		"Antigua & Deps", "Colombia", "France", "Brazil", "Congo", "Guatemala", "Guinea-Bissau", "Austria",
-		"Slovenia", "Comoros", "Serbia", "China", "Belarus", "Dominica", "Madagascar", "Chile", "Denmark",
-		"Tajikistan", "Angola", "Nicaragua", "Georgia", "Argentina", "Bangladesh", "Moldova"
-	};
-	size_t numCountries = sizeof(validCountries) / sizeof(validCountries[0]);
-
-	loadData(hashTable, "couriers.txt", validCountries, numCountries);   // load data from file to hash table
+		if (strcmp(argv[i], "--columnar") == 0)
+		{
+			store.columnar = 1;
+		}
+		else if (strcmp(argv[i], "--compressed") == 0)
+		{
+			store.columnar = 1;
+			store.compressed = 1;
+		}
+		else if (strcmp(argv[i], "--bench-columnar") == 0)
+		{
+			benchmark = 1;
+		}
+		else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc)
+		{
+			snapshotPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--no-snapshot") == 0)
+		{
+			useSnapshot = 0;
+		}
+		else if (strcmp(argv[i], "--verify-snapshot") == 0)
+		{
+			verifySnapshot = 1;
+		}
+		else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+		{
+			batchPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+		{
+			threadCount = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--bench-batch") == 0)
+		{
+			benchmarkBatch = 1;
+		}
+		else if (strcmp(argv[i], "--bench-live") == 0)
+		{
+			benchmarkLive = 1;
+		}
+		else if (strcmp(argv[i], "--bench-mixed") == 0)
+		{
+			benchmarkMixed = 1;
+		}
+		else if (strcmp(argv[i], "--bench-valuation") == 0)
+		{
+			benchmarkValuation = 1;
+		}
+		else if (strcmp(argv[i], "--bench-quantiles") == 0)
+		{
+			benchmarkQuantiles = 1;
+		}
+		else if (strcmp(argv[i], "--bench-box") == 0)
+		{
+			benchmarkBox = 1;
+		}
+		else if (strcmp(argv[i], "--bench-ingest") == 0)
+		{
+			benchmarkIngest = 1;
+		}
+		else if (strcmp(argv[i], "--follow") == 0)
+		{
+			follow = 1;
+		}
+		else if (strcmp(argv[i], "--bench-suite") == 0)
+		{
+			benchmarkSuite = 1;
+		}
+		else if (strcmp(argv[i], "--lazy") == 0)
+		{
+			lazy = 1;
+		}
+		else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+		{
+			memoryBudget = (size_t)atoi(argv[++i]) << 20;   // in megabytes
+			lazy = 1;
+		}
+		else if (strcmp(argv[i], "--rollup") == 0)
+		{
+			rollup = 1;
+		}
+		else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+		{
+			serveAddress = argv[++i];
+		}
+		else if (strcmp(argv[i], "--bench-server") == 0 && i + 1 < argc)
+		{
+			loadAddress = argv[++i];
+		}
+		else if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+		{
+			connectionCount = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+		{
+			statsPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--countries") == 0 && i + 1 < argc)
+		{
+			countriesPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--generate") == 0 && i + 2 < argc && strtoull(argv[i + 2], NULL, 10) > 0
+			&& strtoull(argv[i + 2], NULL, 10) < (unsigned long long)ARENA_CHUNK_SIZE * ARENA_MAX_CHUNKS)
+		{
+			generatePath = argv[++i];
+			generator.rows = strtoull(argv[++i], NULL, 10);   // no more rows than the arena can load
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			generator.seed = strtoull(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--skew") == 0 && i + 1 < argc && atof(argv[i + 1]) >= 0.0)
+		{
+			generator.skew = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--order") == 0 && i + 1 < argc)
+		{
+			int order = 0;
+			while (order < WEIGHT_ORDER_COUNT && strcmp(argv[i + 1], weightOrderNames[order]) != 0)
+			{
+				order++;
+			}
+			if (order == WEIGHT_ORDER_COUNT)
+			{
+				fprintf(stderr, "Unknown weight order %s, use random, sorted, reverse or duplicates.\n", argv[i + 1]);
+				return 1;
+			}
+			generator.order = (WeightOrder)order;
+			i++;
+		}
+		else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc && (strcmp(argv[i + 1], "human") == 0
+			|| strcmp(argv[i + 1], "json") == 0 || strcmp(argv[i + 1], "csv") == 0))
+		{
+			i++;
+			format = argv[i][0] == 'h' ? OUTPUT_HUMAN : argv[i][0] == 'j' ? OUTPUT_JSON : OUTPUT_CSV;
+		}
+		else if (argv[i][0] != '-')
+		{
+			if (!expandFilePattern(&dataFiles, argv[i]))   // a name or a wildcard pattern of data files
+			{
+				return 1;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [--columnar | --compressed] [--bench-columnar] [--snapshot <file> | --no-snapshot] [--verify-snapshot]\n"
+				"       [--batch <file|-> [--format human|json|csv] [--threads <n>] [--bench-batch]]\n"
+				"       [--bench-live] [--bench-mixed] [--bench-valuation] [--bench-quantiles] [--bench-box] [--bench-ingest]\n"
+				"       [--bench-suite [--format human|json|csv]] [--follow] [--stats <file|->] [--countries <file>]\n"
+				"       [--lazy [--memory-budget <MB>]] [--rollup [--format human|json|csv] [--threads <n>]]\n"
+				"       [--serve <port|socket> [--format human|json|csv] [--threads <n>]] [--bench-server <port|socket> [--connections <n>]]\n"
+				"       [--generate <file> <rows> [--seed <n>] [--skew <s>] [--order random|sorted|reverse|duplicates]] [data file | pattern ...]\n", argv[0]);
+			return 1;
+		}
+	}
 
+	CountryList countryList;
+	if (countriesPath == NULL)
+	{
+		initBuiltinCountryList(&countryList);
+	}
+	else if (!loadCountryList(&countryList, countriesPath))
+	{
+		return 1;
+	}
+	const CountryList* validCountries = &countryList;
 	int option;
 	int result;
 
+	if (dataFiles.count > 0)
+	{
+		filename = dataFiles.names[0];   // the benchmarks and a single file load use the first file
+	}
+	if (dataFiles.count > 1 && follow)
+	{
+		fprintf(stderr, "Error: --follow needs a single data file.\n");
+		return 1;
+	}
+	if (lazy && (dataFiles.count > 1 || follow))
+	{
+		fprintf(stderr, "Error: --lazy needs a single data file and can not be combined with --follow.\n");
+		freeFileList(&dataFiles);
+		return 1;
+	}
+
+	if (generatePath != NULL)
+	{
+		return generateParcelFile(generatePath, &generator, validCountries);
+	}
+
+	if (loadAddress != NULL)
+	{
+		result = runLoadGenerator(loadAddress, connectionCount, validCountries);   // the server holds the data
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (benchmarkSuite)
+	{
+		result = runBenchmarkSuite(filename, format, validCountries);   // times the loads itself, without a snapshot
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (benchmarkIngest)
+	{
+		result = benchmarkShardedIngest(filename, threadCount, validCountries);
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (dataFiles.count > 1)
+	{
+		if (useSnapshot && snapshotPath != NULL)
+		{
+			fprintf(stderr, "Warning: The snapshot is only used with a single data file, loading %zu files.\n", dataFiles.count);
+		}
+		useSnapshot = 0;   // a snapshot records a single source file
+	}
+	if (lazy)
+	{
+		useSnapshot = 0;   // a snapshot records every BST, which a lazy load never builds
+	}
+
+	if (useSnapshot && snapshotPath == NULL)
+	{
+		size_t length = strlen(filename);
+		defaultSnapshotPath = (char*)malloc(length + sizeof(".snap"));   // the snapshot sits next to the data file
+		if (defaultSnapshotPath == NULL)
+		{
+			fprintf(stderr, "Error: Memory allocation failed for snapshot name.\n");
+			return 1;
+		}
+		snprintf(defaultSnapshotPath, length + sizeof(".snap"), "%s.snap", filename);
+		snapshotPath = defaultSnapshotPath;
+	}
+
+	if (lazy)
+	{
+		loadedBytes = loadDataLazily(&store, filename, memoryBudget, validCountries);   // one scan for the row offsets
+	}
+	else if (dataFiles.count > 1)
+	{
+		loadedBytes = loadDataFiles(&store, &dataFiles, threadCount, validCountries);   // one thread per file
+	}
+	else if (useSnapshot && loadSnapshot(&store, snapshotPath, filename, verifySnapshot, validCountries))
+	{
+		SnapshotHeader header;
+		memcpy(&header, store.snapshot.data, sizeof(header));
+		loadedBytes = header.sourceSize;   // the snapshot holds exactly this much of the text
+	}
+	else
+	{
+		unsigned long long sourceSize = 0;
+		unsigned long long sourceModified = 0;
+		int stamped = getSourceStamp(filename, &sourceSize, &sourceModified);   // stamp the text before it is read
+
+		loadedBytes = loadData(&store, filename, validCountries);   // load data from file to hash table
+
+		if (useSnapshot && stamped && !writeSnapshot(&store, snapshotPath, sourceSize, sourceModified, validCountries))
+		{
+			fprintf(stderr, "Warning: Unable to write snapshot %s\n", snapshotPath);
+		}
+	}
+	free(defaultSnapshotPath);
+	if (serveAddress != NULL || rollup || benchmarkLive || benchmarkValuation || benchmarkQuantiles || benchmarkBox || benchmarkMixed || benchmark)
+	{
+		materializeAllCountries(&store);   // these read every country or share the store between threads
+	}
+
+	if (batchPath != NULL)
+	{
+		result = runBatchFile(&store, batchPath, format, threadCount, benchmarkBatch, validCountries);
+		dumpRuntimeStatistics(&store, statsPath);
+		cleanupMemory(&store);
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (rollup)
+	{
+		displayRollupReport(&store, format, threadCount);
+		dumpRuntimeStatistics(&store, statsPath);
+		cleanupMemory(&store);
+		freeFileList(&dataFiles);
+		return 0;
+	}
+
+	if (serveAddress != NULL)
+	{
+		result = runQueryServer(&store, serveAddress, format, threadCount, validCountries);
+		dumpRuntimeStatistics(&store, statsPath);
+		cleanupMemory(&store);
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (benchmarkLive)
+	{
+		result = benchmarkLiveIngest(&store, threadCount);
+		dumpRuntimeStatistics(&store, statsPath);
+		cleanupMemory(&store);
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (benchmarkValuation)
+	{
+		result = benchmarkValuationIndex(&store);
+		dumpRuntimeStatistics(&store, statsPath);
+		cleanupMemory(&store);
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (benchmarkQuantiles)
+	{
+		result = benchmarkQuantileSketches(&store);
+		dumpRuntimeStatistics(&store, statsPath);
+		cleanupMemory(&store);
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (benchmarkBox)
+	{
+		result = benchmarkBoxQueries(&store);
+		dumpRuntimeStatistics(&store, statsPath);
+		cleanupMemory(&store);
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (benchmarkMixed)
+	{
+		result = benchmarkMixedWorkload(&store);
+		dumpRuntimeStatistics(&store, statsPath);
+		cleanupMemory(&store);
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (benchmark)
+	{
+		result = benchmarkColumnarScans(&store);
+		dumpRuntimeStatistics(&store, statsPath);
+		cleanupMemory(&store);
+		freeFileList(&dataFiles);
+		return result;
+	}
+
+	if (follow)
+	{
+		live = new LiveIndex;   // the follower inserts through a live index, the menu reads pinned versions of it
+		follower = new ManifestFollower;
+		initLiveIndex(live, &store);
+		menuReader = registerLiveReader(live);
+		startManifestFollower(follower, live, filename, loadedBytes, validCountries);
+		printf("Following %s for appended rows.\n", filename);
+	}
+
 	do
 	{
 		displayMenu();   // display menu
@@ -745,9 +15094,50 @@ int main()
 		// clear input buffer if non-integer input entered
 		while (getchar() != '\n');
 
-		if (result == 1 && option >= 1 && option <= 6)
+		if (result == 1 && option >= 1 && option <= 17)
 		{
-			handleMenuOption(hashTable, option, validCountries, numCountries);   // handle menu selection
+			if (follower != NULL && option == 6)
+			{
+				stopManifestFollower(follower);   // the store must be quiet before it is freed
+				if (menuReader >= 0)
+				{
+					unregisterLiveReader(live, menuReader);
+				}
+				printf("Followed %s: %llu rows added, %llu malformed rows and %llu rows of unlisted countries skipped.\n", filename,
+					follower->ingestedRows, follower->malformedRows, follower->filteredRows);
+				destroyLiveIndex(live);
+				delete follower;
+				delete live;
+				follower = NULL;
+				live = NULL;
+			}
+			if (option == 6)
+			{
+				dumpRuntimeStatistics(&store, statsPath);   // option 6 exits from inside the menu handler
+			}
+			if (live != NULL && menuReader >= 0 && isReadOnlyMenuOption(&store, option))
+			{
+				// pin a version and copy the store around it under the mutex, then query without it, so
+				// a long listing never holds up the follower; the copy only differs in the roots it reads
+				ParcelStore view;
+				{
+					std::lock_guard<std::mutex> guard(live->writer);
+					view = store;
+					view.catalog = beginLiveRead(live, menuReader)->catalog;
+				}
+				handleMenuOption(&view, option, validCountries);
+				endLiveRead(live, menuReader);
+			}
+			else if (live != NULL)
+			{
+				std::lock_guard<std::mutex> guard(live->writer);   // the option writes to the store
+				handleMenuOption(&store, option, validCountries);
+				publishLiveVersion(live);   // readers must not follow the old roots into changed nodes
+			}
+			else
+			{
+				handleMenuOption(&store, option, validCountries);   // handle menu selection
+			}
 		}
 		else
 		{
@@ -755,7 +15145,9 @@ int main()
 		}
 	} while (option != 6);   // repeat until user select option of exit
 
-	cleanupMemory(hashTable);   // clean up memory before exiting
+	cleanupMemory(&store);   // clean up memory before exiting
+	freeCountryList(&countryList);
+	freeFileList(&dataFiles);
 
 	return 0;
 }
\ No newline at end of file